@@ -35,3 +35,109 @@ inline void localMemoryFence() {
 	barrier(CLK_LOCAL_MEM_FENCE);
 }
 
+
+// whole sample symmetric extension (ITU-T Rec. T.800, Annex F) of index i into [0, n)
+inline int mirror(int i, int n) {
+	if (n == 1)
+		return 0;
+	int period = (n - 1) << 1;
+	i = (int)(abs(i) % period);
+	return i < n ? i : period - i;
+}
+
+
+/*
+Image access
+
+Kernels read and write images through the macros and functions below, so that the same source
+builds either for image2d_t objects or, with -D USE_BUFFERS, for plain global buffers:
+CPU runtimes emulate image sampling in software, which is far slower than pointer loads.
+
+A buffer image is a row major array of pixels with 1 or 4 channels, of either float samples
+(readImageF/writeImageF) or short samples (readImageI/writeImageI). A single channel read
+returns (x,0,0,1), like a CL_R image. Buffer reads are not bounds checked, except for readImageIBorder.
+
+Kernel parameters are declared with KERNEL_IMAGE_RO/KERNEL_IMAGE_WO, and each image is bound
+to its geometry with BIND_IMAGE at the start of the kernel. Kernels taking buffer images
+get three extra trailing arguments (BUFFER_IMAGE_ARGS): the full resolution image width and
+height, and the number of channels.
+*/
+#ifdef USE_BUFFERS
+
+typedef struct {
+	GLOBAL void* data;
+	int width;
+	int height;
+	int channels;
+} buffer_image_t;
+
+#define IMAGE_RO buffer_image_t
+#define IMAGE_WO buffer_image_t
+#define KERNEL_IMAGE_RO(name) GLOBAL void* name##Data
+#define KERNEL_IMAGE_WO(name) GLOBAL void* name##Data
+#define BUFFER_IMAGE_ARGS , const unsigned int imageWidth, const unsigned int imageHeight, const unsigned int imageChannels
+#define BIND_IMAGE(name, w, h, ch) const buffer_image_t name = makeBufferImage(name##Data, w, h, ch)
+
+inline buffer_image_t makeBufferImage(GLOBAL void* data, int width, int height, int channels) {
+	buffer_image_t img;
+	img.data = data;
+	img.width = width;
+	img.height = height;
+	img.channels = channels;
+	return img;
+}
+
+inline size_t bufferImageOffset(const buffer_image_t img, int2 pos) {
+	return ((size_t)pos.y * img.width + pos.x) * img.channels;
+}
+
+inline float4 readImageF(const buffer_image_t img, int2 pos) {
+	GLOBAL const float* src = (GLOBAL const float*)img.data + bufferImageOffset(img, pos);
+	return img.channels == 4 ? vload4(0, src) : (float4)(*src, 0, 0, 1);
+}
+
+inline int4 readImageI(const buffer_image_t img, int2 pos) {
+	GLOBAL const short* src = (GLOBAL const short*)img.data + bufferImageOffset(img, pos);
+	return img.channels == 4 ? convert_int4(vload4(0, src)) : (int4)(*src, 0, 0, 1);
+}
+
+// reads outside of the image return zero
+inline int4 readImageIBorder(const buffer_image_t img, int2 pos) {
+	if (pos.x < 0 || pos.y < 0 || pos.x >= img.width || pos.y >= img.height)
+		return (int4)(0);
+	return readImageI(img, pos);
+}
+
+inline void writeImageF(const buffer_image_t img, int2 pos, float4 val) {
+	GLOBAL float* dest = (GLOBAL float*)img.data + bufferImageOffset(img, pos);
+	if (img.channels == 4)
+		vstore4(val, 0, dest);
+	else
+		*dest = val.x;
+}
+
+inline void writeImageI(const buffer_image_t img, int2 pos, int4 val) {
+	GLOBAL short* dest = (GLOBAL short*)img.data + bufferImageOffset(img, pos);
+	if (img.channels == 4)
+		vstore4(convert_short4_sat(val), 0, dest);
+	else
+		*dest = convert_short_sat(val.x);
+}
+
+#else
+
+#define IMAGE_RO read_only image2d_t
+#define IMAGE_WO write_only image2d_t
+#define KERNEL_IMAGE_RO(name) read_only image2d_t name
+#define KERNEL_IMAGE_WO(name) write_only image2d_t name
+#define BUFFER_IMAGE_ARGS
+#define BIND_IMAGE(name, w, h, ch)
+
+// the kernel source defines the sampler
+#define readImageF(img, pos) read_imagef(img, sampler, pos)
+#define readImageI(img, pos) read_imagei(img, sampler, pos)
+#define readImageIBorder(img, pos) read_imagei(img, sampler, pos)
+#define writeImageF(img, pos, val) write_imagef(img, pos, val)
+#define writeImageI(img, pos, val) write_imagei(img, pos, val)
+
+#endif
@@ -95,163 +95,264 @@ iv. CUP
 
 D. Parallel Algorithm
 
-Note: For a given bit plane, sigma_new from next stripe must be ignored, because in the serial algorithm, 
-the next strip would not be processed yet.
+One work group codes one code block, and one work item codes COLUMNS_PER_ITEM stripe columns:
+column lid + s * WORK_GROUP_SIZE, for s = 0 .. COLUMNS_PER_ITEM - 1. Columns are numbered in scan order.
 
-i) MSB is calculated
+Every pass is split into a read phase, in which each work item derives the (CX,D) pairs and new
+state of its own columns from the shared state buffer, and a write phase, separated by barriers.
+The serial scan order is recovered as follows:
 
-ii) perform CUP on MSB
+	- a neighbour that precedes a sample in the scan (previous stripe, left column, or above in the
+	  same column) is seen with the state it has after being coded in the current pass; all other
+	  neighbours are seen with the state from before the current pass
+	- SPP: the set of samples coded in the SPP depends on significance propagating through the pass
+	  in scan order; it is found by iterating a block vote until no new sample joins the pass
+	- MRP: refinement does not change significance, so all columns are independent
+	- CUP: every sample that is still uncoded becomes significant exactly if its bit is set,
+	  so the significance after the pass is known before any pair is emitted
 
-iii) loop over all remaining bit planes, performing the following:
-     a) transfer sigma_new to sigma_old, and clear sigma_new
-	 b) block vote loop to set sigma_new for all pixels in code block
-	 c) coding pass: RLC, MRC, ZC and SC
-	 d) MQ coder after each pass
+The pairs of each pass are then written in scan order (stripe, then column), by taking an exclusive
+prefix sum of the per column pair counts over the work group.
+
+i) MSB of the code block is calculated by the findBitPlanes prepass; blocks with no non-zero samples
+   are not listed in the work list, and are not coded
+
+ii) CUP on MSB
+
+iii) loop over all remaining bit planes: SPP, MRP, CUP
+
+
+E. Output
+
+Code blocks are listed in codeBlocks; the work group index is the index into the work list
+of non-zero blocks.
+
+Each (CX,D) pair is stored in one byte, as (CX << 1) | D, with contexts numbered as follows:
+
+	0 - 8		zero coding (ZC)
+	9 - 13		sign coding (SC)
+	14 - 16		magnitude refinement (MRC)
+	17			run length (RLC)
+	18			uniform (two bit position of the first significant sample of a run)
+
+The pairs of each coding pass are stored contiguously in cxd, at an offset allocated from the
+shared cxdHead counter once the size of the pass is known. Passes that do not fit into cxdCapacity
+are not written, but still allocated, so that the host can grow cxd to cxdHead and run again.
+
+blockInfo holds BLOCK_INFO_SIZE values per code block, at index infoOffset + code block index:
+number of bit planes, number of coding passes, offset and number of pairs of each pass, then
+the distortion reduction of each pass, as float bits.
+
+
+F. Distortion
+
+For rate control, each pass records how much it reduces the squared error of the block, in squared
+quantization steps, assuming the decoder reconstructs at the middle of the remaining interval.
+A sample that becomes significant in bit plane p is reconstructed at 1.5 * 2^p instead of 0;
+a refinement in bit plane p halves the interval around the sample. The last bit plane
+is reconstructed exactly.
 
 */
 
+#define CX_RUN_LENGTH 17
+#define CX_UNIFORM 18
+
+// magnitudes of 16 bit samples
+#define MAX_BIT_PLANES 16
+#define MAX_PASSES (3 * MAX_BIT_PLANES - 2)
+#define BLOCK_INFO_SIZE (2 + 3 * MAX_PASSES)
+#define BLOCK_INFO_DISTORTION (2 + 2 * MAX_PASSES)
 
-#define CODEBLOCKY_QUARTER 8
+#define STRIPE_HEIGHT 4
+#define NUM_STRIPE_COLUMNS (CODEBLOCKX * (CODEBLOCKY / STRIPE_HEIGHT))
 
-#define BOUNDARY 1
-#define BOUNDARY_X2 2
+// code block dimensions are powers of two between 4 and 1024, with at most 4096 samples (ITU-T Rec. T.800, A.6.1)
+#if (CODEBLOCKX < 4) || (CODEBLOCKX > 1024) || (CODEBLOCKX & (CODEBLOCKX - 1)) || \
+	(CODEBLOCKY < 4) || (CODEBLOCKY > 1024) || (CODEBLOCKY & (CODEBLOCKY - 1)) || (CODEBLOCKX * CODEBLOCKY > 4096)
+#error "illegal code block size"
+#endif
 
-#define CODEBLOCKY_X4 128
+// work items per code block: a power of two that divides the number of stripe columns
+#ifndef WORK_GROUP_SIZE
+#define WORK_GROUP_SIZE NUM_STRIPE_COLUMNS
+#endif
+#if (WORK_GROUP_SIZE > NUM_STRIPE_COLUMNS) || (NUM_STRIPE_COLUMNS % WORK_GROUP_SIZE)
+#error "illegal work group size"
+#endif
+#define COLUMNS_PER_ITEM (NUM_STRIPE_COLUMNS / WORK_GROUP_SIZE)
+
+// at most ZC and SC for each sample, plus run length and two uniform pairs
+#define MAX_COLUMN_PAIRS 10
 
 
 //////////////////////////////////////////////////////
 // State Buffer
 
-#define STATE_BUFFER_SIZE 1156
-#define STATE_BOTTOM_BOUNDARY_OFFSET 1124
-
-#define STATE_BUFFER_STRIDE 34
-#define STATE_BUFFER_STRIDE_X2 68
-#define STATE_BUFFER_STRIDE_X3 102
-#define STATE_BUFFER_STRIDE_X4 136
+// code block with a one sample boundary on each side, which is never significant
+#define STATE_BUFFER_STRIDE (CODEBLOCKX + 2)
+#define STATE_BUFFER_SIZE (STATE_BUFFER_STRIDE * (CODEBLOCKY + 2))
 
-#define LEFT_TOP -35
-#define TOP  -34
-#define RIGHT_TOP -33
+#define LEFT_TOP (-STATE_BUFFER_STRIDE - 1)
+#define TOP  (-STATE_BUFFER_STRIDE)
+#define RIGHT_TOP (-STATE_BUFFER_STRIDE + 1)
 
 #define LEFT   -1
 #define RIGHT   1
 
-#define LEFT_BOTTOM  33
-#define BOTTOM  34
-#define RIGHT_BOTTOM  35
+#define LEFT_BOTTOM  (STATE_BUFFER_STRIDE - 1)
+#define BOTTOM  STATE_BUFFER_STRIDE
+#define RIGHT_BOTTOM  (STATE_BUFFER_STRIDE + 1)
 
+// state, scan, passOffset and vote; must match OCLBPC::localMemorySize
+#define LOCAL_MEMORY_USED ((STATE_BUFFER_SIZE + NUM_STRIPE_COLUMNS + 2) * 4)
+#if defined(LOCAL_MEMORY_SIZE) && (LOCAL_MEMORY_USED > LOCAL_MEMORY_SIZE)
+#error "code block does not fit into local memory"
+#endif
 
-////////////////////////////////////////////////////
-// State Variables 
-
-// bit positions (0 based indices)
-#define INPUT_SIGN_BITPOS  15  // assumes 16 bit signed input
 
-#define SIGMA_NEW_BITPOS   0x0 
-#define SIGMA_OLD_BITPOS   0x1
-#define NBH_BITPOS         0x2
-#define PIXEL_START_BITPOS 0xA 
-#define PIXEL_END_BITPOS   0x18 
-#define SIGN_BITPOS        0x19 
-
-// bit flags
-#define SIGMA_NEW_F			 0x1		  //position 0
-#define SIGMA_OLD_F			 0x10		  //position  1
-#define NBH_F				 0x20		  //position  2
-#define PIXEL_F				 0x7FFF0000   //positions 10-24
-#define SIGN_F				 0x2000000    //position  25
+////////////////////////////////////////////////////
+// State Variables
 
-#define NOT_SIGMA_NEW_F      0xFFFFFFFE   // ~SIGMA_NEW
-#define SIGMA_OLD_AND_NEW_F  0x11
+#define SIGMA_F			0x1		// significant before the current bit plane
+#define SPP_F			0x2		// became significant in the SPP of the current bit plane
+#define CUP_F			0x4		// becomes significant in the CUP of the current bit plane
+#define CODED_F			0x8		// coded in the SPP of the current bit plane (eta)
+#define REFINED_F		0x10	// refined in an earlier MRP (sigma_prime)
+#define SIGN_F			0x20
 
-#define INPUT_TO_SIGN_SHIFT 10
-#define SIGMA_OLD_TO_NBH_SHIFT 0x1
+#define MAGNITUDE_BITPOS 16
 
+#define BIT(pix) (((pix) >> (MAGNITUDE_BITPOS + bp)) & 1)
+#define SIGN(pix) (((pix) & SIGN_F) != 0)
 
-#define BIT(pix) (((pix)>>(bp))&1)
-#define NBH(pix) ((pix) & NBH_F)
-#define SIGMA_OLD(pix) ((pix) & SIGMA_OLD_F)
-#define SIGMA_NEW(pix) ((pix) & SIGMA_NEW_F)
-#define SIGMA_OLD_AND_NEW(pix) ((pix) & SIGMA_OLD_AND_NEW_F)
-#define SIGN(pix) ((pix) & SIGN_F)
+// significance as seen from a neighbour coded earlier or later in a pass
+#define SPP_EARLIER_MASK (SIGMA_F | SPP_F)
+#define SPP_LATER_MASK SIGMA_F
+#define CUP_EARLIER_MASK (SIGMA_F | SPP_F | CUP_F)
+#define CUP_LATER_MASK (SIGMA_F | SPP_F)
 
-#define SET_SIGMA_NEW(pix) ( (pix) |= SIGMA_NEW_F )
-#define CLEAR_SIGMA_NEW(pix) ( (pix) &= NOT_SIGMA_NEW_F )
+#define EMIT(cx, d) pairs[numPairs++] = (uchar)(((cx) << 1) | (d))
 
 
-/////////////////////////////////////
-// Context Variables 
+/////////////////////////////////////////////////////
+// Contexts
+
+// must match OCLCodeBlock
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+	int orientation;	// 0 = LL, 1 = HL, 2 = LH, 3 = HH
+	int level;
+} code_block_t;
+
+// significant neighbours of a sample, as seen when the sample is coded
+typedef struct {
+	uint h;		// horizontal
+	uint v;		// vertical
+	uint d;		// diagonal
+	int hSign;	// sign contribution of horizontal neighbours, between -1 and 1
+	int vSign;
+} neighbourhood_t;
+
+inline int signContribution(uint pix, uint significant) {
+	return significant ? (SIGN(pix) ? -1 : 1) : 0;
+}
 
 /*
-0-2		(CX,D) pairs counter
-3		SPP flag
-4		MRP flag
-5		SPP flag
-8		D4
-9-13	CX4
-14		D3
-15-19	CX3
-20		D2
-21-25	CX2
-26		D1
-27-31	CX1
+Neighbours of the sample at state index idx, in row r of its stripe.
 
+Neighbours that precede the sample in the scan are tested against earlierMask, the rest against laterMask.
+Vertical neighbours in the same stripe column are passed in, since the calling work item owns them.
 */
+inline neighbourhood_t getNeighbourhood(LOCAL const uint* state, int idx, uint r, uint top, uint bottom,
+									   uint earlierMask, uint laterMask) {
+	uint leftTop = state[idx + LEFT_TOP] & earlierMask;
+	uint rightTop = state[idx + RIGHT_TOP] & (r == 0 ? earlierMask : laterMask);
+	uint leftBottom = state[idx + LEFT_BOTTOM] & (r == STRIPE_HEIGHT - 1 ? laterMask : earlierMask);
+	uint rightBottom = state[idx + RIGHT_BOTTOM] & laterMask;
+	uint left = state[idx + LEFT];
+	uint right = state[idx + RIGHT];
+	uint leftSig = left & earlierMask;
+	uint rightSig = right & laterMask;
+	uint topSig = top & earlierMask;
+	uint bottomSig = bottom & laterMask;
+
+	neighbourhood_t nbh;
+	nbh.h = (leftSig != 0) + (rightSig != 0);
+	nbh.v = (topSig != 0) + (bottomSig != 0);
+	nbh.d = (leftTop != 0) + (rightTop != 0) + (leftBottom != 0) + (rightBottom != 0);
+	nbh.hSign = clamp(signContribution(left, leftSig) + signContribution(right, rightSig), -1, 1);
+	nbh.vSign = clamp(signContribution(top, topSig) + signContribution(bottom, bottomSig), -1, 1);
+	return nbh;
+}
+
+inline bool isPreferred(neighbourhood_t nbh) {
+	return (nbh.h + nbh.v + nbh.d) != 0;
+}
 
-/////////////////////////////////////////////////////
-
-// TABLES
 /*
+Zero coding context (ITU-T Rec. T.800, Table D.1)
 
-// ZERO CODING /////////////////////////////////////
+LL and LH sub-bands                 HL sub-band: same, with sumH and sumV swapped
 
-// LL and LH sub-bands
-values					Context
-sumH	sumV	sumD	CX
+sumH	sumV	sumD	CX
 2		x		x		8
-1 		1		x		7
-1		0 		1		6
+1 		>=1		x		7
+1		0 		>=1		6
 1		0		0		5
-0		2		x		4	
+0		2		x		4
 0		1		x		3
-0		0 		2		2
-0		0		1		1
-0		0		0		0
-
-
-//HH sub-band
-
-values					Context
-sum(H + V )		sumD	CX
-2 				3		8
-1				2		7
-1				2		6
-1				1		5
-0				1		4
-0				1		3
-0				0		2
-0				0		1
-0				0		0
-
-// HL sub-band
-
- values Context
-sumH	sumV	sumD	CX
-x		2		x		8
-1		1		x		7
-0		1 		1		6
-0		1		0		5
-2		0		x		4
-1		0		x		3
-0		0 		2		2
+0		0 		>=2		2
 0		0		1		1
 0		0		0		0
 
+HH sub-band
+
+sumD	sum(H + V)	CX
+>=3		x			8
+2		>=1			7
+2		0			6
+1		>=2			5
+1		1			4
+1		0			3
+0		>=2			2
+0		1			1
+0		0			0
+*/
+inline uint zeroCodingContext(neighbourhood_t nbh, int orientation) {
+	uint h = nbh.h;
+	uint v = nbh.v;
+	uint d = nbh.d;
+	if (orientation == 3) {
+		uint hv = h + v;
+		if (d >= 3)
+			return 8;
+		if (d == 2)
+			return hv >= 1 ? 7 : 6;
+		if (d == 1)
+			return hv >= 2 ? 5 : (hv == 1 ? 4 : 3);
+		return hv >= 2 ? 2 : hv;
+	}
+	if (orientation == 1) {
+		uint tmp = h;
+		h = v;
+		v = tmp;
+	}
+	if (h == 2)
+		return 8;
+	if (h == 1)
+		return v >= 1 ? 7 : (d >= 1 ? 6 : 5);
+	if (v >= 1)
+		return 2 + v;
+	return d >= 2 ? 2 : d;
+}
 
-// SIGN CODING ///////////////////////
+/*
+Sign coding context (ITU-T Rec. T.800, Table D.3)
 
-H	V	X^	 CX
+H	V	X^	 CX
 1	1	0	 13
 1	0	0	 12
 1	-1	0	 11
@@ -262,486 +363,480 @@ H	V	X^	 CX
 -1	0	1	 12
 -1 -1	1	 13
 
-
-// Magnitude Refinement //////////////////
-
-
-sigm_prime [y; x]	(H + V + D)	CX
-1					x			16
-0 					1			15
-0					0			14
-
-
+Returns the (CX,D) pair, where D is the sign bit XOR X^
 */
+inline uchar signCodingPair(neighbourhood_t nbh, uint pix) {
+	int h = nbh.hSign;
+	int v = nbh.vSign;
+	uint xorBit = (h < 0 || (h == 0 && v < 0)) ? 1 : 0;
+	if (xorBit) {
+		h = -h;
+		v = -v;
+	}
+	uint cx = (h == 0) ? 9 + abs(v) : 12 + v;
+	return (uchar)((cx << 1) | (SIGN(pix) ^ xorBit));
+}
 
-CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE  | CLK_FILTER_NEAREST;
-
-void KERNEL run(read_only image2d_t channel) {
-
-	// state buffer
-	LOCAL uint state[STATE_BUFFER_SIZE];
-	LOCAL uint cxd[STATE_BUFFER_SIZE];
+// magnitude refinement context (ITU-T Rec. T.800, Table D.4)
+inline uint magnitudeRefinementContext(neighbourhood_t nbh, uint pix) {
+	if (pix & REFINED_F)
+		return 16;
+	return isPreferred(nbh) ? 15 : 14;
+}
 
 
-	///////////////////////////////////////////////////////////////////////////////////
-	//1. Calculate MSB
-	
-	LOCAL int msbScratch[CODEBLOCKX]; // between -1 and 31 - negative one value indicates that this code block is identically zero
-
-	int maxSigBit;
-	if (getLocalId(1) == 0) {
-
-		uint maxVal = 0;
-		state[getLocalId(0)] = 0;   //top boundary
-		LOCAL uint* statePtr = state + (BOUNDARY + getLocalId(0));
-		int2 posIn = (int2)(getGlobalId(0),  (getGlobalId(1) >> 3)*CODEBLOCKY);
-
-		for (uint i = 0; i < CODEBLOCKY; ++i) {
-			int pixel = read_imagei(channel, sampler, posIn).x;
-			uint absPixel = abs(pixel);
-			maxVal = max(maxVal, absPixel);
-			pixel = (absPixel << PIXEL_START_BITPOS) | SIGN((pixel << INPUT_TO_SIGN_SHIFT));
-			statePtr[0] = pixel;
-
-			posIn.y++;
-			statePtr += STATE_BUFFER_STRIDE;	
-		}
-		state[ getLocalId(0) + STATE_BOTTOM_BOUNDARY_OFFSET] = 0;		//bottom boundary
-
-		//initialize full left and right boundary columns
-		if (getLocalId(0) == 0 || getLocalId(0) == CODEBLOCKX-1) {
-			int delta = -1 + ((getLocalId(0)/(CODEBLOCKX-1)) << 1); // -1 or +1
-			statePtr = state + BOUNDARY + getLocalId(0) + delta;
-			for (uint i = 0; i < CODEBLOCKY+ BOUNDARY_X2; ++i) {
-				 *statePtr = 0;
-				 statePtr += STATE_BUFFER_STRIDE;
-			}
+/*
+Exclusive prefix sum of the pair counts of all stripe columns over the work group, in scan order.
+Returns the sum of all counts, and the sum of counts before each column of this work item in offsets.
+*/
+inline uint scanPairCounts(LOCAL uint* scan, uint lid, const uint* counts, uint* offsets) {
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+		scan[lid + s * WORK_GROUP_SIZE] = counts[s];
+	localMemoryFence();
+	for (uint d = 1; d < NUM_STRIPE_COLUMNS; d <<= 1) {
+		uint prev[COLUMNS_PER_ITEM];
+		for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+			uint col = lid + s * WORK_GROUP_SIZE;
+			prev[s] = col >= d ? scan[col - d] : 0;
 		}
-
-		// calculate column-msb
-		maxSigBit = 31 - clz(maxVal);
-		msbScratch[getLocalId(0)] =maxSigBit;
+		localMemoryFence();
+		for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+			scan[lid + s * WORK_GROUP_SIZE] += prev[s];
+		localMemoryFence();
 	}
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+		offsets[s] = scan[lid + s * WORK_GROUP_SIZE] - counts[s];
+	uint total = scan[NUM_STRIPE_COLUMNS - 1];
 	localMemoryFence();
+	return total;
+}
 
-	//calculate global msb
-	if (!getLocalId(0) && !getLocalId(1) ) {
-		int4 mx = (int4)(maxSigBit);
-
-		LOCAL int* scratchPtr = msbScratch;
-		for(uint i=0; i < CODEBLOCKX; i+=4) {
-			mx = max(mx,(int4)(msbScratch[i],msbScratch[i+1],msbScratch[i+2],msbScratch[i+3]));
-		}
-		maxSigBit = mx.x;
-		maxSigBit = max(maxSigBit, mx.y);
-		maxSigBit = max(maxSigBit, mx.z);
-		maxSigBit = max(maxSigBit, mx.w);
-		msbScratch[0] = maxSigBit;
+/*
+Allocate space for the pairs of a pass, and write them in scan order.
+passInfo receives the offset and number of pairs of the pass.
+*/
+inline void writePass(GLOBAL uchar* cxd, GLOBAL uint* cxdHead, uint cxdCapacity, GLOBAL uint* passInfo,
+					  LOCAL uint* scan, LOCAL uint* passOffset, uint lid,
+					  uchar pairs[COLUMNS_PER_ITEM][MAX_COLUMN_PAIRS], const uint* numPairs) {
+	uint offsets[COLUMNS_PER_ITEM];
+	uint total = scanPairCounts(scan, lid, numPairs, offsets);
+	if (lid == 0) {
+		*passOffset = total ? atomic_add(cxdHead, total) : 0;
+		passInfo[0] = *passOffset;
+		passInfo[1] = total;
 	}
 	localMemoryFence();
-
-	if (msbScratch[0] == -1)
+	uint start = *passOffset;
+	if (start + total > cxdCapacity)
 		return;
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+		for (uint i = 0; i < numPairs[s]; ++i)
+			cxd[start + offsets[s] + i] = pairs[s][i];
+	}
+}
 
-		
-
-	int startIndex = (BOUNDARY + getLocalId(0)) + (BOUNDARY + getLocalId(1))*STATE_BUFFER_STRIDE_X4;
+// sum of v over the work group; scan is free before and after
+inline float sumWorkGroup(LOCAL uint* scan, uint lid, float v) {
+	scan[lid] = as_uint(v);
+	localMemoryFence();
+	for (uint s = WORK_GROUP_SIZE >> 1; s > 0; s >>= 1) {
+		if (lid < s)
+			scan[lid] = as_uint(as_float(scan[lid]) + as_float(scan[lid + s]));
+		localMemoryFence();
+	}
+	float total = as_float(scan[0]);
+	localMemoryFence();
+	return total;
+}
 
-	////////////////////////////////////////////////////////////////////////////////////////////////
-	// 2. CUP on MSB
+// reconstruction of the bits of a magnitude above bit plane bp, at the middle of the remaining interval
+inline int reconstruct(int mag, int bp) {
+	return ((mag >> bp) << bp) + (bp ? (1 << (bp - 1)) : 0);
+}
 
-	uint bp = msbScratch[0] + PIXEL_START_BITPOS;
+/*
+Reduction of the squared error of the samples of a stripe column whose state has flag set,
+when bit plane bp makes them significant, or refines them.
+x^2 - (x - r1)^2 = r1 * (2x - r1), and (x - r0)^2 - (x - r1)^2 = (r1 - r0) * (2x - r0 - r1)
+*/
+inline float columnDistortion(const uint* mine, uint rows, int bp, uint flag, bool refine) {
+	float d = 0;
+	for (uint r = 0; r < rows; ++r) {
+		if (!(mine[r] & flag))
+			continue;
+		int mag = (int)(mine[r] >> MAGNITUDE_BITPOS);
+		int r0 = refine ? reconstruct(mag, bp + 1) : 0;
+		int r1 = reconstruct(mag, bp);
+		d += (float)(r1 - r0) * (float)(2 * mag - r0 - r1);
+	}
+	return d;
+}
+
+// distortion reduction of a pass over the work group, stored by the first work item
+inline void writeDistortion(GLOBAL uint* passDistortion, LOCAL uint* scan, uint lid,
+							uint mine[COLUMNS_PER_ITEM][STRIPE_HEIGHT], const uint* rows, int bp, uint flag, bool refine) {
+	float d = 0;
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+		d += columnDistortion(mine[s], rows[s], bp, flag, refine);
+	d = sumWorkGroup(scan, lid, d);
+	if (lid == 0)
+		*passDistortion = as_uint(d);
+}
 
-	// i) set sigma_new for stripe column (sigma_old is zero)
-	LOCAL uint* statePtr = state + startIndex;
-	for (uint i = 0; i < 4; ++i) {
-		uint current = statePtr[0];
-		current |= BIT(current);	// set sigma_new
-		*statePtr = current;	
-		statePtr += STATE_BUFFER_STRIDE;
+/*
+Coding of one stripe column in each pass.
+mine holds the state of the rows of the column, idx is the state index of its first row.
+*/
 
+// SPP vote: mark samples that join the pass; returns true if any did
+inline bool sppVoteColumn(LOCAL const uint* state, uint* mine, uint rows, int idx, int bp) {
+	bool changed = false;
+	for (uint r = 0; r < rows; ++r) {
+		uint current = mine[r];
+		if (!(current & (SIGMA_F | CODED_F))) {
+			uint top = r ? mine[r - 1] : state[idx + TOP];
+			uint bottom = state[idx + BOTTOM];
+			neighbourhood_t nbh = getNeighbourhood(state, idx, r, top, bottom, SPP_EARLIER_MASK, SPP_LATER_MASK);
+			if (isPreferred(nbh)) {
+				current |= CODED_F | (BIT(current) ? SPP_F : 0);
+				mine[r] = current;
+				changed = true;
+			}
+		}
+		idx += STATE_BUFFER_STRIDE;
 	}
-	localMemoryFence();
-		
-	// ii) set nbh for stripe column, and do CUP
-	
-	// Note: since this is the very first pass on this code block, the only possible significant pixels
-	// following the scan pattern are the those in top, left top, left and left bottom positions.
-
-	// RLC - runs through all consecutive non-significant pixels in column that are not in preferred neighbourhood,
-	//       starting from first pixel in stripe column
-	// ZC/SC on rest of pixels in column
-
-	statePtr				= state + startIndex;
-	uint current			= statePtr[0];
-	uint top				= statePtr[TOP];
-	uint leftTop			= statePtr[LEFT_TOP];
-	uint left				= statePtr[LEFT];
-	uint leftBottom			= statePtr[LEFT_BOTTOM];
-
-
-	// first pixel in stripe column
-	uint nbh =  SIGMA_NEW(top) | SIGMA_NEW(leftTop) | SIGMA_NEW(left) | SIGMA_NEW(leftBottom);
-	bool doRLC = !nbh && !SIGMA_NEW(current);
-	if (!doRLC) {
-		if (nbh) {
-			//ZC
+	return changed;
+}
+
+// SPP: ZC and SC
+inline uint sppColumn(LOCAL const uint* state, const uint* mine, uint rows, int idx, int bp, int orientation, uchar* pairs) {
+	uint numPairs = 0;
+	for (uint r = 0; r < rows; ++r) {
+		uint current = mine[r];
+		if (current & CODED_F) {
+			uint top = r ? mine[r - 1] : state[idx + TOP];
+			uint bottom = state[idx + BOTTOM];
+			neighbourhood_t nbh = getNeighbourhood(state, idx, r, top, bottom, SPP_EARLIER_MASK, SPP_LATER_MASK);
+			EMIT(zeroCodingContext(nbh, orientation), BIT(current));
+			if (BIT(current))
+				pairs[numPairs++] = signCodingPair(nbh, current);
 		}
-		if (SIGMA_NEW(current) ){
-			//SC
+		idx += STATE_BUFFER_STRIDE;
+	}
+	return numPairs;
+}
+
+// MRP
+inline uint mrpColumn(LOCAL const uint* state, uint* mine, uint rows, int idx, int bp, uchar* pairs) {
+	uint numPairs = 0;
+	for (uint r = 0; r < rows; ++r) {
+		uint current = mine[r];
+		if (current & SIGMA_F) {
+			neighbourhood_t nbh = getNeighbourhood(state, idx, r, state[idx + TOP], state[idx + BOTTOM],
+												   SPP_EARLIER_MASK, SPP_EARLIER_MASK);
+			EMIT(magnitudeRefinementContext(nbh, current), BIT(current));
+			mine[r] = current | REFINED_F;
 		}
+		idx += STATE_BUFFER_STRIDE;
 	}
-
-	for (int i = 0; i < 2; ++i) {
-		statePtr   += STATE_BUFFER_STRIDE;
-		top			= current;
-		current		= statePtr[0];
-		leftTop		= left;
-		left		= leftBottom;
-		leftBottom	= statePtr[LEFT_BOTTOM];
-
-		nbh =  SIGMA_NEW(top) | SIGMA_NEW(leftTop) | SIGMA_NEW(left) | SIGMA_NEW(leftBottom);
-		bool wasDoingRLC = doRLC;
-		doRLC = doRLC && !nbh && !SIGMA_NEW(current);
-		if (!doRLC) {
-		    if (wasDoingRLC) {
-				//RLC for first (i+1) pixels
-			}
-			if (nbh) {
-				//ZC
-			}
-			if (SIGMA_NEW(current)) {
-				//SC
+	return numPairs;
+}
+
+// CUP: RLC, ZC and SC
+inline uint cupColumn(LOCAL const uint* state, const uint* mine, uint rows, int idx, int bp, int orientation, uchar* pairs) {
+	uint numPairs = 0;
+	uint r = 0;
+	if (rows == STRIPE_HEIGHT) {
+		// run length coding: all four samples uncoded, with no significant neighbour outside the column
+		bool doRLC = true;
+		for (uint i = 0; i < STRIPE_HEIGHT; ++i) {
+			int j = idx + i * STATE_BUFFER_STRIDE;
+			neighbourhood_t nbh = getNeighbourhood(state, j, i, i ? 0 : state[j + TOP],
+												   i == STRIPE_HEIGHT - 1 ? state[j + BOTTOM] : 0,
+												   CUP_EARLIER_MASK, CUP_LATER_MASK);
+			doRLC = doRLC && !(mine[i] & (SIGMA_F | CODED_F)) && !isPreferred(nbh);
+		}
+		if (doRLC) {
+			uint runLength = 0;
+			while (runLength < STRIPE_HEIGHT && !(mine[runLength] & CUP_F))
+				runLength++;
+			EMIT(CX_RUN_LENGTH, runLength < STRIPE_HEIGHT);
+			if (runLength < STRIPE_HEIGHT) {
+				EMIT(CX_UNIFORM, runLength >> 1);
+				EMIT(CX_UNIFORM, runLength & 1);
+				int j = idx + runLength * STATE_BUFFER_STRIDE;
+				uint top = runLength ? mine[runLength - 1] : state[j + TOP];
+				neighbourhood_t nbh = getNeighbourhood(state, j, runLength, top, state[j + BOTTOM],
+													   CUP_EARLIER_MASK, CUP_LATER_MASK);
+				pairs[numPairs++] = signCodingPair(nbh, mine[runLength]);
 			}
+			r = runLength + 1;
+			idx += r * STATE_BUFFER_STRIDE;
 		}
 	}
-			
-	// last pixel in stripe column -
-	// ignore leftBottom pixel, because it is in the next
-	// stripe and it hasn't been processed yet
-	statePtr += STATE_BUFFER_STRIDE;
-	top			= current;
-	current		= statePtr[0];
-	leftTop		= left;
-	left		= leftBottom;
-
-	nbh =  SIGMA_NEW(top) | SIGMA_NEW(leftTop) | SIGMA_NEW(left);
-	bool wasDoingRLC = doRLC;
-	doRLC = doRLC && !nbh && !SIGMA_NEW(current);
-	if (doRLC) {
-		//RLC for all four pixels in stripe column
-	}
-	else {
-	   if (wasDoingRLC) {
-		  //RLC for first three pixels in stripe column
-	   }
-
-		if (nbh) {
-			//ZC
-		}
-		if (SIGMA_NEW(current)) {
-			//SC
+	for (; r < rows; ++r) {
+		uint current = mine[r];
+		if (!(current & (SIGMA_F | CODED_F))) {
+			uint top = r ? mine[r - 1] : state[idx + TOP];
+			uint bottom = state[idx + BOTTOM];
+			neighbourhood_t nbh = getNeighbourhood(state, idx, r, top, bottom, CUP_EARLIER_MASK, CUP_LATER_MASK);
+			EMIT(zeroCodingContext(nbh, orientation), BIT(current));
+			if (BIT(current))
+				pairs[numPairs++] = signCodingPair(nbh, current);
 		}
+		idx += STATE_BUFFER_STRIDE;
 	}
-	localMemoryFence();
-
-	
-	/////////////////////////////////////////////////////////////////////////////////////////////////
-	// 3. Processs rest of bit planes
-	bp--;
-	LOCAL char blockVote;
+	return numPairs;
+}
+
+// copy the state of this work item's columns to the shared state buffer
+inline void storeColumns(LOCAL uint* state, uint mine[COLUMNS_PER_ITEM][STRIPE_HEIGHT], const uint* rows, const int* startIndex) {
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+		for (uint r = 0; r < rows[s]; ++r)
+			state[startIndex[s] + r * STATE_BUFFER_STRIDE] = mine[s][r];
+	}
+}
 
-	while (bp >= PIXEL_START_BITPOS) {
-		blockVote = 0;
 
-		/////////////////////////////
-		// 4. pre-process bit plane
+// reads outside of the image return zero
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE  | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
 
-		// i) migrate sigma_new to sigma_old, and clear sigma new bit
-		statePtr = state + startIndex;
-		for (uint i = 0; i < 4; ++i) {
-		    uint current = *statePtr;
-			current |=  SIGMA_NEW(current) << SIGMA_OLD_BITPOS;  
-			CLEAR_SIGMA_NEW(current); 
+// rows of stripe column col inside the code block; zero if the column is outside
+inline uint columnRows(code_block_t block, uint col) {
+	const int x = (int)(col % CODEBLOCKX);
+	const int y0 = (int)((col / CODEBLOCKX) * STRIPE_HEIGHT);
+	return (x < block.width) ? (uint)clamp(block.height - y0, 0, STRIPE_HEIGHT) : 0;
+}
 
-			*statePtr = current;
-			statePtr += STATE_BUFFER_STRIDE;	
-
-		}
+/*
+Prepass: number of bit planes of each code block.
+
+One work group per code block. Writes the number of bit planes and passes of every block to blockInfo,
+and appends each block with at least one non-zero sample to the work list of its channel, which starts
+at workList + infoOffset, as (infoOffset + code block index, number of bit planes).
+The length of the list is counted in workListCounts[channelIndex], and the number of listed blocks
+with b bit planes in bucketCounts[channelIndex * MAX_BIT_PLANES + b - 1].
+The BPC then runs over the work list only.
+*/
+void KERNEL findBitPlanes(KERNEL_IMAGE_RO(channel),
+						  GLOBAL const code_block_t* codeBlocks,
+						  GLOBAL uint* blockInfo,
+						  const unsigned int infoOffset,
+						  GLOBAL uint2* workList,
+						  GLOBAL uint* workListCounts,
+						  GLOBAL uint* bucketCounts,
+						  const unsigned int channelIndex
+						  BUFFER_IMAGE_ARGS) {
+	BIND_IMAGE(channel, imageWidth, imageHeight, 1);
+
+	LOCAL uint scan[WORK_GROUP_SIZE];
+
+	const code_block_t block = codeBlocks[getGroupId(0)];
+	const uint lid = getLocalId(0);
+	uint maxVal = 0;
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+		const uint col = lid + s * WORK_GROUP_SIZE;
+		const uint rows = columnRows(block, col);
+		const int x = block.x + (int)(col % CODEBLOCKX);
+		const int y0 = block.y + (int)((col / CODEBLOCKX) * STRIPE_HEIGHT);
+		for (uint r = 0; r < rows; ++r)
+			maxVal = max(maxVal, (uint)abs(readImageIBorder(channel, (int2)(x, y0 + r)).x));
+	}
+	scan[lid] = maxVal;
+	localMemoryFence();
+	for (uint s = WORK_GROUP_SIZE >> 1; s > 0; s >>= 1) {
+		if (lid < s)
+			scan[lid] = max(scan[lid], scan[lid + s]);
 		localMemoryFence();
-		
-
-		// ii) update nbh
-		statePtr = state + startIndex;
-
-		uint top			= statePtr[TOP];
-		uint leftTop		= statePtr[LEFT_TOP];
-		uint rightTop		= statePtr[RIGHT_TOP];
-		uint left			= statePtr[LEFT];
-		uint current		= statePtr[0];
-		uint right			= statePtr[RIGHT];
-		uint leftBottom		= statePtr[LEFT_BOTTOM];
-		uint bottom			= statePtr[BOTTOM];
-		uint rightBottom	= statePtr[RIGHT_BOTTOM];
-
-		current |=  (   SIGMA_OLD(leftTop) |
-						SIGMA_OLD( top) |
-						SIGMA_OLD( rightTop) |
-						SIGMA_OLD( left) | 
-						SIGMA_OLD( right) | 
-						SIGMA_OLD( leftBottom) |
-						SIGMA_OLD( bottom) |
-						SIGMA_OLD( rightBottom)  ) << SIGMA_OLD_TO_NBH_SHIFT; 
-
-		if ( BIT(current) && NBH(current) && !SIGMA_OLD(current) ) {
-			SET_SIGMA_NEW(current);
-			blockVote = 1;
-
+	}
+	if (lid == 0) {
+		maxVal = scan[0];
+		const uint numBitPlanes = maxVal ? 32 - clz(maxVal) : 0;
+		const uint index = infoOffset + getGroupId(0);
+		GLOBAL uint* info = blockInfo + index * BLOCK_INFO_SIZE;
+		info[0] = numBitPlanes;
+		info[1] = numBitPlanes ? 3 * numBitPlanes - 2 : 0;
+		if (numBitPlanes) {
+			workList[infoOffset + atomic_inc(workListCounts + channelIndex)] = (uint2)(index, numBitPlanes);
+			atomic_inc(bucketCounts + channelIndex * MAX_BIT_PLANES + min(numBitPlanes, (uint)MAX_BIT_PLANES) - 1);
 		}
-		*statePtr = current;
-
-		for (uint i = 0; i < 3; ++i) {
-			statePtr += STATE_BUFFER_STRIDE;
-				
-			top			 = current;
-			leftTop		 = left;
-			rightTop	 = right;
-			left		 = leftBottom;
-			current		 = statePtr[0];
-			right		 = rightBottom;
-			leftBottom   = statePtr[LEFT_BOTTOM];
-			bottom		 = statePtr[BOTTOM];
-			rightBottom  = statePtr[RIGHT_BOTTOM];
-
-			current |=	   ( SIGMA_OLD(leftTop) |
-							 SIGMA_OLD( top) |
-							 SIGMA_OLD( rightTop) |
-							 SIGMA_OLD( left) | 
-							 SIGMA_OLD( right) | 
-							 SIGMA_OLD( leftBottom) |
-							 SIGMA_OLD( bottom) |
-							 SIGMA_OLD( rightBottom)  ) << SIGMA_OLD_TO_NBH_SHIFT; 
-
-			if ( BIT(current) && NBH(current) && !SIGMA_OLD(current) ) {
-			    SET_SIGMA_NEW(current);
-				blockVote = 1;
-			}
-			*statePtr = current;
+	}
+}
 
-		}
-		localMemoryFence();
+/*
+Groups the work list of a channel by number of bit planes, so that neighbouring work groups
+of the BPC launch do similar work.
+
+One work item per block of the channel; items past the length of the list exit at once.
+Buckets are in order of decreasing number of bit planes: entries with b bit planes are appended
+to bucketed after the listed blocks with more, as counted in bucketCounts by the prepass,
+using bucketCursors[channelIndex * MAX_BIT_PLANES + b - 1], which the host zeroes.
+The order within a bucket is undefined.
+*/
+void KERNEL bucketWorkList(GLOBAL const uint2* workList,
+						   GLOBAL const uint* workListCounts,
+						   GLOBAL const uint* bucketCounts,
+						   GLOBAL uint* bucketCursors,
+						   GLOBAL uint2* bucketed,
+						   const unsigned int infoOffset,
+						   const unsigned int channelIndex) {
+	const uint i = getGlobalId(0);
+	if (i >= workListCounts[channelIndex])
+		return;
+	const uint2 work = workList[infoOffset + i];
+	const uint numBitPlanes = min(work.y, (uint)MAX_BIT_PLANES);
+	GLOBAL const uint* counts = bucketCounts + channelIndex * MAX_BIT_PLANES;
+	uint start = 0;
+	for (uint b = numBitPlanes; b < MAX_BIT_PLANES; ++b)
+		start += counts[b];
+	bucketed[infoOffset + start + atomic_inc(bucketCursors + channelIndex * MAX_BIT_PLANES + numBitPlanes - 1)] = work;
+}
 
-		
-		// iii) block vote on sigma new
-		while (blockVote) 
-		{
-		    blockVote = 0;
-			localMemoryFence();
+/*
+Bit plane coder: one work group per entry of the work list of the channel, as written by findBitPlanes,
+from entry firstEntry on. The host sizes the launch before the length of the list is known,
+so work groups past workListCounts[channelIndex] exit at once.
+*/
+void KERNEL run(KERNEL_IMAGE_RO(channel),
+				GLOBAL const code_block_t* codeBlocks,
+				GLOBAL const uint2* workList,
+				GLOBAL const uint* workListCounts,
+				const unsigned int channelIndex,
+				const unsigned int firstEntry,
+				GLOBAL uint* blockInfo,
+				const unsigned int infoOffset,
+				GLOBAL uchar* cxd,
+				GLOBAL uint* cxdHead,
+				const unsigned int cxdCapacity
+				BUFFER_IMAGE_ARGS) {
+	BIND_IMAGE(channel, imageWidth, imageHeight, 1);
 
-			statePtr = state + startIndex;
+	LOCAL uint state[STATE_BUFFER_SIZE];
+	LOCAL uint scan[NUM_STRIPE_COLUMNS];
+	LOCAL uint passOffset;
+	LOCAL uint vote;
 
-			//first pixel in stripe column
-			uint top			= statePtr[TOP];
-			uint leftTop		= statePtr[LEFT_TOP];
-			uint left			= statePtr[LEFT];
-			uint current		= statePtr[0];
-			uint leftBottom		= statePtr[LEFT_BOTTOM];
+	// the whole work group leaves together, before any barrier
+	const uint entry = firstEntry + getGroupId(0);
+	if (entry >= workListCounts[channelIndex])
+		return;
+	const uint2 work = workList[infoOffset + entry];
+	const code_block_t block = codeBlocks[work.x - infoOffset];
+	const uint numBitPlanes = work.y;
+	GLOBAL uint* info = blockInfo + work.x * BLOCK_INFO_SIZE;
+	const uint lid = getLocalId(0);
+
+	// stripe columns of this work item: column lid + s * WORK_GROUP_SIZE, in scan order
+	uint rows[COLUMNS_PER_ITEM];
+	int startIndex[COLUMNS_PER_ITEM];
+	uint mine[COLUMNS_PER_ITEM][STRIPE_HEIGHT];	// state of the stripe column
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+		const uint col = lid + s * WORK_GROUP_SIZE;
+		rows[s] = columnRows(block, col);
+		startIndex[s] = (int)((col % CODEBLOCKX) + 1 + ((col / CODEBLOCKX) * STRIPE_HEIGHT + 1) * STATE_BUFFER_STRIDE);
+	}
 
-			current  |= (   SIGMA_NEW(leftTop) |
-							SIGMA_NEW( top) |
-							SIGMA_NEW( left) | 
-							SIGMA_NEW( leftBottom) ) << NBH_BITPOS; 
+	///////////////////////////////////////////////////////////////////////////////////
+	//1. Load code block
 
-			if (  BIT(current) && !SIGMA_OLD(current) &&  NBH(current)  &&  !SIGMA_NEW(current)) {
-				SET_SIGMA_NEW(current);
-				blockVote = 1;
+	for (uint i = lid; i < STATE_BUFFER_SIZE; i += WORK_GROUP_SIZE)
+		state[i] = 0;
+	localMemoryFence();
 
+	for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+		const uint col = lid + s * WORK_GROUP_SIZE;
+		const int x = block.x + (int)(col % CODEBLOCKX);
+		const int y0 = block.y + (int)((col / CODEBLOCKX) * STRIPE_HEIGHT);
+		for (uint r = 0; r < STRIPE_HEIGHT; ++r) {
+			mine[s][r] = 0;
+			if (r < rows[s]) {
+				int pixel = readImageIBorder(channel, (int2)(x, y0 + r)).x;
+				mine[s][r] = ((uint)abs(pixel) << MAGNITUDE_BITPOS) | (pixel < 0 ? SIGN_F : 0);
 			}
-			statePtr[0] = current;
-
-			// next two pixels in stripe column
-			for (uint i = 0; i < 2; ++i) {
-				statePtr += STATE_BUFFER_STRIDE;
-
-				top			= current;
-				current		= statePtr[0];
-				leftTop		= left;
-				left		= leftBottom;
-				leftBottom  = statePtr[LEFT_BOTTOM];
+		}
+	}
+	storeColumns(state, mine, rows, startIndex);
+	localMemoryFence();
 
-				current  |= (   SIGMA_NEW(leftTop) |
-								SIGMA_NEW( top) |
-								SIGMA_NEW( left) | 
-								SIGMA_NEW( leftBottom) ) << NBH_BITPOS; 
+	GLOBAL uint* passInfo = info + 2;
+	GLOBAL uint* passDistortion = info + BLOCK_INFO_DISTORTION;
+	uchar pairs[COLUMNS_PER_ITEM][MAX_COLUMN_PAIRS];
+	uint numPairs[COLUMNS_PER_ITEM];
 
-				if (  BIT(current) && !SIGMA_OLD(current) && NBH(current)  && !SIGMA_NEW(current)) {
-					SET_SIGMA_NEW(current);
-					blockVote = 1;
+	for (int bp = numBitPlanes - 1; bp >= 0; --bp) {
 
+		/////////////////////////////
+		// 2. pre-process bit plane: samples that became significant in the previous bit plane join sigma
+
+		if (bp != numBitPlanes - 1) {
+			for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+				for (uint r = 0; r < rows[s]; ++r) {
+					uint current = mine[s][r];
+					if (current & (SPP_F | CUP_F))
+						current |= SIGMA_F;
+					mine[s][r] = current & ~(SPP_F | CUP_F | CODED_F);
 				}
-				statePtr[0] = current;
-			}
-
-			// last pixel in stripe column -
-			// ignore leftBottom pixel, because it is in the next
-			// stripe and it hasn't been processed yet
-			statePtr += STATE_BUFFER_STRIDE;
-
-			top			= current;
-			current		= statePtr[0];
-			leftTop		= left;
-			left		= leftBottom;
-
-			current |= ( SIGMA_NEW(leftTop) |
-						 SIGMA_NEW( top) |
-						 SIGMA_NEW( left) ) << NBH_BITPOS;
-			if (  BIT(current) && !SIGMA_OLD(current) && NBH(current)  && !SIGMA_NEW(current)) {
-				SET_SIGMA_NEW(current);
-				blockVote = 1;
 			}
-			statePtr[0] = current;
-
+			storeColumns(state, mine, rows, startIndex);
 			localMemoryFence();
 
-		}
-		
-		/////////////////////////
-		// 5. bit plane processing 
-		statePtr = state + startIndex;
-
-		// first pixel in stripe column
-		top				= statePtr[TOP];
-		leftTop			= statePtr[LEFT_TOP];
-		rightTop		= statePtr[RIGHT_TOP];
-		left			= statePtr[LEFT];
-		current			= statePtr[0];
-		right			= statePtr[RIGHT];
-		leftBottom		= statePtr[LEFT_BOTTOM];
-		bottom			= statePtr[BOTTOM];
-		rightBottom		= statePtr[RIGHT_BOTTOM];
-
-		bool doRLC = false;
-		if (SIGMA_OLD(current)) {
-			// MRC
-		} else {
-			int nbh = ( SIGMA_OLD_AND_NEW(leftTop) |
-						SIGMA_OLD_AND_NEW( top) |
-						SIGMA_OLD_AND_NEW( rightTop) |
-						SIGMA_OLD_AND_NEW( left) | 
-						SIGMA_OLD_AND_NEW( right) | 
-						SIGMA_OLD_AND_NEW( leftBottom) |
-						SIGMA_OLD_AND_NEW( bottom) |
-						SIGMA_OLD_AND_NEW( rightBottom)  ) ; 
-
-			doRLC = !nbh && !SIGMA_NEW(current);	
-			if (!doRLC) {
-				 if (nbh) {
-					//ZC
-				 }
-
-                // could be from SPP or CUP
-				if (BIT(current)) {
-					//SC
-				}
-			}	
-		}
-
-		// next two pixels in stripe column
-		for (uint i = 0; i < 2; ++i) {
-			statePtr += STATE_BUFFER_STRIDE;	
-
-			top			= current;
-			leftTop		= left;
-			rightTop	= right;
-			left		= leftBottom;
-			current		= statePtr[0];
-			right		= rightBottom;
-			leftBottom  = statePtr[LEFT_BOTTOM];
-			bottom		= statePtr[BOTTOM];
-			rightBottom = statePtr[RIGHT_BOTTOM];
-
-			if (SIGMA_OLD(current)) {
-			    if (doRLC) {
-					//RLC for first (i+1) pixels
-					doRLC = false;
-				}
-				// MRC
-			} else {
-				int nbh = ( SIGMA_OLD_AND_NEW(leftTop) |
-							SIGMA_OLD_AND_NEW( top) |
-							SIGMA_OLD_AND_NEW( rightTop) |
-							SIGMA_OLD_AND_NEW( left) | 
-							SIGMA_OLD_AND_NEW( right) | 
-							SIGMA_OLD_AND_NEW( leftBottom) |
-							SIGMA_OLD_AND_NEW( bottom) |
-							SIGMA_OLD_AND_NEW( rightBottom)  ) ; 
-
-				bool wasDoingRLC = doRLC;
-				doRLC = doRLC && !nbh && !SIGMA_NEW(current);	
-				if (!doRLC) {
-					if (wasDoingRLC) {
-						//RLC for first (i+1) pixels
-					}
-					if (nbh) {
-						//ZC
-					}
-
-					// could be from SPP or CUP
-					if (BIT(current) ) {
-						//SC
-					}
-
+			/////////////////////////////
+			// 3. SPP
+
+			// i) block vote until no more samples join the pass
+			do {
+				localMemoryFence();
+				if (lid == 0)
+					vote = 0;
+				localMemoryFence();
+
+				bool changed = false;
+				for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+					changed = sppVoteColumn(state, mine[s], rows[s], startIndex[s], bp) || changed;
+				localMemoryFence();
+				if (changed) {
+					storeColumns(state, mine, rows, startIndex);
+					vote = 1;
 				}
-			}
+				localMemoryFence();
+			} while (vote);
+
+			// ii) ZC and SC
+			for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+				numPairs[s] = sppColumn(state, mine[s], rows[s], startIndex[s], bp, block.orientation, pairs[s]);
+			writePass(cxd, cxdHead, cxdCapacity, passInfo, scan, &passOffset, lid, pairs, numPairs);
+			writeDistortion(passDistortion++, scan, lid, mine, rows, bp, SPP_F, false);
+			passInfo += 2;
+
+			/////////////////////////////
+			// 4. MRP
+
+			for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+				numPairs[s] = mrpColumn(state, mine[s], rows[s], startIndex[s], bp, pairs[s]);
+			writePass(cxd, cxdHead, cxdCapacity, passInfo, scan, &passOffset, lid, pairs, numPairs);
+			writeDistortion(passDistortion++, scan, lid, mine, rows, bp, SIGMA_F, true);
+			passInfo += 2;
 		}
 
-		// last pixel in stripe column (ignore sigma_new from next stripe)
-		statePtr += STATE_BUFFER_STRIDE;	
-
-		top			= current;
-		leftTop		= left;
-		rightTop	= right;
-		left		= leftBottom;
-		current		= statePtr[0];
-		right		= rightBottom;
-		leftBottom  = statePtr[LEFT_BOTTOM];
-		bottom		= statePtr[BOTTOM];
-		rightBottom = statePtr[RIGHT_BOTTOM];
-
-		if (SIGMA_OLD(current)) {
-			if (doRLC) {
-				//RLC for first three pixels
-			}
-			// MRC
-		} else {
-			int nbh = ( SIGMA_OLD_AND_NEW(leftTop) |
-							SIGMA_OLD_AND_NEW( top) |
-							SIGMA_OLD_AND_NEW( rightTop) |
-							SIGMA_OLD_AND_NEW( left) | 
-							SIGMA_OLD_AND_NEW( right) | 
-							SIGMA_OLD( leftBottom) |
-							SIGMA_OLD( bottom) |
-							SIGMA_OLD( rightBottom)  ) ; 
-
-			bool wasDoingRLC = doRLC;
-			doRLC = doRLC && !nbh && !SIGMA_NEW(current);	
-			if (doRLC) {
-				// RLC for all four pixels in stripe column
-			} else {
-				if (wasDoingRLC) {
-					//RLC for first three pixels in column
-				}
-				if (nbh) {
-					//ZC
-				}
-
-				// could be from SPP or CUP
-				if (BIT(current) ) {
-					//SC
-				}
+		/////////////////////////////
+		// 5. CUP
+
+		// i) every uncoded sample with its bit set becomes significant
+		for (uint s = 0; s < COLUMNS_PER_ITEM; ++s) {
+			for (uint r = 0; r < rows[s]; ++r) {
+				uint current = mine[s][r];
+				if (!(current & (SIGMA_F | CODED_F)) && BIT(current))
+					mine[s][r] = current | CUP_F;
 			}
 		}
+		storeColumns(state, mine, rows, startIndex);
 		localMemoryFence();
-		bp--;
+
+		// ii) RLC, ZC and SC
+		for (uint s = 0; s < COLUMNS_PER_ITEM; ++s)
+			numPairs[s] = cupColumn(state, mine[s], rows[s], startIndex[s], bp, block.orientation, pairs[s]);
+		writePass(cxd, cxdHead, cxdCapacity, passInfo, scan, &passOffset, lid, pairs, numPairs);
+		writeDistortion(passDistortion++, scan, lid, mine, rows, bp, CUP_F, false);
+		passInfo += 2;
 	}
-}
\ No newline at end of file
+}
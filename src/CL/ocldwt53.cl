@@ -22,9 +22,16 @@ Lossless forward 5/3 discrete wavelet transform
 
 Assumptions:
 
-1) assume WIN_SIZE_X equals the number of work items in the work group
-2) width and height are both even (will need to relax this assumption in the future)
-3) data precision is 14 bits or less
+1) assume WIN_SIZE_Y equals the number of work items in the work group
+2) data precision is 14 bits or less
+
+Width and height are arbitrary: image boundaries use whole sample symmetric extension,
+and for odd sizes the low pass band gets the extra sample.
+
+Columns are lifted before rows, as in 2D_SD of ITU-T Rec. T.800 (F.4.2): the lifting steps round,
+so only this order is undone exactly by a conforming decoder. Each step therefore loads its window
+with HALO_X columns on each side, which the horizontal lifting of the window reads once they have
+been lifted vertically.
 
 */
 
@@ -45,7 +52,8 @@ Assumptions:
 Layout for scratch buffer
 
 Odd and even rows are separated. (Generates less bank conflicts when using lifting scheme.)
-All even rows are stored first, then all odd rows.
+All even rows are stored first, then all odd rows. Each row holds SCRATCH_X columns:
+the window, and HALO_X columns on each side of it.
 
 Left (even) boundary row
 Even rows
@@ -58,35 +66,41 @@ Right (odd) boundary row
 
 #define BOUNDARY_Y 2
 
-#define HORIZONTAL_STRIDE 64  // WIN_SIZE_Y/2 
+// columns on each side of the window that its horizontal lifting reads
+#define HALO_X 2
+#define SCRATCH_X (WIN_SIZE_X + 2 * HALO_X)
+
+#define HORIZONTAL_STRIDE (WIN_SIZE_Y >> 1)
 
 
 // two vertical neighbours: pointer diff:
-#define BUFFER_SIZE            512	// HORIZONTAL_STRIDE * WIN_SIZE_X
+#define BUFFER_SIZE            (HORIZONTAL_STRIDE * SCRATCH_X)
 
 
-#define CHANNEL_BUFFER_SIZE     1024            // BUFFER_SIZE + BUFFER_SIZE
+#define CHANNEL_BUFFER_SIZE     (BUFFER_SIZE << 1)
 
-#define CHANNEL_BUFFER_SIZE_X2  2048   
-#define CHANNEL_BUFFER_SIZE_X3  3072   
+#define CHANNEL_BUFFER_SIZE_X2  (CHANNEL_BUFFER_SIZE * 2)
+#define CHANNEL_BUFFER_SIZE_X3  (CHANNEL_BUFFER_SIZE * 3)
 
-#define PIXEL_BUFFER_SIZE   4096
+#define PIXEL_BUFFER_SIZE   (CHANNEL_BUFFER_SIZE * 4)
 
-#define VERTICAL_ODD_TO_PREVIOUS_EVEN -512
-#define VERTICAL_ODD_TO_NEXT_EVEN     -511
+#define VERTICAL_ODD_TO_PREVIOUS_EVEN (-BUFFER_SIZE)
+#define VERTICAL_ODD_TO_NEXT_EVEN     (1 - BUFFER_SIZE)
 
 
-#define VERTICAL_EVEN_TO_PREVIOUS_ODD  511
-#define VERTICAL_EVEN_TO_NEXT_ODD      512
+#define VERTICAL_EVEN_TO_PREVIOUS_ODD  (BUFFER_SIZE - 1)
+#define VERTICAL_EVEN_TO_NEXT_ODD      BUFFER_SIZE
 
 
 
 ///////////////////////////////////////////////////////////////////////
 
-CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_MIRRORED_REPEAT  | CLK_FILTER_NEAREST;
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE  | CLK_FILTER_NEAREST;
 
+// image row of this work item: work groups overlap by 2 * BOUNDARY_Y rows, and the first group
+// starts BOUNDARY_Y rows above the image
 inline int getCorrectedGlobalIdY() {
-      return getGlobalId(1) - 2 * BOUNDARY_Y * getGroupId(1);
+      return (int)getGlobalId(1) - BOUNDARY_Y - 2 * BOUNDARY_Y * (int)getGroupId(1);
 }
 
 
@@ -106,8 +120,13 @@ inline void writePixel(int4 pix, LOCAL short*  restrict  dest) {
 	*dest = pix.w;
 }
 
+// read pixel at column x of image row y, mirroring x at the image boundaries
+inline int4 readMirrored(IMAGE_RO idata, int x, int y, int width) {
+	return readImageI(idata, (int2)(mirror(x, width), y));
+}
+
 // write row to destination
-void writeRowToOutput(LOCAL short* restrict currentScratch, write_only image2d_t odata, unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth){
+void writeRowToOutput(LOCAL short* restrict currentScratch, IMAGE_WO odata, unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int lowWidth){
 
 	int2 posOut = {firstX>>1, outputY};
 	for (int j = 0; j < WIN_SIZE_X; j+=2) {
@@ -115,24 +134,23 @@ void writeRowToOutput(LOCAL short* restrict currentScratch, write_only image2d_t
 	    // low pass
 		
 		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
+	    if (posOut.x >= lowWidth)
 			break;
 
-		write_imagei(odata, posOut,readPixel(currentScratch));
+		writeImageI(odata, posOut,readPixel(currentScratch));
 
-		// high pass
+		// high pass (for odd widths, the last even point has no odd neighbour)
 		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagei(odata, posOut, readPixel(currentScratch));
+		if ((posOut.x << 1) + 1 < width)
+			writeImageI(odata, (int2)(posOut.x + lowWidth, posOut.y), readPixel(currentScratch));
 
 		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
+		posOut.x++;
 	}
 }
 
-// write row to destination
-void writeRowToMixedOutput(LOCAL short* restrict currentScratch, write_only image2d_t odata,  write_only image2d_t odataLL, unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth){
+// write row to destination: low pass goes to odataLL, high pass to odata
+void writeRowToMixedOutput(LOCAL short* restrict currentScratch, IMAGE_WO odata,  IMAGE_WO odataLL, unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int lowWidth){
 
 	int2 posOut = {firstX>>1, outputY};
 	for (int j = 0; j < WIN_SIZE_X; j+=2) {
@@ -140,19 +158,18 @@ void writeRowToMixedOutput(LOCAL short* restrict currentScratch, write_only imag
 	    // low pass
 		
 		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
+	    if (posOut.x >= lowWidth)
 			break;
 
-		write_imagei(odataLL, posOut,readPixel(currentScratch));
+		writeImageI(odataLL, posOut,readPixel(currentScratch));
 
 		// high pass
 		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagei(odata, posOut, readPixel(currentScratch));
+		if ((posOut.x << 1) + 1 < width)
+			writeImageI(odata, (int2)(posOut.x + lowWidth, posOut.y), readPixel(currentScratch));
 
 		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
+		posOut.x++;
 	}
 }
 
@@ -162,21 +179,27 @@ inline unsigned int getScratchOffset(){
    return (getLocalId(1)>> 1) + (getLocalId(1)&1) * BUFFER_SIZE;
 }
 
-// assumptions: width and height are both even
-// (we will probably have to relax these assumptions in the future)
-void KERNEL run(read_only image2d_t idata, write_only image2d_t odataLL, write_only image2d_t odata,
+void KERNEL run(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata),
                        const unsigned int  width, const unsigned int height, const unsigned int steps,
-					   const unsigned int  level, const unsigned int levels) {
+					   const unsigned int  level, const unsigned int levels BUFFER_IMAGE_ARGS) {
 
 	int inputY = getCorrectedGlobalIdY();
+	const unsigned int lowWidth = (width + 1) >> 1;
+	const unsigned int lowHeight = (height + 1) >> 1;
 	int outputY = -1;
 	if (inputY < height && inputY >= 0)
-	    outputY = (inputY >> 1) + (inputY & 1)*( height >> 1);
+	    outputY = (inputY >> 1) + (inputY & 1)*lowHeight;
 	bool pureOutput = (inputY & 1) || (level == levels-1);
 
-    const unsigned int halfWidth = width >> 1;
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odataLL, lowWidth, lowHeight, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+
+	// boundary rows outside of the image hold their mirror image
+	// (mirroring preserves parity, so the lifting steps below are unchanged)
+	const int rowY = mirror(inputY, height);
+
 	LOCAL short scratch[PIXEL_BUFFER_SIZE];
-	const float xDelta = 1.0/(width-1);
 	int firstX = getGlobalId(0) * (steps * WIN_SIZE_X);
 
 	bool doP = false;
@@ -186,108 +209,80 @@ void KERNEL run(read_only image2d_t idata, write_only image2d_t odataLL, write_o
 	 else
 	    doU = (getLocalId(1) != 0) && (getLocalId(1) != WIN_SIZE_Y-2);
 	bool writeRow = (getLocalId(1) >= BOUNDARY_Y) && ( getLocalId(1) < WIN_SIZE_Y - BOUNDARY_Y) && outputY != -1;
-	
-	//0. Initialize: fetch first pixel (and 2 top boundary pixels)
-
-	// read -1 point
-	float2 posIn = (float2)(firstX-1, inputY) /  (float2)(width-1, height-1);	
-	int4 previous = read_imagei(idata, sampler, posIn);
-
-	// read 0 point
-	posIn.x += xDelta;
-	int4 current = read_imagei(idata, sampler, posIn);
 
-	// predict previous (odd)
-	previous -= ( read_imagei(idata, sampler, (float2)((firstX - 2)*xDelta,posIn.y )) + current) >> 1;   
 	for (int i = 0; i < steps; ++i) {
+		// the whole work group shares firstX, so it leaves the loop together
+		if (firstX >= width)
+			break;
 
-		// 1. read from source image, transform columns, and store in local scratch
+		// 1. read the row of the window, and HALO_X columns on each side of it, into local scratch
 		LOCAL short* currentScratch = scratch + getScratchOffset();
-		for (int j = 0; j < WIN_SIZE_X; j+=2) {
-	   
-			///////////////////////////////////////////////////////////////////////////////////////////
-			// fetch next two pixels, then transform and write current (odd) and last (even)  
-			
-			// read next (odd) point
-			posIn.x += xDelta;
-			if (posIn.x > 1 + xDelta)
-				break;
-			int4 next = read_imagei(idata, sampler, posIn);
-	
-			// read next plus one (even) point
-			posIn.x += xDelta;
-			int4 nextPlusOne = read_imagei(idata, sampler, posIn);
-
-			// predict next (odd)
-			// F.4, page 118, ITU-T Rec. T.800 final draft
-			next -= (current + nextPlusOne) >> 1;  
-	
-			// update current (even)
-			// F.3, page 118, ITU-T Rec. T.800 final draft
-			// note 8 = 2 << 2, which we need to do because the data is left shifted by 2
-			current += (previous + next + 2) >> 2; 
-
-	
-
-			//write current (even)
-			writePixel(current, currentScratch);
-
-			//write odd
+		for (int j = 0; j < SCRATCH_X; j++) {
+			writePixel(readMirrored(idata, firstX - HALO_X + j, rowY, width), currentScratch);
 			currentScratch += HORIZONTAL_STRIDE;
-			writePixel(next, currentScratch);
-
-			//advance scratch pointer
-			currentScratch += HORIZONTAL_STRIDE;
-
-			//update registers
-			previous = next;
-			current = nextPlusOne;
 		}
 
-		
-		//4. transform horizontally
-		currentScratch = scratch + getScratchOffset();	
-
-		
+		// 2. transform vertically
+		currentScratch = scratch + getScratchOffset();
 		localMemoryFence();
-		//odd columns (skip right odd boundary column)
+		//odd rows (skip bottom odd boundary row)
 		if ( doP) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
+			for (int j = 0; j < SCRATCH_X; j++) {
 				int4 currentOdd = readPixel(currentScratch);
 				int4 prevEven = readPixel(currentScratch + VERTICAL_ODD_TO_PREVIOUS_EVEN);
-				int4 nextEven = readPixel(currentScratch + VERTICAL_ODD_TO_NEXT_EVEN); 
+				int4 nextEven = readPixel(currentScratch + VERTICAL_ODD_TO_NEXT_EVEN);
+				// F.4, page 118, ITU-T Rec. T.800 final draft
 				currentOdd -= ((prevEven + nextEven) >> 1);
 				writePixel( currentOdd, currentScratch);
 				currentScratch += HORIZONTAL_STRIDE;
 			}
 		}
-		
-		currentScratch = scratch + getScratchOffset();	
+
+		currentScratch = scratch + getScratchOffset();
 		localMemoryFence();
-		//even columns (skip left and right even boundary columns)
+		//even rows (skip top and bottom even boundary rows)
 		if ( doU  ) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
+			for (int j = 0; j < SCRATCH_X; j++) {
 				int4 currentEven = readPixel(currentScratch);
 				int4 prevOdd = readPixel(currentScratch + VERTICAL_EVEN_TO_PREVIOUS_ODD);
-				int4 nextOdd = readPixel(currentScratch + VERTICAL_EVEN_TO_NEXT_ODD); 
-				currentEven += (prevOdd + nextOdd + 2) >> 2; 
+				int4 nextOdd = readPixel(currentScratch + VERTICAL_EVEN_TO_NEXT_ODD);
+				// F.3, page 118, ITU-T Rec. T.800 final draft
+				currentEven += (prevOdd + nextOdd + 2) >> 2;
 				writePixel( currentEven, currentScratch);
 				currentScratch += HORIZONTAL_STRIDE;
 			}
 		}
 		localMemoryFence();
 
-		//5. write local buffer column to destination image
-		// (only write non-boundary columns that are within the image bounds)
+		// 3. transform own row horizontally: scratch column j holds image column firstX - HALO_X + j,
+		// and mirrored columns beyond the image hold the vertical transform of their mirror image
 		if (writeRow) {
-			 if (pureOutput)
-			   writeRowToOutput(scratch + getScratchOffset(), odata, firstX, outputY, width, halfWidth);
+			LOCAL short* row = scratch + getScratchOffset();
+			// predict odd columns, up to the last one of the window
+			for (int j = 1; j < SCRATCH_X - 1; j += 2) {
+				int4 odd = readPixel(row + j * HORIZONTAL_STRIDE);
+				odd -= (readPixel(row + (j - 1) * HORIZONTAL_STRIDE) + readPixel(row + (j + 1) * HORIZONTAL_STRIDE)) >> 1;
+				writePixel(odd, row + j * HORIZONTAL_STRIDE);
+			}
+			// update the even columns of the window
+			for (int j = HALO_X; j < HALO_X + WIN_SIZE_X; j += 2) {
+				int4 even = readPixel(row + j * HORIZONTAL_STRIDE);
+				even += (readPixel(row + (j - 1) * HORIZONTAL_STRIDE) + readPixel(row + (j + 1) * HORIZONTAL_STRIDE) + 2) >> 2;
+				writePixel(even, row + j * HORIZONTAL_STRIDE);
+			}
+		}
+
+		//4. write local buffer row to destination image
+		// (only write non-boundary rows that are within the image bounds)
+		if (writeRow) {
+			LOCAL short* window = scratch + getScratchOffset() + HALO_X * HORIZONTAL_STRIDE;
+			if (pureOutput)
+			   writeRowToOutput(window, odata, firstX, outputY, width, lowWidth);
 			else
-			   writeRowToMixedOutput(scratch + getScratchOffset(), odata, odataLL, firstX, outputY, width, halfWidth);
+			   writeRowToMixedOutput(window, odata, odataLL, firstX, outputY, width, lowWidth);
 
 		}
 		// move to next step 
 		firstX += WIN_SIZE_X;
 	}
 }
-
@@ -13,21 +13,32 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
-
 #include "ocl_platform.cl"
 
 /*
-Lossless forward 5/3 discrete wavelet transform
+Lossless inverse 5/3 discrete wavelet transform (one level)
+
+Input is one level of the forward transform in Mallat layout: low pass band of width (width+1)/2
+on the left, and of height (height+1)/2 on the top. Output is the reconstructed image, in natural order.
+The LL band is read from idataLL, and all other bands from idata: for the coarsest level, idataLL
+and idata are the same image; otherwise idataLL holds the output of the previous (coarser) level.
+The work groups cover the region of the output that starts at (originX, originY), both even, so that
+a window is reconstructed from the coefficients within the filter support of it alone.
 
 Assumptions:
 
 1) assume WIN_SIZE_X equals the number of work items in the work group
-2) width and height are both even (will need to relax this assumption in the future)
-3) data precision is 14 bits or less
+2) data precision is 14 bits or less
 
-*/
+Width and height are arbitrary: boundaries use whole sample symmetric extension
+of the interleaved coefficients, as in the forward transform.
 
-#include "ocl_platform.cl"
+Rows are lifted before columns, as in 2D_SR of ITU-T Rec. T.800 (F.3.2), which undoes
+the columns first order of the forward transform exactly. Each step therefore loads its window
+with HALO_Y rows above and below it, which the vertical lifting of the window reads once they have
+been lifted horizontally.
+
+*/
 
 //////////////////////////
 // dimensions of window
@@ -44,7 +55,8 @@ Assumptions:
 Layout for scratch buffer
 
 Odd and even columns are separated. (Generates less bank conflicts when using lifting scheme.)
-All even columns are stored first, then all odd columns.
+All even columns are stored first, then all odd columns. Each column holds SCRATCH_Y rows:
+the window, and HALO_Y rows above and below it.
 
 Left (even) boundary column
 Even Columns
@@ -57,35 +69,41 @@ Right (odd) boundary column
 
 #define BOUNDARY_X 2
 
-#define VERTICAL_STRIDE 64  // WIN_SIZE_X/2 
+// rows above and below the window that its vertical lifting reads
+#define HALO_Y 2
+#define SCRATCH_Y (WIN_SIZE_Y + 2 * HALO_Y)
+
+#define VERTICAL_STRIDE (WIN_SIZE_X >> 1)
 
 
-// two vertical neighbours: pointer diff:
-#define BUFFER_SIZE            512	// VERTICAL_STRIDE * WIN_SIZE_Y
+// two horizontal neighbours: pointer diff:
+#define BUFFER_SIZE            (VERTICAL_STRIDE * SCRATCH_Y)
 
 
-#define CHANNEL_BUFFER_SIZE     1024            // BUFFER_SIZE + BUFFER_SIZE
+#define CHANNEL_BUFFER_SIZE     (BUFFER_SIZE << 1)
 
-#define CHANNEL_BUFFER_SIZE_X2  2048   
-#define CHANNEL_BUFFER_SIZE_X3  3072   
+#define CHANNEL_BUFFER_SIZE_X2  (CHANNEL_BUFFER_SIZE * 2)
+#define CHANNEL_BUFFER_SIZE_X3  (CHANNEL_BUFFER_SIZE * 3)
 
-#define PIXEL_BUFFER_SIZE   4096
+#define PIXEL_BUFFER_SIZE   (CHANNEL_BUFFER_SIZE * 4)
 
-#define HORIZONTAL_ODD_TO_PREVIOUS_EVEN -512
-#define HORIZONTAL_ODD_TO_NEXT_EVEN     -511
+#define HORIZONTAL_ODD_TO_PREVIOUS_EVEN (-BUFFER_SIZE)
+#define HORIZONTAL_ODD_TO_NEXT_EVEN     (1 - BUFFER_SIZE)
 
 
-#define HORIZONTAL_EVEN_TO_PREVIOUS_ODD  511
-#define HORIZONTAL_EVEN_TO_NEXT_ODD      512
+#define HORIZONTAL_EVEN_TO_PREVIOUS_ODD  (BUFFER_SIZE - 1)
+#define HORIZONTAL_EVEN_TO_NEXT_ODD      BUFFER_SIZE
 
 
 
 ///////////////////////////////////////////////////////////////////////
 
-CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_MIRRORED_REPEAT  | CLK_FILTER_NEAREST;
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE  | CLK_FILTER_NEAREST;
 
+// image column of this work item: work groups overlap by 2 * BOUNDARY_X columns, and the first group
+// starts BOUNDARY_X columns left of the image
 inline int getCorrectedGlobalIdX() {
-      return getGlobalId(0) - 2 * BOUNDARY_X * getGroupId(0);
+      return (int)getGlobalId(0) - BOUNDARY_X - 2 * BOUNDARY_X * (int)getGroupId(0);
 }
 
 
@@ -105,149 +123,135 @@ inline void writePixel(int4 pix, LOCAL short*  restrict  dest) {
 	*dest = pix.w;
 }
 
-// write column to destination
-void writeColumnToOutput(LOCAL short* restrict currentScratch, write_only image2d_t odata, int firstY, int inputX, int height, int halfHeight){
-
-	int2 posOut = {inputX, firstY>>1};
-	for (int j = 0; j < WIN_SIZE_Y; j+=2) {
-	
-	    // even row
-		
-		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.y >= halfHeight)
-			break;
-
-		write_imagei(odata, posOut,readPixel(currentScratch));
-
-		// odd row
-		currentScratch += VERTICAL_STRIDE ;
-		posOut.y+= halfHeight;
+// read coefficient at (Mallat) column bandX and interleaved row y, mirroring y at the image boundaries.
+// A single row has no high pass coefficients: the extension is zero
+inline int4 readCoefficient(IMAGE_RO idata, IMAGE_RO idataLL, int bandX, bool lowX, int y, int height, int lowHeight) {
+	if (height == 1 && (y & 1))
+		return (int4)(0);
+	y = mirror(y, height);
+	int2 pos = (int2)(bandX, (y >> 1) + (y & 1) * lowHeight);
+	if (lowX && !(y & 1))
+		return readImageI(idataLL, pos);
+	return readImageI(idata, pos);
+}
 
-		write_imagei(odata, posOut,readPixel(currentScratch));
+// write column to destination
+void writeColumnToOutput(LOCAL short* restrict currentScratch, IMAGE_WO odata, int firstY, int outputX, int height){
 
+	int2 posOut = {outputX, firstY};
+	for (int j = 0; j < WIN_SIZE_Y; j++) {
+	    if (posOut.y >= height)
+			break;
+		writeImageI(odata, posOut,readPixel(currentScratch));
 		currentScratch += VERTICAL_STRIDE;
-		posOut.y -= (halfHeight - 1);
+		posOut.y++;
 	}
 }
 
-// initial scratch offset when transforming vertically
+// initial scratch offset when transforming horizontally
 inline int getScratchOffset(){
    return (getLocalId(0)>> 1) + (getLocalId(0)&1) * BUFFER_SIZE;
 }
 
-// assumptions: width and height are both even
-// (we will probably have to relax these assumptions in the future)
-void KERNEL run(read_only image2d_t idata, write_only image2d_t odata,   
-                       const unsigned int  width, const unsigned int  height, const unsigned int steps) {
+void KERNEL run(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_RO(idataLL), KERNEL_IMAGE_WO(odata),   
+                       const unsigned int  width, const unsigned int  height, const unsigned int steps,
+					   const unsigned int  level, const unsigned int levels,
+					   const unsigned int originX, const unsigned int originY BUFFER_IMAGE_ARGS) {
 
-	int inputX = getCorrectedGlobalIdX();
+	const int inputX = getCorrectedGlobalIdX() + originX;
+	const int lowWidth = (width + 1) >> 1;
+	const int lowHeight = (height + 1) >> 1;
 
-	int outputX = inputX;
-	outputX = (outputX >> 1) + (outputX & 1)*( width >> 1);
+	BIND_IMAGE(idata, imageWidth, imageHeight, imageChannels);
+	// at the coarsest level, idataLL is idata
+	BIND_IMAGE(idataLL, (level == levels-1) ? imageWidth : ((width + 1) >> 1),
+			   (level == levels-1) ? imageHeight : ((height + 1) >> 1), imageChannels);
+	BIND_IMAGE(odata, width, height, imageChannels);
 
-    const unsigned int halfHeight = height >> 1;
-	LOCAL short scratch[PIXEL_BUFFER_SIZE];
-	const float yDelta = 1.0/(height-1);
-	int firstY = getGlobalId(1) * (steps * WIN_SIZE_Y);
-	
-	//0. Initialize: fetch first pixel (and 2 top boundary pixels)
+	// boundary columns outside of the image hold their mirror image
+	const int columnX = mirror(inputX, width);
+	const bool lowX = !(columnX & 1);
+	const int bandX = (columnX >> 1) + (columnX & 1) * lowWidth;
+	// a single column has no high pass coefficients: the extension is zero
+	const bool zeroColumn = (width == 1) && (inputX & 1);
 
-	// read -1 point
-	float2 posIn = (float2)(inputX, firstY - 1) /  (float2)(width-1, height-1);	
-	int4 previous = read_imagei(idata, sampler, posIn);
+	LOCAL short scratch[PIXEL_BUFFER_SIZE];
+	int firstY = originY + getGlobalId(1) * (steps * WIN_SIZE_Y);
 
-	// read 0 point
-	posIn.y += yDelta;
-	int4 current = read_imagei(idata, sampler, posIn);
+	const int lid = getLocalId(0);
+	bool doU = !(lid&1) && (lid != 0);
+	bool doP = (lid&1) && (lid != 1) && (lid != WIN_SIZE_X-1);
+	bool writeColumn = (lid >= BOUNDARY_X) && (lid < WIN_SIZE_X - BOUNDARY_X) && (inputX < width) && (inputX >= 0);
 
-	// predict previous (odd)
-	previous -= ( read_imagei(idata, sampler, (float2)(posIn.x, (firstY - 2)*yDelta)) + current) >> 1;   
 	for (int i = 0; i < steps; ++i) {
+		// the whole work group shares firstY, so it leaves the loop together
+		if (firstY >= height)
+			break;
 
-		// 1. read from source image, transform columns, and store in local scratch
+		// 1. read the column of the window, and HALO_Y rows above and below it, into local scratch
 		LOCAL short* currentScratch = scratch + getScratchOffset();
-		for (int j = 0; j < WIN_SIZE_Y; j+=2) {
-	   
-			///////////////////////////////////////////////////////////////////////////////////////////
-			// fetch next two pixels, then transform and write current (odd) and last (even)  
-			
-			// read next (odd) point
-			posIn.y += yDelta;
-			if (posIn.y > 1 + yDelta)
-				break;
-			int4 next = read_imagei(idata, sampler, posIn);
-	
-			// read next plus one (even) point
-			posIn.y += yDelta;
-			int4 nextPlusOne = read_imagei(idata, sampler, posIn);
-
-			// predict next (odd)
-			// F.4, page 118, ITU-T Rec. T.800 final draft
-			next -= (current + nextPlusOne) >> 1;  
-	
-			// update current (even)
-			// F.3, page 118, ITU-T Rec. T.800 final draft
-			// note 8 = 2 << 2, which we need to do because the data is left shifted by 2
-			current += (previous + next + 8) >> 2; 
-
-	
-
-			//write current (even)
-			writePixel(current, currentScratch);
-
-			//write odd
-			currentScratch += VERTICAL_STRIDE;
-			writePixel(next, currentScratch);
-
-			//advance scratch pointer
+		for (int j = 0; j < SCRATCH_Y; j++) {
+			int4 coefficient = readCoefficient(idata, idataLL, bandX, lowX, firstY - HALO_Y + j, height, lowHeight);
+			writePixel(zeroColumn ? (int4)(0) : coefficient, currentScratch);
 			currentScratch += VERTICAL_STRIDE;
-
-			//update registers
-			previous = next;
-			current = nextPlusOne;
 		}
 
-		
-		//4. transform horizontally
-		currentScratch = scratch + getScratchOffset();	
+		// 2. transform horizontally
+		currentScratch = scratch + getScratchOffset();
+		localMemoryFence();
+		//even columns (skip left and right even boundary columns)
+		if ( doU  ) {
+			for (int j = 0; j < SCRATCH_Y; j++) {
+				int4 currentEven = readPixel(currentScratch);
+				int4 prevOdd = readPixel(currentScratch + HORIZONTAL_EVEN_TO_PREVIOUS_ODD);
+				int4 nextOdd = readPixel(currentScratch + HORIZONTAL_EVEN_TO_NEXT_ODD);
+				// F.7, ITU-T Rec. T.800
+				currentEven -= (prevOdd + nextOdd + 2) >> 2;
+				writePixel( currentEven, currentScratch);
+				currentScratch += VERTICAL_STRIDE;
+			}
+		}
 
-		
+		currentScratch = scratch + getScratchOffset();
 		localMemoryFence();
-		//odd columns (skip right odd boundary column)
-		if ( (getLocalId(0)&1) && (getLocalId(0) != WIN_SIZE_X-1) ) {
-			for (int j = 0; j < WIN_SIZE_Y; j++) {
+		//odd columns (skip left and right odd boundary columns)
+		if ( doP) {
+			for (int j = 0; j < SCRATCH_Y; j++) {
 				int4 currentOdd = readPixel(currentScratch);
 				int4 prevEven = readPixel(currentScratch + HORIZONTAL_ODD_TO_PREVIOUS_EVEN);
-				int4 nextEven = readPixel(currentScratch + HORIZONTAL_ODD_TO_NEXT_EVEN); 
-				currentOdd -= ((prevEven + nextEven) >> 1);
+				int4 nextEven = readPixel(currentScratch + HORIZONTAL_ODD_TO_NEXT_EVEN);
+				// F.8, ITU-T Rec. T.800
+				currentOdd += (prevEven + nextEven) >> 1;
 				writePixel( currentOdd, currentScratch);
 				currentScratch += VERTICAL_STRIDE;
 			}
 		}
-		
-		currentScratch = scratch + getScratchOffset();	
 		localMemoryFence();
-		//even columns (skip left and right even boundary columns)
-		if ( !(getLocalId(0)&1) && (getLocalId(0) != 0) && (getLocalId(0) != WIN_SIZE_X-2)  ) {
-			for (int j = 0; j < WIN_SIZE_Y; j++) {
-				int4 currentEven = readPixel(currentScratch);
-				int4 prevOdd = readPixel(currentScratch + HORIZONTAL_EVEN_TO_PREVIOUS_ODD);
-				int4 nextOdd = readPixel(currentScratch + HORIZONTAL_EVEN_TO_NEXT_ODD); 
-				currentEven += (prevOdd + nextOdd + 8) >> 2; // note 8 = 2 << 2, which we need to do because the data is left shifted by 2
-				writePixel( currentEven, currentScratch);
-				currentScratch += VERTICAL_STRIDE;
+
+		// 3. transform own column vertically: scratch row j holds interleaved row firstY - HALO_Y + j,
+		// and mirrored rows beyond the image hold the horizontal transform of their mirror image
+		if (writeColumn) {
+			LOCAL short* column = scratch + getScratchOffset();
+			// undo update of even rows, down to the one below the window
+			for (int j = HALO_Y; j < SCRATCH_Y - 1; j += 2) {
+				int4 even = readPixel(column + j * VERTICAL_STRIDE);
+				even -= (readPixel(column + (j - 1) * VERTICAL_STRIDE) + readPixel(column + (j + 1) * VERTICAL_STRIDE) + 2) >> 2;
+				writePixel(even, column + j * VERTICAL_STRIDE);
+			}
+			// undo predict of the odd rows of the window
+			for (int j = HALO_Y + 1; j < HALO_Y + WIN_SIZE_Y; j += 2) {
+				int4 odd = readPixel(column + j * VERTICAL_STRIDE);
+				odd += (readPixel(column + (j - 1) * VERTICAL_STRIDE) + readPixel(column + (j + 1) * VERTICAL_STRIDE)) >> 1;
+				writePixel(odd, column + j * VERTICAL_STRIDE);
 			}
 		}
-		localMemoryFence();
 
-		//5. write local buffer column to destination image
+		//4. write local buffer column to destination image
 		// (only write non-boundary columns that are within the image bounds)
-		if ((getLocalId(0) >= BOUNDARY_X) && ( getLocalId(0) < WIN_SIZE_X - BOUNDARY_X) && (inputX < width) && inputX >= 0) {
-			writeColumnToOutput(scratch + getScratchOffset(), odata, firstY, outputX, height, halfHeight);
+		if (writeColumn)
+			writeColumnToOutput(scratch + getScratchOffset() + HALO_Y * VERTICAL_STRIDE, odata, firstY, inputX, height);
 
-		}
 		// move to next step 
 		firstY += WIN_SIZE_Y;
 	}
 }
-
@@ -14,6 +14,19 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 
+/*
+
+Irreversible forward 9/7 discrete wavelet transform, with optional dead zone quantization
+
+Assumptions:
+
+1) assume WIN_SIZE_Y equals the number of work items in the work group
+
+Width and height are arbitrary: image boundaries use whole sample symmetric extension,
+and for odd sizes the low pass band gets the extra sample.
+
+*/
+
 #include "ocl_platform.cl"
 
 //////////////////////////
@@ -44,36 +57,31 @@ Right (odd) boundary row
 
 #define BOUNDARY_Y 4
 
-#define HORIZONTAL_STRIDE 64  // WIN_SIZE_X/2 
+#define HORIZONTAL_STRIDE (WIN_SIZE_Y >> 1)
 
 
 // two vertical neighbours: pointer diff:
-#define BUFFER_SIZE            512	// HORIZONTAL_STRIDE * WIN_SIZE_X
+#define BUFFER_SIZE            (HORIZONTAL_STRIDE * WIN_SIZE_X)
 
 
-#define CHANNEL_BUFFER_SIZE     1024            // BUFFER_SIZE + BUFFER_SIZE
+#define CHANNEL_BUFFER_SIZE     (BUFFER_SIZE << 1)
 
-#define CHANNEL_BUFFER_SIZE_X2  2048   
-#define CHANNEL_BUFFER_SIZE_X3  3072   
+#define CHANNEL_BUFFER_SIZE_X2  (CHANNEL_BUFFER_SIZE * 2)
+#define CHANNEL_BUFFER_SIZE_X3  (CHANNEL_BUFFER_SIZE * 3)
 
-#define PIXEL_BUFFER_SIZE   4096
+#define PIXEL_BUFFER_SIZE   (CHANNEL_BUFFER_SIZE * 4)
 
-#define VERTICAL_EVEN_TO_PREVIOUS_ODD  511
-#define VERTICAL_EVEN_TO_NEXT_ODD      512
+#define VERTICAL_EVEN_TO_PREVIOUS_ODD  (BUFFER_SIZE - 1)
+#define VERTICAL_EVEN_TO_NEXT_ODD      BUFFER_SIZE
 
-#define VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE -513
-#define VERTICAL_ODD_TO_PREVIOUS_EVEN -512
-#define VERTICAL_ODD_TO_NEXT_EVEN     -511
-#define VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE     -510
+#define VERTICAL_ODD_TO_PREVIOUS_EVEN (-BUFFER_SIZE)
+#define VERTICAL_ODD_TO_NEXT_EVEN     (1 - BUFFER_SIZE)
 
 #define P1  -1.586134342f 
 #define U1  -0.05298011854f  
 #define P2  0.8829110762f 
 #define U2  0.4435068522f   
 
-// U1 * P1
-#define U1P1  0.08403358545952490068f
-
 #define scale97Mul  1.23017410491400f
 #define scale97Div   0.81289306611596153187273657637352f
 
@@ -82,41 +90,24 @@ Right (odd) boundary row
 Lifting scheme consists of four steps: Predict1 Update1 Predict2 Update2
 followed by scaling (even points are scaled by scale97Div, odd points are scaled by scale97Mul)
 
-
-Predict Calculation:
-
-For S odd, we have:
-
-
-plusOne_P1 = plusOne + P1*(current + plusTwo)
-
-plusOne_P2 = plusOne_P1 + 
-             P2*(current_U1 + plusTwo_U1)
-           =   plusOne + P1*(current + plusTwo) +
-		         P2*(current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo) + 
-				     plusTwo + U1*(plusOne + plusThree) + U1P1*(current + 2*plusTwo + plusFour)  )
-
-
-
-Update Calculation
-
-For S even, we have
-
-current_U1 = current + U1*(minusOne_P1 + plusOne_P1)
-           = current + U1*(minusOne + P1*(minusTwo + current) + plusOne + P1*(current + plusTwo))
-		   = current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo)
-
-current_U2 = current_U1 + U2*(minusOne_P2 + plusOne_P2)
+Rows are transformed in registers, as they are read from the source image.
+Columns are transformed in local scratch, one lifting step at a time: each step
+only updates rows of one parity, from rows of the other parity, so a barrier between
+steps is all the synchronization needed. Each step invalidates one more boundary row
+at the top and bottom of the window, hence BOUNDARY_Y == 4.
+Vertical scaling is applied when the row is written to the destination image.
 
 */
   
 
 ///////////////////////////////////////////////////////////////////////
 
-CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_MIRRORED_REPEAT  | CLK_FILTER_NEAREST;
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE  | CLK_FILTER_NEAREST;
 
+// image row of this work item: work groups overlap by 2 * BOUNDARY_Y rows, and the first group
+// starts BOUNDARY_Y rows above the image
 inline int getCorrectedGlobalIdY() {
-      return getGlobalId(1) - 2 * BOUNDARY_Y * getGroupId(1);
+      return (int)getGlobalId(1) - BOUNDARY_Y - 2 * BOUNDARY_Y * (int)getGroupId(1);
 }
 
 
@@ -136,53 +127,62 @@ inline void writePixel(float4 pix, LOCAL float*  restrict  dest) {
 	*dest = pix.w;
 }
 
-// write row to destination
-void writeRowToOutput(LOCAL float* restrict currentScratch, write_only image2d_t odata, 
-																		unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth){
-
-	int2 posOut = {firstX>>1, outputY};
-	for (int j = 0; j < WIN_SIZE_X; j+=2) {
-	
-	    // low pass
-		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
-			break;
-
-		write_imagef(odata, posOut,scale97Div * readPixel(currentScratch));
-
-		// high pass
-		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagef(odata, posOut,scale97Mul * readPixel(currentScratch));
+// read pixel at column x of image row y, mirroring x at the image boundaries
+inline float4 readMirrored(IMAGE_RO idata, int x, int y, int width) {
+	return readImageF(idata, (int2)(mirror(x, width), y));
+}
 
+// one vertical lifting step: update this work item's row from its two neighbouring rows
+inline void liftRow(LOCAL float* restrict currentScratch, const int toPrevious, const int toNext, const float coefficient) {
+	for (int j = 0; j < WIN_SIZE_X; j++) {
+		writePixel(readPixel(currentScratch) +
+		           coefficient * (readPixel(currentScratch + toPrevious) + readPixel(currentScratch + toNext)),
+				   currentScratch);
 		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
 	}
 }
 
-// write row to destination
-void writeRowToMixedOutput(LOCAL float* restrict currentScratch, write_only image2d_t odataLL, write_only image2d_t odata, 
-																		unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth){
+// dead zone quantization: sign(x) * floor(|x| * quant)
+inline int4 quantize(float4 pix, float quant) {
+	return convert_int4_rtz(quant * pix);
+}
+
+// write row to destination.
+// If writeLL is true, low pass goes to odataLL unquantized (it is the input of the next level),
+// otherwise both bands go to odata (quantized if quant is true)
+void writeRowToOutput(LOCAL float* restrict currentScratch, IMAGE_WO odataLL, IMAGE_WO odata,
+					  unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int lowWidth,
+					  const float rowScale, const bool writeLL, const bool quant, const float quantLow, const float quantHigh){
 
 	int2 posOut = {firstX>>1, outputY};
 	for (int j = 0; j < WIN_SIZE_X; j+=2) {
 	
 	    // low pass
 		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
+	    if (posOut.x >= lowWidth)
 			break;
 
-		write_imagef(odataLL, posOut,scale97Div * readPixel(currentScratch));
+		float4 pix = rowScale * readPixel(currentScratch);
+		if (writeLL)
+			writeImageF(odataLL, posOut, pix);
+		else if (quant)
+			writeImageI(odata, posOut, quantize(pix, quantLow));
+		else
+			writeImageF(odata, posOut, pix);
 
-		// high pass
+		// high pass (for odd widths, the last even point has no odd neighbour)
 		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagef(odata, posOut,scale97Mul * readPixel(currentScratch));
+		if ((posOut.x << 1) + 1 < width) {
+			int2 posHigh = (int2)(posOut.x + lowWidth, posOut.y);
+			pix = rowScale * readPixel(currentScratch);
+			if (quant)
+				writeImageI(odata, posHigh, quantize(pix, quantHigh));
+			else
+				writeImageF(odata, posHigh, pix);
+		}
 
 		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
+		posOut.x++;
 	}
 }
 
@@ -191,59 +191,51 @@ inline unsigned int getScratchOffset(){
    return (getLocalId(1)>> 1) + (getLocalId(1)&1) * BUFFER_SIZE;
 }
 
-// assumptions: width and height are both even
-// (we will probably have to relax these assumptions in the future)
-void KERNEL run(read_only image2d_t idata, write_only image2d_t odataLL, write_only image2d_t odata, 
-                       const unsigned int  width, const unsigned int  height, const unsigned int steps,
-					   const unsigned int  level, const unsigned int levels) {
+// shared by run and runWithQuantization
+void transform(IMAGE_RO idata, IMAGE_WO odataLL, IMAGE_WO odata, LOCAL float* scratch,
+			   const unsigned int  width, const unsigned int height, const unsigned int steps,
+			   const unsigned int  level, const unsigned int levels,
+			   const bool quant, const float quantLL, const float quantLH, const float quantHH) {
 
 	int inputY = getCorrectedGlobalIdY();
+	const unsigned int lowWidth = (width + 1) >> 1;
+	const unsigned int lowHeight = (height + 1) >> 1;
 	int outputY = -1;
 	if (inputY < height && inputY >= 0)
-	    outputY = (inputY >> 1) + (inputY & 1)*( height >> 1);
-	bool pureOutput = (inputY&1) || (level == levels-1);
-
-	bool writeRow = ((getLocalId(1) >= BOUNDARY_Y) && ( getLocalId(1) < WIN_SIZE_Y - BOUNDARY_Y) && outputY != -1);
-	bool doP2 = false;
-	bool doU2 = false;
-	if (getLocalId(1)&1)
-		doP2 = (getLocalId(1) >= BOUNDARY_Y-1) && (getLocalId(1) < WIN_SIZE_Y-BOUNDARY_Y);
-	else
-		doU2 = (getLocalId(1) >= BOUNDARY_Y) && (getLocalId(1) < WIN_SIZE_Y-BOUNDARY_Y) ;
-
-    const unsigned int halfWidth = width >> 1;
-	LOCAL float scratch[PIXEL_BUFFER_SIZE];
-	const float xDelta = 1.0/(width-1);
+	    outputY = (inputY >> 1) + (inputY & 1)*lowHeight;
+	bool oddInputY = inputY & 1;
+	bool writeLL = !oddInputY && (level < levels-1);
+
+	// boundary rows outside of the image hold their mirror image
+	// (mirroring preserves parity, so the lifting steps below are unchanged)
+	const int rowY = mirror(inputY, height);
+
+	const float rowScale = oddInputY ? scale97Mul : scale97Div;
+	const float quantLow = oddInputY ? quantLH : quantLL;
+	const float quantHigh = oddInputY ? quantHH : quantLH;
+
+	const int lid = getLocalId(1);
+	bool writeRow = ((lid >= BOUNDARY_Y) && ( lid < WIN_SIZE_Y - BOUNDARY_Y) && outputY != -1);
+	bool doP1 = false, doU1 = false, doP2 = false, doU2 = false;
+	if (lid&1) {
+		doP1 = lid < WIN_SIZE_Y-1;
+		doP2 = (lid >= 3) && (lid < WIN_SIZE_Y-4);
+	} else {
+		doU1 = (lid >= 2) && (lid < WIN_SIZE_Y-3);
+		doU2 = (lid >= 4) && (lid < WIN_SIZE_Y-5);
+	}
+
 	int firstX = getGlobalId(0) * (steps * WIN_SIZE_X);
 	
-	//0. Initialize: fetch first pixel (and 2 top boundary pixels)
-
-	// read -4 point
-	float2 posIn = (float2)(firstX-4, inputY) /  (float2)(width-1, height-1);	
-	float4 minusFour = read_imagef(idata, sampler, posIn);
-
-	posIn.x += xDelta;
-	float4 minusThree = read_imagef(idata, sampler, posIn);
-
-	// read -2 point
-	posIn.x += xDelta;
-	float4 minusTwo = read_imagef(idata, sampler, posIn);
-
-	// read -1 point
-	posIn.x += xDelta;
-	float4 minusOne = read_imagef(idata, sampler, posIn);
+	//0. Initialize: fetch first pixel (and 4 left boundary pixels)
 
-	// read 0 point
-	posIn.x += xDelta;
-	float4 current = read_imagef(idata, sampler, posIn);
-
-	// +1 point
-	posIn.x += xDelta;
-	float4 plusOne = read_imagef(idata, sampler, posIn);
-
-	// +2 point
-	posIn.x += xDelta;
-	float4 plusTwo = read_imagef(idata, sampler, posIn);
+	float4 minusFour = readMirrored(idata, firstX - 4, rowY, width);
+	float4 minusThree = readMirrored(idata, firstX - 3, rowY, width);
+	float4 minusTwo = readMirrored(idata, firstX - 2, rowY, width);
+	float4 minusOne = readMirrored(idata, firstX - 1, rowY, width);
+	float4 current = readMirrored(idata, firstX, rowY, width);
+	float4 plusOne = readMirrored(idata, firstX + 1, rowY, width);
+	float4 plusTwo = readMirrored(idata, firstX + 2, rowY, width);
 
 	float4 minusThree_P1 = minusThree + P1*(minusFour + minusTwo);
 	float4 minusOne_P1   = minusOne   + P1*(minusTwo + current);
@@ -252,30 +244,26 @@ void KERNEL run(read_only image2d_t idata, write_only image2d_t odataLL, write_o
 	float4 minusTwo_U1 = minusTwo + U1*(minusThree_P1 + minusOne_P1);
 	float4 current_U1  = current + U1*(minusOne_P1 + plusOne_P1);
 	float4 minusOne_P2 = minusOne_P1 + P2*(minusTwo_U1 + current_U1);
-		
+
+	// x coordinate of current (even) point
+	int x = firstX;
 	for (int i = 0; i < steps; ++i) {
 
 		// 1. read from source image, transform rows, and store in local scratch
 		LOCAL float* currentScratch = scratch + getScratchOffset();
 		for (int j = 0; j < WIN_SIZE_X; j+=2) {
 
-	        //read next two points
-
-			// +3 point
-			posIn.x += xDelta;
-			float4 plusThree = read_imagef(idata, sampler, posIn);
-	   
-	   		// +4 point
-			posIn.x += xDelta;
-	   		if (posIn.x > 1 + 3*xDelta)
+			if (x >= width)
 				break;
-			float4 plusFour = read_imagef(idata, sampler, posIn);
+
+	        //read next two points
+			float4 plusThree = readMirrored(idata, x + 3, rowY, width);
+			float4 plusFour = readMirrored(idata, x + 4, rowY, width);
 
 			float4 plusThree_P1    = plusThree  + P1*(plusTwo + plusFour);
 			float4 plusTwo_U1      = plusTwo + U1*(plusOne_P1 + plusThree_P1);
 			float4 plusOne_P2      = plusOne_P1 + P2*(current_U1 + plusTwo_U1);
 								 
-					  
 			//write current U2 (even)
 			writePixel(scale97Div * (current_U1 +  U2 * (minusOne_P2 + plusOne_P2)), currentScratch);
 
@@ -307,411 +295,55 @@ void KERNEL run(read_only image2d_t idata, write_only image2d_t odataLL, write_o
 
 			//update P2s
 			minusOne_P2 = plusOne_P2;
+			x += 2;
 		}
 
-		
 		//4. transform vertically
 		currentScratch = scratch + getScratchOffset();	
 
-		
 		localMemoryFence();
-		// P2 - predict odd columns (skip left three boundary columns and all right boundary columns)
-		if ( doP2 ) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
-				float4 minusOne = readPixel(currentScratch -1);
-				float4 plusOne = readPixel(currentScratch);
-				float4 plusThree = readPixel(currentScratch + 1); 
-
-				float4 minusTwo, current,plusTwo, plusFour;
-
-				minusTwo.x = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.x  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.x  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.x = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.y = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.y  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.y  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.y = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.z = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.z  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.z  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.z = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.w = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.w  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.w  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.w = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-
-				float4 current_U1 = current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo);
-
-				// write P2
-				writePixel( scale97Mul*(plusOne + P1*(current + plusTwo) +
-		         				      P2*(current_U1 + plusTwo + U1*(plusOne + plusThree) +
-									  U1P1*(current + 2*plusTwo + plusFour)  )),
-									  currentScratch);
-				// write U1, for use by even loop
-				writePixel(current_U1, currentScratch + VERTICAL_ODD_TO_PREVIOUS_EVEN);
-
-				currentScratch += HORIZONTAL_STRIDE;
-			}
-		}
-		
-
-		currentScratch = scratch + getScratchOffset();	
+		if (doP1)
+			liftRow(currentScratch, VERTICAL_ODD_TO_PREVIOUS_EVEN, VERTICAL_ODD_TO_NEXT_EVEN, P1);
 		localMemoryFence();
-		//U2 - update even columns (skip left and right boundary columns)
-		if ( doU2 ) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
-
-				float4 current = readPixel(currentScratch);
-
-				// read previous and next odd
-				float4 prevOdd, nextOdd;
-
-				prevOdd.x = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.x  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.y = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.y  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.z = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.z  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.w = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.w  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-				//////////////////////////////////////////////////////////////////
-
-				// write U2
-				writePixel( scale97Div*(current + U2*(prevOdd + nextOdd)), currentScratch);
-				currentScratch += HORIZONTAL_STRIDE;
-			}
-		}
+		if (doU1)
+			liftRow(currentScratch, VERTICAL_EVEN_TO_PREVIOUS_ODD, VERTICAL_EVEN_TO_NEXT_ODD, U1);
+		localMemoryFence();
+		if (doP2)
+			liftRow(currentScratch, VERTICAL_ODD_TO_PREVIOUS_EVEN, VERTICAL_ODD_TO_NEXT_EVEN, P2);
+		localMemoryFence();
+		if (doU2)
+			liftRow(currentScratch, VERTICAL_EVEN_TO_PREVIOUS_ODD, VERTICAL_EVEN_TO_NEXT_ODD, U2);
 		localMemoryFence();
-		
-
 
-		//5. write local buffer column to destination image
-		// (only write non-boundary columns that are within the image bounds)
-		if (writeRow) {
-		   if (pureOutput)
-			   writeRowToOutput(scratch + getScratchOffset(), odata, firstX, outputY, width, halfWidth);
-			else
-			   writeRowToMixedOutput(scratch + getScratchOffset(), odataLL, odata, firstX, outputY, width, halfWidth);
+		//5. write local buffer row to destination image
+		// (only write non-boundary rows that are within the image bounds)
+		if (writeRow)
+			writeRowToOutput(currentScratch, odataLL, odata, firstX, outputY, width, lowWidth,
+							 rowScale, writeLL, quant, quantLow, quantHigh);
 
-		}
 		// move to next step 
 		firstX += WIN_SIZE_X;
 	}
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-// DWT with Quantization
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-// write quantized low and high bands (relative to horizontal axis)
-void writeQuantizedRowToOutput(LOCAL float* restrict currentScratch, write_only image2d_t odata, 
-													unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth,
-													 const float quantLow, const float quantHigh){
-
-	int2 posOut = {firstX>>1, outputY};
-	for (int j = 0; j < WIN_SIZE_X; j+=2) {
-	
-	    // low pass
-		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
-			break;
-
-		write_imagei(odata, posOut, convert_int4_rte(ceil(quantLow * readPixel(currentScratch))) );
-
-		// high pass
-		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagei(odata, posOut, convert_int4_rte(ceil(quantHigh * readPixel(currentScratch))) );
-
-		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
-	}
-}
-
-
-// write low and high bands (relative to horizontal axis)
-// low band is not quantized, but high band is
-// odata is integer buffer (use quantization), while odataLL is float buffer (no quantization) 
-void writeMixedQuantizedRowToOutput(LOCAL float* restrict currentScratch, write_only image2d_t odataLL,
-										 write_only image2d_t odata, unsigned int firstX, unsigned int outputY, unsigned int width, unsigned int halfWidth,
-										  const float quantLow, const float quantHigh){
-
-	int2 posOut = {firstX>>1, outputY};
-	for (int j = 0; j < WIN_SIZE_X; j+=2) {
-	
-	    // low pass
-		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.x >= halfWidth)
-			break;
-
-		write_imagef(odataLL, posOut,quantLow * readPixel(currentScratch));
-
-		// high pass
-		currentScratch += HORIZONTAL_STRIDE ;
-		posOut.x+= halfWidth;
-
-		write_imagei(odata, posOut, convert_int4_rte(ceil(quantHigh * readPixel(currentScratch))) );
-
-		currentScratch += HORIZONTAL_STRIDE;
-		posOut.x -= (halfWidth - 1);
-	}
+void KERNEL run(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata), 
+                       const unsigned int  width, const unsigned int  height, const unsigned int steps,
+					   const unsigned int  level, const unsigned int levels BUFFER_IMAGE_ARGS) {
+	LOCAL float scratch[PIXEL_BUFFER_SIZE];
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odataLL, (width + 1) >> 1, (height + 1) >> 1, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+	transform(idata, odataLL, odata, scratch, width, height, steps, level, levels, false, 1.0f, 1.0f, 1.0f);
 }
 
-
-
-// assumptions: width and height are both even
-// (we will probably have to relax these assumptions in the future)
-void KERNEL runWithQuantization(read_only image2d_t idata,  write_only image2d_t odataLL, write_only image2d_t odata,
+// odata is an integer image (quantized), while odataLL is a float image (not quantized)
+void KERNEL runWithQuantization(KERNEL_IMAGE_RO(idata),  KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata),
                        const unsigned int  width, const unsigned int height, const unsigned int steps,
 					   const unsigned int  level, const unsigned int levels, 
-					   const float quantLL, const float quantLH, const float quantHH) {
-
-	int inputY = getCorrectedGlobalIdY();
-	int outputY = -1;
-	if (inputY < height && inputY >= 0)
-	    outputY = (inputY >> 1) + (inputY & 1)*( height >> 1);
-	bool writeRow = ((getLocalId(1) >= BOUNDARY_Y) && ( getLocalId(1) < WIN_SIZE_Y - BOUNDARY_Y) && outputY != -1);
-	bool doP2 = false;
-	bool doU2 = false;
-	if (getLocalId(1)&1)
-		doP2 = (getLocalId(1) >= BOUNDARY_Y-1) && (getLocalId(1) < WIN_SIZE_Y-BOUNDARY_Y);
-	else
-		doU2 = (getLocalId(1) >= BOUNDARY_Y) && (getLocalId(1) < WIN_SIZE_Y-BOUNDARY_Y) ;
-
-    bool oddInputY = inputY &1;
-	bool pureOutput = oddInputY || (level == levels-1);
-	const float quantLow = (oddInputY ? quantLH : quantLL) * scale97Div;
-	const float quantHigh = (oddInputY ? quantHH : quantLH) * scale97Mul;
-
-    const unsigned int halfWidth = width >> 1;
+					   const float quantLL, const float quantLH, const float quantHH BUFFER_IMAGE_ARGS) {
 	LOCAL float scratch[PIXEL_BUFFER_SIZE];
-	const float xDelta = 1.0/(width-1);
-	int firstX = getGlobalId(0) * (steps * WIN_SIZE_X);
-	
-	//0. Initialize: fetch first pixel (and 2 top boundary pixels)
-
-	// read -4 point
-	float2 posIn = (float2)(firstX-4, inputY) /  (float2)(width-1, height-1);	
-	float4 minusFour = read_imagef(idata, sampler, posIn);
-
-	posIn.x += xDelta;
-	float4 minusThree = read_imagef(idata, sampler, posIn);
-
-	// read -2 point
-	posIn.x += xDelta;
-	float4 minusTwo = read_imagef(idata, sampler, posIn);
-
-	// read -1 point
-	posIn.x += xDelta;
-	float4 minusOne = read_imagef(idata, sampler, posIn);
-
-	// read 0 point
-	posIn.x += xDelta;
-	float4 current = read_imagef(idata, sampler, posIn);
-
-	// +1 point
-	posIn.x += xDelta;
-	float4 plusOne = read_imagef(idata, sampler, posIn);
-
-	// +2 point
-	posIn.x += xDelta;
-	float4 plusTwo = read_imagef(idata, sampler, posIn);
-
-	float4 minusThree_P1 = minusThree + P1*(minusFour + minusTwo);
-	float4 minusOne_P1   = minusOne   + P1*(minusTwo + current);
-	float4 plusOne_P1    = plusOne    + P1*(current + plusTwo);
-
-	float4 minusTwo_U1 = minusTwo + U1*(minusThree_P1 + minusOne_P1);
-	float4 current_U1  = current + U1*(minusOne_P1 + plusOne_P1);
-	float4 minusOne_P2 = minusOne_P1 + P2*(minusTwo_U1 + current_U1);
-		
-	for (int i = 0; i < steps; ++i) {
-
-		// 1. read from source image, transform rows, and store in local scratch
-		LOCAL float* currentScratch = scratch + getScratchOffset();
-		for (int j = 0; j < WIN_SIZE_X; j+=2) {
-
-	        //read next two points
-
-			// +3 point
-			posIn.x += xDelta;
-			float4 plusThree = read_imagef(idata, sampler, posIn);
-	   
-	   		// +4 point
-			posIn.x += xDelta;
-	   		if (posIn.x > 1 + 3*xDelta)
-				break;
-			float4 plusFour = read_imagef(idata, sampler, posIn);
-
-			float4 plusThree_P1    = plusThree  + P1*(plusTwo + plusFour);
-			float4 plusTwo_U1      = plusTwo + U1*(plusOne_P1 + plusThree_P1);
-			float4 plusOne_P2      = plusOne_P1 + P2*(current_U1 + plusTwo_U1);
-								 
-					  
-			//write current U2 (even)
-			writePixel(scale97Div * (current_U1 +  U2 * (minusOne_P2 + plusOne_P2)), currentScratch);
-
-			//advance scratch pointer
-			currentScratch += HORIZONTAL_STRIDE;
-
-			//write current P2 (odd)
-			writePixel(scale97Mul* plusOne_P2 , currentScratch);
-
-			//advance scratch pointer
-			currentScratch += HORIZONTAL_STRIDE;
-
-			// shift registers up by two
-			minusFour = minusTwo;
-			minusThree = minusOne;
-			minusTwo = current;
-			minusOne = plusOne;
-			current = plusTwo;
-			plusOne = plusThree;
-			plusTwo = plusFour;
-			//update P1s
-			minusThree_P1 = minusOne_P1;
-			minusOne_P1 = plusOne_P1;
-			plusOne_P1 = plusThree_P1;
-
-			//update U1s
-			minusTwo_U1 = current_U1;
-			current_U1 = plusTwo_U1;
-
-			//update P2s
-			minusOne_P2 = plusOne_P2;
-		}
-
-		
-		//4. transform vertically
-		currentScratch = scratch + getScratchOffset();	
-
-		
-		localMemoryFence();
-		// P2 - predict odd columns (skip left three boundary columns and all right boundary columns)
-		if ( doP2 ) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
-				float4 minusOne = readPixel(currentScratch -1);
-				float4 plusOne = readPixel(currentScratch);
-				float4 plusThree = readPixel(currentScratch + 1); 
-
-				float4 minusTwo, current,plusTwo, plusFour;
-
-				minusTwo.x = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.x  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.x  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.x = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.y = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.y  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.y  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.y = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.z = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.z  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.z  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.z = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.w = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.w  = currentScratch[VERTICAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.w  = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN];
-				plusFour.w = currentScratch[VERTICAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-
-				float4 current_U1 = current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo);
-
-				// write P2
-				writePixel( scale97Mul*(plusOne + P1*(current + plusTwo) +
-		         				      P2*(current_U1 + plusTwo + U1*(plusOne + plusThree) +
-									  U1P1*(current + 2*plusTwo + plusFour)  )),
-									  currentScratch);
-				// write U1, for use by even loop
-				writePixel(current_U1, currentScratch + VERTICAL_ODD_TO_PREVIOUS_EVEN);
-
-				currentScratch += HORIZONTAL_STRIDE;
-			}
-		}
-		
-
-		currentScratch = scratch + getScratchOffset();	
-		localMemoryFence();
-		//U2 - update even columns (skip left and right boundary columns)
-		if ( doU2 ) {
-			for (int j = 0; j < WIN_SIZE_X; j++) {
-
-				float4 current = readPixel(currentScratch);
-
-				// read previous and next odd
-				float4 prevOdd, nextOdd;
-
-				prevOdd.x = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.x  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.y = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.y  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.z = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.z  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.w = currentScratch[VERTICAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.w  = currentScratch[VERTICAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-				//////////////////////////////////////////////////////////////////
-
-				// write U2
-				writePixel( scale97Div*(current + U2*(prevOdd + nextOdd)), currentScratch);
-				currentScratch += HORIZONTAL_STRIDE;
-			}
-		}
-		localMemoryFence();
-		
-
-
-		//5. write local buffer column to destination image
-		if (writeRow) {
-		
-		   if (pureOutput)
-			   writeQuantizedRowToOutput(scratch + getScratchOffset(), odata, firstX, outputY, 
-			                            width, halfWidth, quantLow, quantHigh);
-			else
-			   writeMixedQuantizedRowToOutput(scratch + getScratchOffset(), odataLL, odata, firstX, outputY, 
-										width, halfWidth, quantLow, quantHigh);
-										
-		}
-		// move to next step 
-		firstX += WIN_SIZE_X;
-	}
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odataLL, (width + 1) >> 1, (height + 1) >> 1, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+	transform(idata, odataLL, odata, scratch, width, height, steps, level, levels, true, quantLL, quantLH, quantHH);
 }
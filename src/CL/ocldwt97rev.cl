@@ -13,53 +13,26 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
-
 #include "ocl_platform.cl"
 
-//////////////////////////////////////////////////////////////////////////////////////
-CONSTANT float RevU2 = -0.4435068522;    ///< undo 9/7 update 2
-CONSTANT float RevP2 = -0.8829110762;  ///< undo 9/7 predict 2
-CONSTANT float RevU1 = 0.05298011854;    ///< undo 9/7 update 1
-CONSTANT float RevP1 = 1.586134342;  ///< undo 9/7 predict 1
-
-CONSTANT float RevU1P1 = 0.08403358545952490068;
-
-
 /*
+Irreversible inverse 9/7 discrete wavelet transform (one level), with optional dequantization
 
-Reverse Lifting scheme consists of reverse scaling followed by four steps: 
-ReverseUpdate2 ReversePredict2 ReverseUpdate1 ReversePredict1   
-
-Even points are scaled by scale97Mul, odd points are scaled by scale97Div.
-
-
-Update Calculation
-
-For S even, we have
-
-current_RevU2 = current + RevU2*(minusOne + plusOne);
+Input is one level of the forward transform in Mallat layout: low pass band of width (width+1)/2
+on the left, and of height (height+1)/2 on the top. Output is the reconstructed image, in natural order.
+The LL band is read from idataLL, and all other bands from idata: for the coarsest level, idataLL
+and idata are the same image; otherwise idataLL holds the output of the previous (coarser) level.
+The work groups cover the region of the output that starts at (originX, originY), both even, so that
+a window is reconstructed from the coefficients within the filter support of it alone.
 
-current_RevU1 = current_RevU2 + RevU1*(minusOne_RevP2 + plusOne_RevP2);
-   
-              = current + RevU2*(minusOne + plusOne) + 
-			     RevU1*(plusOne + RevP2*( minusTwo + RevU2*(minusThree + minusOne) +  current + RevU2*(minusOne + plusOne)) + 
-				        plusOne + RevP2*( current + RevU2*(minusOne + plusOne) +  plusTwo + RevU2*(plusOne + plusThree)) );
+Assumptions:
 
-Predict Calculation:
-
-For S odd, we have:
-
-plusOne_RevP2 = plusOne + RevP2*(current_RevU2 + plusTwo_RevU2);
-
-              = plusOne + RevP2*( current + RevU2*(minusOne + plusOne) +  plusTwo + RevU2*(plusOne + plusThree));
-
-
-plusOne_RevP1 = plusOne_RevP2 + RevP1*(current_RevU2 + plusTwo_RevU2);
+1) assume WIN_SIZE_X equals the number of work items in the work group
 
+Width and height are arbitrary: boundaries use whole sample symmetric extension
+of the interleaved coefficients, as in the forward transform.
 
 */
-///////////////////////////////////////////////////////////////////////////////////////////////////
-
 
 //////////////////////////
 // dimensions of window
@@ -89,77 +62,56 @@ Right (odd) boundary column
 
 #define BOUNDARY_X 4
 
-#define VERTICAL_STRIDE 64  // WIN_SIZE_X/2 
+#define VERTICAL_STRIDE (WIN_SIZE_X >> 1)
 
 
-// two vertical neighbours: pointer diff:
-#define BUFFER_SIZE            512	// VERTICAL_STRIDE * WIN_SIZE_Y
+// two horizontal neighbours: pointer diff:
+#define BUFFER_SIZE            (VERTICAL_STRIDE * WIN_SIZE_Y)
 
 
-#define CHANNEL_BUFFER_SIZE     1024            // BUFFER_SIZE + BUFFER_SIZE
+#define CHANNEL_BUFFER_SIZE     (BUFFER_SIZE << 1)
 
-#define CHANNEL_BUFFER_SIZE_X2  2048   
-#define CHANNEL_BUFFER_SIZE_X3  3072   
+#define CHANNEL_BUFFER_SIZE_X2  (CHANNEL_BUFFER_SIZE * 2)
+#define CHANNEL_BUFFER_SIZE_X3  (CHANNEL_BUFFER_SIZE * 3)
 
-#define PIXEL_BUFFER_SIZE   4096
+#define PIXEL_BUFFER_SIZE   (CHANNEL_BUFFER_SIZE * 4)
 
-#define HORIZONTAL_EVEN_TO_PREVIOUS_ODD  511
-#define HORIZONTAL_EVEN_TO_NEXT_ODD      512
+#define HORIZONTAL_ODD_TO_PREVIOUS_EVEN (-BUFFER_SIZE)
+#define HORIZONTAL_ODD_TO_NEXT_EVEN     (1 - BUFFER_SIZE)
 
-#define HORIZONTAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE -513
-#define HORIZONTAL_ODD_TO_PREVIOUS_EVEN -512
-#define HORIZONTAL_ODD_TO_NEXT_EVEN     -511
-#define HORIZONTAL_ODD_TO_NEXT_EVEN_PLUS_ONE     -510
+#define HORIZONTAL_EVEN_TO_PREVIOUS_ODD  (BUFFER_SIZE - 1)
+#define HORIZONTAL_EVEN_TO_NEXT_ODD      BUFFER_SIZE
 
-CONSTANT float P1 = -1.586134342;   ///< forward 9/7 predict 1
-CONSTANT float U1 = -0.05298011854;  ///< forward 9/7 update 1
-CONSTANT float P2 = 0.8829110762;   ///< forward 9/7 predict 2
-CONSTANT float U2 = 0.4435068522;    ///< forward 9/7 update 2
-CONSTANT float U1P1 = 0.08403358545952490068;
+#define P1  -1.586134342f 
+#define U1  -0.05298011854f  
+#define P2  0.8829110762f 
+#define U2  0.4435068522f   
 
-CONSTANT float scale97Mul = 1.23017410491400f;
-CONSTANT float scale97Div = 1.0 / 1.23017410491400f;
+#define scale97Mul  1.23017410491400f
+#define scale97Div   0.81289306611596153187273657637352f
 
 /*
 
-Lifting scheme consists of four steps: Predict1 Update1 Predict2 Update2
-followed by scaling (even points are scaled by scale97Div, odd points are scaled by scale97Mul)
-
-
-Predict Calculation:
+Inverse lifting undoes the forward steps in reverse order:
+unscaling (even points are scaled by scale97Mul, odd points by scale97Div),
+followed by Update2 Predict2 Update1 Predict1, each with negated coefficient.
 
-For S odd, we have:
-
-
-plusOne_P1 = plusOne + P1*(current + plusTwo)
-
-plusOne_P2 = plusOne_P1 + 
-             P2*(current_U1 + plusTwo_U1)
-           =   plusOne + P1*(current + plusTwo) +
-		         P2*(current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo) + 
-				     plusTwo + U1*(plusOne + plusThree) + U1P1*(current + 2*plusTwo + plusFour)  )
-
-
-
-Update Calculation
-
-For S even, we have
-
-current_U1 = current + U1*(minusOne_P1 + plusOne_P1)
-           = current + U1*(minusOne + P1*(minusTwo + current) + plusOne + P1*(current + plusTwo))
-		   = current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo)
-
-current_U2 = current_U1 + U2*(minusOne_P2 + plusOne_P2)
+Columns are transformed in registers, as they are read from the source image. The register
+pipeline lags two even/odd pairs behind the last pair read.
+Rows are transformed in local scratch, one lifting step at a time, so each step invalidates
+one more boundary column at the left and right of the window, hence BOUNDARY_X == 4.
+Horizontal unscaling is applied when the column is stored in scratch.
 
 */
-  
 
 ///////////////////////////////////////////////////////////////////////
 
-CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_MIRRORED_REPEAT  | CLK_FILTER_NEAREST;
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE  | CLK_FILTER_NEAREST;
 
+// image column of this work item: work groups overlap by 2 * BOUNDARY_X columns, and the first group
+// starts BOUNDARY_X columns left of the image
 inline int getCorrectedGlobalIdX() {
-      return getGlobalId(0) - 2 * BOUNDARY_X * getGroupId(0);
+      return (int)getGlobalId(0) - BOUNDARY_X - 2 * BOUNDARY_X * (int)getGroupId(0);
 }
 
 
@@ -179,248 +131,198 @@ inline void writePixel(float4 pix, LOCAL float*  restrict  dest) {
 	*dest = pix.w;
 }
 
-// write column to destination
-void writeColumnToOutput(LOCAL float* restrict currentScratch, __write_only image2d_t odata, int firstY, int inputX, int height, int halfHeight){
-
-	int2 posOut = {inputX, firstY>>1};
-	for (int j = 0; j < WIN_SIZE_Y; j+=2) {
-	
-	    // even row
-		
-		//only need to check evens, since even point will be the first out of bound point
-	    if (posOut.y >= halfHeight)
-			break;
+// dequantize, reconstructing at the mid point of the quantization interval
+inline float4 dequantize(int4 q, float step) {
+	float4 val = convert_float4(q);
+	return (val + 0.5f * sign(val)) * step;
+}
 
-		write_imagef(odata, posOut,scale97Div * readPixel(currentScratch));
+// read coefficient at (Mallat) column bandX and interleaved row y, mirroring y at the image boundaries,
+// and undo vertical scaling. A single row has no high pass coefficients: the extension is zero.
+// When dequant is true, idata holds quantized coefficients; the LL band is quantized at the coarsest level only.
+inline float4 readCoefficient(IMAGE_RO idata, IMAGE_RO idataLL, int bandX, bool lowX, int y, int height, int lowHeight,
+							  const bool dequant, const bool coarsest, float stepLL, float stepHL, float stepLH, float stepHH) {
+	if (height == 1 && (y & 1))
+		return (float4)(0);
+	y = mirror(y, height);
+	const bool lowY = !(y & 1);
+	int2 pos = (int2)(bandX, (y >> 1) + (y & 1) * lowHeight);
+	float4 val;
+	if (lowX && lowY && !(dequant && coarsest))
+		val = readImageF(idataLL, pos);
+	else if (!dequant)
+		val = readImageF(idata, pos);
+	else
+		val = dequantize(readImageI(idata, pos), lowX ? (lowY ? stepLL : stepLH) : (lowY ? stepHL : stepHH));
+	return (lowY ? scale97Mul : scale97Div) * val;
+}
 
-		// odd row
-		currentScratch += VERTICAL_STRIDE ;
-		posOut.y+= halfHeight;
+// one horizontal lifting step: update this work item's column from its two neighbouring columns
+inline void liftColumn(LOCAL float* restrict currentScratch, const int toPrevious, const int toNext, const float coefficient) {
+	for (int j = 0; j < WIN_SIZE_Y; j++) {
+		writePixel(readPixel(currentScratch) -
+		           coefficient * (readPixel(currentScratch + toPrevious) + readPixel(currentScratch + toNext)),
+				   currentScratch);
+		currentScratch += VERTICAL_STRIDE;
+	}
+}
 
-		write_imagef(odata, posOut,scale97Mul * readPixel(currentScratch));
+// write column to destination
+void writeColumnToOutput(LOCAL float* restrict currentScratch, IMAGE_WO odata, int firstY, int outputX, int height){
 
+	int2 posOut = {outputX, firstY};
+	for (int j = 0; j < WIN_SIZE_Y; j++) {
+	    if (posOut.y >= height)
+			break;
+		writeImageF(odata, posOut,readPixel(currentScratch));
 		currentScratch += VERTICAL_STRIDE;
-		posOut.y -= (halfHeight - 1);
+		posOut.y++;
 	}
 }
 
-// initial scratch offset when transforming vertically
+// initial scratch offset when transforming horizontally
 inline int getScratchOffset(){
    return (getLocalId(0)>> 1) + (getLocalId(0)&1) * BUFFER_SIZE;
 }
 
-// assumptions: width and height are both even
-// (we will probably have to relax these assumptions in the future)
-void KERNEL run(__read_only image2d_t idata, __write_only image2d_t odata,   
-                       const unsigned int  width, const unsigned int  height, const unsigned int steps) {
-
-	int inputX = getCorrectedGlobalIdX();
-
-	int outputX = inputX;
-	outputX = (outputX >> 1) + (outputX & 1)*( width >> 1);
+#define READ_COEFFICIENT(Y) readCoefficient(idata, idataLL, bandX, lowX, (Y), height, lowHeight, dequant, coarsest, stepLL, stepHL, stepLH, stepHH)
+
+// shared by run and runWithQuantization
+void transform(IMAGE_RO idata, IMAGE_RO idataLL, IMAGE_WO odata, LOCAL float* scratch,
+			   const unsigned int  width, const unsigned int  height, const unsigned int steps,
+			   const unsigned int  level, const unsigned int levels,
+			   const unsigned int originX, const unsigned int originY,
+			   const bool dequant, const float stepLL, const float stepHL, const float stepLH, const float stepHH) {
+
+	const int inputX = getCorrectedGlobalIdX() + originX;
+	const int lowWidth = (width + 1) >> 1;
+	const int lowHeight = (height + 1) >> 1;
+	const bool coarsest = (level == levels - 1);
+
+	// boundary columns outside of the image hold their mirror image
+	const int columnX = mirror(inputX, width);
+	const bool lowX = !(columnX & 1);
+	const int bandX = (columnX >> 1) + (columnX & 1) * lowWidth;
+	// a single column has no high pass coefficients: the extension is zero
+	const bool zeroColumn = (width == 1) && (inputX & 1);
+	const float columnScale = zeroColumn ? 0.0f : (lowX ? scale97Mul : scale97Div);
+
+	int firstY = originY + getGlobalId(1) * (steps * WIN_SIZE_Y);
+
+	const int lid = getLocalId(0);
+	bool doU2 = false, doP2 = false, doU1 = false, doP1 = false;
+	if (lid & 1) {
+		doP2 = (lid >= 3) && (lid <= WIN_SIZE_X-3);
+		doP1 = (lid >= 5) && (lid <= WIN_SIZE_X-5);
+	} else {
+		doU2 = (lid >= 2) && (lid <= WIN_SIZE_X-2);
+		doU1 = (lid >= 4) && (lid <= WIN_SIZE_X-4);
+	}
+	bool writeColumn = (lid >= BOUNDARY_X) && (lid < WIN_SIZE_X - BOUNDARY_X) && (inputX < width) && (inputX >= 0);
+
+	//0. Initialize: prime the register pipeline with the two pairs above firstY
+	// Pair n holds interleaved rows 2n and 2n+1; suffixes give the last step applied:
+	// e1/o1 after undoing Update2/Predict2, e2/o2 after undoing Update1/Predict1.
+	int n = (firstY >> 1) - 2;
+	float4 odd = READ_COEFFICIENT(2 * n - 1);		// o of pair n-1
+	float4 even1 = 0;							// e1 of pair n-1
+	float4 odd1 = 0;							// o1 of pair n-2
+	float4 even2 = 0;							// e2 of pair n-2
+	for (int k = 0; k < 4; ++k) {
+		float4 e = READ_COEFFICIENT(2 * n);
+		float4 o = READ_COEFFICIENT(2 * n + 1);
+		float4 e1 = e - U2 * (odd + o);
+		float4 o1 = odd - P2 * (even1 + e1);
+		float4 e2 = even1 - U1 * (odd1 + o1);
+		odd = o;
+		even1 = e1;
+		odd1 = o1;
+		even2 = e2;
+		n++;
+	}
 
-    const unsigned int halfHeight = height >> 1;
-	LOCAL float scratch[PIXEL_BUFFER_SIZE];
-	const float yDelta = 1.0/(height-1);
-	int firstY = getGlobalId(1) * (steps * WIN_SIZE_Y);
-	
-	//0. Initialize: fetch first pixel (and 2 top boundary pixels)
-
-	// read -4 point
-	float2 posIn = (float2)(inputX, firstY - 4) /  (float2)(width-1, height-1);	
-	float4 minusFour = read_imagef(idata, sampler, posIn);
-
-	posIn.y += yDelta;
-	float4 minusThree = read_imagef(idata, sampler, posIn);
-
-	// read -2 point
-	posIn.y += yDelta;
-	float4 minusTwo = read_imagef(idata, sampler, posIn);
-
-	// read -1 point
-	posIn.y += yDelta;
-	float4 minusOne = read_imagef(idata, sampler, posIn);
-
-	// read 0 point
-	posIn.y += yDelta;
-	float4 current = read_imagef(idata, sampler, posIn);
-
-	// +1 point
-	posIn.y += yDelta;
-	float4 plusOne = read_imagef(idata, sampler, posIn);
-
-	// +2 point
-	posIn.y += yDelta;
-	float4 plusTwo = read_imagef(idata, sampler, posIn);
-
-	float4 minusThree_P1 = minusThree + P1*(minusFour + minusTwo);
-	float4 minusOne_P1   = minusOne   + P1*(minusTwo + current);
-	float4 plusOne_P1    = plusOne    + P1*(current + plusTwo);
-
-	float4 minusTwo_U1 = minusTwo + U1*(minusThree_P1 + minusOne_P1);
-	float4 current_U1  = current + U1*(minusOne_P1 + plusOne_P1);
-	float4 minusOne_P2 = minusOne_P1 + P2*(minusTwo_U1 + current_U1);
-		
 	for (int i = 0; i < steps; ++i) {
 
-		// 1. read from source image, transform columns, and store in local scratch
+		// 1. read from source image, transform column, and store in local scratch
 		LOCAL float* currentScratch = scratch + getScratchOffset();
 		for (int j = 0; j < WIN_SIZE_Y; j+=2) {
 
-	        //read next two points
-
-			// +3 point
-			posIn.y += yDelta;
-			float4 plusThree = read_imagef(idata, sampler, posIn);
-	   
-	   		// +4 point
-			posIn.y += yDelta;
-	   		if (posIn.y > 1 + 3*yDelta)
+			// first row of output pair
+			if (2 * (n - 2) >= height)
 				break;
-			float4 plusFour = read_imagef(idata, sampler, posIn);
 
-			float4 plusThree_P1    = plusThree  + P1*(plusTwo + plusFour);
-			float4 plusTwo_U1      = plusTwo + U1*(plusOne_P1 + plusThree_P1);
-			float4 plusOne_P2      = plusOne_P1 + P2*(current_U1 + plusTwo_U1);
-								 
-					  
-			//write current U2 (even)
-			writePixel(scale97Div * (current_U1 +  U2 * (minusOne_P2 + plusOne_P2)), currentScratch);
+			float4 e = READ_COEFFICIENT(2 * n);
+			float4 o = READ_COEFFICIENT(2 * n + 1);
+			float4 e1 = e - U2 * (odd + o);
+			float4 o1 = odd - P2 * (even1 + e1);
+			float4 e2 = even1 - U1 * (odd1 + o1);
+			float4 o2 = odd1 - P1 * (even2 + e2);
 
-			//advance scratch pointer
+			// write pair n-2: even, then odd
+			writePixel(columnScale * even2, currentScratch);
 			currentScratch += VERTICAL_STRIDE;
-
-			//write current P2 (odd)
-			writePixel(scale97Mul* plusOne_P2 , currentScratch);
-
-			//advance scratch pointer
+			writePixel(columnScale * o2, currentScratch);
 			currentScratch += VERTICAL_STRIDE;
 
-			// shift registers up by two
-			minusFour = minusTwo;
-			minusThree = minusOne;
-			minusTwo = current;
-			minusOne = plusOne;
-			current = plusTwo;
-			plusOne = plusThree;
-			plusTwo = plusFour;
-			//update P1s
-			minusThree_P1 = minusOne_P1;
-			minusOne_P1 = plusOne_P1;
-			plusOne_P1 = plusThree_P1;
-
-			//update U1s
-			minusTwo_U1 = current_U1;
-			current_U1 = plusTwo_U1;
-
-			//update P2s
-			minusOne_P2 = plusOne_P2;
+			//update registers
+			odd = o;
+			even1 = e1;
+			odd1 = o1;
+			even2 = e2;
+			n++;
 		}
 
-		
 		//4. transform horizontally
 		currentScratch = scratch + getScratchOffset();	
 
-		
 		localMemoryFence();
-		// P2 - predict odd columns (skip left three boundary columns and all right boundary columns)
-		if ( (getLocalId(0)&1) && (getLocalId(0) >= BOUNDARY_X-1) && (getLocalId(0) < WIN_SIZE_X-BOUNDARY_X) ) {
-			for (int j = 0; j < WIN_SIZE_Y; j++) {
-				float4 minusOne = readPixel(currentScratch -1);
-				float4 plusOne = readPixel(currentScratch);
-				float4 plusThree = readPixel(currentScratch + 1); 
-
-				float4 minusTwo, current,plusTwo, plusFour;
-
-				minusTwo.x = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.x  = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.x  = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN];
-				plusFour.x = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.y = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.y  = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.y  = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN];
-				plusFour.y = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.z = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.z  = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.z  = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN];
-				plusFour.z = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				minusTwo.w = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN_MINUS_ONE];
-				current.w  = currentScratch[HORIZONTAL_ODD_TO_PREVIOUS_EVEN];
-				plusTwo.w  = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN];
-				plusFour.w = currentScratch[HORIZONTAL_ODD_TO_NEXT_EVEN_PLUS_ONE];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-
-				float4 current_U1 = current + U1*(minusOne + plusOne) + U1P1*(minusTwo + 2*current + plusTwo);
-
-				// write P2
-				writePixel( scale97Mul*(plusOne + P1*(current + plusTwo) +
-		         				      P2*(current_U1 + plusTwo + U1*(plusOne + plusThree) +
-									  U1P1*(current + 2*plusTwo + plusFour)  )),
-									  currentScratch);
-				// write U1, for use by even loop
-				writePixel(current_U1, currentScratch + HORIZONTAL_ODD_TO_PREVIOUS_EVEN);
-
-				currentScratch += VERTICAL_STRIDE;
-			}
-		}
-		
-
-		currentScratch = scratch + getScratchOffset();	
+		if (doU2)
+			liftColumn(currentScratch, HORIZONTAL_EVEN_TO_PREVIOUS_ODD, HORIZONTAL_EVEN_TO_NEXT_ODD, U2);
 		localMemoryFence();
-		//U2 - update even columns (skip left and right boundary columns)
-		if ( !(getLocalId(0)&1) && (getLocalId(0) >= BOUNDARY_X) && (getLocalId(0) < WIN_SIZE_X-BOUNDARY_X)  ) {
-			for (int j = 0; j < WIN_SIZE_Y; j++) {
-
-				float4 current = readPixel(currentScratch);
-
-				// read previous and next odd
-				float4 prevOdd, nextOdd;
-
-				prevOdd.x = currentScratch[HORIZONTAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.x  = currentScratch[HORIZONTAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.y = currentScratch[HORIZONTAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.y  = currentScratch[HORIZONTAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.z = currentScratch[HORIZONTAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.z  = currentScratch[HORIZONTAL_EVEN_TO_NEXT_ODD];
-
-
-				currentScratch += CHANNEL_BUFFER_SIZE;
-				prevOdd.w = currentScratch[HORIZONTAL_EVEN_TO_PREVIOUS_ODD];
-				nextOdd.w  = currentScratch[HORIZONTAL_EVEN_TO_NEXT_ODD];
-
-				currentScratch -= CHANNEL_BUFFER_SIZE_X3;
-				//////////////////////////////////////////////////////////////////
-
-				// write U2
-				writePixel( scale97Div*(current + U2*(prevOdd + nextOdd)), currentScratch);
-				currentScratch += VERTICAL_STRIDE;
-			}
-		}
+		if (doP2)
+			liftColumn(currentScratch, HORIZONTAL_ODD_TO_PREVIOUS_EVEN, HORIZONTAL_ODD_TO_NEXT_EVEN, P2);
+		localMemoryFence();
+		if (doU1)
+			liftColumn(currentScratch, HORIZONTAL_EVEN_TO_PREVIOUS_ODD, HORIZONTAL_EVEN_TO_NEXT_ODD, U1);
+		localMemoryFence();
+		if (doP1)
+			liftColumn(currentScratch, HORIZONTAL_ODD_TO_PREVIOUS_EVEN, HORIZONTAL_ODD_TO_NEXT_EVEN, P1);
 		localMemoryFence();
-		
-
 
 		//5. write local buffer column to destination image
 		// (only write non-boundary columns that are within the image bounds)
-		if ((getLocalId(0) >= BOUNDARY_X) && ( getLocalId(0) < WIN_SIZE_X - BOUNDARY_X) && (inputX < width) && inputX >= 0) {
-			writeColumnToOutput(scratch + getScratchOffset(), odata, firstY, outputX, height, halfHeight);
+		if (writeColumn)
+			writeColumnToOutput(currentScratch, odata, firstY, inputX, height);
 
-		}
 		// move to next step 
 		firstY += WIN_SIZE_Y;
 	}
 }
 
+void KERNEL run(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_RO(idataLL), KERNEL_IMAGE_WO(odata),   
+                       const unsigned int  width, const unsigned int  height, const unsigned int steps,
+					   const unsigned int  level, const unsigned int levels,
+					   const unsigned int originX, const unsigned int originY BUFFER_IMAGE_ARGS) {
+	LOCAL float scratch[PIXEL_BUFFER_SIZE];
+	BIND_IMAGE(idata, imageWidth, imageHeight, imageChannels);
+	// at the coarsest level, idataLL is idata
+	BIND_IMAGE(idataLL, (level == levels-1) ? imageWidth : ((width + 1) >> 1),
+			   (level == levels-1) ? imageHeight : ((height + 1) >> 1), imageChannels);
+	BIND_IMAGE(odata, width, height, imageChannels);
+	transform(idata, idataLL, odata, scratch, width, height, steps, level, levels, originX, originY, false, 1.0f, 1.0f, 1.0f, 1.0f);
+}
+
+// idata is an integer image (quantized), while idataLL is a float image (not quantized)
+void KERNEL runWithQuantization(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_RO(idataLL), KERNEL_IMAGE_WO(odata),   
+                       const unsigned int  width, const unsigned int  height, const unsigned int steps,
+					   const unsigned int  level, const unsigned int levels,
+					   const unsigned int originX, const unsigned int originY,
+					   const float stepLL, const float stepHL, const float stepLH, const float stepHH BUFFER_IMAGE_ARGS) {
+	LOCAL float scratch[PIXEL_BUFFER_SIZE];
+	BIND_IMAGE(idata, imageWidth, imageHeight, imageChannels);
+	// at the coarsest level, idataLL is idata
+	BIND_IMAGE(idataLL, (level == levels-1) ? imageWidth : ((width + 1) >> 1),
+			   (level == levels-1) ? imageHeight : ((height + 1) >> 1), imageChannels);
+	BIND_IMAGE(odata, width, height, imageChannels);
+	transform(idata, idataLL, odata, scratch, width, height, steps, level, levels, originX, originY, true, stepLL, stepHL, stepLH, stepHH);
+}
@@ -0,0 +1,229 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "ocl_platform.cl"
+
+//////////////////////////
+// TAIL_SIZE: maximum width and height of the LL band handed to the tail kernels.
+// All kernels expect TAIL_SIZE work items in a single work group.
+///////////////////////////
+
+/**
+
+Fused tail levels of the forward DWT.
+
+Once the LL band of a level fits in local memory, the remaining levels are computed
+by a single work group without going back to global memory: the band is loaded
+into a TAIL_SIZE x TAIL_SIZE scratch tile, and for each level,
+
+1. each work item transforms one column (in private memory) and stores it back to the tile, low pass followed by high pass
+2. each work item transforms one row in the same way
+3. the three high pass bands are written to the output image; the LL band stays in the top left corner of the tile
+
+The LL band of the last level is written to the output image as well. Since the output image
+uses Mallat layout, tile coordinates are also output coordinates.
+
+Boundaries use whole sample symmetric extension, so odd widths and heights are supported.
+Columns are lifted before rows, as in 2D_SD of ITU-T Rec. T.800 (F.4.2), so that the 5/3
+transform is undone exactly by a conforming decoder.
+
+**/
+
+#define P1  -1.586134342f
+#define U1  -0.05298011854f
+#define P2  0.8829110762f
+#define U2  0.4435068522f
+
+#define scale97Mul  1.23017410491400f
+#define scale97Div   0.81289306611596153187273657637352f
+
+CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// neighbours of sample i in a line of n samples, with symmetric extension
+inline int prevIndex(int i) {
+	return i > 0 ? i - 1 : 1;
+}
+inline int nextIndex(int i, int n) {
+	return i + 1 < n ? i + 1 : i - 1;
+}
+
+// 9/7 lifting of n interleaved samples; result is scaled
+void lift97(float4* line, int n) {
+	if (n < 2)
+		return;
+	for (int i = 1; i < n; i += 2)
+		line[i] += P1 * (line[i - 1] + line[nextIndex(i, n)]);
+	for (int i = 0; i < n; i += 2)
+		line[i] += U1 * (line[prevIndex(i)] + line[nextIndex(i, n)]);
+	for (int i = 1; i < n; i += 2)
+		line[i] += P2 * (line[i - 1] + line[nextIndex(i, n)]);
+	for (int i = 0; i < n; i += 2)
+		line[i] += U2 * (line[prevIndex(i)] + line[nextIndex(i, n)]);
+	for (int i = 0; i < n; i += 2)
+		line[i] *= scale97Div;
+	for (int i = 1; i < n; i += 2)
+		line[i] *= scale97Mul;
+}
+
+// 5/3 reversible lifting of n interleaved samples
+void lift53(int4* line, int n) {
+	if (n < 2)
+		return;
+	for (int i = 1; i < n; i += 2)
+		line[i] -= (line[i - 1] + line[nextIndex(i, n)]) >> 1;
+	for (int i = 0; i < n; i += 2)
+		line[i] += (line[prevIndex(i)] + line[nextIndex(i, n)] + 2) >> 2;
+}
+
+// quantization factor of output point (x,y) at level
+inline float getQuant(CONSTANT float* quant, int x, int y, int loW, int loH, unsigned int level) {
+	if (x < loW && y < loH)
+		return quant[level * 3];
+	if (x >= loW && y >= loH)
+		return quant[level * 3 + 2];
+	return quant[level * 3 + 1];
+}
+
+// transform columns of the top left w x h corner of the tile, then rows.
+// TYPE is the pixel type, LIFT the lifting function
+#define TRANSFORM_LEVEL(TYPE, LIFT)                                         \
+	{                                                                       \
+		TYPE line[TAIL_SIZE];                                               \
+		const int loW = (w + 1) >> 1;                                       \
+		const int loH = (h + 1) >> 1;                                       \
+		if (lid < w) {                                                      \
+			LOCAL TYPE* col = tile + lid;                                   \
+			for (int y = 0; y < h; ++y)                                     \
+				line[y] = col[y * TAIL_SIZE];                               \
+			LIFT(line, h);                                                  \
+			for (int y = 0; y < h; ++y)                                     \
+				col[((y >> 1) + (y & 1) * loH) * TAIL_SIZE] = line[y];      \
+		}                                                                   \
+		localMemoryFence();                                                 \
+		if (lid < h) {                                                      \
+			LOCAL TYPE* row = tile + lid * TAIL_SIZE;                       \
+			for (int x = 0; x < w; ++x)                                     \
+				line[x] = row[x];                                           \
+			LIFT(line, w);                                                  \
+			for (int x = 0; x < w; ++x)                                     \
+				row[(x >> 1) + (x & 1) * loW] = line[x];                    \
+		}                                                                   \
+		localMemoryFence();                                                 \
+	}
+
+
+// idata: LL band of the first tail level (width x height)
+// odata: output image; receives all sub bands of the remaining levels
+// level: first tail level, levels: total number of levels
+// Arguments match the per level DWT kernels: odataLL and steps are not used
+void KERNEL run53(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata),
+				  const unsigned int width, const unsigned int height, const unsigned int steps,
+				  const unsigned int level, const unsigned int levels BUFFER_IMAGE_ARGS) {
+	LOCAL int4 tile[TAIL_SIZE * TAIL_SIZE];
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+	const int lid = getLocalId(0);
+	if (lid < height) {
+		for (int x = 0; x < width; ++x)
+			tile[lid * TAIL_SIZE + x] = readImageI(idata, (int2)(x, lid));
+	}
+	localMemoryFence();
+
+	int w = width;
+	int h = height;
+	for (unsigned int l = level; l < levels; ++l) {
+		TRANSFORM_LEVEL(int4, lift53)
+		const int loW = (w + 1) >> 1;
+		const int loH = (h + 1) >> 1;
+		const bool last = (l == levels - 1);
+		// only the last level writes the LL band, and the next level touches nothing else,
+		// so no barrier is needed here
+		if (lid < h) {
+			for (int x = 0; x < w; ++x) {
+				if (last || x >= loW || lid >= loH)
+					writeImageI(odata, (int2)(x, lid), tile[lid * TAIL_SIZE + x]);
+			}
+		}
+		w = loW;
+		h = loH;
+	}
+}
+
+void KERNEL run97(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata),
+				  const unsigned int width, const unsigned int height, const unsigned int steps,
+				  const unsigned int level, const unsigned int levels BUFFER_IMAGE_ARGS) {
+	LOCAL float4 tile[TAIL_SIZE * TAIL_SIZE];
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+	const int lid = getLocalId(0);
+	if (lid < height) {
+		for (int x = 0; x < width; ++x)
+			tile[lid * TAIL_SIZE + x] = readImageF(idata, (int2)(x, lid));
+	}
+	localMemoryFence();
+
+	int w = width;
+	int h = height;
+	for (unsigned int l = level; l < levels; ++l) {
+		TRANSFORM_LEVEL(float4, lift97)
+		const int loW = (w + 1) >> 1;
+		const int loH = (h + 1) >> 1;
+		const bool last = (l == levels - 1);
+		if (lid < h) {
+			for (int x = 0; x < w; ++x) {
+				if (last || x >= loW || lid >= loH)
+					writeImageF(odata, (int2)(x, lid), tile[lid * TAIL_SIZE + x]);
+			}
+		}
+		w = loW;
+		h = loH;
+	}
+}
+
+// quant holds three factors per level: LL, LH/HL and HH.
+// Quantization is dead zone: sign(x) * floor(|x| * quant)
+void KERNEL run97WithQuantization(KERNEL_IMAGE_RO(idata), KERNEL_IMAGE_WO(odataLL), KERNEL_IMAGE_WO(odata),
+								  const unsigned int width, const unsigned int height, const unsigned int steps,
+								  const unsigned int level, const unsigned int levels,
+								  CONSTANT float* quant BUFFER_IMAGE_ARGS) {
+	LOCAL float4 tile[TAIL_SIZE * TAIL_SIZE];
+	BIND_IMAGE(idata, width, height, imageChannels);
+	BIND_IMAGE(odata, imageWidth, imageHeight, imageChannels);
+	const int lid = getLocalId(0);
+	if (lid < height) {
+		for (int x = 0; x < width; ++x)
+			tile[lid * TAIL_SIZE + x] = readImageF(idata, (int2)(x, lid));
+	}
+	localMemoryFence();
+
+	int w = width;
+	int h = height;
+	for (unsigned int l = level; l < levels; ++l) {
+		TRANSFORM_LEVEL(float4, lift97)
+		const int loW = (w + 1) >> 1;
+		const int loH = (h + 1) >> 1;
+		const bool last = (l == levels - 1);
+		if (lid < h) {
+			for (int x = 0; x < w; ++x) {
+				if (last || x >= loW || lid >= loH) {
+					float q = getQuant(quant, x, lid, loW, loH, l);
+					writeImageI(odata, (int2)(x, lid), convert_int4_rtz(q * tile[lid * TAIL_SIZE + x]));
+				}
+			}
+		}
+		w = loW;
+		h = loH;
+	}
+}
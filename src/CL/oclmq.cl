@@ -0,0 +1,293 @@
+/*  Copyright 2014 Aaron Boxer
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+
+#include "ocl_platform.cl"
+
+/*
+
+MQ Coder
+========
+
+Arithmetic codes the (CX,D) pairs of the bit plane coder (ITU-T Rec. T.800, Annex C),
+one code block per work item.
+
+A. Input
+
+blockInfo, workList and cxd as written by oclbpc.cl; each pair is one byte, (CX << 1) | D.
+Work item i codes entry i of the work lists, which hold blocksPerChannel entries per channel,
+of which workListCounts[channel] are used. A block with a pass that did not fit into cxdCapacity is not coded.
+
+B. Probability States
+
+State i with more probable symbol mps is stored at index 2 * i + mps, so that
+a switch of the MPS is part of the next state index.
+
+C. Output
+
+Each block is coded into its own reservation in scratch, allocated from scratchHead: one byte for
+the virtual byte that precedes the code word, one byte per pair, and MQ_SCRATCH_SLACK bytes for the flush.
+The finished code word is then copied to codewords, at an offset allocated from codewordHead,
+so that only code words, packed together, need to be read back.
+
+mqInfo holds MQ_INFO_SIZE values per work list entry: offset in codewords, code word length,
+number of bit planes, number of coding passes, the truncation length of each pass, then
+the distortion reduction of each pass, copied from blockInfo.
+A block whose code word does not fit into its reservation has length MQ_BLOCK_OVERFLOW.
+
+*/
+
+// must match oclbpc.cl
+#define MAX_BIT_PLANES 16
+#define MAX_PASSES (3 * MAX_BIT_PLANES - 2)
+#define BLOCK_INFO_SIZE (2 + 3 * MAX_PASSES)
+#define BLOCK_INFO_DISTORTION (2 + 2 * MAX_PASSES)
+
+#define MQ_INFO_SIZE (4 + 2 * MAX_PASSES)
+#define MQ_INFO_DISTORTION (4 + MAX_PASSES)
+#define MQ_SCRATCH_SLACK 16
+#define MQ_BLOCK_OVERFLOW 0xFFFFFFFF
+
+#define NUM_CONTEXTS 19
+#define CX_ZC_FIRST 0
+#define CX_RUN_LENGTH 17
+#define CX_UNIFORM 18
+
+// probability estimation (ITU-T Rec. T.800, Table C.2)
+CONSTANT ushort qeTable[] = {
+	0x5601, 0x5601, 0x3401, 0x3401, 0x1801, 0x1801, 0x0ac1, 0x0ac1, 0x0521, 0x0521,
+	0x0221, 0x0221, 0x5601, 0x5601, 0x5401, 0x5401, 0x4801, 0x4801, 0x3801, 0x3801,
+	0x3001, 0x3001, 0x2401, 0x2401, 0x1c01, 0x1c01, 0x1601, 0x1601, 0x5601, 0x5601,
+	0x5401, 0x5401, 0x5101, 0x5101, 0x4801, 0x4801, 0x3801, 0x3801, 0x3401, 0x3401,
+	0x3001, 0x3001, 0x2801, 0x2801, 0x2401, 0x2401, 0x2201, 0x2201, 0x1c01, 0x1c01,
+	0x1801, 0x1801, 0x1601, 0x1601, 0x1401, 0x1401, 0x1201, 0x1201, 0x1101, 0x1101,
+	0x0ac1, 0x0ac1, 0x09c1, 0x09c1, 0x08a1, 0x08a1, 0x0521, 0x0521, 0x0441, 0x0441,
+	0x02a1, 0x02a1, 0x0221, 0x0221, 0x0141, 0x0141, 0x0111, 0x0111, 0x0085, 0x0085,
+	0x0049, 0x0049, 0x0025, 0x0025, 0x0015, 0x0015, 0x0009, 0x0009, 0x0005, 0x0005,
+	0x0001, 0x0001, 0x5601, 0x5601
+};
+
+CONSTANT uchar nmpsTable[] = {
+	2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 76, 77, 14, 15, 16, 17,
+	18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 58, 59, 30, 31, 32, 33,
+	34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49,
+	50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65,
+	66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81,
+	82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 90, 91, 92, 93
+};
+
+CONSTANT uchar nlpsTable[] = {
+	3, 2, 12, 13, 18, 19, 24, 25, 58, 59, 66, 67, 13, 12, 28, 29,
+	28, 29, 28, 29, 34, 35, 36, 37, 40, 41, 42, 43, 29, 28, 28, 29,
+	30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 38, 39, 40, 41, 42, 43,
+	44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59,
+	60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75,
+	76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 92, 93
+};
+
+typedef struct {
+	uint a;
+	uint c;
+	uint ct;
+	uint bp;			// index of byte B in buf; buf[0] is the virtual byte before the code word
+	uint end;			// size of buf
+	bool overflow;
+	GLOBAL uchar* buf;
+	uchar contexts[NUM_CONTEXTS];
+} mq_coder_t;
+
+inline void mqInit(mq_coder_t* mq, GLOBAL uchar* buf, uint end) {
+	mq->a = 0x8000;
+	mq->c = 0;
+	mq->ct = 12;
+	mq->bp = 0;
+	mq->end = end;
+	mq->overflow = false;
+	mq->buf = buf;
+	buf[0] = 0;
+	for (uint cx = 0; cx < NUM_CONTEXTS; ++cx)
+		mq->contexts[cx] = 0;
+	// initial states (ITU-T Rec. T.800, Table D.7)
+	mq->contexts[CX_ZC_FIRST] = 2 * 4;
+	mq->contexts[CX_RUN_LENGTH] = 2 * 3;
+	mq->contexts[CX_UNIFORM] = 2 * 46;
+}
+
+inline void mqPutByte(mq_coder_t* mq, uint value) {
+	if (mq->bp + 1 >= mq->end) {
+		mq->overflow = true;
+		return;
+	}
+	mq->buf[++mq->bp] = (uchar)value;
+}
+
+inline void mqByteOut(mq_coder_t* mq) {
+	uint b = mq->buf[mq->bp];
+	if (b == 0xFF) {
+		// bit stuffing: the byte after 0xFF carries seven bits
+		mqPutByte(mq, mq->c >> 20);
+		mq->c &= 0xFFFFF;
+		mq->ct = 7;
+		return;
+	}
+	if (mq->c & 0x8000000) {
+		// propagate carry into B
+		b++;
+		mq->buf[mq->bp] = (uchar)b;
+		mq->c &= 0x7FFFFFF;
+		if (b == 0xFF) {
+			mqPutByte(mq, mq->c >> 20);
+			mq->c &= 0xFFFFF;
+			mq->ct = 7;
+			return;
+		}
+	}
+	mqPutByte(mq, mq->c >> 19);
+	mq->c &= 0x7FFFF;
+	mq->ct = 8;
+}
+
+inline void mqRenormalize(mq_coder_t* mq) {
+	do {
+		mq->a <<= 1;
+		mq->c <<= 1;
+		if (--mq->ct == 0)
+			mqByteOut(mq);
+	} while ((mq->a & 0x8000) == 0);
+}
+
+inline void mqEncode(mq_coder_t* mq, uint cx, uint d) {
+	uint state = mq->contexts[cx];
+	uint qe = qeTable[state];
+	mq->a -= qe;
+	if ((state & 1) == d) {
+		// MPS
+		if (mq->a & 0x8000) {
+			mq->c += qe;
+			return;
+		}
+		if (mq->a < qe)
+			mq->a = qe;
+		else
+			mq->c += qe;
+		mq->contexts[cx] = nmpsTable[state];
+	} else {
+		// LPS
+		if (mq->a < qe)
+			mq->c += qe;
+		else
+			mq->a = qe;
+		mq->contexts[cx] = nlpsTable[state];
+	}
+	mqRenormalize(mq);
+}
+
+// terminate the code word, and return its length, which excludes the virtual byte
+inline uint mqFlush(mq_coder_t* mq) {
+	// set as many trailing bits of C to one as possible (SETBITS)
+	uint temp = mq->c + mq->a;
+	mq->c |= 0xFFFF;
+	if (mq->c >= temp)
+		mq->c -= 0x8000;
+	mq->c <<= mq->ct;
+	mqByteOut(mq);
+	mq->c <<= mq->ct;
+	mqByteOut(mq);
+	// a trailing 0xFF is implied by the decoder
+	return mq->buf[mq->bp] == 0xFF ? mq->bp - 1 : mq->bp;
+}
+
+void KERNEL run(GLOBAL const uint* blockInfo,
+				GLOBAL const uint2* workList,
+				GLOBAL const uint* workListCounts,
+				const unsigned int blocksPerChannel,
+				const unsigned int numEntries,
+				GLOBAL const uchar* cxd,
+				const unsigned int cxdCapacity,
+				GLOBAL uchar* scratch,
+				GLOBAL uint* scratchHead,
+				const unsigned int scratchCapacity,
+				GLOBAL uint* mqInfo,
+				GLOBAL uchar* codewords,
+				GLOBAL uint* codewordHead) {
+	const uint entry = getGlobalId(0);
+	if (entry >= numEntries || entry % blocksPerChannel >= workListCounts[entry / blocksPerChannel])
+		return;
+	GLOBAL const uint* in = blockInfo + workList[entry].x * BLOCK_INFO_SIZE;
+	GLOBAL uint* out = mqInfo + entry * MQ_INFO_SIZE;
+	const uint numPasses = in[1];
+	out[0] = 0;
+	out[1] = 0;
+	out[2] = in[0];
+	out[3] = numPasses;
+	if (!numPasses)
+		return;
+	for (uint pass = 0; pass < numPasses; ++pass)
+		out[MQ_INFO_DISTORTION + pass] = in[BLOCK_INFO_DISTORTION + pass];
+
+	uint numPairs = 0;
+	for (uint pass = 0; pass < numPasses; ++pass) {
+		if (in[2 + 2 * pass] + in[3 + 2 * pass] > cxdCapacity) {
+			out[1] = MQ_BLOCK_OVERFLOW;
+			return;
+		}
+		numPairs += in[3 + 2 * pass];
+	}
+	const uint reserve = 1 + numPairs + MQ_SCRATCH_SLACK;
+	const uint start = atomic_add(scratchHead, reserve);
+	if (start + reserve > scratchCapacity) {
+		out[1] = MQ_BLOCK_OVERFLOW;
+		return;
+	}
+
+	mq_coder_t mq;
+	mqInit(&mq, scratch + start, reserve);
+	GLOBAL uint* rates = out + 4;
+	for (uint pass = 0; pass < numPasses; ++pass) {
+		GLOBAL const uchar* pairs = cxd + in[2 + 2 * pass];
+		const uint count = in[3 + 2 * pass];
+		for (uint i = 0; i < count; ++i) {
+			uint pair = pairs[i];
+			mqEncode(&mq, pair >> 1, pair & 1);
+		}
+		// bytes up to and including B, plus three for the bits still held in C
+		rates[pass] = mq.bp + 3;
+	}
+	const uint length = mqFlush(&mq);
+	if (mq.overflow) {
+		out[1] = MQ_BLOCK_OVERFLOW;
+		return;
+	}
+
+	// a truncation point may not end on 0xFF, and none may be beyond the end of the code word;
+	// the last pass is terminated
+	GLOBAL const uchar* word = mq.buf + 1;
+	uint previous = 0;
+	for (uint pass = 0; pass < numPasses; ++pass) {
+		uint rate = pass == numPasses - 1 ? length : min(rates[pass], length);
+		if (rate > previous && word[rate - 1] == 0xFF)
+			rate--;
+		rate = max(rate, previous);
+		rates[pass] = rate;
+		previous = rate;
+	}
+
+	const uint offset = length ? atomic_add(codewordHead, length) : 0;
+	for (uint i = 0; i < length; ++i)
+		codewords[offset + i] = word[i];
+	out[0] = offset;
+	out[1] = length;
+}
@@ -20,22 +20,28 @@
 CONSTANT sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE  | CLK_FILTER_NEAREST;
 
 
-void KERNEL run(read_only image2d_t idata, const unsigned int  width, const unsigned int height, 
-						write_only image2d_t R,
-						 write_only image2d_t G, 
-						 write_only image2d_t B,
-						 write_only image2d_t A ) {
-
-        int x = getLocalId(0) + getGroupId(0) * WIN_SIZE_X;
-		int y = getLocalId(1) + getGroupId(1) * WIN_SIZE_Y;
+void KERNEL run(KERNEL_IMAGE_RO(idata), const unsigned int  width, const unsigned int height, 
+						KERNEL_IMAGE_WO(R),
+						 KERNEL_IMAGE_WO(G), 
+						 KERNEL_IMAGE_WO(B),
+						 KERNEL_IMAGE_WO(A) BUFFER_IMAGE_ARGS) {
+		BIND_IMAGE(idata, width, height, 4);
+		BIND_IMAGE(R, width, height, 1);
+		BIND_IMAGE(G, width, height, 1);
+		BIND_IMAGE(B, width, height, 1);
+		BIND_IMAGE(A, width, height, 1);
+
+        // global size is rounded up to a multiple of the work group size
+        int x = getGlobalId(0);
+		int y = getGlobalId(1);
 		if (x >=width || y >= height)
 			return;
 		int2 pos = (int2)(x,y);
-		int4 pix = read_imagei(idata, sampler, pos);
-		write_imagei(R,pos, (int4)(pix.x,0,0,0));
-		write_imagei(G,pos, (int4)(pix.y,0,0,0));
-		write_imagei(B,pos, (int4)(pix.z,0,0,0));
-		write_imagei(A,pos, (int4)(pix.w,0,0,0));
+		int4 pix = readImageI(idata, pos);
+		writeImageI(R,pos, (int4)(pix.x,0,0,0));
+		writeImageI(G,pos, (int4)(pix.y,0,0,0));
+		writeImageI(B,pos, (int4)(pix.z,0,0,0));
+		writeImageI(A,pos, (int4)(pix.w,0,0,0));
 
 
 }
\ No newline at end of file
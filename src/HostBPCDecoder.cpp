@@ -0,0 +1,239 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostBPCDecoder.h"
+#include <algorithm>
+
+// contexts, as numbered in oclbpc.cl
+static const unsigned int CX_SIGN_FIRST = 9;
+static const unsigned int CX_REFINE_FIRST = 14;
+static const unsigned int CX_RUN_LENGTH = 17;
+static const unsigned int CX_UNIFORM = 18;
+
+static const size_t STRIPE_HEIGHT = 4;
+
+// state of a sample
+static const unsigned char SIGNIFICANT_F = 0x1;
+static const unsigned char CODED_F = 0x2;       // coded in the significance pass of the current bit plane
+static const unsigned char REFINED_F = 0x4;     // refined in an earlier bit plane
+static const unsigned char SIGN_F = 0x8;
+
+// magnitude of a sample that becomes significant in bit plane bp, at the middle of its interval
+static inline unsigned int significantMagnitude(int bp) {
+    return bp ? (3u << (bp - 1)) : 1;
+}
+
+static inline int signContribution(unsigned char s) {
+    return (s & SIGNIFICANT_F) ? ((s & SIGN_F) ? -1 : 1) : 0;
+}
+
+static inline int clampSign(int s) {
+    return s < -1 ? -1 : (s > 1 ? 1 : s);
+}
+
+HostBPCDecoder::HostBPCDecoder(void) : width(0),
+    height(0),
+    stride(0),
+    orientation(0)
+{
+}
+
+inline void HostBPCDecoder::neighbours(size_t idx, unsigned int& h, unsigned int& v, unsigned int& d) const {
+    const unsigned char* s = &state[idx];
+    h = (s[-1] & SIGNIFICANT_F) + (s[1] & SIGNIFICANT_F);
+    v = (s[-(int)stride] & SIGNIFICANT_F) + (s[stride] & SIGNIFICANT_F);
+    d = (s[-(int)stride - 1] & SIGNIFICANT_F) + (s[-(int)stride + 1] & SIGNIFICANT_F) +
+        (s[stride - 1] & SIGNIFICANT_F) + (s[stride + 1] & SIGNIFICANT_F);
+}
+
+inline bool HostBPCDecoder::anySignificantNeighbour(size_t idx) const {
+    unsigned int h, v, d;
+    neighbours(idx, h, v, d);
+    return (h + v + d) != 0;
+}
+
+// ITU-T Rec. T.800, Table D.1; as zeroCodingContext in oclbpc.cl
+unsigned int HostBPCDecoder::zeroCodingContext(size_t idx) const {
+    unsigned int h, v, d;
+    neighbours(idx, h, v, d);
+    if (orientation == 3) {
+        unsigned int hv = h + v;
+        if (d >= 3)
+            return 8;
+        if (d == 2)
+            return hv >= 1 ? 7 : 6;
+        if (d == 1)
+            return hv >= 2 ? 5 : (hv == 1 ? 4 : 3);
+        return hv >= 2 ? 2 : hv;
+    }
+    if (orientation == 1) {
+        unsigned int tmp = h;
+        h = v;
+        v = tmp;
+    }
+    if (h == 2)
+        return 8;
+    if (h == 1)
+        return v >= 1 ? 7 : (d >= 1 ? 6 : 5);
+    if (v >= 1)
+        return 2 + v;
+    return d >= 2 ? 2 : d;
+}
+
+// ITU-T Rec. T.800, Table D.3: the decoded bit is the sign XOR X^
+void HostBPCDecoder::decodeSign(size_t idx, size_t sample, int bp) {
+    unsigned char* s = &state[idx];
+    int h = clampSign(signContribution(s[-1]) + signContribution(s[1]));
+    int v = clampSign(signContribution(s[-(int)stride]) + signContribution(s[stride]));
+    unsigned int xorBit = (h < 0 || (h == 0 && v < 0)) ? 1 : 0;
+    if (xorBit) {
+        h = -h;
+        v = -v;
+    }
+    unsigned int cx = (h == 0) ? CX_SIGN_FIRST + (unsigned int)(v < 0 ? -v : v) : (unsigned int)(CX_SIGN_FIRST + 3 + v);
+    unsigned int sign = mq.decode(cx) ^ xorBit;
+    *s |= SIGNIFICANT_F | (sign ? SIGN_F : 0);
+    magnitudes[sample] = significantMagnitude(bp);
+}
+
+void HostBPCDecoder::decodeSample(size_t idx, size_t sample, int bp) {
+    if (mq.decode(zeroCodingContext(idx)))
+        decodeSign(idx, sample, bp);
+}
+
+void HostBPCDecoder::significancePass(int bp) {
+    for (size_t y0 = 0; y0 < height; y0 += STRIPE_HEIGHT) {
+        size_t rows = std::min(STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            size_t idx = (y0 + 1) * stride + x + 1;
+            size_t sample = y0 * width + x;
+            for (size_t r = 0; r < rows; ++r, idx += stride, sample += width) {
+                if ((state[idx] & SIGNIFICANT_F) || !anySignificantNeighbour(idx))
+                    continue;
+                state[idx] |= CODED_F;
+                decodeSample(idx, sample, bp);
+            }
+        }
+    }
+}
+
+void HostBPCDecoder::refinementPass(int bp) {
+    unsigned int half = bp ? 1u << (bp - 1) : 0;
+    for (size_t y0 = 0; y0 < height; y0 += STRIPE_HEIGHT) {
+        size_t rows = std::min(STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            size_t idx = (y0 + 1) * stride + x + 1;
+            size_t sample = y0 * width + x;
+            for (size_t r = 0; r < rows; ++r, idx += stride, sample += width) {
+                unsigned char s = state[idx];
+                if ((s & (SIGNIFICANT_F | CODED_F)) != SIGNIFICANT_F)
+                    continue;
+                // Table D.4
+                unsigned int cx = (s & REFINED_F) ? CX_REFINE_FIRST + 2 : CX_REFINE_FIRST + (anySignificantNeighbour(idx) ? 1 : 0);
+                unsigned int bit = mq.decode(cx);
+                // bit bp held the half of the interval of the bit plane above
+                unsigned int& mag = magnitudes[sample];
+                mag = ((mag >> (bp + 1)) << (bp + 1)) | (bit << bp) | half;
+                state[idx] = s | REFINED_F;
+            }
+        }
+    }
+}
+
+void HostBPCDecoder::cleanupPass(int bp) {
+    for (size_t y0 = 0; y0 < height; y0 += STRIPE_HEIGHT) {
+        size_t rows = std::min(STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            size_t idx = (y0 + 1) * stride + x + 1;
+            size_t sample = y0 * width + x;
+            size_t r = 0;
+            if (rows == STRIPE_HEIGHT) {
+                // run length coding: four uncoded samples, none with a significant neighbour
+                bool run = true;
+                for (size_t i = 0; i < STRIPE_HEIGHT && run; ++i) {
+                    size_t j = idx + i * stride;
+                    run = !(state[j] & (SIGNIFICANT_F | CODED_F)) && !anySignificantNeighbour(j);
+                }
+                if (run) {
+                    if (!mq.decode(CX_RUN_LENGTH)) {
+                        // the whole column stays insignificant
+                        continue;
+                    }
+                    r = mq.decode(CX_UNIFORM) << 1;
+                    r |= mq.decode(CX_UNIFORM);
+                    decodeSign(idx + r * stride, sample + r * width, bp);
+                    r++;
+                }
+            }
+            for (; r < rows; ++r) {
+                size_t j = idx + r * stride;
+                if (!(state[j] & (SIGNIFICANT_F | CODED_F)))
+                    decodeSample(j, sample + r * width, bp);
+            }
+            for (r = 0; r < rows; ++r)
+                state[idx + r * stride] &= ~CODED_F;
+        }
+    }
+}
+
+void HostBPCDecoder::decode(const HostCodeBlockCodeword& codeword, const OCLCodeBlock& block, short* dst, size_t rowPitch, size_t pixelPitch) {
+    width = (size_t)block.width;
+    height = (size_t)block.height;
+    stride = width + 2;
+    orientation = block.orientation;
+    magnitudes.assign(width * height, 0);
+
+    bool coded = codeword.numPasses && codeword.numBitPlanes;
+    if (coded) {
+        state.assign(stride * (height + 2), 0);
+        const HostCodeBlockSegment* segments = codeword.segments.empty() ? NULL : &codeword.segments[0];
+        if (codeword.segments.size() == 1) {
+            mq.init(segments[0].data, segments[0].length);
+        } else {
+            bytes.clear();
+            for (size_t i = 0; i < codeword.segments.size(); ++i)
+                bytes.insert(bytes.end(), segments[i].data, segments[i].data + segments[i].length);
+            mq.init(bytes.empty() ? NULL : &bytes[0], bytes.size());
+        }
+
+        // the most significant bit plane only has a cleanup pass
+        int bp = (int)codeword.numBitPlanes - 1;
+        cleanupPass(bp);
+        size_t pass = 1;
+        while (pass < codeword.numPasses && --bp >= 0) {
+            significancePass(bp);
+            if (++pass == codeword.numPasses)
+                break;
+            refinementPass(bp);
+            if (++pass == codeword.numPasses)
+                break;
+            cleanupPass(bp);
+            ++pass;
+        }
+    }
+
+    for (size_t y = 0; y < height; ++y) {
+        short* row = dst + y * rowPitch;
+        const unsigned int* mag = &magnitudes[y * width];
+        const unsigned char* s = coded ? &state[(y + 1) * stride + 1] : NULL;
+        for (size_t x = 0; x < width; ++x, row += pixelPitch) {
+            int val = (int)std::min(mag[x], 0x8000u);
+            if (s && (s[x] & SIGN_F))
+                val = -val;
+            *row = (short)std::min(val, 0x7FFF);
+        }
+    }
+}
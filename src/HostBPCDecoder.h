@@ -0,0 +1,59 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostMQDecoder.h"
+#include "HostTier2Decoder.h"
+#include "OCLBPC.h"
+#include <vector>
+
+/*
+Bit plane decoder (ITU-T Rec. T.800, Annex D): the inverse of the bit plane coder of oclbpc.cl.
+
+Samples are decoded serially in the scan order of the standard: stripes of four rows from top to bottom,
+columns left to right within a stripe. Each decoded bit plane of a sample adds half of the remaining
+interval, so that a code word truncated after any pass reconstructs at the middle of what is known,
+and a complete one reconstructs exactly.
+*/
+class HostBPCDecoder
+{
+public:
+    HostBPCDecoder(void);
+    // Decode codeword, the code word of block, into coefficients: sample (x, y) of the block goes to
+    // dst[y * rowPitch + x * pixelPitch]. Blocks without passes are zero
+    void decode(const HostCodeBlockCodeword& codeword, const OCLCodeBlock& block, short* dst, size_t rowPitch, size_t pixelPitch);
+private:
+    void significancePass(int bp);
+    void refinementPass(int bp);
+    void cleanupPass(int bp);
+    // zero coding of the insignificant sample at state index idx, and its sign if it becomes significant
+    void decodeSample(size_t idx, size_t sample, int bp);
+    void decodeSign(size_t idx, size_t sample, int bp);
+    // number of significant neighbours of each kind
+    inline void neighbours(size_t idx, unsigned int& h, unsigned int& v, unsigned int& d) const;
+    inline bool anySignificantNeighbour(size_t idx) const;
+    unsigned int zeroCodingContext(size_t idx) const;
+
+    HostMQDecoder mq;
+    size_t width;
+    size_t height;
+    size_t stride;          // of the state, which has a border of one sample on each side
+    int orientation;
+    std::vector<unsigned char> state;
+    std::vector<unsigned int> magnitudes;   // width x height, with the half of the remaining interval added
+    std::vector<unsigned char> bytes;       // code word split over several packets, joined
+};
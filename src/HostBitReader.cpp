@@ -0,0 +1,56 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostBitReader.h"
+
+HostBitReader::HostBitReader(const unsigned char* data, size_t size) : data(data),
+    size(size),
+    pos(0),
+    byte(0),
+    numBits(0),
+    pastEnd(false)
+{
+}
+
+unsigned int HostBitReader::readBit() {
+    if (!numBits) {
+        if (pos >= size) {
+            pastEnd = true;
+            return 0;
+        }
+        numBits = (byte == 0xFF) ? 7 : 8;
+        byte = data[pos++];
+    }
+    return (byte >> --numBits) & 1;
+}
+
+unsigned int HostBitReader::readBits(size_t numBits) {
+    unsigned int val = 0;
+    for (size_t i = 0; i < numBits; ++i)
+        val = (val << 1) | readBit();
+    return val;
+}
+
+void HostBitReader::align() {
+    numBits = 0;
+    if (byte == 0xFF) {
+        if (pos < size)
+            pos++;
+        else
+            pastEnd = true;
+        byte = 0;
+    }
+}
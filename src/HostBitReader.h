@@ -0,0 +1,51 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+Bit reader for packet headers (ITU-T Rec. T.800, B.10.1), the inverse of HostBitWriter.
+
+A byte that follows 0xFF only holds 7 bits; its most significant bit is the stuffed zero, and is skipped.
+Reading past the end returns zeros and sets the overrun flag, so that a truncated header
+is detected once, after it has been read, rather than on every bit.
+*/
+class HostBitReader
+{
+public:
+    HostBitReader(const unsigned char* data, size_t size);
+    unsigned int readBit();
+    // numBits bits, most significant first
+    unsigned int readBits(size_t numBits);
+    // skip to the end of the header: the rest of the last byte, and the zero byte that follows 0xFF
+    void align();
+    // bytes consumed
+    size_t position() const {
+        return pos;
+    }
+    bool overrun() const {
+        return pastEnd;
+    }
+private:
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    unsigned int byte;      // last byte read
+    size_t numBits;         // bits of byte still to be read
+    bool pastEnd;
+};
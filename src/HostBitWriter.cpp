@@ -0,0 +1,51 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostBitWriter.h"
+
+HostBitWriter::HostBitWriter(HostOutputArena* output) : output(output),
+    byte(0),
+    numBits(0),
+    capacity(8)
+{
+}
+
+void HostBitWriter::emit() {
+    output->writeByte((unsigned char)byte);
+    capacity = (byte == 0xFF) ? 7 : 8;
+    byte = 0;
+    numBits = 0;
+}
+
+void HostBitWriter::writeBit(unsigned int bit) {
+    byte = (byte << 1) | (bit & 1);
+    if (++numBits == capacity)
+        emit();
+}
+
+void HostBitWriter::writeBits(unsigned int val, size_t numBits) {
+    for (size_t i = numBits; i > 0; --i)
+        writeBit(val >> (i - 1));
+}
+
+void HostBitWriter::flush() {
+    if (numBits) {
+        byte <<= capacity - numBits;
+        emit();
+    }
+    if (capacity == 7)
+        emit();
+}
@@ -0,0 +1,42 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostOutputArena.h"
+
+/*
+Bit writer for packet headers (ITU-T Rec. T.800, B.10.1).
+
+Bits are packed from the most significant bit. A byte that follows 0xFF only holds 7 bits,
+with a zero stuffed into its most significant bit, so that no marker can appear in a header.
+*/
+class HostBitWriter
+{
+public:
+    HostBitWriter(HostOutputArena* output);
+    void writeBit(unsigned int bit);
+    // the numBits least significant bits of val, most significant first
+    void writeBits(unsigned int val, size_t numBits);
+    // pad the last byte with zeros; a header ending in 0xFF gets a zero byte appended
+    void flush();
+private:
+    void emit();
+    HostOutputArena* output;
+    unsigned int byte;
+    size_t numBits;         // bits in byte
+    size_t capacity;        // 7 after 0xFF, else 8
+};
@@ -0,0 +1,247 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include "HostDWTForward.h"
+#include "HostLifting.h"
+#include <math.h>
+#include <string.h>
+
+template<typename T> HostDWTForward<T>::HostDWTForward(bool lossy, bool scalarReference) : lossy(lossy),
+    scalarReference(scalarReference),
+    floatOutput(false),
+    rowPitch(0)
+{
+}
+
+template<typename T> HostDWTForward<T>::~HostDWTForward(void)
+{
+}
+
+// 1D transform along a row of contiguous samples, in place: lo samples first, then hi samples
+static void forwardRow(float* data, float* scratch, size_t n) {
+    size_t nLo = (n + 1) >> 1;
+    size_t nHi = n >> 1;
+    float* lo = scratch;
+    float* hi = scratch + nLo;
+    for (size_t i = 0; i < nHi; ++i) {
+        lo[i] = data[2*i];
+        hi[i] = data[2*i + 1];
+    }
+    if (nLo > nHi)
+        lo[nLo - 1] = data[n - 1];
+    forward97(lo, hi, nLo, nHi);
+    memcpy(data, scratch, n * sizeof(float));
+}
+
+static void forwardRow(int* data, int* scratch, size_t n) {
+    size_t nLo = (n + 1) >> 1;
+    size_t nHi = n >> 1;
+    int* lo = scratch;
+    int* hi = scratch + nLo;
+    for (size_t i = 0; i < nHi; ++i) {
+        lo[i] = data[2*i];
+        hi[i] = data[2*i + 1];
+    }
+    if (nLo > nHi)
+        lo[nLo - 1] = data[n - 1];
+    forward53(lo, hi, nLo, nHi);
+    memcpy(data, scratch, n * sizeof(int));
+}
+
+// vertical transform of rows 0..h, in place, rows still interleaved (even rows low, odd rows high).
+// Lifting steps work on whole rows at a time, so they vectorize along x
+static void forwardColumns(float* data, size_t stride, size_t w, size_t h) {
+    if (h < 2)
+        return;
+    const float steps[4] = {LIFT97_P1, LIFT97_U1, LIFT97_P2, LIFT97_U2};
+    for (int s = 0; s < 4; ++s) {
+        bool predict = (s & 1) == 0;
+        for (size_t y = predict ? 1 : 0; y < h; y += 2) {
+            // symmetric extension: row -1 mirrors to row 1, row h mirrors to row h-2
+            size_t above = (y == 0) ? 1 : y - 1;
+            size_t below = (y + 1 < h) ? y + 1 : h - 2;
+            liftAdd(data + y * stride, data + above * stride, data + below * stride, w, steps[s]);
+        }
+    }
+    for (size_t y = 0; y < h; ++y)
+        liftScale(data + y * stride, w, (y & 1) ? LIFT97_SCALE_MUL : LIFT97_SCALE_DIV);
+}
+
+static void forwardColumns(int* data, size_t stride, size_t w, size_t h) {
+    if (h < 2)
+        return;
+    for (size_t y = 1; y < h; y += 2) {
+        size_t below = (y + 1 < h) ? y + 1 : h - 2;
+        liftPredict53(data + y * stride, data + (y - 1) * stride, data + below * stride, w);
+    }
+    for (size_t y = 0; y < h; y += 2) {
+        size_t above = (y == 0) ? 1 : y - 1;
+        size_t below = (y + 1 < h) ? y + 1 : h - 2;
+        liftUpdate53(data + y * stride, data + above * stride, data + below * stride, w);
+    }
+}
+
+// sample i of a signal of n >= 2 samples, under whole-sample symmetric extension
+static size_t mirror(ptrdiff_t i, size_t n) {
+    ptrdiff_t period = 2 * ((ptrdiff_t)n - 1);
+    i %= period;
+    if (i < 0)
+        i += period;
+    return (size_t)(i < (ptrdiff_t)n ? i : period - i);
+}
+
+// Scalar reference: 1D transform of the n samples x[0], x[stride], ..., in place, left interleaved.
+// Operations are done in the same order as the vectorized lifting, so results are bit-identical
+static void referenceLift(float* x, size_t n, size_t stride) {
+    if (n < 2)
+        return;
+    const float steps[4] = {LIFT97_P1, LIFT97_U1, LIFT97_P2, LIFT97_U2};
+    for (int s = 0; s < 4; ++s) {
+        // predict steps update the odd samples, and update steps the even ones
+        for (size_t i = (s & 1) ? 0 : 1; i < n; i += 2)
+            x[i * stride] += steps[s] * (x[mirror((ptrdiff_t)i - 1, n) * stride] + x[mirror((ptrdiff_t)i + 1, n) * stride]);
+    }
+    for (size_t i = 0; i < n; ++i)
+        x[i * stride] *= (i & 1) ? LIFT97_SCALE_MUL : LIFT97_SCALE_DIV;
+}
+
+static void referenceLift(int* x, size_t n, size_t stride) {
+    if (n < 2)
+        return;
+    for (size_t i = 1; i < n; i += 2)
+        x[i * stride] -= (x[mirror((ptrdiff_t)i - 1, n) * stride] + x[mirror((ptrdiff_t)i + 1, n) * stride]) >> 1;
+    for (size_t i = 0; i < n; i += 2)
+        x[i * stride] += (x[mirror((ptrdiff_t)i - 1, n) * stride] + x[mirror((ptrdiff_t)i + 1, n) * stride] + 2) >> 2;
+}
+
+// One level of the 2D transform on the top left w x h region;
+// plane is scratch space for at least w x h samples.
+// Columns are lifted before rows, as in 2D_SD of T.800 (F.4.2): the 5/3 lifting steps round,
+// so only this order is undone exactly by a conforming decoder
+template<typename T> template<typename U> void HostDWTForward<T>::transform2D(U* data, U* plane, size_t stride, size_t w, size_t h) {
+    size_t wLo = (w + 1) >> 1;
+    size_t hLo = (h + 1) >> 1;
+    if (scalarReference) {
+        for (size_t x = 0; x < w; ++x)
+            referenceLift(data + x, h, stride);
+        for (size_t y = 0; y < h; ++y)
+            referenceLift(data + y * stride, w, 1);
+
+        // deinterleave columns and rows together
+        for (size_t y = 0; y < h; ++y) {
+            size_t outY = (y & 1) ? hLo + (y >> 1) : (y >> 1);
+            for (size_t x = 0; x < w; ++x) {
+                size_t outX = (x & 1) ? wLo + (x >> 1) : (x >> 1);
+                plane[outX + outY * w] = data[x + y * stride];
+            }
+        }
+    } else {
+        forwardColumns(data, stride, w, h);
+        for (size_t y = 0; y < h; ++y)
+            forwardRow(data + y * stride, plane, w);
+
+        // deinterleave rows: low rows to the top half, high rows to the bottom half
+        for (size_t y = 0; y < h; ++y) {
+            size_t outY = (y & 1) ? hLo + (y >> 1) : (y >> 1);
+            memcpy(plane + outY * w, data + y * stride, w * sizeof(U));
+        }
+    }
+    for (size_t y = 0; y < h; ++y)
+        memcpy(data + y * stride, plane + y * w, w * sizeof(U));
+}
+
+template<typename T> void HostDWTForward<T>::runComponent53(T* component, size_t comp, size_t numComponents, size_t w, size_t h, size_t levels) {
+    for (size_t i = 0; i < w * h; ++i)
+        workInt[i] = (int)component[i];
+
+    size_t levelW = w, levelH = h;
+    for (size_t level = 0; level < levels && levelW > 0 && levelH > 0; ++level) {
+        transform2D(&workInt[0], &planeInt[0], w, levelW, levelH);
+        levelW = (levelW + 1) >> 1;
+        levelH = (levelH + 1) >> 1;
+    }
+
+    int16_t* out = (int16_t*)&output[0];
+    for (size_t i = 0; i < w * h; ++i)
+        out[i * numComponents + comp] = (int16_t)workInt[i];
+}
+
+template<typename T> void HostDWTForward<T>::runComponent97(T* component, size_t comp, size_t numComponents, size_t w, size_t h, size_t levels, const std::vector<float>& quant) {
+    for (size_t i = 0; i < w * h; ++i)
+        workFloat[i] = (float)component[i];
+
+    size_t levelW = w, levelH = h;
+    for (size_t level = 0; level < levels && levelW > 0 && levelH > 0; ++level) {
+        transform2D(&workFloat[0], &planeFloat[0], w, levelW, levelH);
+        levelW = (levelW + 1) >> 1;
+        levelH = (levelH + 1) >> 1;
+    }
+
+    if (quant.empty()) {
+        float* out = (float*)&output[0];
+        for (size_t i = 0; i < w * h; ++i)
+            out[i * numComponents + comp] = workFloat[i];
+        return;
+    }
+
+    // dead-zone quantization, band by band: LH and HL share a factor
+    int16_t* out = (int16_t*)&output[0];
+    levelW = w;
+    levelH = h;
+    for (size_t level = 0; level < levels; ++level) {
+        size_t loW = (levelW + 1) >> 1;
+        size_t loH = (levelH + 1) >> 1;
+        bool last = (level == levels - 1);
+        for (size_t y = 0; y < levelH; ++y) {
+            for (size_t x = 0; x < levelW; ++x) {
+                bool highX = x >= loW;
+                bool highY = y >= loH;
+                if (!highX && !highY && !last)
+                    continue;
+                float q = quant[level * 3 + ((highX && highY) ? 2 : ((highX || highY) ? 1 : 0))];
+                float val = workFloat[x + y * w] * q;
+                int16_t qval = (int16_t)(val < 0 ? -floor(-val) : floor(val));
+                out[(x + y * w) * numComponents + comp] = qval;
+            }
+        }
+        levelW = loW;
+        levelH = loH;
+    }
+}
+
+template<typename T> void HostDWTForward<T>::run(std::vector<T*> components, size_t w, size_t h, size_t levels, const std::vector<float>& quant) {
+    if (components.empty() || w == 0 || h == 0 || levels == 0)
+        return;
+    size_t numComponents = components.size();
+    floatOutput = lossy && quant.empty();
+    rowPitch = w * numComponents * (floatOutput ? sizeof(float) : sizeof(int16_t));
+    output.resize(rowPitch * h);
+    if (lossy) {
+        workFloat.resize(w * h);
+        planeFloat.resize(w * h);
+    } else {
+        workInt.resize(w * h);
+        planeInt.resize(w * h);
+    }
+
+    for (size_t comp = 0; comp < numComponents; ++comp) {
+        if (lossy)
+            runComponent97(components[comp], comp, numComponents, w, h, levels, quant);
+        else
+            runComponent53(components[comp], comp, numComponents, w, h, levels);
+    }
+}
@@ -0,0 +1,71 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+Host forward DWT: multi-level 5/3 (lossless) or 9/7 (lossy) transform,
+with optional dead-zone quantization of the 9/7 sub-bands.
+
+Each level lifts columns, then rows, as T.800 Annex F requires.
+Output matches the layout of the device DWT output image: Mallat layout
+(each level's LL in the top left corner of the previous level's region),
+with components interleaved. Output samples are float for unquantized 9/7,
+and 16 bit integers otherwise.
+
+With scalarReference, each level is instead computed sample by sample from the
+lifting equations of T.800 Annex F, with explicit symmetric extension and no vector
+code. It is slow, but gives bit-identical output, so it is an oracle for the
+vectorized path and for the device kernels.
+*/
+template<typename T> class HostDWTForward
+{
+public:
+    HostDWTForward(bool lossy, bool scalarReference = false);
+    ~HostDWTForward(void);
+
+    // quant holds 3 factors (LL, LH/HL, HH) per level for quantized 9/7, and is empty otherwise
+    void run(std::vector<T*> components, size_t w, size_t h, size_t levels, const std::vector<float>& quant);
+
+    void* getOutput() {
+        return output.empty() ? NULL : &output[0];
+    }
+    // bytes per row of the output
+    size_t getRowPitch() {
+        return rowPitch;
+    }
+    bool isFloatOutput() {
+        return floatOutput;
+    }
+private:
+    void runComponent53(T* component, size_t comp, size_t numComponents, size_t w, size_t h, size_t levels);
+    void runComponent97(T* component, size_t comp, size_t numComponents, size_t w, size_t h, size_t levels, const std::vector<float>& quant);
+    template<typename U> void transform2D(U* data, U* plane, size_t stride, size_t w, size_t h);
+
+    bool lossy;
+    bool scalarReference;
+    bool floatOutput;
+    size_t rowPitch;
+    std::vector<uint8_t> output;
+    std::vector<int> workInt;
+    std::vector<float> workFloat;
+    // scratch plane of the size of the image, reused by every level
+    std::vector<int> planeInt;
+    std::vector<float> planeFloat;
+};
@@ -0,0 +1,141 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostJP2Writer.h"
+#include "J2KMarkers.h"
+#include "OCLUtil.h"
+
+// box header: length and type
+static const size_t JP2_BOX_HEADER_SIZE = 8;
+// box header with an extended length
+static const size_t JP2_BOX_HEADER_XL_SIZE = 16;
+
+HostJP2Writer::HostJP2Writer(void) : fp(NULL),
+    codestreamBytes(0),
+    failed(false)
+{
+}
+
+HostJP2Writer::~HostJP2Writer(void)
+{
+    if (fp)
+        close();
+}
+
+bool HostJP2Writer::open(std::string fileName, size_t width, size_t height, size_t numChannels, size_t precision) {
+    if (fp)
+        close();
+    name = fileName;
+    codestreamBytes = 0;
+    failed = false;
+    fp = fopen(fileName.c_str(), "wb");
+    if (!fp) {
+        LogError("Cannot write file %s", fileName.c_str());
+        return false;
+    }
+
+    HostOutputArena boxes(128);
+    boxes.writeUInt32(12);
+    boxes.writeUInt32(JP2_BOX_SIGNATURE);
+    boxes.writeUInt32(JP2_SIGNATURE);
+
+    boxes.writeUInt32(20);
+    boxes.writeUInt32(JP2_BOX_FILE_TYPE);
+    boxes.writeUInt32(JP2_BRAND);
+    boxes.writeUInt32(0);
+    boxes.writeUInt32(JP2_BRAND);
+
+    // header super box, whose length is patched once its contents are written
+    size_t header = boxes.size();
+    boxes.writeUInt32(0);
+    boxes.writeUInt32(JP2_BOX_HEADER);
+
+    boxes.writeUInt32(22);
+    boxes.writeUInt32(JP2_BOX_IMAGE_HEADER);
+    boxes.writeUInt32((unsigned int)height);
+    boxes.writeUInt32((unsigned int)width);
+    boxes.writeUInt16((unsigned int)numChannels);
+    boxes.writeByte((unsigned char)(precision - 1));
+    boxes.writeByte(7);         // compression type: JPEG 2000
+    boxes.writeByte(0);         // colour space is known
+    boxes.writeByte(0);         // no intellectual property box
+
+    // enumerated colour space
+    boxes.writeUInt32(15);
+    boxes.writeUInt32(JP2_BOX_COLOUR);
+    boxes.writeByte(1);
+    boxes.writeByte(0);
+    boxes.writeByte(0);
+    boxes.writeUInt32(numChannels < 3 ? JP2_COLOUR_GREY : JP2_COLOUR_SRGB);
+
+    if (numChannels == 2 || numChannels == 4) {
+        // colour channels, in order, then opacity of the whole image
+        boxes.writeUInt32((unsigned int)(JP2_BOX_HEADER_SIZE + 2 + 6 * numChannels));
+        boxes.writeUInt32(JP2_BOX_CHANNELS);
+        boxes.writeUInt16((unsigned int)numChannels);
+        for (size_t c = 0; c < numChannels; ++c) {
+            bool opacity = c + 1 == numChannels;
+            boxes.writeUInt16((unsigned int)c);
+            boxes.writeUInt16(opacity ? 1 : 0);
+            boxes.writeUInt16(opacity ? 0 : (unsigned int)(c + 1));
+        }
+    }
+    boxes.patchUInt32(header, (unsigned int)(boxes.size() - header));
+
+    // code stream box, with a placeholder for the extended length
+    boxes.writeUInt32(1);
+    boxes.writeUInt32(JP2_BOX_CODESTREAM);
+    const unsigned char placeholder[8] = { 0 };
+    if (fwrite(boxes.data(), 1, boxes.size(), fp) != boxes.size() || fgetpos(fp, &codestreamLength) != 0 ||
+            fwrite(placeholder, 1, sizeof(placeholder), fp) != sizeof(placeholder)) {
+        LogError("Cannot write file %s", fileName.c_str());
+        failed = true;
+    }
+    return !failed;
+}
+
+bool HostJP2Writer::write(const unsigned char* data, size_t n) {
+    if (!fp || failed)
+        return false;
+    if (n && fwrite(data, 1, n, fp) != n) {
+        LogError("Cannot write file %s", name.c_str());
+        failed = true;
+        return false;
+    }
+    codestreamBytes += n;
+    return true;
+}
+
+bool HostJP2Writer::close() {
+    if (!fp)
+        return false;
+    // errors before close() have been reported
+    bool rc = !failed;
+    if (rc) {
+        unsigned long long length = codestreamBytes + JP2_BOX_HEADER_XL_SIZE;
+        unsigned char field[8];
+        for (int i = 0; i < 8; ++i)
+            field[i] = (unsigned char)(length >> (56 - 8 * i));
+        rc = fsetpos(fp, &codestreamLength) == 0 && fwrite(field, 1, sizeof(field), fp) == sizeof(field);
+    }
+    if (fclose(fp) != 0)
+        rc = false;
+    fp = NULL;
+    if (!rc && !failed)
+        LogError("Cannot write file %s", name.c_str());
+    failed = !rc;
+    return rc;
+}
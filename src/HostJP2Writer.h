@@ -0,0 +1,54 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostOutputArena.h"
+#include <stdio.h>
+#include <string>
+
+/*
+JP2 file writer (ITU-T Rec. T.800, Annex I).
+
+open() writes the signature, file type and header boxes; the code stream then goes straight
+to the file, in as many pieces as the caller has ready, so that a large image is never held in
+memory as a whole. The length of the code stream box is only known on close(): its header is
+reserved with an extended 8 byte length, which is patched in place.
+
+Components are unsigned, as in the code stream. One or two components are greyscale, more are sRGB;
+with two or four, the last one is opacity.
+*/
+class HostJP2Writer
+{
+public:
+    HostJP2Writer(void);
+    // closes an open file
+    ~HostJP2Writer(void);
+    bool open(std::string fileName, size_t width, size_t height, size_t numChannels, size_t precision);
+    // append n bytes of the code stream
+    bool write(const unsigned char* data, size_t n);
+    bool write(const HostOutputArena& codestream) {
+        return write(codestream.data(), codestream.size());
+    }
+    // patch the code stream box length, and close the file
+    bool close();
+private:
+    FILE* fp;
+    fpos_t codestreamLength;    // extended length field of the code stream box
+    unsigned long long codestreamBytes;
+    bool failed;
+    std::string name;
+};
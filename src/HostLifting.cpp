@@ -0,0 +1,224 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "HostLifting.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HOST_LIFTING_SSE2
+#endif
+
+// AVX2 code is built whenever the compiler can emit it for single functions,
+// and used when the CPU supports it, so that default builds still get it
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HOST_LIFTING_AVX2
+#define HOST_LIFTING_AVX2_TARGET
+#elif defined(HOST_LIFTING_SSE2) && defined(__GNUC__)
+#include <immintrin.h>
+#define HOST_LIFTING_AVX2
+#define HOST_LIFTING_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(HOST_LIFTING_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#define HOST_LIFTING_AVX2
+#define HOST_LIFTING_AVX2_TARGET
+#endif
+
+#if defined(HOST_LIFTING_AVX2)
+static bool cpuHasAVX2() {
+#if defined(__AVX2__)
+    return true;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    // the OS must also save the YMM registers
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+static const bool hasAVX2 = cpuHasAVX2();
+
+// AVX2 loops return the number of samples they processed; the rest is left to the SSE2 and scalar loops
+
+HOST_LIFTING_AVX2_TARGET static size_t liftAddAVX2(float* dst, const float* a, const float* b, size_t n, float c) {
+    size_t i = 0;
+    __m256 vc = _mm256_set1_ps(c);
+    for (; i + 8 <= n; i += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(vc, sum)));
+    }
+    return i;
+}
+
+HOST_LIFTING_AVX2_TARGET static size_t liftScaleAVX2(float* dst, size_t n, float c) {
+    size_t i = 0;
+    __m256 vc = _mm256_set1_ps(c);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(vc, _mm256_loadu_ps(dst + i)));
+    return i;
+}
+
+HOST_LIFTING_AVX2_TARGET static size_t liftPredict53AVX2(int* dst, const int* a, const int* b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_sub_epi32(d, _mm256_srai_epi32(sum, 1)));
+    }
+    return i;
+}
+
+HOST_LIFTING_AVX2_TARGET static size_t liftUpdate53AVX2(int* dst, const int* a, const int* b, size_t n) {
+    size_t i = 0;
+    __m256i two = _mm256_set1_epi32(2);
+    for (; i + 8 <= n; i += 8) {
+        __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(d, _mm256_srai_epi32(_mm256_add_epi32(sum, two), 2)));
+    }
+    return i;
+}
+#endif
+
+
+void liftAdd(float* dst, const float* a, const float* b, size_t n, float c) {
+    size_t i = 0;
+#if defined(HOST_LIFTING_AVX2)
+    if (hasAVX2)
+        i = liftAddAVX2(dst, a, b, n, c);
+#endif
+#if defined(HOST_LIFTING_SSE2)
+    __m128 vc = _mm_set1_ps(c);
+    for (; i + 4 <= n; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(vc, sum)));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] += c * (a[i] + b[i]);
+}
+
+void liftScale(float* dst, size_t n, float c) {
+    size_t i = 0;
+#if defined(HOST_LIFTING_AVX2)
+    if (hasAVX2)
+        i = liftScaleAVX2(dst, n, c);
+#endif
+#if defined(HOST_LIFTING_SSE2)
+    __m128 vc = _mm_set1_ps(c);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_mul_ps(vc, _mm_loadu_ps(dst + i)));
+#endif
+    for (; i < n; ++i)
+        dst[i] *= c;
+}
+
+void liftPredict53(int* dst, const int* a, const int* b, size_t n) {
+    size_t i = 0;
+#if defined(HOST_LIFTING_AVX2)
+    if (hasAVX2)
+        i = liftPredict53AVX2(dst, a, b, n);
+#endif
+#if defined(HOST_LIFTING_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_sub_epi32(d, _mm_srai_epi32(sum, 1)));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] -= (a[i] + b[i]) >> 1;
+}
+
+void liftUpdate53(int* dst, const int* a, const int* b, size_t n) {
+    size_t i = 0;
+#if defined(HOST_LIFTING_AVX2)
+    if (hasAVX2)
+        i = liftUpdate53AVX2(dst, a, b, n);
+#endif
+#if defined(HOST_LIFTING_SSE2)
+    __m128i two = _mm_set1_epi32(2);
+    for (; i + 4 <= n; i += 4) {
+        __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(d, _mm_srai_epi32(_mm_add_epi32(sum, two), 2)));
+    }
+#endif
+    for (; i < n; ++i)
+        dst[i] += (a[i] + b[i] + 2) >> 2;
+}
+
+/*
+Boundary handling for a signal x[0..n) starting at an even sample:
+
+predict: hi[i] uses x[2i] = lo[i] and x[2i+2] = lo[i+1]; at the right edge (n even),
+         x[n] mirrors to x[n-2] = lo[nLo-1]
+update:  lo[i] uses x[2i-1] = hi[i-1] and x[2i+1] = hi[i]; at the left edge,
+         x[-1] mirrors to x[1] = hi[0], and at the right edge (n odd), x[n] mirrors to x[n-2] = hi[nHi-1]
+*/
+
+static void predict97(float* lo, float* hi, size_t nLo, size_t nHi, float c) {
+    size_t interior = nHi < nLo ? nHi : nLo - 1;
+    liftAdd(hi, lo, lo + 1, interior, c);
+    for (size_t i = interior; i < nHi; ++i)
+        hi[i] += c * (lo[i] + lo[nLo - 1]);
+}
+
+static void update97(float* lo, float* hi, size_t nLo, size_t nHi, float c) {
+    lo[0] += c * (hi[0] + hi[0]);
+    size_t interior = nLo < nHi ? nLo : nHi;
+    if (interior > 1)
+        liftAdd(lo + 1, hi, hi + 1, interior - 1, c);
+    for (size_t i = interior > 1 ? interior : 1; i < nLo; ++i)
+        lo[i] += c * (hi[nHi - 1] + hi[nHi - 1]);
+}
+
+void forward97(float* lo, float* hi, size_t nLo, size_t nHi) {
+    // a single sample is passed through unchanged
+    if (nHi == 0)
+        return;
+    predict97(lo, hi, nLo, nHi, LIFT97_P1);
+    update97(lo, hi, nLo, nHi, LIFT97_U1);
+    predict97(lo, hi, nLo, nHi, LIFT97_P2);
+    update97(lo, hi, nLo, nHi, LIFT97_U2);
+    liftScale(lo, nLo, LIFT97_SCALE_DIV);
+    liftScale(hi, nHi, LIFT97_SCALE_MUL);
+}
+
+void forward53(int* lo, int* hi, size_t nLo, size_t nHi) {
+    if (nHi == 0)
+        return;
+    size_t interior = nHi < nLo ? nHi : nLo - 1;
+    liftPredict53(hi, lo, lo + 1, interior);
+    for (size_t i = interior; i < nHi; ++i)
+        hi[i] -= (lo[i] + lo[nLo - 1]) >> 1;
+
+    lo[0] += (hi[0] + hi[0] + 2) >> 2;
+    interior = nLo < nHi ? nLo : nHi;
+    if (interior > 1)
+        liftUpdate53(lo + 1, hi, hi + 1, interior - 1);
+    for (size_t i = interior > 1 ? interior : 1; i < nLo; ++i)
+        lo[i] += (hi[nHi - 1] + hi[nHi - 1] + 2) >> 2;
+}
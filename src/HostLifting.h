@@ -0,0 +1,51 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+Vectorized lifting primitives for the host DWT.
+
+On x86/x64, AVX2 is used when the CPU supports it, whatever the compiler targets,
+and SSE2 otherwise; elsewhere, plain C++. Pointers need not be aligned.
+*/
+
+// 9/7 lifting constants, shared with ocldwt97.cl
+const float LIFT97_P1 = -1.586134342f;
+const float LIFT97_U1 = -0.05298011854f;
+const float LIFT97_P2 = 0.8829110762f;
+const float LIFT97_U2 = 0.4435068522f;
+const float LIFT97_SCALE_MUL = 1.23017410491400f;                    // high pass (odd samples)
+const float LIFT97_SCALE_DIV = 0.81289306611596153187273657637352f;  // low pass (even samples)
+
+// dst[i] += c * (a[i] + b[i])
+void liftAdd(float* dst, const float* a, const float* b, size_t n, float c);
+
+// dst[i] *= c
+void liftScale(float* dst, size_t n, float c);
+
+// 5/3 predict: dst[i] -= (a[i] + b[i]) >> 1
+void liftPredict53(int* dst, const int* a, const int* b, size_t n);
+
+// 5/3 update: dst[i] += (a[i] + b[i] + 2) >> 2
+void liftUpdate53(int* dst, const int* a, const int* b, size_t n);
+
+// One dimensional forward transforms of a signal starting at an even sample,
+// already split into its even (lo) and odd (hi) samples, with whole-sample symmetric extension
+// at both ends. nLo = (n+1)/2, nHi = n/2.
+void forward97(float* lo, float* hi, size_t nLo, size_t nHi);
+void forward53(int* lo, int* hi, size_t nLo, size_t nHi);
@@ -0,0 +1,60 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostMQDecoder.h"
+
+HostMQDecoder::HostMQDecoder(void) : states(HostMQEncoder::getStates()),
+    data(NULL),
+    length(0),
+    pos(0),
+    a(0),
+    c(0),
+    ct(0)
+{
+    init(NULL, 0);
+}
+
+void HostMQDecoder::init(const unsigned char* bytes, size_t numBytes) {
+    data = bytes;
+    length = numBytes;
+    pos = 0;
+    // INITDEC
+    c = byteAt(0) << 16;
+    byteIn();
+    c <<= 7;
+    ct -= 7;
+    a = 0x8000;
+    for (size_t cx = 0; cx < MQ_NUM_CONTEXTS; ++cx)
+        contexts[cx] = HostMQEncoder::initialState(cx);
+}
+
+void HostMQDecoder::byteIn() {
+    if (byteAt(pos) == 0xFF) {
+        // a marker, or the end of the code word, feeds ones; otherwise the byte after 0xFF carries seven bits
+        if (byteAt(pos + 1) > 0x8F) {
+            c += 0xFF00;
+            ct = 8;
+        } else {
+            pos++;
+            c += byteAt(pos) << 9;
+            ct = 7;
+        }
+    } else {
+        pos++;
+        c += byteAt(pos) << 8;
+        ct = 8;
+    }
+}
@@ -0,0 +1,87 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostMQEncoder.h"
+
+/*
+MQ arithmetic decoder (ITU-T Rec. T.800, C.3), the inverse of HostMQEncoder, with the same state table.
+
+Bytes past the end of the code word read as 0xFF, so that a code word truncated at any pass
+decodes the symbols that were coded before the cut.
+*/
+class HostMQDecoder
+{
+public:
+    HostMQDecoder(void);
+
+    // start decoding the length bytes at data, with all contexts in their initial states
+    void init(const unsigned char* data, size_t length);
+    inline unsigned int decode(unsigned int cx) {
+        const HostMQState* s = states + contexts[cx];
+        unsigned int d;
+        a -= s->qe;
+        if ((c >> 16) < s->qe) {
+            // LPS exchange: the smaller sub interval holds the MPS if it is the larger one
+            if (a < s->qe) {
+                d = s->mps;
+                contexts[cx] = s->nmps;
+            } else {
+                d = 1 - s->mps;
+                contexts[cx] = s->nlps;
+            }
+            a = s->qe;
+            renormalize();
+        } else {
+            c -= s->qe << 16;
+            if (a & 0x8000)
+                return s->mps;
+            if (a < s->qe) {
+                d = 1 - s->mps;
+                contexts[cx] = s->nlps;
+            } else {
+                d = s->mps;
+                contexts[cx] = s->nmps;
+            }
+            renormalize();
+        }
+        return d;
+    }
+private:
+    inline void renormalize() {
+        do {
+            if (ct == 0)
+                byteIn();
+            a <<= 1;
+            c <<= 1;
+            ct--;
+        } while ((a & 0x8000) == 0);
+    }
+    inline unsigned int byteAt(size_t i) {
+        return i < length ? data[i] : 0xFF;
+    }
+    void byteIn();
+
+    const HostMQState* states;
+    const unsigned char* data;
+    size_t length;
+    size_t pos;             // BP of the standard
+    unsigned int a;
+    unsigned int c;
+    unsigned int ct;
+    unsigned char contexts[MQ_NUM_CONTEXTS];
+};
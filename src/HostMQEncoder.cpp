@@ -0,0 +1,144 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "HostMQEncoder.h"
+
+/*
+Probability estimation (ITU-T Rec. T.800, Table C.2).
+Entry 2 * i + mps is state i with more probable symbol mps; an LPS in a state with
+the SWITCH flag set moves to the entry with the other MPS.
+*/
+const HostMQState HostMQEncoder::states[] = {
+    {0x5601, 0, 2, 3}, {0x5601, 1, 3, 2},
+    {0x3401, 0, 4, 12}, {0x3401, 1, 5, 13},
+    {0x1801, 0, 6, 18}, {0x1801, 1, 7, 19},
+    {0x0ac1, 0, 8, 24}, {0x0ac1, 1, 9, 25},
+    {0x0521, 0, 10, 58}, {0x0521, 1, 11, 59},
+    {0x0221, 0, 76, 66}, {0x0221, 1, 77, 67},
+    {0x5601, 0, 14, 13}, {0x5601, 1, 15, 12},
+    {0x5401, 0, 16, 28}, {0x5401, 1, 17, 29},
+    {0x4801, 0, 18, 28}, {0x4801, 1, 19, 29},
+    {0x3801, 0, 20, 28}, {0x3801, 1, 21, 29},
+    {0x3001, 0, 22, 34}, {0x3001, 1, 23, 35},
+    {0x2401, 0, 24, 36}, {0x2401, 1, 25, 37},
+    {0x1c01, 0, 26, 40}, {0x1c01, 1, 27, 41},
+    {0x1601, 0, 58, 42}, {0x1601, 1, 59, 43},
+    {0x5601, 0, 30, 29}, {0x5601, 1, 31, 28},
+    {0x5401, 0, 32, 28}, {0x5401, 1, 33, 29},
+    {0x5101, 0, 34, 30}, {0x5101, 1, 35, 31},
+    {0x4801, 0, 36, 32}, {0x4801, 1, 37, 33},
+    {0x3801, 0, 38, 34}, {0x3801, 1, 39, 35},
+    {0x3401, 0, 40, 36}, {0x3401, 1, 41, 37},
+    {0x3001, 0, 42, 38}, {0x3001, 1, 43, 39},
+    {0x2801, 0, 44, 38}, {0x2801, 1, 45, 39},
+    {0x2401, 0, 46, 40}, {0x2401, 1, 47, 41},
+    {0x2201, 0, 48, 42}, {0x2201, 1, 49, 43},
+    {0x1c01, 0, 50, 44}, {0x1c01, 1, 51, 45},
+    {0x1801, 0, 52, 46}, {0x1801, 1, 53, 47},
+    {0x1601, 0, 54, 48}, {0x1601, 1, 55, 49},
+    {0x1401, 0, 56, 50}, {0x1401, 1, 57, 51},
+    {0x1201, 0, 58, 52}, {0x1201, 1, 59, 53},
+    {0x1101, 0, 60, 54}, {0x1101, 1, 61, 55},
+    {0x0ac1, 0, 62, 56}, {0x0ac1, 1, 63, 57},
+    {0x09c1, 0, 64, 58}, {0x09c1, 1, 65, 59},
+    {0x08a1, 0, 66, 60}, {0x08a1, 1, 67, 61},
+    {0x0521, 0, 68, 62}, {0x0521, 1, 69, 63},
+    {0x0441, 0, 70, 64}, {0x0441, 1, 71, 65},
+    {0x02a1, 0, 72, 66}, {0x02a1, 1, 73, 67},
+    {0x0221, 0, 74, 68}, {0x0221, 1, 75, 69},
+    {0x0141, 0, 76, 70}, {0x0141, 1, 77, 71},
+    {0x0111, 0, 78, 72}, {0x0111, 1, 79, 73},
+    {0x0085, 0, 80, 74}, {0x0085, 1, 81, 75},
+    {0x0049, 0, 82, 76}, {0x0049, 1, 83, 77},
+    {0x0025, 0, 84, 78}, {0x0025, 1, 85, 79},
+    {0x0015, 0, 86, 80}, {0x0015, 1, 87, 81},
+    {0x0009, 0, 88, 82}, {0x0009, 1, 89, 83},
+    {0x0005, 0, 90, 84}, {0x0005, 1, 91, 85},
+    {0x0001, 0, 90, 86}, {0x0001, 1, 91, 87},
+    {0x5601, 0, 92, 92}, {0x5601, 1, 93, 93}
+};
+
+// contexts of the bit plane coder, as numbered in oclbpc.cl
+static const size_t MQ_CX_ZC_FIRST = 0;
+static const size_t MQ_CX_RUN_LENGTH = 17;
+static const size_t MQ_CX_UNIFORM = 18;
+
+HostMQEncoder::HostMQEncoder(void) : a(0), c(0), ct(0)
+{
+    init();
+}
+
+unsigned char HostMQEncoder::initialState(size_t cx) {
+    // ITU-T Rec. T.800, Table D.7
+    if (cx == MQ_CX_UNIFORM)
+        return 2 * 46;
+    if (cx == MQ_CX_RUN_LENGTH)
+        return 2 * 3;
+    if (cx == MQ_CX_ZC_FIRST)
+        return 2 * 4;
+    return 0;
+}
+
+void HostMQEncoder::init() {
+    a = 0x8000;
+    c = 0;
+    ct = 12;
+    buffer.clear();
+    buffer.push_back(0);
+    for (size_t cx = 0; cx < MQ_NUM_CONTEXTS; ++cx)
+        contexts[cx] = initialState(cx);
+}
+
+void HostMQEncoder::byteOut() {
+    unsigned char& b = buffer.back();
+    if (b == 0xFF) {
+        // bit stuffing: the byte after 0xFF carries seven bits
+        buffer.push_back((unsigned char)(c >> 20));
+        c &= 0xFFFFF;
+        ct = 7;
+        return;
+    }
+    if (c & 0x8000000) {
+        // propagate carry into B
+        b++;
+        c &= 0x7FFFFFF;
+        if (b == 0xFF) {
+            buffer.push_back((unsigned char)(c >> 20));
+            c &= 0xFFFFF;
+            ct = 7;
+            return;
+        }
+    }
+    buffer.push_back((unsigned char)(c >> 19));
+    c &= 0x7FFFF;
+    ct = 8;
+}
+
+void HostMQEncoder::flush(std::vector<unsigned char>& output) {
+    // set as many trailing bits of C to one as possible (SETBITS)
+    unsigned int temp = c + a;
+    c |= 0xFFFF;
+    if (c >= temp)
+        c -= 0x8000;
+    c <<= ct;
+    byteOut();
+    c <<= ct;
+    byteOut();
+    // a trailing 0xFF is implied by the decoder
+    size_t end = buffer.size();
+    if (buffer.back() == 0xFF)
+        end--;
+    output.assign(buffer.begin() + 1, buffer.begin() + end);
+}
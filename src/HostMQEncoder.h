@@ -0,0 +1,108 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+// contexts of the bit plane coder (ITU-T Rec. T.800, Table D.7)
+const size_t MQ_NUM_CONTEXTS = 19;
+
+// probability state of a context: index into the state table, which interleaves
+// the two values of the more probable symbol
+struct HostMQState {
+    unsigned int qe;
+    unsigned int mps;
+    unsigned char nmps;     // next state after coding the more probable symbol
+    unsigned char nlps;     // next state after coding the less probable symbol
+};
+
+/*
+MQ arithmetic encoder (ITU-T Rec. T.800, Annex C).
+
+State transitions are driven by a single table that folds the MPS switch into the state index.
+*/
+class HostMQEncoder
+{
+public:
+    HostMQEncoder(void);
+
+    // start a new code word, with all contexts in their initial states
+    void init();
+    inline void encode(unsigned int cx, unsigned int d) {
+        const HostMQState* s = states + contexts[cx];
+        if (s->mps == d)
+            codeMPS(cx, s);
+        else
+            codeLPS(cx, s);
+    }
+    // bytes that must be kept if the code word is truncated after the symbols coded so far
+    size_t truncationLength() {
+        // bytes up to and including B, plus three for the bits still held in C
+        return (buffer.size() - 1) + 3;
+    }
+    // terminate the code word, and copy it to output
+    void flush(std::vector<unsigned char>& output);
+
+    static const HostMQState* getStates() {
+        return states;
+    }
+    // initial state of context cx
+    static unsigned char initialState(size_t cx);
+private:
+    inline void codeMPS(unsigned int cx, const HostMQState* s) {
+        a -= s->qe;
+        if ((a & 0x8000) == 0) {
+            if (a < s->qe)
+                a = s->qe;
+            else
+                c += s->qe;
+            contexts[cx] = s->nmps;
+            renormalize();
+        } else {
+            c += s->qe;
+        }
+    }
+    inline void codeLPS(unsigned int cx, const HostMQState* s) {
+        a -= s->qe;
+        if (a < s->qe)
+            c += s->qe;
+        else
+            a = s->qe;
+        contexts[cx] = s->nlps;
+        renormalize();
+    }
+    inline void renormalize() {
+        do {
+            a <<= 1;
+            c <<= 1;
+            if (--ct == 0)
+                byteOut();
+        } while ((a & 0x8000) == 0);
+    }
+    void byteOut();
+
+    static const HostMQState states[];
+
+    unsigned int a;
+    unsigned int c;
+    unsigned int ct;
+    // code word, preceded by a virtual byte; the last byte is B of the standard,
+    // which a carry may still increment
+    std::vector<unsigned char> buffer;
+    unsigned char contexts[MQ_NUM_CONTEXTS];
+};
@@ -0,0 +1,124 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostMappedFile.h"
+#include "OCLUtil.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+HostMappedFile::HostMappedFile(void) : bytes(NULL),
+    length(0),
+#if defined(_WIN32)
+    file(INVALID_HANDLE_VALUE),
+    mapping(NULL)
+#else
+    file(-1)
+#endif
+{
+}
+
+HostMappedFile::~HostMappedFile(void)
+{
+    close();
+}
+
+#if defined(_WIN32)
+
+bool HostMappedFile::open(std::string fileName) {
+    close();
+    file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        LogError("Cannot read file %s", fileName.c_str());
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || (unsigned long long)fileSize.QuadPart > (size_t)-1) {
+        LogError("Cannot read file %s", fileName.c_str());
+        close();
+        return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    // an empty file cannot be mapped, and has nothing to decode
+    if (!length)
+        return true;
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+        bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!bytes) {
+        LogError("Cannot map file %s", fileName.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void HostMappedFile::close() {
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    bytes = NULL;
+    length = 0;
+    mapping = NULL;
+    file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool HostMappedFile::open(std::string fileName) {
+    close();
+    file = ::open(fileName.c_str(), O_RDONLY);
+    struct stat st;
+    if (file < 0 || fstat(file, &st) != 0) {
+        LogError("Cannot read file %s", fileName.c_str());
+        close();
+        return false;
+    }
+    length = (size_t)st.st_size;
+    // an empty file cannot be mapped, and has nothing to decode
+    if (!length)
+        return true;
+    void* view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED) {
+        LogError("Cannot map file %s", fileName.c_str());
+        close();
+        return false;
+    }
+    bytes = (const unsigned char*)view;
+    return true;
+}
+
+void HostMappedFile::close() {
+    if (bytes)
+        munmap((void*)bytes, length);
+    if (file >= 0)
+        ::close(file);
+    bytes = NULL;
+    length = 0;
+    file = -1;
+}
+
+#endif
@@ -0,0 +1,55 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+/*
+Read only view of a whole file, mapped into memory.
+
+Decoders work on the mapped bytes in place: the pages of a code stream are only read
+when a packet is parsed or a code block is decoded, and are never copied into a buffer.
+*/
+class HostMappedFile
+{
+public:
+    HostMappedFile(void);
+    // unmaps an open file
+    ~HostMappedFile(void);
+    bool open(std::string fileName);
+    void close();
+    const unsigned char* data() const {
+        return bytes;
+    }
+    size_t size() const {
+        return length;
+    }
+private:
+    // not copyable: the view belongs to one object
+    HostMappedFile(const HostMappedFile&);
+    HostMappedFile& operator=(const HostMappedFile&);
+
+    const unsigned char* bytes;
+    size_t length;
+#if defined(_WIN32)
+    void* file;
+    void* mapping;
+#else
+    int file;
+#endif
+};
@@ -0,0 +1,88 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostOutputArena.h"
+#include "OCLUtil.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+HostOutputArena::HostOutputArena(size_t initialCapacity) : buffer(initialCapacity),
+    length(0)
+{
+}
+
+void HostOutputArena::reserve(size_t capacity) {
+    if (capacity > buffer.size())
+        buffer.resize(capacity);
+}
+
+unsigned char* HostOutputArena::alloc(size_t n) {
+    if (length + n > buffer.size())
+        reserve(std::max(length + n, buffer.size() * 2));
+    unsigned char* rc = n ? &buffer[length] : NULL;
+    length += n;
+    return rc;
+}
+
+void HostOutputArena::writeByte(unsigned char val) {
+    *alloc(1) = val;
+}
+
+void HostOutputArena::writeUInt16(unsigned int val) {
+    unsigned char* dest = alloc(2);
+    dest[0] = (unsigned char)(val >> 8);
+    dest[1] = (unsigned char)val;
+}
+
+void HostOutputArena::writeUInt32(unsigned int val) {
+    unsigned char* dest = alloc(4);
+    dest[0] = (unsigned char)(val >> 24);
+    dest[1] = (unsigned char)(val >> 16);
+    dest[2] = (unsigned char)(val >> 8);
+    dest[3] = (unsigned char)val;
+}
+
+void HostOutputArena::write(const unsigned char* src, size_t n) {
+    if (n)
+        memcpy(alloc(n), src, n);
+}
+
+void HostOutputArena::patchUInt16(size_t offset, unsigned int val) {
+    buffer[offset] = (unsigned char)(val >> 8);
+    buffer[offset + 1] = (unsigned char)val;
+}
+
+void HostOutputArena::patchUInt32(size_t offset, unsigned int val) {
+    buffer[offset] = (unsigned char)(val >> 24);
+    buffer[offset + 1] = (unsigned char)(val >> 16);
+    buffer[offset + 2] = (unsigned char)(val >> 8);
+    buffer[offset + 3] = (unsigned char)val;
+}
+
+bool HostOutputArena::writeFile(std::string fileName) const {
+    FILE* fp = fopen(fileName.c_str(), "wb");
+    if (!fp) {
+        LogError("Cannot write file %s", fileName.c_str());
+        return false;
+    }
+    bool rc = fwrite(data(), 1, length, fp) == length;
+    if (fclose(fp) != 0)
+        rc = false;
+    if (!rc)
+        LogError("Cannot write file %s", fileName.c_str());
+    return rc;
+}
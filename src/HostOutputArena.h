@@ -0,0 +1,65 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stddef.h>
+
+/*
+Growable output buffer for a code stream.
+
+Storage is kept between frames: clear() only rewinds, so once the arena has grown to fit
+a frame, later frames are written without any allocation. Markers whose length is only known
+once their contents are written are reserved first, and patched afterwards.
+*/
+class HostOutputArena
+{
+public:
+    HostOutputArena(size_t initialCapacity = 0);
+
+    void clear() {
+        length = 0;
+    }
+    size_t size() const {
+        return length;
+    }
+    const unsigned char* data() const {
+        return length ? &buffer[0] : NULL;
+    }
+    unsigned char* data() {
+        return length ? &buffer[0] : NULL;
+    }
+    // grow storage to at least capacity bytes, keeping the contents
+    void reserve(size_t capacity);
+
+    // n bytes at the end of the arena, to be filled by the caller
+    unsigned char* alloc(size_t n);
+    void writeByte(unsigned char val);
+    // big endian, as all code stream fields
+    void writeUInt16(unsigned int val);
+    void writeUInt32(unsigned int val);
+    void write(const unsigned char* src, size_t n);
+    // overwrite a field that was written earlier
+    void patchUInt16(size_t offset, unsigned int val);
+    void patchUInt32(size_t offset, unsigned int val);
+
+    bool writeFile(std::string fileName) const;
+private:
+    std::vector<unsigned char> buffer;
+    size_t length;
+};
@@ -0,0 +1,161 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostRateControl.h"
+#include <algorithm>
+#include <math.h>
+
+// bisection steps on the slope threshold, which is geometric, since slopes span many orders of magnitude
+static const size_t RATE_CONTROL_MAX_STEPS = 64;
+static const double RATE_CONTROL_TOLERANCE = 1e-12;
+
+HostRateControl::HostRateControl(void) : totalDistortion(0),
+    minSlope(0),
+    maxSlope(0)
+{
+}
+
+void HostRateControl::init(const HostTier1Output& input, const std::vector<double>& blockWeights) {
+    points.clear();
+    firstPoint.clear();
+    totalDistortion = 0;
+    minSlope = 0;
+    maxSlope = 0;
+    size_t blocksPerChannel = input.codeBlocks.size();
+    for (size_t i = 0; i < input.blocks.size(); ++i) {
+        const HostCodeBlockStream& stream = input.blocks[i];
+        double weight = blocksPerChannel ? blockWeights[i % blocksPerChannel] : 1;
+        size_t start = points.size();
+        firstPoint.push_back(start);
+        double distortion = 0;
+        for (size_t pass = 0; pass < stream.passRates.size(); ++pass) {
+            if (pass < stream.passDistortions.size())
+                distortion += stream.passDistortions[pass] * weight;
+            size_t rate = stream.passRates[pass];
+            // drop earlier points that lie on or below the chord to this one
+            while (true) {
+                size_t previousRate = points.size() > start ? points.back().rate : 0;
+                double previousDistortion = points.size() > start ? points.back().distortion : 0;
+                if (distortion <= previousDistortion)
+                    break;
+                if (rate <= previousRate) {
+                    // more distortion removed for no more bytes
+                    if (points.size() > start) {
+                        points.pop_back();
+                        continue;
+                    }
+                    break;
+                }
+                double slope = (distortion - previousDistortion) / (double)(rate - previousRate);
+                if (points.size() > start && slope >= points.back().slope) {
+                    points.pop_back();
+                    continue;
+                }
+                HullPoint point;
+                point.numPasses = pass + 1;
+                point.rate = rate;
+                point.distortion = distortion;
+                point.slope = slope;
+                points.push_back(point);
+                break;
+            }
+        }
+        if (points.size() > start) {
+            totalDistortion += points.back().distortion;
+            minSlope = (minSlope == 0) ? points.back().slope : std::min(minSlope, points.back().slope);
+            maxSlope = std::max(maxSlope, points[start].slope);
+        }
+    }
+    firstPoint.push_back(points.size());
+}
+
+const HostRateControl::HullPoint* HostRateControl::truncate(size_t block, double threshold) const {
+    // slopes decrease along the hull
+    size_t lo = firstPoint[block], hi = firstPoint[block + 1];
+    while (lo < hi) {
+        size_t mid = (lo + hi) >> 1;
+        if (points[mid].slope >= threshold)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo > firstPoint[block]) ? &points[lo - 1] : NULL;
+}
+
+void HostRateControl::evaluate(double threshold, size_t& rate, double& distortion) const {
+    rate = 0;
+    distortion = totalDistortion;
+    for (size_t i = 0; i + 1 < firstPoint.size(); ++i) {
+        const HullPoint* point = truncate(i, threshold);
+        if (point) {
+            rate += point->rate;
+            distortion -= point->distortion;
+        }
+    }
+}
+
+void HostRateControl::collect(double threshold, std::vector<size_t>& numPasses) const {
+    numPasses.assign(firstPoint.size() - 1, 0);
+    for (size_t i = 0; i < numPasses.size(); ++i) {
+        const HullPoint* point = truncate(i, threshold);
+        numPasses[i] = point ? point->numPasses : 0;
+    }
+}
+
+size_t HostRateControl::truncateToRate(size_t maxBytes, std::vector<size_t>& numPasses) {
+    size_t rate = 0;
+    double distortion = 0;
+    // lo keeps every hull point, hi none
+    double lo = minSlope, hi = maxSlope * 2;
+    evaluate(lo, rate, distortion);
+    if (rate <= maxBytes || points.empty()) {
+        collect(lo, numPasses);
+        return rate;
+    }
+    for (size_t step = 0; step < RATE_CONTROL_MAX_STEPS && hi - lo > hi * RATE_CONTROL_TOLERANCE; ++step) {
+        double mid = sqrt(lo * hi);
+        evaluate(mid, rate, distortion);
+        if (rate <= maxBytes)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    collect(hi, numPasses);
+    evaluate(hi, rate, distortion);
+    return rate;
+}
+
+size_t HostRateControl::truncateToDistortion(double maxDistortion, std::vector<size_t>& numPasses) {
+    size_t rate = 0;
+    double distortion = 0;
+    double lo = minSlope, hi = maxSlope * 2;
+    evaluate(hi, rate, distortion);
+    if (distortion <= maxDistortion || points.empty()) {
+        collect(hi, numPasses);
+        return rate;
+    }
+    for (size_t step = 0; step < RATE_CONTROL_MAX_STEPS && hi - lo > hi * RATE_CONTROL_TOLERANCE; ++step) {
+        double mid = sqrt(lo * hi);
+        evaluate(mid, rate, distortion);
+        if (distortion <= maxDistortion)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    collect(lo, numPasses);
+    evaluate(lo, rate, distortion);
+    return rate;
+}
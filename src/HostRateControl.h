@@ -0,0 +1,65 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostTier1Encoder.h"
+#include <vector>
+
+/*
+Post compression rate-distortion optimization (PCRD-opt).
+
+The truncation points of each code block are reduced to the lower convex hull of its
+rate-distortion curve, so that the distortion-rate slope of successive points strictly decreases.
+For a slope threshold, every block is then truncated at the last hull point whose slope
+is at least the threshold: this minimizes distortion for the resulting rate, across all blocks.
+The threshold that meets a rate or distortion target is found by bisection on the slopes;
+each step costs a binary search per block.
+*/
+class HostRateControl
+{
+public:
+    HostRateControl(void);
+    // Build the hulls of all blocks of input; the distortion of a pass is weighted by the weight of its block,
+    // one per code block of one channel, to bring it to squared error in the image
+    void init(const HostTier1Output& input, const std::vector<double>& blockWeights);
+
+    // Number of passes of each block, for the least distortion whose code words fit into maxBytes.
+    // Returns the code word bytes used
+    size_t truncateToRate(size_t maxBytes, std::vector<size_t>& numPasses);
+    // Number of passes of each block, for the fewest code word bytes that leave
+    // at most maxDistortion of the distortion the passes can remove.
+    // Returns the code word bytes used
+    size_t truncateToDistortion(double maxDistortion, std::vector<size_t>& numPasses);
+private:
+    struct HullPoint {
+        size_t numPasses;
+        size_t rate;            // cumulative bytes
+        double distortion;      // cumulative weighted distortion reduction
+        double slope;           // from the previous hull point
+    };
+    // last hull point of block with slope >= threshold, or NULL for none
+    const HullPoint* truncate(size_t block, double threshold) const;
+    // total rate and remaining distortion at threshold
+    void evaluate(double threshold, size_t& rate, double& distortion) const;
+    void collect(double threshold, std::vector<size_t>& numPasses) const;
+
+    std::vector<HullPoint> points;
+    std::vector<size_t> firstPoint;     // hull of block i is points[firstPoint[i]] up to points[firstPoint[i + 1]]
+    double totalDistortion;             // reduction of all passes of all blocks
+    double minSlope;
+    double maxSlope;
+};
@@ -0,0 +1,121 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostTagTree.h"
+#include <limits.h>
+
+HostTagTree::HostTagTree(void) : numLeaves(0)
+{
+}
+
+void HostTagTree::init(size_t width, size_t height) {
+    nodes.clear();
+    numLeaves = width * height;
+    if (!numLeaves)
+        return;
+    // levels from the leaves up to a single root
+    std::vector<size_t> levelWidth(1, width), levelHeight(1, height), levelStart(1, 0);
+    size_t total = numLeaves;
+    while (levelWidth.back() * levelHeight.back() > 1) {
+        levelStart.push_back(total);
+        levelWidth.push_back((levelWidth.back() + 1) >> 1);
+        levelHeight.push_back((levelHeight.back() + 1) >> 1);
+        total += levelWidth.back() * levelHeight.back();
+    }
+    nodes.resize(total);
+    for (size_t level = 0; level < levelStart.size(); ++level) {
+        for (size_t y = 0; y < levelHeight[level]; ++y) {
+            for (size_t x = 0; x < levelWidth[level]; ++x) {
+                Node& node = nodes[levelStart[level] + x + y * levelWidth[level]];
+                node.parent = (level + 1 < levelStart.size()) ?
+                              (int)(levelStart[level + 1] + (x >> 1) + (y >> 1) * levelWidth[level + 1]) : -1;
+            }
+        }
+    }
+    reset();
+}
+
+void HostTagTree::reset() {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].value = INT_MAX;
+        nodes[i].low = 0;
+        nodes[i].known = false;
+    }
+}
+
+void HostTagTree::setValue(size_t leaf, int value) {
+    int node = (int)leaf;
+    while (node != -1 && nodes[node].value > value) {
+        nodes[node].value = value;
+        node = nodes[node].parent;
+    }
+}
+
+void HostTagTree::encode(HostBitWriter& out, size_t leaf, int threshold) {
+    // path from the leaf up to the root, which is coded first
+    int path[32];
+    int depth = 0;
+    for (int node = (int)leaf; node != -1; node = nodes[node].parent)
+        path[depth++] = node;
+
+    int low = 0;
+    while (depth--) {
+        Node& node = nodes[path[depth]];
+        if (low > node.low)
+            node.low = low;
+        else
+            low = node.low;
+        while (low < threshold) {
+            if (low >= node.value) {
+                if (!node.known) {
+                    out.writeBit(1);
+                    node.known = true;
+                }
+                break;
+            }
+            out.writeBit(0);
+            ++low;
+        }
+        node.low = low;
+    }
+}
+
+bool HostTagTree::decode(HostBitReader& in, size_t leaf, int threshold) {
+    int path[32];
+    int depth = 0;
+    for (int node = (int)leaf; node != -1; node = nodes[node].parent)
+        path[depth++] = node;
+
+    // values are unknown until read: a 1 bit sets the value of a node to its lower bound
+    int low = 0;
+    while (depth--) {
+        Node& node = nodes[path[depth]];
+        if (low > node.low)
+            node.low = low;
+        else
+            low = node.low;
+        // a truncated header reads as zeros: stop rather than count up to threshold
+        while (low < threshold && low < node.value && !in.overrun()) {
+            if (in.readBit()) {
+                node.value = low;
+                break;
+            }
+            ++low;
+        }
+        node.low = low;
+    }
+    return nodes[leaf].value < threshold;
+}
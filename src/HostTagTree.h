@@ -0,0 +1,57 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostBitWriter.h"
+#include "HostBitReader.h"
+#include <vector>
+
+/*
+Tag tree encoder and decoder (ITU-T Rec. T.800, B.10.2).
+
+Leaves are the code blocks of a precinct in raster order; each parent holds the minimum of up to
+2x2 children. The state of what has already been signalled is kept between calls, so that later
+layers only send what the decoder does not know yet. A decoder tree reads the same bits
+in the same order, and learns each value once the encoder has signalled it.
+*/
+class HostTagTree
+{
+public:
+    HostTagTree(void);
+    // width x height leaves, all reset
+    void init(size_t width, size_t height);
+    // forget all values and everything signalled
+    void reset();
+    void setValue(size_t leaf, int value);
+    // signal whether the value of leaf is below threshold, and if so, the value itself
+    void encode(HostBitWriter& out, size_t leaf, int threshold);
+    // read what encode() signalled; returns whether the value of leaf is below threshold
+    bool decode(HostBitReader& in, size_t leaf, int threshold);
+    // value of leaf, once decode() has returned true for it
+    int getValue(size_t leaf) const {
+        return nodes[leaf].value;
+    }
+private:
+    struct Node {
+        int parent;         // -1 for the root
+        int value;
+        int low;            // value is known to be at least low
+        bool known;
+    };
+    std::vector<Node> nodes;
+    size_t numLeaves;
+};
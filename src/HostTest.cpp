@@ -0,0 +1,763 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostTest.h"
+#include "HostDWTForward.cpp"
+#include "J2KMarkers.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const size_t TEST_MQ_SEQUENCES = 200;
+static const size_t TEST_MQ_MAX_SYMBOLS = 20000;
+static const size_t TEST_MQ_CHECKPOINTS = 16;
+static const size_t TEST_TIER2_FRAMES = 100;
+static const size_t TEST_MAX_BIT_PLANES = 10;
+// (CX,D) pairs of a pass are at most this, or the samples of the block
+static const size_t TEST_MAX_PASS_PAIRS = 512;
+static const size_t TEST_DWT_IMAGES = 200;
+static const size_t TEST_DWT_MAX_SIZE = 200;
+static const size_t TEST_DWT_MAX_LEVELS = 6;
+static const size_t TEST_TIER1_FRAMES = 50;
+static const size_t TEST_TIER1_MAX_SIZE = 150;
+static const size_t TEST_DEQUANT_IMAGES = 50;
+// relative error allowed for float rounding in the DWT and the quantization factors
+static const double TEST_DEQUANT_TOLERANCE = 1e-3;
+
+HostTest::HostTest(unsigned int seed) : state(seed),
+    blockInfo(BPC_BLOCK_INFO_SIZE)
+{
+}
+
+bool HostTest::test() {
+    bool mqPassed = testMQ(TEST_MQ_SEQUENCES);
+    bool tier2Passed = testTier2(TEST_TIER2_FRAMES);
+    bool tier1Passed = testTier1(TEST_TIER1_FRAMES);
+    bool dequantPassed = testDequantization(TEST_DEQUANT_IMAGES);
+    bool dwtPassed = testDWT(TEST_DWT_IMAGES);
+    return mqPassed && tier2Passed && tier1Passed && dequantPassed && dwtPassed;
+}
+
+size_t HostTest::random(size_t n) {
+    // the LCG of C, so that runs are the same on every platform
+    state = state * 1103515245 + 12345;
+    return n ? ((state >> 16) & 0x7FFF) % n : 0;
+}
+
+bool HostTest::testMQ(size_t numSequences) {
+    HostMQDecoder decoder;
+    std::vector<unsigned char> symbols;
+    std::vector<unsigned char> data;
+    size_t bad = 0;
+    size_t truncations = 0;
+    for (size_t sequence = 0; sequence < numSequences; ++sequence) {
+        // each context has its own skew, from even to almost certain
+        size_t skew[MQ_NUM_CONTEXTS];
+        for (size_t cx = 0; cx < MQ_NUM_CONTEXTS; ++cx)
+            skew[cx] = 2 + random(64);
+        size_t numSymbols = random(TEST_MQ_MAX_SYMBOLS) + 1;
+        symbols.resize(numSymbols);
+        std::vector<size_t> checkpoints;        // symbols coded
+        std::vector<size_t> checkpointLengths;  // and the truncation length after them
+        mq.init();
+        for (size_t i = 0; i < numSymbols; ++i) {
+            unsigned int cx = (unsigned int)random(MQ_NUM_CONTEXTS);
+            unsigned int d = (random(skew[cx]) == 0) ^ (cx & 1);
+            symbols[i] = (unsigned char)((cx << 1) | d);
+            mq.encode(cx, d);
+            if (random(numSymbols / TEST_MQ_CHECKPOINTS + 1) == 0) {
+                checkpoints.push_back(i + 1);
+                checkpointLengths.push_back(mq.truncationLength());
+            }
+        }
+        mq.flush(data);
+
+        decoder.init(data.empty() ? NULL : &data[0], data.size());
+        bool ok = true;
+        for (size_t i = 0; i < numSymbols && ok; ++i)
+            ok = decoder.decode(symbols[i] >> 1) == (symbols[i] & 1u);
+
+        // truncation points, adjusted as HostTier1Encoder does
+        size_t previous = 0;
+        for (size_t k = 0; k < checkpoints.size() && ok; ++k) {
+            size_t rate = std::min(checkpointLengths[k], data.size());
+            if (rate > previous && data[rate - 1] == 0xFF)
+                rate--;
+            rate = std::max(rate, previous);
+            previous = rate;
+            decoder.init(rate ? &data[0] : NULL, rate);
+            for (size_t i = 0; i < checkpoints[k] && ok; ++i)
+                ok = decoder.decode(symbols[i] >> 1) == (symbols[i] & 1u);
+            truncations++;
+        }
+        if (!ok)
+            bad++;
+    }
+    printf("mq: %d sequences, %d truncations, %d bad\n", (int)numSequences, (int)truncations, (int)bad);
+    return bad == 0;
+}
+
+void HostTest::randomBlock(const OCLCodeBlock& block, HostCodeBlockStream& stream) {
+    size_t numBitPlanes = random(TEST_MAX_BIT_PLANES);
+    size_t numPasses = numBitPlanes ? 3 * numBitPlanes - 2 : 0;
+    size_t maxPairs = std::min((size_t)(block.width * block.height), TEST_MAX_PASS_PAIRS);
+    blockInfo[0] = (cl_uint)numBitPlanes;
+    blockInfo[1] = (cl_uint)numPasses;
+    cxd.clear();
+    cl_float distortion = 1000;
+    for (size_t pass = 0; pass < numPasses; ++pass) {
+        size_t numPairs = random(maxPairs + 1);
+        blockInfo[2 + 2 * pass] = (cl_uint)cxd.size();
+        blockInfo[3 + 2 * pass] = (cl_uint)numPairs;
+        for (size_t i = 0; i < numPairs; ++i) {
+            size_t cx = random(MQ_NUM_CONTEXTS);
+            cxd.push_back((cl_uchar)((cx << 1) | (random(4) == 0)));
+        }
+        distortion *= 0.5f;
+        memcpy(&blockInfo[BPC_BLOCK_INFO_DISTORTION + pass], &distortion, sizeof(distortion));
+    }
+    if (cxd.empty())
+        cxd.push_back(0);
+    HostTier1Encoder::encodeBlock(mq, &blockInfo[0], &cxd[0], stream);
+}
+
+size_t HostTest::compare(const HostCodestreamParams& params, const HostTier1Output& input, const HostTier2Output& decoded,
+                         bool complete) {
+    const HostCodestreamParams& p = decoded.params;
+    if (p.width != params.width || p.height != params.height || p.levels != params.levels ||
+            p.precision != params.precision || p.lossy != params.lossy || p.codeBlockX != params.codeBlockX ||
+            p.codeBlockY != params.codeBlockY || p.numLayers != params.numLayers || p.progression != params.progression ||
+            decoded.numChannels != input.numChannels || decoded.codeBlocks.size() != input.codeBlocks.size() ||
+            decoded.blocks.size() != input.blocks.size())
+        return input.blocks.size() + 1;
+    size_t bad = 0;
+    for (size_t i = 0; i < input.codeBlocks.size(); ++i) {
+        if (memcmp(&decoded.codeBlocks[i], &input.codeBlocks[i], sizeof(OCLCodeBlock)))
+            bad++;
+    }
+    std::vector<unsigned char> codeword;
+    for (size_t i = 0; i < input.blocks.size(); ++i) {
+        const HostCodeBlockStream& stream = input.blocks[i];
+        const HostCodeBlockCodeword& block = decoded.blocks[i];
+        if (block.numPasses > stream.passRates.size() || (block.numPasses && block.numBitPlanes != stream.numBitPlanes)) {
+            bad++;
+            continue;
+        }
+        // the segments are the start of the code word, up to the end of their last pass
+        // unless the stream ends in their packet
+        codeword.clear();
+        size_t numPasses = 0;
+        for (size_t s = 0; s < block.segments.size(); ++s) {
+            const HostCodeBlockSegment& segment = block.segments[s];
+            codeword.insert(codeword.end(), segment.data, segment.data + segment.length);
+            numPasses += segment.numPasses;
+        }
+        size_t length = block.numPasses ? stream.passRates[block.numPasses - 1] : 0;
+        if (numPasses != block.numPasses ||
+                (complete ? codeword.size() != length : codeword.size() > length) ||
+                (codeword.size() && memcmp(&codeword[0], &stream.data[0], codeword.size())))
+            bad++;
+    }
+    return bad;
+}
+
+bool HostTest::testTier2(size_t numFrames) {
+    // kept across frames, as in a sequence
+    HostTier2Encoder encoder;
+    HostTier2Decoder decoder;
+    HostOutputArena arena;
+    J2KPacketLayout packetLayout;
+    HostTier1Output input;
+    HostTier2Output decoded;
+    size_t bad = 0;
+    size_t failed = 0;
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        HostCodestreamParams params;
+        params.width = random(300) + 1;
+        params.height = random(300) + 1;
+        params.levels = random(6);
+        params.precision = 8;
+        params.lossy = random(2) != 0;
+        params.codeBlockX = (size_t)4 << random(5);
+        params.codeBlockY = (size_t)4 << random(5);
+        params.numLayers = random(4) + 1;
+        params.progression = (unsigned int)random(5);
+        if (random(2)) {
+            params.precinctWidth.push_back(2 * params.codeBlockX);
+            params.precinctHeight.push_back(2 * params.codeBlockY);
+        }
+        input.numChannels = random(4) + 1;
+        if (!packetLayout.init(params, input.numChannels)) {
+            failed++;
+            continue;
+        }
+
+        codeBlockTable(params, packetLayout, input.codeBlocks);
+        input.blocks.resize(input.numChannels * input.codeBlocks.size());
+        for (size_t i = 0; i < input.blocks.size(); ++i)
+            randomBlock(input.codeBlocks[i % input.codeBlocks.size()], input.blocks[i]);
+
+        if (!encoder.encode(params, input, arena) || !decoder.decode(arena.data(), arena.size(), decoded)) {
+            failed++;
+            continue;
+        }
+        bad += compare(params, input, decoded, true);
+
+        // a stream cut anywhere after its first tile-part header still parses, into a prefix of each code word;
+        // the packet that was cut keeps the bytes that arrived
+        const unsigned char* data = arena.data();
+        size_t start = 0;
+        while (start + 1 < arena.size() && !(data[start] == 0xFF && data[start + 1] == (J2K_SOD & 0xFF)))
+            start++;
+        size_t cut = std::min(start + 2 + random(arena.size() - start), arena.size());
+        if (!decoder.decode(data, cut, decoded)) {
+            failed++;
+            continue;
+        }
+        bad += compare(params, input, decoded, cut == arena.size());
+    }
+    printf("tier-2: %d frames, %d failed, %d bad code blocks\n", (int)numFrames, (int)failed, (int)bad);
+    return failed == 0 && bad == 0;
+}
+
+HostCodestreamParams HostTest::randomParams(size_t maxSize) {
+    HostCodestreamParams params;
+    params.width = random(maxSize) + 1;
+    params.height = random(maxSize) + 1;
+    params.levels = random(6);
+    params.precision = 8;
+    params.lossy = random(2) != 0;
+    params.codeBlockX = (size_t)4 << random(5);
+    params.codeBlockY = (size_t)4 << random(5);
+    params.numLayers = 1;
+    params.progression = (unsigned int)random(5);
+    return params;
+}
+
+void HostTest::codeBlockTable(const HostCodestreamParams& params, const J2KPacketLayout& packetLayout,
+                              std::vector<OCLCodeBlock>& codeBlocks) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    codeBlocks.resize(packetLayout.getNumBlocks());
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        for (size_t y = 0; y < sb.numBlocksY; ++y) {
+            for (size_t x = 0; x < sb.numBlocksX; ++x) {
+                OCLCodeBlock& block = codeBlocks[sb.firstBlock + x + y * sb.numBlocksX];
+                block.x = (cl_int)(sb.x + x * params.codeBlockX);
+                block.y = (cl_int)(sb.y + y * params.codeBlockY);
+                block.width = (cl_int)std::min(params.codeBlockX, sb.width - x * params.codeBlockX);
+                block.height = (cl_int)std::min(params.codeBlockY, sb.height - y * params.codeBlockY);
+                block.orientation = (cl_int)sb.orientation;
+                block.level = (cl_int)sb.level;
+            }
+        }
+    }
+}
+
+bool HostTest::testTier1(size_t numFrames) {
+    HostReferenceBPC reference;
+    HostTier1Decoder decoder;
+    HostBPCDecoder bpcDecoder;
+    J2KPacketLayout packetLayout;
+    HostTier1Output encoded;
+    HostTier2Output input;
+    std::vector<short> image;
+    std::vector<short> decoded;
+    std::vector<int> coefficients;
+    std::vector<short> truncated;
+    size_t bad = 0;
+    size_t failed = 0;
+    size_t truncations = 0;
+    for (size_t frame = 0; frame < numFrames; ++frame) {
+        HostCodestreamParams params = randomParams(TEST_TIER1_MAX_SIZE);
+        size_t numChannels = random(3) + 1;
+        if (!packetLayout.init(params, numChannels)) {
+            failed++;
+            continue;
+        }
+        codeBlockTable(params, packetLayout, encoded.codeBlocks);
+        encoded.numChannels = numChannels;
+        encoded.blocks.resize(numChannels * encoded.codeBlocks.size());
+        size_t rowPitch = params.width * numChannels;
+        image.assign(rowPitch * params.height, 0);
+
+        // each block has its own magnitude and density of non-zero samples, so that
+        // every pass, and run length coding, is exercised
+        for (size_t i = 0; i < encoded.blocks.size(); ++i) {
+            size_t channel = i / encoded.codeBlocks.size();
+            const OCLCodeBlock& block = encoded.codeBlocks[i % encoded.codeBlocks.size()];
+            size_t numBitPlanes = random(TEST_MAX_BIT_PLANES + 1);
+            size_t density = random(8) + 1;
+            coefficients.resize((size_t)(block.width * block.height));
+            for (size_t j = 0; j < coefficients.size(); ++j) {
+                int magnitude = random(density) ? 0 : (int)random((size_t)1 << numBitPlanes);
+                coefficients[j] = random(2) ? -magnitude : magnitude;
+                size_t x = (size_t)block.x + j % (size_t)block.width;
+                size_t y = (size_t)block.y + j / (size_t)block.width;
+                image[y * rowPitch + x * numChannels + channel] = (short)coefficients[j];
+            }
+            reference.code(block, coefficients.empty() ? NULL : &coefficients[0], blockInfo, cxd);
+            if (cxd.empty())
+                cxd.push_back(0);
+            HostTier1Encoder::encodeBlock(mq, &blockInfo[0], &cxd[0], encoded.blocks[i]);
+
+            // truncated after the cleanup pass of each bit plane, a block decodes to the bit planes coded so far
+            const HostCodeBlockStream& stream = encoded.blocks[i];
+            HostCodeBlockCodeword codeword;
+            codeword.numBitPlanes = stream.numBitPlanes;
+            truncated.resize(coefficients.size());
+            for (size_t numPasses = 1; numPasses < stream.passRates.size(); numPasses += 3) {
+                size_t length = stream.passRates[numPasses - 1];
+                codeword.numPasses = numPasses;
+                codeword.segments.assign(1, HostCodeBlockSegment(length ? &stream.data[0] : NULL, length, numPasses));
+                bpcDecoder.decode(codeword, block, truncated.empty() ? NULL : &truncated[0], (size_t)block.width, 1);
+                int bp = (int)stream.numBitPlanes - 1 - (int)(numPasses - 1) / 3;
+                bool ok = true;
+                for (size_t j = 0; j < coefficients.size() && ok; ++j) {
+                    int known = (abs(coefficients[j]) >> bp) << bp;
+                    int value = truncated[j];
+                    ok = (abs(value) >> bp) << bp == known && (!known || (value < 0) == (coefficients[j] < 0));
+                }
+                if (!ok)
+                    bad++;
+                truncations++;
+            }
+        }
+
+        // the whole code word of every block, as tier-2 would hand it over
+        input.params = params;
+        input.numChannels = numChannels;
+        input.codeBlocks = encoded.codeBlocks;
+        input.blocks.resize(encoded.blocks.size());
+        for (size_t i = 0; i < encoded.blocks.size(); ++i) {
+            const HostCodeBlockStream& stream = encoded.blocks[i];
+            HostCodeBlockCodeword& codeword = input.blocks[i];
+            codeword.numBitPlanes = stream.numBitPlanes;
+            codeword.numPasses = stream.passRates.size();
+            codeword.segments.clear();
+            if (codeword.numPasses)
+                codeword.segments.push_back(HostCodeBlockSegment(&stream.data[0], stream.data.size(), codeword.numPasses));
+        }
+        decoded.assign(image.size(), 0x7FFF);
+        decoder.decode(&input, HostCoefficientImage(&decoded[0], rowPitch, numChannels));
+        decoder.wait();
+        for (size_t i = 0; i < encoded.blocks.size(); ++i) {
+            size_t channel = i / encoded.codeBlocks.size();
+            const OCLCodeBlock& block = encoded.codeBlocks[i % encoded.codeBlocks.size()];
+            bool ok = true;
+            for (size_t y = (size_t)block.y; y < (size_t)(block.y + block.height) && ok; ++y) {
+                for (size_t x = (size_t)block.x; x < (size_t)(block.x + block.width) && ok; ++x) {
+                    size_t idx = y * rowPitch + x * numChannels + channel;
+                    ok = decoded[idx] == image[idx];
+                }
+            }
+            if (!ok)
+                bad++;
+        }
+    }
+    printf("tier-1: %d frames, %d truncations, %d failed, %d bad code blocks\n", (int)numFrames, (int)truncations,
+           (int)failed, (int)bad);
+    return failed == 0 && bad == 0;
+}
+
+bool HostTest::testDequantization(size_t numImages) {
+    HostTier2Encoder encoder;
+    HostTier2Decoder decoder;
+    HostOutputArena arena;
+    J2KPacketLayout packetLayout;
+    HostTier1Output input;
+    HostTier2Output decoded;
+    std::vector<short> image;
+    size_t bad = 0;
+    size_t failed = 0;
+    for (size_t n = 0; n < numImages; ++n) {
+        HostCodestreamParams params = randomParams(TEST_DWT_MAX_SIZE);
+        params.lossy = true;
+        params.levels = random(TEST_DWT_MAX_LEVELS) + 1;
+        params.precision = 8 + random(5);
+        size_t w = params.width;
+        size_t h = params.height;
+        size_t levels = params.levels;
+
+        // the steps come from the QCD marker of a stream; its code blocks have no passes
+        input.numChannels = 1;
+        if (!packetLayout.init(params, input.numChannels)) {
+            failed++;
+            continue;
+        }
+        codeBlockTable(params, packetLayout, input.codeBlocks);
+        input.blocks.assign(input.codeBlocks.size(), HostCodeBlockStream());
+        if (!encoder.encode(params, input, arena) || !decoder.decode(arena.data(), arena.size(), decoded) ||
+                decoded.stepSizes.size() != 3 * levels + 1) {
+            failed++;
+            continue;
+        }
+
+        // quantized as OCLEncoder::runHostDWT does, with the steps of OCLDWT::getStep
+        std::vector<float> quant;
+        for (size_t level = 0; level < levels; ++level) {
+            quant.push_back(1.0f / J2KQuantization::step(J2KQuantization::irreversibleStep(level, J2K_ORIENT_LL, params.precision),
+                            J2K_ORIENT_LL, params.precision));
+            quant.push_back(1.0f / J2KQuantization::step(J2KQuantization::irreversibleStep(level, J2K_ORIENT_HL, params.precision),
+                            J2K_ORIENT_HL, params.precision));
+            quant.push_back(1.0f / J2KQuantization::step(J2KQuantization::irreversibleStep(level, J2K_ORIENT_HH, params.precision),
+                            J2K_ORIENT_HH, params.precision));
+        }
+        int range = 1 << params.precision;
+        image.resize(w * h);
+        for (size_t i = 0; i < image.size(); ++i)
+            image[i] = (short)((int)random((size_t)range) - range / 2);
+        std::vector<short*> components(1, &image[0]);
+        HostDWTForward<short> exact(true);
+        exact.run(components, w, h, levels, std::vector<float>());
+        HostDWTForward<short> quantized(true);
+        quantized.run(components, w, h, levels, quant);
+        const float* coefficients = (const float*)exact.getOutput();
+        const int16_t* indices = (const int16_t*)quantized.getOutput();
+
+        // level sizes, finest first
+        std::vector<size_t> widths(1, w);
+        std::vector<size_t> heights(1, h);
+        for (size_t l = 0; l < levels; ++l) {
+            widths.push_back((widths.back() + 1) >> 1);
+            heights.push_back((heights.back() + 1) >> 1);
+        }
+        bool ok = true;
+        for (size_t y = 0; y < h && ok; ++y) {
+            for (size_t x = 0; x < w && ok; ++x) {
+                // subband of the sample, in code block table order: LL, then HL, LH and HH from the coarsest level
+                size_t subband = 0;
+                size_t orient = J2K_ORIENT_LL;
+                for (size_t l = 0; l < levels; ++l) {
+                    bool highX = x >= widths[l + 1];
+                    bool highY = y >= heights[l + 1];
+                    if (highX || highY) {
+                        orient = highX ? (highY ? J2K_ORIENT_HH : J2K_ORIENT_HL) : J2K_ORIENT_LH;
+                        subband = 1 + 3 * (levels - 1 - l) + orient - 1;
+                        break;
+                    }
+                }
+                // dequantized at the mid point of the interval, as ocldwt97rev.cl does
+                double step = J2KQuantization::step(decoded.stepSizes[subband], orient, params.precision);
+                double value = coefficients[x + y * w];
+                int index = indices[x + y * w];
+                double tolerance = TEST_DEQUANT_TOLERANCE * (step + fabs(value));
+                if (index)
+                    ok = fabs((index + (index < 0 ? -0.5 : 0.5)) * step - value) <= 0.5 * step + tolerance;
+                else
+                    ok = fabs(value) < step + tolerance;
+            }
+        }
+        if (!ok)
+            bad++;
+    }
+    printf("dequantization: %d images, %d failed, %d bad\n", (int)numImages, (int)failed, (int)bad);
+    return failed == 0 && bad == 0;
+}
+
+// whole sample symmetric extension (T.800, F.3.7) of index i into [0, n)
+static size_t extendIndex(ptrdiff_t i, size_t n) {
+    if (n == 1)
+        return 0;
+    ptrdiff_t period = 2 * ((ptrdiff_t)n - 1);
+    i %= period;
+    if (i < 0)
+        i += period;
+    return (size_t)(i < (ptrdiff_t)n ? i : period - i);
+}
+
+// 1D_SR of T.800 (F.3.8) for the 5/3 filter, on n interleaved samples at stride, starting at an even index
+static void inverseLift53(int* data, size_t n, size_t stride, std::vector<int>& line) {
+    if (n < 2)
+        return;
+    line.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        line[i] = data[i * stride];
+    // F.7, then F.8: even samples first, from the extended odd samples
+    for (size_t i = 0; i < n; i += 2)
+        data[i * stride] = line[i] - ((line[extendIndex((ptrdiff_t)i - 1, n)] + line[extendIndex((ptrdiff_t)i + 1, n)] + 2) >> 2);
+    for (size_t i = 0; i < n; i += 2)
+        line[i] = data[i * stride];
+    for (size_t i = 1; i < n; i += 2)
+        data[i * stride] = line[i] + ((line[extendIndex((ptrdiff_t)i - 1, n)] + line[extendIndex((ptrdiff_t)i + 1, n)]) >> 1);
+}
+
+bool HostTest::testDWT(size_t numImages) {
+    std::vector<short> image;
+    std::vector<int> coefficients;
+    std::vector<int> level;
+    std::vector<int> line;
+    size_t bad = 0;
+    for (size_t n = 0; n < numImages; ++n) {
+        size_t w = random(TEST_DWT_MAX_SIZE) + 1;
+        size_t h = random(TEST_DWT_MAX_SIZE) + 1;
+        size_t levels = random(TEST_DWT_MAX_LEVELS) + 1;
+        image.resize(w * h);
+        for (size_t i = 0; i < image.size(); ++i)
+            image[i] = (short)((int)random(256) - 128);
+
+        // every other image takes the scalar path
+        HostDWTForward<short> dwt(false, (n & 1) != 0);
+        dwt.run(std::vector<short*>(1, &image[0]), w, h, levels, std::vector<float>());
+        const int16_t* output = (const int16_t*)dwt.getOutput();
+        coefficients.assign(output, output + w * h);
+
+        // level sizes, finest first
+        std::vector<size_t> widths(1, w);
+        std::vector<size_t> heights(1, h);
+        for (size_t l = 0; l < levels; ++l) {
+            widths.push_back((widths.back() + 1) >> 1);
+            heights.push_back((heights.back() + 1) >> 1);
+        }
+        // 2D_SR, coarsest level first: interleave the four sub bands, then lift rows, then columns
+        for (size_t l = levels; l-- > 0;) {
+            size_t lw = widths[l];
+            size_t lh = heights[l];
+            size_t lowWidth = widths[l + 1];
+            size_t lowHeight = heights[l + 1];
+            level.resize(lw * lh);
+            for (size_t y = 0; y < lh; ++y) {
+                for (size_t x = 0; x < lw; ++x) {
+                    size_t bandX = (x >> 1) + (x & 1) * lowWidth;
+                    size_t bandY = (y >> 1) + (y & 1) * lowHeight;
+                    level[x + y * lw] = coefficients[bandX + bandY * w];
+                }
+            }
+            for (size_t y = 0; y < lh; ++y)
+                inverseLift53(&level[y * lw], lw, 1, line);
+            for (size_t x = 0; x < lw; ++x)
+                inverseLift53(&level[x], lh, lw, line);
+            for (size_t y = 0; y < lh; ++y)
+                memcpy(&coefficients[y * w], &level[y * lw], lw * sizeof(int));
+        }
+        for (size_t i = 0; i < image.size(); ++i) {
+            if (coefficients[i] != image[i]) {
+                bad++;
+                break;
+            }
+        }
+    }
+    printf("dwt: %d images, %d bad\n", (int)numImages, (int)bad);
+    return bad == 0;
+}
+
+// contexts, as numbered in oclbpc.cl
+static const unsigned int REF_CX_SIGN_FIRST = 9;
+static const unsigned int REF_CX_REFINE_FIRST = 14;
+static const unsigned int REF_CX_RUN_LENGTH = 17;
+static const unsigned int REF_CX_UNIFORM = 18;
+
+static const size_t REF_STRIPE_HEIGHT = 4;
+
+// state of a sample
+static const unsigned char REF_SIGNIFICANT_F = 0x1;
+static const unsigned char REF_CODED_F = 0x2;       // coded in the significance pass of the current bit plane
+static const unsigned char REF_REFINED_F = 0x4;     // refined in an earlier bit plane
+static const unsigned char REF_SIGN_F = 0x8;
+
+HostReferenceBPC::HostReferenceBPC(void) : width(0),
+    height(0),
+    stride(0),
+    orientation(0),
+    coefficients(NULL),
+    cxd(NULL)
+{
+}
+
+void HostReferenceBPC::neighbours(size_t idx, unsigned int& h, unsigned int& v, unsigned int& d) const {
+    const unsigned char* s = &state[idx];
+    h = (s[-1] & REF_SIGNIFICANT_F) + (s[1] & REF_SIGNIFICANT_F);
+    v = (s[-(int)stride] & REF_SIGNIFICANT_F) + (s[stride] & REF_SIGNIFICANT_F);
+    d = (s[-(int)stride - 1] & REF_SIGNIFICANT_F) + (s[-(int)stride + 1] & REF_SIGNIFICANT_F) +
+        (s[stride - 1] & REF_SIGNIFICANT_F) + (s[stride + 1] & REF_SIGNIFICANT_F);
+}
+
+bool HostReferenceBPC::anySignificantNeighbour(size_t idx) const {
+    unsigned int h, v, d;
+    neighbours(idx, h, v, d);
+    return (h + v + d) != 0;
+}
+
+// ITU-T Rec. T.800, Table D.1: HL prefers vertical neighbours, LL and LH horizontal ones
+unsigned int HostReferenceBPC::zeroCodingContext(size_t idx) const {
+    unsigned int h, v, d;
+    neighbours(idx, h, v, d);
+    if (orientation == 3) {
+        unsigned int hv = h + v;
+        if (d >= 3)
+            return 8;
+        if (d == 2)
+            return hv >= 1 ? 7 : 6;
+        if (d == 1)
+            return hv >= 2 ? 5 : (hv == 1 ? 4 : 3);
+        return hv >= 2 ? 2 : hv;
+    }
+    unsigned int preferred = orientation == 1 ? v : h;
+    unsigned int other = orientation == 1 ? h : v;
+    if (preferred == 2)
+        return 8;
+    if (preferred == 1)
+        return other >= 1 ? 7 : (d >= 1 ? 6 : 5);
+    if (other >= 1)
+        return 2 + other;
+    return d >= 2 ? 2 : d;
+}
+
+// ITU-T Rec. T.800, Tables D.2 and D.3, written out
+void HostReferenceBPC::codeSign(size_t idx) {
+    // by horizontal, then vertical contribution, from -1 to 1
+    static const unsigned int contexts[3][3] = {{4, 3, 2}, {1, 0, 1}, {2, 3, 4}};
+    static const unsigned int xorBits[3][3] = {{1, 1, 1}, {1, 0, 0}, {0, 0, 0}};
+    const unsigned char* s = &state[idx];
+    const unsigned char* n[4] = {s - 1, s + 1, s - stride, s + stride};
+    int contribution[4];
+    for (size_t i = 0; i < 4; ++i)
+        contribution[i] = (*n[i] & REF_SIGNIFICANT_F) ? ((*n[i] & REF_SIGN_F) ? -1 : 1) : 0;
+    int h = std::max(-1, std::min(1, contribution[0] + contribution[1]));
+    int v = std::max(-1, std::min(1, contribution[2] + contribution[3]));
+    unsigned int sign = (*s & REF_SIGN_F) ? 1 : 0;
+    emit(REF_CX_SIGN_FIRST + contexts[h + 1][v + 1], sign ^ xorBits[h + 1][v + 1]);
+}
+
+void HostReferenceBPC::codeSample(size_t idx, size_t sample, int bp) {
+    unsigned int bit = ((unsigned int)abs(coefficients[sample]) >> bp) & 1;
+    emit(zeroCodingContext(idx), bit);
+    if (bit) {
+        codeSign(idx);
+        state[idx] |= REF_SIGNIFICANT_F;
+    }
+}
+
+void HostReferenceBPC::significancePass(int bp) {
+    for (size_t y0 = 0; y0 < height; y0 += REF_STRIPE_HEIGHT) {
+        size_t rows = std::min(REF_STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            for (size_t r = 0; r < rows; ++r) {
+                size_t idx = (y0 + r + 1) * stride + x + 1;
+                if ((state[idx] & REF_SIGNIFICANT_F) || !anySignificantNeighbour(idx))
+                    continue;
+                state[idx] |= REF_CODED_F;
+                codeSample(idx, (y0 + r) * width + x, bp);
+            }
+        }
+    }
+}
+
+void HostReferenceBPC::refinementPass(int bp) {
+    for (size_t y0 = 0; y0 < height; y0 += REF_STRIPE_HEIGHT) {
+        size_t rows = std::min(REF_STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            for (size_t r = 0; r < rows; ++r) {
+                size_t idx = (y0 + r + 1) * stride + x + 1;
+                unsigned char s = state[idx];
+                if (!(s & REF_SIGNIFICANT_F) || (s & REF_CODED_F))
+                    continue;
+                // Table D.4
+                unsigned int cx = REF_CX_REFINE_FIRST + ((s & REF_REFINED_F) ? 2 : (anySignificantNeighbour(idx) ? 1 : 0));
+                emit(cx, ((unsigned int)abs(coefficients[(y0 + r) * width + x]) >> bp) & 1);
+                state[idx] = s | REF_REFINED_F;
+            }
+        }
+    }
+}
+
+void HostReferenceBPC::cleanupPass(int bp) {
+    for (size_t y0 = 0; y0 < height; y0 += REF_STRIPE_HEIGHT) {
+        size_t rows = std::min(REF_STRIPE_HEIGHT, height - y0);
+        for (size_t x = 0; x < width; ++x) {
+            size_t r = 0;
+            if (rows == REF_STRIPE_HEIGHT) {
+                bool run = true;
+                for (size_t i = 0; i < REF_STRIPE_HEIGHT && run; ++i) {
+                    size_t idx = (y0 + i + 1) * stride + x + 1;
+                    run = !(state[idx] & (REF_SIGNIFICANT_F | REF_CODED_F)) && !anySignificantNeighbour(idx);
+                }
+                if (run) {
+                    // the first sample of the column that becomes significant, if any
+                    size_t first = 0;
+                    while (first < REF_STRIPE_HEIGHT && !(((unsigned int)abs(coefficients[(y0 + first) * width + x]) >> bp) & 1))
+                        first++;
+                    emit(REF_CX_RUN_LENGTH, first < REF_STRIPE_HEIGHT);
+                    if (first == REF_STRIPE_HEIGHT)
+                        continue;
+                    emit(REF_CX_UNIFORM, (unsigned int)(first >> 1));
+                    emit(REF_CX_UNIFORM, (unsigned int)(first & 1));
+                    size_t idx = (y0 + first + 1) * stride + x + 1;
+                    codeSign(idx);
+                    state[idx] |= REF_SIGNIFICANT_F;
+                    r = first + 1;
+                }
+            }
+            for (; r < rows; ++r) {
+                size_t idx = (y0 + r + 1) * stride + x + 1;
+                if (!(state[idx] & (REF_SIGNIFICANT_F | REF_CODED_F)))
+                    codeSample(idx, (y0 + r) * width + x, bp);
+            }
+            for (r = 0; r < rows; ++r)
+                state[(y0 + r + 1) * stride + x + 1] &= ~REF_CODED_F;
+        }
+    }
+}
+
+void HostReferenceBPC::code(const OCLCodeBlock& block, const int* coeffs, std::vector<cl_uint>& blockInfo, std::vector<cl_uchar>& pairs) {
+    width = (size_t)block.width;
+    height = (size_t)block.height;
+    stride = width + 2;
+    orientation = block.orientation;
+    coefficients = coeffs;
+    cxd = &pairs;
+    pairs.clear();
+    blockInfo.assign(BPC_BLOCK_INFO_SIZE, 0);
+
+    // the sign is known from the start, but only read once the sample is significant
+    state.assign(stride * (height + 2), 0);
+    unsigned int maxMagnitude = 0;
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            int c = coefficients[y * width + x];
+            maxMagnitude = std::max(maxMagnitude, (unsigned int)abs(c));
+            if (c < 0)
+                state[(y + 1) * stride + x + 1] = REF_SIGN_F;
+        }
+    }
+    size_t numBitPlanes = 0;
+    while (maxMagnitude >> numBitPlanes)
+        numBitPlanes++;
+    size_t numPasses = numBitPlanes ? 3 * numBitPlanes - 2 : 0;
+    blockInfo[0] = (cl_uint)numBitPlanes;
+    blockInfo[1] = (cl_uint)numPasses;
+
+    // the most significant bit plane only has a cleanup pass
+    size_t pass = 0;
+    for (int bp = (int)numBitPlanes - 1; bp >= 0; --bp) {
+        for (size_t kind = (bp == (int)numBitPlanes - 1) ? 2 : 0; kind < 3; ++kind, ++pass) {
+            blockInfo[2 + 2 * pass] = (cl_uint)pairs.size();
+            if (kind == 0)
+                significancePass(bp);
+            else if (kind == 1)
+                refinementPass(bp);
+            else
+                cleanupPass(bp);
+            blockInfo[3 + 2 * pass] = (cl_uint)pairs.size() - blockInfo[2 + 2 * pass];
+            // only rate control reads the distortion, which just has to fall with each pass
+            cl_float distortion = (cl_float)(numPasses - pass);
+            memcpy(&blockInfo[BPC_BLOCK_INFO_DISTORTION + pass], &distortion, sizeof(distortion));
+        }
+    }
+}
+
@@ -0,0 +1,106 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostMQEncoder.h"
+#include "HostMQDecoder.h"
+#include "HostTier1Encoder.h"
+#include "HostTier1Decoder.h"
+#include "HostTier2Encoder.h"
+#include "HostTier2Decoder.h"
+#include <vector>
+
+/*
+Round trip checks of the host entropy coders, which need no device:
+MQ coded symbol streams must decode to the symbols, whole and truncated at every pass boundary
+that tier-1 records, and tier-2 streams of synthetic tier-1 output must parse back into
+the same geometry and code words, for random geometry, layers, progression orders and precincts.
+Random code blocks, bit plane coded by a serial reference in the pass order and with the contexts
+of oclbpc.cl, must decode exactly, and to the known bit planes when truncated after a cleanup pass.
+Quantized DWT coefficients, dequantized with the steps read back from a stream we wrote, must lie
+within half a step of the unquantized ones.
+The 5/3 forward DWT, vectorized and scalar, must be undone exactly by an inverse that follows
+the order of the standard (2D_SR of T.800 Annex F: rows, then columns), as any conforming decoder does.
+
+A fixed seed makes every run the same, so a failure can be reproduced and debugged.
+*/
+class HostTest
+{
+public:
+    HostTest(unsigned int seed = 1);
+
+    // run every check, and print one line of results per check; returns false if any failed
+    bool test();
+private:
+    bool testMQ(size_t numSequences);
+    bool testTier2(size_t numFrames);
+    bool testTier1(size_t numFrames);
+    bool testDequantization(size_t numImages);
+    bool testDWT(size_t numImages);
+    // random geometry of a code stream with one quality layer
+    HostCodestreamParams randomParams(size_t maxSize);
+    // code block table of the frame, as OCLBPC partitions the subbands
+    static void codeBlockTable(const HostCodestreamParams& params, const J2KPacketLayout& packetLayout,
+                               std::vector<OCLCodeBlock>& codeBlocks);
+    // MQ code one random block of the geometry of block into stream, as tier-1 would
+    void randomBlock(const OCLCodeBlock& block, HostCodeBlockStream& stream);
+    // Compare decoded with the input it was written from: each code word must be the start of the input one,
+    // and, if the stream was complete, end on a pass. Returns the number of mismatched code blocks
+    static size_t compare(const HostCodestreamParams& params, const HostTier1Output& input,
+                          const HostTier2Output& decoded, bool complete);
+    // uniform in [0, n)
+    size_t random(size_t n);
+
+    unsigned int state;
+    HostMQEncoder mq;
+    std::vector<cl_uint> blockInfo;     // in the layout of OCLBPCMappedOutput
+    std::vector<cl_uchar> cxd;
+};
+
+/*
+Serial bit plane coder (ITU-T Rec. T.800, Annex D) in the scan order, pass order and contexts of oclbpc.cl:
+the device coder, one sample at a time, so that the host decoders can be checked without a device.
+*/
+class HostReferenceBPC
+{
+public:
+    HostReferenceBPC(void);
+    // Code the block.width x block.height coefficients of block, row by row, into blockInfo and cxd,
+    // in the layout of OCLBPCMappedOutput
+    void code(const OCLCodeBlock& block, const int* coefficients, std::vector<cl_uint>& blockInfo, std::vector<cl_uchar>& pairs);
+private:
+    void significancePass(int bp);
+    void refinementPass(int bp);
+    void cleanupPass(int bp);
+    // zero coding of the insignificant sample at state index idx, and its sign if it becomes significant
+    void codeSample(size_t idx, size_t sample, int bp);
+    void codeSign(size_t idx);
+    void neighbours(size_t idx, unsigned int& h, unsigned int& v, unsigned int& d) const;
+    bool anySignificantNeighbour(size_t idx) const;
+    unsigned int zeroCodingContext(size_t idx) const;
+    void emit(unsigned int cx, unsigned int d) {
+        cxd->push_back((cl_uchar)((cx << 1) | d));
+    }
+
+    size_t width;
+    size_t height;
+    size_t stride;          // of the state, which has a border of one sample on each side
+    int orientation;
+    const int* coefficients;
+    std::vector<unsigned char> state;
+    std::vector<cl_uchar>* cxd;
+};
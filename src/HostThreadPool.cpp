@@ -0,0 +1,79 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostThreadPool.h"
+
+HostThreadPool::HostThreadPool(size_t numThreads) :
+    pending(0),
+    stopping(false)
+{
+    if (numThreads == 0)
+        numThreads = boost::thread::hardware_concurrency();
+    if (numThreads == 0)
+        numThreads = 1;
+    for (size_t i = 0; i < numThreads; ++i)
+        threads.push_back(new boost::thread(&HostThreadPool::work, this));
+}
+
+HostThreadPool::~HostThreadPool(void)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
+
+void HostThreadPool::submit(HostTask* task) {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        tasks.push_back(task);
+        pending++;
+    }
+    taskAvailable.notify_one();
+}
+
+void HostThreadPool::wait() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (pending)
+        tasksDone.wait(lock);
+}
+
+void HostThreadPool::work() {
+    while (true) {
+        HostTask* task = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (tasks.empty() && !stopping)
+                taskAvailable.wait(lock);
+            if (tasks.empty())
+                return;
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task->run();
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            pending--;
+            if (!pending)
+                tasksDone.notify_all();
+        }
+    }
+}
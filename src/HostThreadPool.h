@@ -0,0 +1,65 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <boost/thread.hpp>
+#include <deque>
+#include <vector>
+
+// unit of work for HostThreadPool
+class HostTask
+{
+public:
+    virtual ~HostTask(void) {}
+    virtual void run() = 0;
+};
+
+/*
+Fixed pool of worker threads, fed from a single queue.
+
+There are no per-worker deques and no work stealing. The tier-1 coders submit one task per
+thread, and each task claims chunks of code blocks from a shared counter. That balances the
+load dynamically, as stealing would, because all blocks of a frame are known up front, and
+no task spawns more work. The lock is taken once per chunk and once per task, so
+contention stays negligible next to the MQ coding of a chunk.
+
+Tasks are owned by the caller, and must stay alive until wait() returns.
+*/
+class HostThreadPool
+{
+public:
+    // numThreads == 0 creates one thread per hardware thread
+    HostThreadPool(size_t numThreads = 0);
+    ~HostThreadPool(void);
+
+    size_t getNumThreads() {
+        return threads.size();
+    }
+    void submit(HostTask* task);
+    // block until every submitted task has run
+    void wait();
+private:
+    void work();
+
+    std::vector<boost::thread*> threads;
+    boost::mutex mutex;
+    boost::condition_variable taskAvailable;
+    boost::condition_variable tasksDone;
+    std::deque<HostTask*> tasks;
+    size_t pending;     // submitted tasks that have not completed
+    bool stopping;
+};
@@ -0,0 +1,84 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostTier1Decoder.h"
+#include <algorithm>
+
+// blocks claimed by a worker at a time: large enough to keep the shared counter cold,
+// small enough to balance the load at the end of a frame
+static const size_t TIER1_CHUNK_SIZE = 16;
+
+HostTier1Decoder::HostTier1Decoder(size_t numThreads) :
+    pool(new HostThreadPool(numThreads)),
+    nextBlock(0),
+    input(NULL),
+    selection(NULL)
+{
+    for (size_t i = 0; i < pool->getNumThreads(); ++i)
+        workers.push_back(new Worker(this));
+}
+
+HostTier1Decoder::~HostTier1Decoder(void)
+{
+    if (pool) {
+        pool->wait();
+        delete pool;
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        delete workers[i];
+}
+
+void HostTier1Decoder::decode(const HostTier2Output* in, HostCoefficientImage out, const std::vector<size_t>* blocks) {
+    pool->wait();
+    input = in;
+    output = out;
+    selection = blocks;
+    nextBlock = 0;
+    for (size_t i = 0; i < workers.size(); ++i)
+        pool->submit(workers[i]);
+}
+
+void HostTier1Decoder::wait() {
+    pool->wait();
+}
+
+bool HostTier1Decoder::nextChunk(size_t& begin, size_t& end) {
+    boost::mutex::scoped_lock lock(chunkMutex);
+    size_t numBlocks = selection ? input->numChannels * selection->size() : input->blocks.size();
+    if (nextBlock >= numBlocks)
+        return false;
+    begin = nextBlock;
+    end = std::min(numBlocks, nextBlock + TIER1_CHUNK_SIZE);
+    nextBlock = end;
+    return true;
+}
+
+void HostTier1Decoder::Worker::run() {
+    const HostTier2Output& in = *parent->input;
+    const HostCoefficientImage& out = parent->output;
+    const std::vector<size_t>* selection = parent->selection;
+    size_t blocksPerChannel = selection ? selection->size() : in.codeBlocks.size();
+    size_t begin = 0, end = 0;
+    while (parent->nextChunk(begin, end)) {
+        for (size_t i = begin; i < end; ++i) {
+            size_t channel = i / blocksPerChannel;
+            size_t index = selection ? (*selection)[i % blocksPerChannel] : i % blocksPerChannel;
+            const OCLCodeBlock& block = in.codeBlocks[index];
+            short* dst = out.data + channel + ((size_t)block.y - out.y0) * out.rowPitch + ((size_t)block.x - out.x0) * out.pixelPitch;
+            bpc.decode(in.blocks[channel * in.codeBlocks.size() + index], block, dst, out.rowPitch, out.pixelPitch);
+        }
+    }
+}
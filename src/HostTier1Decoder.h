@@ -0,0 +1,77 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostThreadPool.h"
+#include "HostBPCDecoder.h"
+#include "HostTier2Decoder.h"
+#include <vector>
+
+// coefficient image that decoded code blocks are written into, in the layout of the DWT output
+struct HostCoefficientImage {
+    HostCoefficientImage() : data(NULL), rowPitch(0), pixelPitch(1), x0(0), y0(0) {}
+    HostCoefficientImage(short* data, size_t rowPitch, size_t pixelPitch, size_t x0 = 0, size_t y0 = 0) : data(data),
+        rowPitch(rowPitch), pixelPitch(pixelPitch), x0(x0), y0(y0) {}
+    short* data;            // sample (x0, y0) of channel 0
+    size_t rowPitch;        // in samples
+    size_t pixelPitch;      // in samples: the number of interleaved channels
+    size_t x0;              // origin of a part of the DWT output, such as a mapped region
+    size_t y0;
+};
+
+/*
+Host tier-1 decoder: MQ and bit plane decodes every code block of a frame, the inverse of HostTier1Encoder.
+
+Code blocks are independent, so each worker of the thread pool takes chunks of blocks from a shared counter
+until the frame is done, and writes them straight into the coefficient image, which is usually the mapped
+DWT output image of the device: every sample of the image belongs to exactly one block.
+*/
+class HostTier1Decoder
+{
+public:
+    // numThreads == 0 creates one thread per hardware thread
+    HostTier1Decoder(size_t numThreads = 0);
+    ~HostTier1Decoder(void);
+
+    // Start decoding input into output, and return immediately.
+    // input and the code stream it points into must stay untouched, and output mapped, until wait() returns.
+    // blocks, if not NULL, selects the code blocks of each channel to decode, by code block table index,
+    // such as those of a J2KWindow; the samples of all others are left untouched
+    void decode(const HostTier2Output* input, HostCoefficientImage output, const std::vector<size_t>* blocks = NULL);
+    // block until the last decode has completed
+    void wait();
+private:
+    class Worker : public HostTask
+    {
+    public:
+        Worker(HostTier1Decoder* parent) : parent(parent) {}
+        void run();
+    private:
+        HostTier1Decoder* parent;
+        HostBPCDecoder bpc;
+    };
+    // claim the next chunk of blocks; returns false when there are none left
+    bool nextChunk(size_t& begin, size_t& end);
+
+    HostThreadPool* pool;
+    std::vector<Worker*> workers;
+    boost::mutex chunkMutex;
+    size_t nextBlock;
+    const HostTier2Output* input;
+    HostCoefficientImage output;
+    const std::vector<size_t>* selection;
+};
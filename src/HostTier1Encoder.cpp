@@ -0,0 +1,109 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "HostTier1Encoder.h"
+#include <algorithm>
+
+// blocks claimed by a worker at a time: large enough to keep the shared counter cold,
+// small enough to balance the load at the end of a frame
+static const size_t TIER1_CHUNK_SIZE = 16;
+
+HostTier1Encoder::HostTier1Encoder(size_t numThreads) :
+    pool(new HostThreadPool(numThreads)),
+    nextBlock(0),
+    output(NULL)
+{
+    for (size_t i = 0; i < pool->getNumThreads(); ++i)
+        workers.push_back(new Worker(this));
+}
+
+HostTier1Encoder::~HostTier1Encoder(void)
+{
+    if (pool) {
+        pool->wait();
+        delete pool;
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        delete workers[i];
+}
+
+void HostTier1Encoder::encode(const OCLBPCMappedOutput& in, HostTier1Output* out) {
+    pool->wait();
+    input = in;
+    output = out;
+    output->codeBlocks.assign(in.codeBlocks, in.codeBlocks + in.numCodeBlocks);
+    output->numChannels = in.numChannels;
+    output->blocks.resize(in.numChannels * in.numCodeBlocks);
+    nextBlock = 0;
+    for (size_t i = 0; i < workers.size(); ++i)
+        pool->submit(workers[i]);
+}
+
+void HostTier1Encoder::wait() {
+    pool->wait();
+}
+
+bool HostTier1Encoder::nextChunk(size_t& begin, size_t& end) {
+    boost::mutex::scoped_lock lock(chunkMutex);
+    size_t numBlocks = output->blocks.size();
+    if (nextBlock >= numBlocks)
+        return false;
+    begin = nextBlock;
+    end = std::min(numBlocks, nextBlock + TIER1_CHUNK_SIZE);
+    nextBlock = end;
+    return true;
+}
+
+void HostTier1Encoder::Worker::run() {
+    size_t begin = 0, end = 0;
+    while (parent->nextChunk(begin, end)) {
+        for (size_t i = begin; i < end; ++i)
+            encodeBlock(mq, parent->input.blockInfo + i * BPC_BLOCK_INFO_SIZE, parent->input.cxd, parent->output->blocks[i]);
+    }
+}
+
+void HostTier1Encoder::encodeBlock(HostMQEncoder& mq, const cl_uint* blockInfo, const cl_uchar* cxd, HostCodeBlockStream& stream) {
+    size_t numPasses = blockInfo[1];
+    stream.numBitPlanes = blockInfo[0];
+    stream.passRates.resize(numPasses);
+    stream.passDistortions.resize(numPasses);
+    for (size_t pass = 0; pass < numPasses; ++pass)
+        stream.passDistortions[pass] = asFloat(blockInfo[BPC_BLOCK_INFO_DISTORTION + pass]);
+    stream.data.clear();
+    if (!numPasses)
+        return;
+
+    mq.init();
+    for (size_t pass = 0; pass < numPasses; ++pass) {
+        const cl_uchar* pairs = cxd + blockInfo[2 + 2 * pass];
+        const cl_uchar* pairsEnd = pairs + blockInfo[3 + 2 * pass];
+        for (; pairs < pairsEnd; ++pairs)
+            mq.encode(*pairs >> 1, *pairs & 1);
+        stream.passRates[pass] = mq.truncationLength();
+    }
+    mq.flush(stream.data);
+    // the last pass is terminated
+    stream.passRates[numPasses - 1] = stream.data.size();
+
+    // A truncation point may not end on 0xFF, and none may be beyond the end of the code word
+    size_t previous = 0;
+    for (size_t pass = 0; pass < numPasses; ++pass) {
+        size_t rate = std::min(stream.passRates[pass], stream.data.size());
+        if (rate > previous && stream.data[rate - 1] == 0xFF)
+            rate--;
+        stream.passRates[pass] = std::max(rate, previous);
+        previous = stream.passRates[pass];
+    }
+}
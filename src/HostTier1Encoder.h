@@ -0,0 +1,81 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include "HostThreadPool.h"
+#include "HostMQEncoder.h"
+#include "OCLBPC.h"
+#include <vector>
+
+// MQ coded code word of one code block
+struct HostCodeBlockStream {
+    HostCodeBlockStream() : numBitPlanes(0) {}
+    std::vector<unsigned char> data;
+    std::vector<size_t> passRates;      // length of data needed to decode up to the end of each pass
+    std::vector<float> passDistortions; // reduction of the squared error of each pass, in squared quantization steps
+    size_t numBitPlanes;
+};
+
+// tier-1 output of one frame
+struct HostTier1Output {
+    HostTier1Output() : numChannels(0) {}
+    std::vector<OCLCodeBlock> codeBlocks;   // code blocks of one channel; the same for all channels
+    size_t numChannels;
+    std::vector<HostCodeBlockStream> blocks; // channel * codeBlocks.size() + code block
+};
+
+/*
+Host tier-1 encoder: MQ codes the (CX,D) pairs of every code block.
+
+Code blocks are independent, so each worker of the thread pool takes chunks of blocks
+from a shared counter until the frame is done; the cost of a chunk varies with image content,
+so workers that draw cheap chunks simply take more of them.
+*/
+class HostTier1Encoder
+{
+public:
+    // numThreads == 0 creates one thread per hardware thread
+    HostTier1Encoder(size_t numThreads = 0);
+    ~HostTier1Encoder(void);
+
+    // Start coding input into output, and return immediately.
+    // input must stay mapped, and output untouched, until wait() returns
+    void encode(const OCLBPCMappedOutput& input, HostTier1Output* output);
+    // block until the last encode has completed
+    void wait();
+
+    // code one block, whose BPC output is in the device layout of OCLBPCMappedOutput
+    static void encodeBlock(HostMQEncoder& mq, const cl_uint* blockInfo, const cl_uchar* cxd, HostCodeBlockStream& stream);
+private:
+    class Worker : public HostTask
+    {
+    public:
+        Worker(HostTier1Encoder* parent) : parent(parent) {}
+        void run();
+    private:
+        HostTier1Encoder* parent;
+        HostMQEncoder mq;
+    };
+    // claim the next chunk of blocks; returns false when there are none left
+    bool nextChunk(size_t& begin, size_t& end);
+
+    HostThreadPool* pool;
+    std::vector<Worker*> workers;
+    boost::mutex chunkMutex;
+    size_t nextBlock;
+    OCLBPCMappedOutput input;
+    HostTier1Output* output;
+};
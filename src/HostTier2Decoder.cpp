@@ -0,0 +1,588 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostTier2Decoder.h"
+#include "OCLUtil.h"
+#include <limits.h>
+#include <algorithm>
+
+// length bits of a code block before any increment (B.10.7.1)
+static const size_t INITIAL_LBLOCK = 3;
+
+// JP2 box header: length and type; an extended length follows a length of 1
+static const size_t JP2_BOX_HEADER_SIZE = 8;
+static const size_t JP2_BOX_HEADER_XL_SIZE = 16;
+
+// SOT marker segment, and SOP marker segment, including the marker
+static const size_t J2K_SOT_SIZE = 12;
+static const size_t J2K_SOP_SIZE = 6;
+
+// largest number of decomposition levels of COD
+static const size_t J2K_MAX_LEVELS = 32;
+
+static unsigned int readUInt16(const unsigned char* p) {
+    return ((unsigned int)p[0] << 8) | p[1];
+}
+
+static unsigned int readUInt32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static size_t numBits(size_t val) {
+    size_t n = 0;
+    for (; val; val >>= 1)
+        n++;
+    return n;
+}
+
+HostTier2Decoder::HostTier2Decoder(void) : nextPacket(0),
+    truncated(false),
+    packetStartMarkers(false),
+    packetHeaderMarkers(false)
+{
+}
+
+bool HostTier2Decoder::findCodestream(const unsigned char*& data, size_t& size) {
+    if (size >= 2 && readUInt16(data) == J2K_SOC)
+        return true;
+    if (size < 12 || readUInt32(data) != 12 || readUInt32(data + 4) != JP2_BOX_SIGNATURE || readUInt32(data + 8) != JP2_SIGNATURE) {
+        LogError("tier-2: neither a code stream nor a JP2 file");
+        return false;
+    }
+    size_t pos = 0;
+    while (size - pos >= JP2_BOX_HEADER_SIZE) {
+        unsigned long long length = readUInt32(data + pos);
+        unsigned int type = readUInt32(data + pos + 4);
+        size_t header = JP2_BOX_HEADER_SIZE;
+        if (length == 1) {
+            if (size - pos < JP2_BOX_HEADER_XL_SIZE)
+                break;
+            length = ((unsigned long long)readUInt32(data + pos + 8) << 32) | readUInt32(data + pos + 12);
+            header = JP2_BOX_HEADER_XL_SIZE;
+        } else if (length == 0) {
+            // last box: up to the end of the file
+            length = size - pos;
+        }
+        if (length < header) {
+            LogError("tier-2: JP2 box of %llu bytes", length);
+            return false;
+        }
+        // a file cut short still holds the first part of the code stream
+        size_t available = (size_t)std::min(length, (unsigned long long)(size - pos));
+        if (type == JP2_BOX_CODESTREAM) {
+            data += pos + header;
+            size = available - header;
+            if (size < 2 || readUInt16(data) != J2K_SOC) {
+                LogError("tier-2: code stream box does not start with SOC");
+                return false;
+            }
+            return true;
+        }
+        pos += available;
+    }
+    LogError("tier-2: JP2 file without a code stream box");
+    return false;
+}
+
+bool HostTier2Decoder::readSIZ(const unsigned char* segment, size_t length, HostTier2Output& output) {
+    if (length < 38) {
+        LogError("tier-2: SIZ of %d bytes", (int)length);
+        return false;
+    }
+    size_t width = readUInt32(segment + 2), height = readUInt32(segment + 6);
+    size_t originX = readUInt32(segment + 10), originY = readUInt32(segment + 14);
+    size_t tileW = readUInt32(segment + 18), tileH = readUInt32(segment + 22);
+    size_t tileOriginX = readUInt32(segment + 26), tileOriginY = readUInt32(segment + 30);
+    size_t numChannels = readUInt16(segment + 34);
+    if (!numChannels || length != 36 + 3 * numChannels) {
+        LogError("tier-2: SIZ of %d bytes for %d components", (int)length, (int)numChannels);
+        return false;
+    }
+    if (originX || originY || tileOriginX || tileOriginY || tileW < width || tileH < height) {
+        LogError("tier-2: only a single tile at the origin is supported");
+        return false;
+    }
+    if (!width || !height) {
+        LogError("tier-2: empty image");
+        return false;
+    }
+    const unsigned char* component = segment + 36;
+    for (size_t c = 0; c < numChannels; ++c, component += 3) {
+        // components are unsigned, of equal precision, and not subsampled, as the encoder writes them
+        if (component[0] & 0x80) {
+            LogError("tier-2: signed components are not supported");
+            return false;
+        }
+        if (component[0] != segment[36]) {
+            LogError("tier-2: components of different precision are not supported");
+            return false;
+        }
+        if (component[1] != 1 || component[2] != 1) {
+            LogError("tier-2: subsampled components are not supported");
+            return false;
+        }
+    }
+    output.params.width = width;
+    output.params.height = height;
+    output.params.precision = (size_t)(segment[36] & 0x7F) + 1;
+    output.numChannels = numChannels;
+    return true;
+}
+
+bool HostTier2Decoder::readCOD(const unsigned char* segment, size_t length, HostTier2Output& output) {
+    if (length < 10) {
+        LogError("tier-2: COD of %d bytes", (int)length);
+        return false;
+    }
+    unsigned int style = segment[0];
+    HostCodestreamParams& params = output.params;
+    params.progression = segment[1];
+    params.numLayers = readUInt16(segment + 2);
+    unsigned int componentTransform = segment[4];
+    params.levels = segment[5];
+    size_t expX = (size_t)segment[6] + 2, expY = (size_t)segment[7] + 2;
+    unsigned int blockStyle = segment[8];
+    unsigned int transform = segment[9];
+    if (style & ~(J2K_COD_PRECINCTS | J2K_COD_SOP | J2K_COD_EPH)) {
+        LogError("tier-2: unknown coding style 0x%x", style);
+        return false;
+    }
+    if (componentTransform) {
+        LogError("tier-2: component transforms are not supported");
+        return false;
+    }
+    if (params.levels > J2K_MAX_LEVELS || expX > 10 || expY > 10 || expX + expY > 12) {
+        LogError("tier-2: %d levels, code blocks of 2^%d x 2^%d", (int)params.levels, (int)expX, (int)expY);
+        return false;
+    }
+    if (blockStyle) {
+        LogError("tier-2: code block style 0x%x is not supported", blockStyle);
+        return false;
+    }
+    if (transform != J2K_TRANSFORM_97 && transform != J2K_TRANSFORM_53) {
+        LogError("tier-2: unknown wavelet transform %d", transform);
+        return false;
+    }
+    params.codeBlockX = (size_t)1 << expX;
+    params.codeBlockY = (size_t)1 << expY;
+    params.lossy = transform == J2K_TRANSFORM_97;
+    packetStartMarkers = (style & J2K_COD_SOP) != 0;
+    packetHeaderMarkers = (style & J2K_COD_EPH) != 0;
+
+    // precinct sizes are signalled from the lowest resolution up, and listed in params from the highest down
+    params.precinctWidth.clear();
+    params.precinctHeight.clear();
+    size_t numResolutions = params.levels + 1;
+    if (length != 10 + ((style & J2K_COD_PRECINCTS) ? numResolutions : 0)) {
+        LogError("tier-2: COD of %d bytes for %d levels", (int)length, (int)params.levels);
+        return false;
+    }
+    if (style & J2K_COD_PRECINCTS) {
+        for (size_t r = numResolutions; r-- > 0;) {
+            params.precinctWidth.push_back((size_t)1 << (segment[10 + r] & 0xF));
+            params.precinctHeight.push_back((size_t)1 << (segment[10 + r] >> 4));
+        }
+    }
+    return true;
+}
+
+bool HostTier2Decoder::readQCD(const unsigned char* segment, size_t length, HostTier2Output& output) {
+    const HostCodestreamParams& params = output.params;
+    size_t numSubbands = 3 * params.levels + 1;
+    unsigned int style = segment[0] & 0x1F;
+    output.numGuardBits = segment[0] >> 5;
+    output.stepSizes.resize(numSubbands);
+    if (style == J2K_QUANT_NONE && !params.lossy && length == 1 + numSubbands) {
+        for (size_t i = 0; i < numSubbands; ++i)
+            output.stepSizes[i] = J2KStepSize(segment[1 + i] >> 3, 0);
+        return true;
+    }
+    if (style == J2K_QUANT_SCALAR_EXPOUNDED && params.lossy && length == 1 + 2 * numSubbands) {
+        for (size_t i = 0; i < numSubbands; ++i) {
+            unsigned int step = readUInt16(segment + 1 + 2 * i);
+            output.stepSizes[i] = J2KStepSize((int)(step >> 11), (int)(step & 0x7FF));
+        }
+        return true;
+    }
+    if (style == J2K_QUANT_SCALAR_DERIVED && params.lossy && length == 3) {
+        // E.1.1.2: the exponent of LL is signalled; each level up adds one
+        unsigned int step = readUInt16(segment + 1);
+        output.stepSizes[0] = J2KStepSize((int)(step >> 11), (int)(step & 0x7FF));
+        for (size_t i = 1; i < numSubbands; ++i) {
+            size_t level = params.levels - (i - 1) / 3;
+            output.stepSizes[i] = J2KStepSize(output.stepSizes[0].exponent - (int)params.levels + (int)level,
+                                              output.stepSizes[0].mantissa);
+        }
+        return true;
+    }
+    LogError("tier-2: QCD style %d of %d bytes does not match the %s transform with %d levels", style, (int)length,
+             params.lossy ? "9/7" : "5/3", (int)params.levels);
+    return false;
+}
+
+bool HostTier2Decoder::readMainHeader(const unsigned char* data, size_t size, size_t& pos, HostTier2Output& output) {
+    const unsigned char* qcd = NULL;
+    size_t qcdLength = 0;
+    bool siz = false, cod = false;
+    pos = 2;
+    while (true) {
+        if (size - pos < 2) {
+            LogError("tier-2: code stream ends in the main header");
+            return false;
+        }
+        unsigned int marker = readUInt16(data + pos);
+        if (marker == J2K_SOT)
+            break;
+        if (size - pos < 4 || readUInt16(data + pos + 2) < 2 || size - pos - 2 < readUInt16(data + pos + 2)) {
+            LogError("tier-2: code stream ends in marker 0x%04X", marker);
+            return false;
+        }
+        // marker segment, without marker and length
+        const unsigned char* segment = data + pos + 4;
+        size_t length = readUInt16(data + pos + 2) - 2;
+        pos += 4 + length;
+        switch (marker) {
+        case J2K_SIZ:
+            if (!readSIZ(segment, length, output))
+                return false;
+            siz = true;
+            break;
+        case J2K_COD:
+            if (!readCOD(segment, length, output))
+                return false;
+            cod = true;
+            break;
+        case J2K_QCD:
+            // needs the number of levels from COD, which may follow
+            qcd = segment;
+            qcdLength = length;
+            break;
+        case J2K_COC:
+        case J2K_QCC:
+        case J2K_RGN:
+        case J2K_POC:
+        case J2K_PPM:
+            LogError("tier-2: marker 0x%04X is not supported", marker);
+            return false;
+        default:
+            // COM, TLM, PLM, CRG, and markers of later parts, carry nothing needed to decode
+            if ((marker >> 8) != 0xFF) {
+                LogError("tier-2: 0x%04X is not a marker", marker);
+                return false;
+            }
+            break;
+        }
+    }
+    if (!siz || !cod || !qcd || !qcdLength) {
+        LogError("tier-2: main header without %s", !siz ? "SIZ" : (!cod ? "COD" : "QCD"));
+        return false;
+    }
+    return readQCD(qcd, qcdLength, output);
+}
+
+bool HostTier2Decoder::layout(HostTier2Output& output) {
+    const HostCodestreamParams& params = output.params;
+    if (!packetLayout.matches(params, output.numChannels)) {
+        if (!packetLayout.init(params, output.numChannels))
+            return false;
+        const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+        const std::vector<J2KPacketLayout::Resolution>& resolutions = packetLayout.getResolutions();
+        inclusion.resize(output.numChannels * packetLayout.getNumPrecincts());
+        zeroBitPlanes.resize(inclusion.size());
+        for (size_t channel = 0; channel < output.numChannels; ++channel) {
+            for (size_t i = 0; i < subbands.size(); ++i) {
+                const J2KPacketLayout::Subband& sb = subbands[i];
+                const J2KPacketLayout::Resolution& res = resolutions[sb.resolution];
+                for (size_t p = 0; p < res.numPrecinctsX * res.numPrecinctsY; ++p) {
+                    size_t x0, y0, x1, y1;
+                    packetLayout.precinctBlocks(sb, p, x0, y0, x1, y1);
+                    size_t tree = channel * packetLayout.getNumPrecincts() + sb.firstTree + p;
+                    inclusion[tree].init(x1 - x0, y1 - y0);
+                    zeroBitPlanes[tree].init(x1 - x0, y1 - y0);
+                }
+            }
+        }
+    } else {
+        for (size_t i = 0; i < inclusion.size(); ++i) {
+            inclusion[i].reset();
+            zeroBitPlanes[i].reset();
+        }
+    }
+
+    // code block table, as OCLBPC partitions the subbands
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    output.codeBlocks.resize(packetLayout.getNumBlocks());
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        for (size_t y = 0; y < sb.numBlocksY; ++y) {
+            for (size_t x = 0; x < sb.numBlocksX; ++x) {
+                OCLCodeBlock& block = output.codeBlocks[sb.firstBlock + x + y * sb.numBlocksX];
+                block.x = (cl_int)(sb.x + x * params.codeBlockX);
+                block.y = (cl_int)(sb.y + y * params.codeBlockY);
+                block.width = (cl_int)std::min(params.codeBlockX, sb.width - x * params.codeBlockX);
+                block.height = (cl_int)std::min(params.codeBlockY, sb.height - y * params.codeBlockY);
+                block.orientation = (cl_int)sb.orientation;
+                block.level = (cl_int)sb.level;
+            }
+        }
+    }
+    // segments keep their capacity from the last frame
+    output.blocks.resize(output.numChannels * output.codeBlocks.size());
+    for (size_t i = 0; i < output.blocks.size(); ++i) {
+        output.blocks[i].numBitPlanes = 0;
+        output.blocks[i].numPasses = 0;
+        output.blocks[i].segments.clear();
+    }
+    lblock.assign(output.blocks.size(), INITIAL_LBLOCK);
+    skipped.assign(inclusion.size(), false);
+    nextPacket = 0;
+    return true;
+}
+
+bool HostTier2Decoder::readPLT(const unsigned char* segment, size_t length) {
+    // Lplt and Zplt, then lengths of 7 bits per byte, most significant first, with the top bit set on all but the last byte
+    size_t val = 0;
+    bool pending = false;
+    for (size_t i = 3; i < length; ++i) {
+        val = (val << 7) | (segment[i] & 0x7F);
+        pending = (segment[i] & 0x80) != 0;
+        if (!pending) {
+            packetLengths.push_back(val);
+            val = 0;
+        }
+    }
+    if (pending || length < 3) {
+        LogError("tier-2: PLT ends within a packet length");
+        return false;
+    }
+    return true;
+}
+
+size_t HostTier2Decoder::precinctTree(const J2KPacketLayout::Packet& packet) const {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    size_t i = 0;
+    while (i + 1 < subbands.size() && subbands[i].resolution != packet.resolution)
+        i++;
+    return packet.channel * packetLayout.getNumPrecincts() + subbands[i].firstTree + packet.precinct;
+}
+
+size_t HostTier2Decoder::readNumPasses(HostBitReader& in) {
+    // Table B.4
+    if (!in.readBit())
+        return 1;
+    if (!in.readBit())
+        return 2;
+    size_t n = in.readBits(2);
+    if (n != 3)
+        return 3 + n;
+    n = in.readBits(5);
+    if (n != 31)
+        return 6 + n;
+    return 37 + in.readBits(7);
+}
+
+bool HostTier2Decoder::readPacket(const unsigned char* data, size_t end, size_t& pos, const J2KPacketLayout::Packet& packet,
+                                  HostTier2Output& output) {
+    if (packetStartMarkers && end - pos >= J2K_SOP_SIZE && readUInt16(data + pos) == J2K_SOP)
+        pos += J2K_SOP_SIZE;
+
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    size_t channelOffset = packet.channel * output.codeBlocks.size();
+    HostBitReader in(data + pos, end - pos);
+    contributions.clear();
+    if (in.readBit()) {
+        for (size_t i = 0; i < subbands.size(); ++i) {
+            const J2KPacketLayout::Subband& sb = subbands[i];
+            if (sb.resolution != packet.resolution)
+                continue;
+            size_t tree = packet.channel * packetLayout.getNumPrecincts() + sb.firstTree + packet.precinct;
+            HostTagTree& incl = inclusion[tree];
+            HostTagTree& zbp = zeroBitPlanes[tree];
+            int maxBitPlanes = J2KQuantization::maxBitPlanes(output.stepSizes[i], output.numGuardBits);
+            size_t x0, y0, x1, y1;
+            packetLayout.precinctBlocks(sb, packet.precinct, x0, y0, x1, y1);
+            for (size_t y = y0; y < y1; ++y) {
+                for (size_t x = x0; x < x1; ++x) {
+                    size_t leaf = (x - x0) + (y - y0) * (x1 - x0);
+                    size_t block = channelOffset + sb.firstBlock + x + y * sb.numBlocksX;
+                    HostCodeBlockCodeword& codeword = output.blocks[block];
+                    // blocks not yet included read their first layer; the others a single bit
+                    bool firstInclusion = !codeword.numPasses;
+                    bool included = firstInclusion ? incl.decode(in, leaf, (int)packet.layer + 1) : in.readBit() != 0;
+                    if (!included)
+                        continue;
+                    if (firstInclusion) {
+                        // missing most significant bit planes: raise the threshold until the value is known
+                        int threshold = 1;
+                        while (!zbp.decode(in, leaf, threshold) && !in.overrun() && threshold < maxBitPlanes)
+                            threshold++;
+                        int numBitPlanes = maxBitPlanes - zbp.getValue(leaf);
+                        if (in.overrun())
+                            break;
+                        if (numBitPlanes < 1 || numBitPlanes > (int)BPC_MAX_BIT_PLANES) {
+                            LogError("tier-2: code block of %d bit planes", numBitPlanes);
+                            return false;
+                        }
+                        codeword.numBitPlanes = (size_t)numBitPlanes;
+                    }
+                    size_t added = readNumPasses(in);
+                    size_t& lb = lblock[block];
+                    while (in.readBit() && !in.overrun())
+                        lb++;
+                    size_t lengthBits = lb + numBits(added) - 1;
+                    if (lengthBits > 32) {
+                        LogError("tier-2: code block segment of %d length bits", (int)lengthBits);
+                        return false;
+                    }
+                    contributions.push_back(Contribution(block, in.readBits(lengthBits), added));
+                }
+            }
+        }
+    }
+    in.align();
+    if (in.overrun()) {
+        truncated = true;
+        return true;
+    }
+    pos += in.position();
+    if (packetHeaderMarkers) {
+        if (end - pos < 2) {
+            truncated = true;
+            return true;
+        }
+        if (readUInt16(data + pos) != J2K_EPH) {
+            LogError("tier-2: packet header without EPH");
+            return false;
+        }
+        pos += 2;
+    }
+
+    // body, in header order
+    for (size_t i = 0; i < contributions.size(); ++i) {
+        const Contribution& c = contributions[i];
+        HostCodeBlockCodeword& codeword = output.blocks[c.block];
+        size_t length = std::min(c.length, end - pos);
+        codeword.numPasses += c.numPasses;
+        if (codeword.numPasses > 3 * codeword.numBitPlanes - 2) {
+            LogError("tier-2: %d coding passes in %d bit planes", (int)codeword.numPasses, (int)codeword.numBitPlanes);
+            return false;
+        }
+        codeword.segments.push_back(HostCodeBlockSegment(data + pos, length, c.numPasses));
+        pos += length;
+        if (length < c.length) {
+            truncated = true;
+            break;
+        }
+    }
+    return true;
+}
+
+bool HostTier2Decoder::readPackets(const unsigned char* data, size_t end, size_t& pos, HostTier2Output& output, const J2KWindow* window) {
+    const std::vector<J2KPacketLayout::Packet>& packets = packetLayout.getPackets();
+    // a tile-part holds whole packets; what follows the last one is padding
+    for (size_t i = 0; pos < end && nextPacket < packets.size() && !truncated; ++i) {
+        const J2KPacketLayout::Packet& packet = packets[nextPacket];
+        if (window && !window->containsPrecinct(packet.resolution, packet.precinct)) {
+            size_t tree = precinctTree(packet);
+            if (i < packetLengths.size()) {
+                if (packetLengths[i] > end - pos) {
+                    truncated = true;
+                    break;
+                }
+                pos += packetLengths[i];
+                skipped[tree] = true;
+                nextPacket++;
+                continue;
+            }
+            // the header of a later layer depends on the tag tree state of the skipped ones
+            if (skipped[tree]) {
+                LogError("tier-2: packet without PLT length of a precinct whose earlier packets were skipped");
+                return false;
+            }
+        }
+        if (!readPacket(data, end, pos, packet, output))
+            return false;
+        if (!truncated)
+            nextPacket++;
+    }
+    return true;
+}
+
+bool HostTier2Decoder::decode(const unsigned char* data, size_t size, HostTier2Output& output, J2KWindow* window) {
+    if (!data || !findCodestream(data, size))
+        return false;
+    output.params = HostCodestreamParams();
+    size_t pos = 0;
+    if (!readMainHeader(data, size, pos, output) || !layout(output))
+        return false;
+    if (window && !window->layout(packetLayout, output.params))
+        return false;
+
+    truncated = false;
+    while (size - pos >= J2K_SOT_SIZE && readUInt16(data + pos) == J2K_SOT && !truncated) {
+        size_t tilePartStart = pos;
+        if (readUInt16(data + pos + 2) != J2K_SOT_SIZE - 2) {
+            LogError("tier-2: SOT of %d bytes", (int)readUInt16(data + pos + 2));
+            return false;
+        }
+        if (readUInt16(data + pos + 4) != 0) {
+            LogError("tier-2: only a single tile is supported");
+            return false;
+        }
+        // a tile-part length of zero extends to EOC
+        size_t tilePartLength = readUInt32(data + pos + 6);
+        size_t end = size;
+        if (tilePartLength) {
+            if (tilePartLength < J2K_SOT_SIZE + 2) {
+                LogError("tier-2: tile-part of %d bytes", (int)tilePartLength);
+                return false;
+            }
+            end = std::min(size, tilePartStart + tilePartLength);
+        } else if (size >= 2 && readUInt16(data + size - 2) == J2K_EOC) {
+            end = size - 2;
+        }
+        pos += J2K_SOT_SIZE;
+        packetLengths.clear();
+
+        // tile-part header, up to SOD
+        while (true) {
+            if (end - pos < 2) {
+                truncated = true;
+                break;
+            }
+            unsigned int marker = readUInt16(data + pos);
+            if (marker == J2K_SOD) {
+                pos += 2;
+                break;
+            }
+            if (marker != J2K_COM && marker != J2K_PLT) {
+                LogError("tier-2: marker 0x%04X in a tile-part header is not supported", marker);
+                return false;
+            }
+            if (end - pos < 4 || end - pos - 2 < readUInt16(data + pos + 2)) {
+                truncated = true;
+                break;
+            }
+            if (marker == J2K_PLT && !readPLT(data + pos + 2, readUInt16(data + pos + 2)))
+                return false;
+            pos += 2 + readUInt16(data + pos + 2);
+        }
+        if (!truncated && !readPackets(data, end, pos, output, window))
+            return false;
+        pos = end;
+    }
+    return true;
+}
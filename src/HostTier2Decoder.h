@@ -0,0 +1,124 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostBitReader.h"
+#include "HostTagTree.h"
+#include "J2KQuantization.h"
+#include "J2KMarkers.h"
+#include "J2KPacketLayout.h"
+#include "J2KWindow.h"
+#include "OCLBPC.h"
+#include <vector>
+
+// code word bytes of one code block contributed by one packet; points into the code stream
+struct HostCodeBlockSegment {
+    HostCodeBlockSegment() : data(NULL), length(0), numPasses(0) {}
+    HostCodeBlockSegment(const unsigned char* data, size_t length, size_t numPasses) : data(data),
+        length(length), numPasses(numPasses) {}
+    const unsigned char* data;
+    size_t length;
+    size_t numPasses;       // coding passes that end in this segment
+};
+
+// MQ coded code word of one code block, as the packets of all layers deliver it.
+// Without code block style options the segments are one code word, split at layer boundaries
+struct HostCodeBlockCodeword {
+    HostCodeBlockCodeword() : numBitPlanes(0), numPasses(0) {}
+    size_t numBitPlanes;    // coded bit planes, below the missing most significant ones
+    size_t numPasses;       // in all segments
+    std::vector<HostCodeBlockSegment> segments;
+};
+
+// tier-2 output of one frame: the coding parameters, and the code word of every code block
+struct HostTier2Output {
+    HostTier2Output() : numChannels(0), numGuardBits(0) {}
+    HostCodestreamParams params;
+    size_t numChannels;
+    size_t numGuardBits;
+    std::vector<J2KStepSize> stepSizes;     // of each subband, in code block table order
+    std::vector<OCLCodeBlock> codeBlocks;   // code blocks of one channel; the same for all channels
+    std::vector<HostCodeBlockCodeword> blocks; // channel * codeBlocks.size() + code block
+};
+
+/*
+Tier-2 decoder: parses the markers of a JPEG 2000 code stream, raw or in a JP2 file, and the headers of
+its packets (ITU-T Rec. T.800, Annex A and B), into the code words of the code blocks.
+
+Nothing is copied: segments point into the code stream, which is usually a HostMappedFile, so it must
+outlive the output. Streams are read as HostTier2Encoder writes them, plus what other encoders commonly add:
+any number of tile-parts, SOP and EPH markers, and comment and length markers, which are skipped, but for
+the packet lengths of PLT, which let a window decode skip the packets it does not need.
+Multiple tiles, component specific coding or quantization, progression order changes, packed packet headers,
+regions of interest, component transforms and code block style options are rejected.
+
+A stream truncated at any point decodes up to the last complete packet header, so that the bytes
+that arrived, or a prefix of the layers, still give an image.
+
+The layout, tag trees and output vectors are kept between frames, so that a sequence of frames of the same
+geometry is parsed without allocation.
+*/
+class HostTier2Decoder
+{
+public:
+    HostTier2Decoder(void);
+    // Parse the size bytes at data into output, replacing its contents.
+    // If window is not NULL, it is laid out for the frame once the main header is read, and the packets of
+    // precincts outside it are skipped without parsing their headers wherever PLT markers give their lengths;
+    // the code blocks of those precincts are then left without passes.
+    // Returns false, and logs why, if the stream is malformed or uses options that are not supported
+    bool decode(const unsigned char* data, size_t size, HostTier2Output& output, J2KWindow* window = NULL);
+private:
+    // included code block of a packet, whose bytes follow the packet header
+    struct Contribution {
+        Contribution(size_t block, size_t length, size_t numPasses) : block(block), length(length), numPasses(numPasses) {}
+        size_t block;
+        size_t length;
+        size_t numPasses;
+    };
+    // the contents of the code stream box of a JP2 file; a raw code stream as it is
+    static bool findCodestream(const unsigned char*& data, size_t& size);
+    // main header, up to the first SOT; pos is left on it
+    bool readMainHeader(const unsigned char* data, size_t size, size_t& pos, HostTier2Output& output);
+    bool readSIZ(const unsigned char* segment, size_t length, HostTier2Output& output);
+    bool readCOD(const unsigned char* segment, size_t length, HostTier2Output& output);
+    bool readQCD(const unsigned char* segment, size_t length, HostTier2Output& output);
+    // append the packet lengths of a PLT marker segment, of length bytes from Lplt on, to packetLengths
+    bool readPLT(const unsigned char* segment, size_t length);
+    // lay out output.params, and reset the per frame state
+    bool layout(HostTier2Output& output);
+    // Read the packets of the tile-part data [pos, end) into output.
+    // Returns false if a packet is malformed; a packet cut short sets truncated
+    bool readPackets(const unsigned char* data, size_t end, size_t& pos, HostTier2Output& output, const J2KWindow* window);
+    bool readPacket(const unsigned char* data, size_t end, size_t& pos, const J2KPacketLayout::Packet& packet,
+                    HostTier2Output& output);
+    static size_t readNumPasses(HostBitReader& in);
+    // index of the tag trees of the first subband of the precinct of packet
+    size_t precinctTree(const J2KPacketLayout::Packet& packet) const;
+
+    J2KPacketLayout packetLayout;
+    std::vector<HostTagTree> inclusion;     // channel * precincts of a channel + subband firstTree + precinct
+    std::vector<HostTagTree> zeroBitPlanes;
+    std::vector<size_t> lblock;             // per code block of the frame
+    std::vector<Contribution> contributions;    // of the packet being read
+    std::vector<size_t> packetLengths;      // of the packets of the current tile-part, from PLT
+    std::vector<bool> skipped;              // per precinctTree: packets were skipped, so its tag trees are stale
+    size_t nextPacket;                      // in progression order
+    bool truncated;                         // the stream ends before nextPacket is complete
+    bool packetStartMarkers;                // SOP may precede each packet
+    bool packetHeaderMarkers;               // EPH follows each packet header
+};
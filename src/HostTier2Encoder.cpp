@@ -0,0 +1,468 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "HostTier2Encoder.h"
+#include "J2KMarkers.h"
+#include "OCLUtil.h"
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+
+// length bits of a code block before any increment (B.10.7.1)
+static const size_t INITIAL_LBLOCK = 3;
+
+// code streams written to meet a byte target, each with a smaller code word budget
+static const size_t TIER2_MAX_RATE_ATTEMPTS = 8;
+
+static size_t numBits(size_t val) {
+    size_t n = 0;
+    for (; val; val >>= 1)
+        n++;
+    return n;
+}
+
+HostTier2Encoder::HostTier2Encoder(void)
+{
+}
+
+bool HostTier2Encoder::layout(const HostCodestreamParams& params, const HostTier1Output& input) {
+    size_t numBlocks = input.codeBlocks.size();
+    if (input.blocks.size() != numBlocks * input.numChannels) {
+        LogError("tier-2: tier-1 output does not match the frame");
+        return false;
+    }
+    if (!params.layerBytes.empty() && params.layerBytes.size() + 1 != params.numLayers) {
+        LogError("tier-2: %d layers with %d layer byte targets", (int)params.numLayers, (int)params.layerBytes.size());
+        return false;
+    }
+    if (!packetLayout.matches(params, input.numChannels)) {
+        if (!packetLayout.init(params, input.numChannels))
+            return false;
+        // a tag tree per precinct of each subband
+        const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+        const std::vector<J2KPacketLayout::Resolution>& resolutions = packetLayout.getResolutions();
+        inclusion.resize(input.numChannels * packetLayout.getNumPrecincts());
+        zeroBitPlanes.resize(inclusion.size());
+        for (size_t channel = 0; channel < input.numChannels; ++channel) {
+            for (size_t i = 0; i < subbands.size(); ++i) {
+                const J2KPacketLayout::Subband& sb = subbands[i];
+                const J2KPacketLayout::Resolution& res = resolutions[sb.resolution];
+                for (size_t p = 0; p < res.numPrecinctsX * res.numPrecinctsY; ++p) {
+                    size_t x0, y0, x1, y1;
+                    packetLayout.precinctBlocks(sb, p, x0, y0, x1, y1);
+                    size_t tree = channel * packetLayout.getNumPrecincts() + sb.firstTree + p;
+                    inclusion[tree].init(x1 - x0, y1 - y0);
+                    zeroBitPlanes[tree].init(x1 - x0, y1 - y0);
+                }
+            }
+        }
+    }
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    if (packetLayout.getNumBlocks() != numBlocks) {
+        LogError("tier-2: code block table does not match the frame");
+        return false;
+    }
+    stepSizes.resize(subbands.size());
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        const OCLCodeBlock* first = sb.numBlocksX ? &input.codeBlocks[sb.firstBlock] : NULL;
+        if (first && ((size_t)first->orientation != sb.orientation || (size_t)first->level != sb.level)) {
+            LogError("tier-2: code block table does not match the frame");
+            return false;
+        }
+        stepSizes[i] = params.lossy ? J2KQuantization::irreversibleStep(sb.level - 1, sb.orientation, params.precision) :
+                       J2KQuantization::reversibleStep(sb.orientation, params.precision);
+    }
+    return true;
+}
+
+bool HostTier2Encoder::guardBits(const HostTier1Output& input, size_t& numGuardBits) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    int needed = J2K_DEFAULT_GUARD_BITS;
+    for (size_t channel = 0; channel < input.numChannels; ++channel) {
+        for (size_t i = 0; i < subbands.size(); ++i) {
+            const J2KPacketLayout::Subband& sb = subbands[i];
+            size_t begin = channel * input.codeBlocks.size() + sb.firstBlock;
+            size_t end = begin + sb.numBlocksX * sb.numBlocksY;
+            for (size_t b = begin; b < end; ++b) {
+                // M_b = G + epsilon_b - 1 must be at least the number of bit planes
+                int g = (int)input.blocks[b].numBitPlanes - stepSizes[i].exponent + 1;
+                if (g > needed)
+                    needed = g;
+            }
+        }
+    }
+    if (needed > (int)J2K_MAX_GUARD_BITS) {
+        LogError("tier-2: %d guard bits needed; at most %d can be signalled", needed, (int)J2K_MAX_GUARD_BITS);
+        return false;
+    }
+    numGuardBits = (size_t)needed;
+    return true;
+}
+
+void HostTier2Encoder::writeMainHeader(const HostCodestreamParams& params, size_t numChannels, size_t numGuardBits, HostOutputArena& output) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    const std::vector<J2KPacketLayout::Resolution>& resolutions = packetLayout.getResolutions();
+    output.writeUInt16(J2K_SOC);
+
+    // single tile, covering the image
+    output.writeUInt16(J2K_SIZ);
+    output.writeUInt16((unsigned int)(38 + 3 * numChannels));
+    output.writeUInt16(0);
+    output.writeUInt32((unsigned int)params.width);
+    output.writeUInt32((unsigned int)params.height);
+    output.writeUInt32(0);
+    output.writeUInt32(0);
+    output.writeUInt32((unsigned int)params.width);
+    output.writeUInt32((unsigned int)params.height);
+    output.writeUInt32(0);
+    output.writeUInt32(0);
+    output.writeUInt16((unsigned int)numChannels);
+    for (size_t c = 0; c < numChannels; ++c) {
+        // unsigned: the decoder undoes the DC level shift of the caller
+        output.writeByte((unsigned char)(params.precision - 1));
+        output.writeByte(1);
+        output.writeByte(1);
+    }
+
+    // no component transform; precinct sizes only if they are not the default
+    bool customPrecincts = !params.precinctWidth.empty();
+    output.writeUInt16(J2K_COD);
+    output.writeUInt16((unsigned int)(12 + (customPrecincts ? resolutions.size() : 0)));
+    output.writeByte(customPrecincts ? J2K_COD_PRECINCTS : 0);
+    output.writeByte((unsigned char)params.progression);
+    output.writeUInt16((unsigned int)params.numLayers);
+    output.writeByte(0);
+    output.writeByte((unsigned char)params.levels);
+    output.writeByte((unsigned char)(numBits(params.codeBlockX) - 3));
+    output.writeByte((unsigned char)(numBits(params.codeBlockY) - 3));
+    output.writeByte(0);
+    output.writeByte(params.lossy ? J2K_TRANSFORM_97 : J2K_TRANSFORM_53);
+    for (size_t r = 0; r < resolutions.size() && customPrecincts; ++r)
+        output.writeByte((unsigned char)((resolutions[r].precinctExpY << 4) | resolutions[r].precinctExpX));
+
+    // one step per subband, in code block table order
+    output.writeUInt16(J2K_QCD);
+    output.writeUInt16((unsigned int)(3 + subbands.size() * (params.lossy ? 2 : 1)));
+    output.writeByte((unsigned char)((numGuardBits << 5) | (params.lossy ? J2K_QUANT_SCALAR_EXPOUNDED : J2K_QUANT_NONE)));
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KStepSize& step = stepSizes[i];
+        if (params.lossy)
+            output.writeUInt16((unsigned int)((step.exponent << 11) | step.mantissa));
+        else
+            output.writeByte((unsigned char)(step.exponent << 3));
+    }
+}
+
+void HostTier2Encoder::writeNumPasses(HostBitWriter& out, size_t numPasses) {
+    // Table B.4
+    if (numPasses == 1)
+        out.writeBits(0, 1);
+    else if (numPasses == 2)
+        out.writeBits(2, 2);
+    else if (numPasses <= 5)
+        out.writeBits(0xc | (unsigned int)(numPasses - 3), 4);
+    else if (numPasses <= 36)
+        out.writeBits(0x1e0 | (unsigned int)(numPasses - 6), 9);
+    else
+        out.writeBits(0xff80 | (unsigned int)(numPasses - 37), 16);
+}
+
+void HostTier2Encoder::writePacket(const HostTier1Output& input, const J2KPacketLayout::Packet& packet, HostOutputArena& output) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    size_t channelOffset = packet.channel * input.codeBlocks.size();
+    const std::vector<size_t>& passes = layerPasses[packet.layer];
+    const std::vector<size_t>* previous = packet.layer ? &layerPasses[packet.layer - 1] : NULL;
+    bool empty = true;
+    for (size_t i = 0; i < subbands.size() && empty; ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        if (sb.resolution != packet.resolution)
+            continue;
+        size_t x0, y0, x1, y1;
+        packetLayout.precinctBlocks(sb, packet.precinct, x0, y0, x1, y1);
+        for (size_t y = y0; y < y1 && empty; ++y) {
+            for (size_t x = x0; x < x1 && empty; ++x) {
+                size_t block = channelOffset + sb.firstBlock + x + y * sb.numBlocksX;
+                empty = passes[block] == (previous ? (*previous)[block] : 0);
+            }
+        }
+    }
+    HostBitWriter out(&output);
+    out.writeBit(empty ? 0 : 1);
+    if (empty) {
+        out.flush();
+        return;
+    }
+
+    // header
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        if (sb.resolution != packet.resolution)
+            continue;
+        size_t tree = packet.channel * packetLayout.getNumPrecincts() + sb.firstTree + packet.precinct;
+        HostTagTree& incl = inclusion[tree];
+        HostTagTree& zbp = zeroBitPlanes[tree];
+        size_t x0, y0, x1, y1;
+        packetLayout.precinctBlocks(sb, packet.precinct, x0, y0, x1, y1);
+        for (size_t y = y0; y < y1; ++y) {
+            for (size_t x = x0; x < x1; ++x) {
+                size_t leaf = (x - x0) + (y - y0) * (x1 - x0);
+                size_t block = channelOffset + sb.firstBlock + x + y * sb.numBlocksX;
+                const HostCodeBlockStream& stream = input.blocks[block];
+                size_t before = previous ? (*previous)[block] : 0;
+                size_t after = passes[block];
+                // blocks not yet included signal their first layer; the others a single bit
+                if (!before)
+                    incl.encode(out, leaf, (int)packet.layer + 1);
+                else
+                    out.writeBit(after > before ? 1 : 0);
+                if (after == before)
+                    continue;
+                if (!before)
+                    zbp.encode(out, leaf, INT_MAX);
+                size_t added = after - before;
+                writeNumPasses(out, added);
+                size_t length = stream.passRates[after - 1] - (before ? stream.passRates[before - 1] : 0);
+                size_t& lb = lblock[block];
+                size_t lengthBits = lb + numBits(added) - 1;
+                while (lengthBits < numBits(length)) {
+                    out.writeBit(1);
+                    lb++;
+                    lengthBits++;
+                }
+                out.writeBit(0);
+                out.writeBits((unsigned int)length, lengthBits);
+            }
+        }
+    }
+    out.flush();
+
+    // body, in header order
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        if (sb.resolution != packet.resolution)
+            continue;
+        size_t x0, y0, x1, y1;
+        packetLayout.precinctBlocks(sb, packet.precinct, x0, y0, x1, y1);
+        for (size_t y = y0; y < y1; ++y) {
+            for (size_t x = x0; x < x1; ++x) {
+                size_t block = channelOffset + sb.firstBlock + x + y * sb.numBlocksX;
+                const HostCodeBlockStream& stream = input.blocks[block];
+                size_t begin = (previous && (*previous)[block]) ? stream.passRates[(*previous)[block] - 1] : 0;
+                size_t end = passes[block] ? stream.passRates[passes[block] - 1] : 0;
+                if (end > begin)
+                    output.write(&stream.data[begin], end - begin);
+            }
+        }
+    }
+}
+
+void HostTier2Encoder::allocate(const HostCodestreamParams& params, const HostTier1Output& input, size_t numGuardBits, HostOutputArena& output) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    // squared error in the image of a unit error in a coefficient: quantization step and synthesis norm of the subband
+    blockWeights.resize(input.codeBlocks.size());
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        double weight = J2KQuantization::norm(sb.level - 1, sb.orientation, !params.lossy);
+        // the 9/7 norms are those of high pass bands scaled down by their gain
+        if (params.lossy)
+            weight *= J2KQuantization::step(stepSizes[i], sb.orientation, params.precision) / (1 << J2KQuantization::gain(sb.orientation));
+        for (size_t b = 0; b < sb.numBlocksX * sb.numBlocksY; ++b)
+            blockWeights[sb.firstBlock + b] = weight * weight;
+    }
+    rateControl.init(input, blockWeights);
+
+    // the last layer ends with every pass, or with those that reach the quality target
+    std::vector<size_t> quality(input.blocks.size());
+    for (size_t i = 0; i < input.blocks.size(); ++i)
+        quality[i] = input.blocks[i].passRates.size();
+    if (params.targetPSNR > 0) {
+        double peak = (double)((1 << params.precision) - 1);
+        double maxDistortion = peak * peak / pow(10.0, params.targetPSNR / 10) *
+                               (double)(params.width * params.height * input.numChannels);
+        rateControl.truncateToDistortion(maxDistortion, quality);
+    }
+    size_t qualityBytes = 0;
+    for (size_t i = 0; i < quality.size(); ++i)
+        qualityBytes += quality[i] ? input.blocks[i].passRates[quality[i] - 1] : 0;
+
+    // code word budget of each layer; byte targets count headers too, which are only known once
+    // written, so the budgets shrink by the overshoot until the layers fit. Truncation points are
+    // discrete, so a small overshoot may need a larger cut: each attempt doubles the cut
+    size_t numLayers = params.numLayers;
+    std::vector<size_t> targets(numLayers, 0);
+    for (size_t l = 0; l < params.layerBytes.size(); ++l)
+        targets[l] = params.layerBytes[l];
+    targets.back() = params.targetBytes;
+    std::vector<size_t> budgets(targets);
+    if (!budgets.back())
+        budgets.back() = qualityBytes;
+    for (size_t attempt = 0; attempt < TIER2_MAX_RATE_ATTEMPTS; ++attempt) {
+        // layers without a target get half the budget of the next
+        for (size_t l = numLayers - 1; l-- > 0;) {
+            if (!targets[l])
+                budgets[l] = budgets[l + 1] >> 1;
+        }
+        truncateLayers(budgets, quality, qualityBytes);
+        write(params, input, numGuardBits, output);
+        bool fits = true;
+        for (size_t l = 0; l < numLayers; ++l) {
+            if (!targets[l] || layerSize[l] <= targets[l])
+                continue;
+            size_t excess = (layerSize[l] - targets[l]) << attempt;
+            if (budgets[l])
+                fits = false;
+            budgets[l] = budgets[l] > excess ? budgets[l] - excess : 0;
+        }
+        if (fits)
+            return;
+    }
+}
+
+void HostTier2Encoder::truncateLayers(const std::vector<size_t>& layerBudgets, const std::vector<size_t>& quality, size_t qualityBytes) {
+    // Thresholds of lower budgets are higher, so layers computed separately are already nested,
+    // except where a budget exceeds the next one
+    layerPasses.resize(layerBudgets.size());
+    for (size_t l = layerBudgets.size(); l-- > 0;) {
+        std::vector<size_t>& passes = layerPasses[l];
+        const std::vector<size_t>& limit = (l + 1 < layerBudgets.size()) ? layerPasses[l + 1] : quality;
+        // passes that remove no distortion are not on the hull, but complete a lossless stream
+        if (layerBudgets[l] >= qualityBytes) {
+            passes = limit;
+            continue;
+        }
+        rateControl.truncateToRate(layerBudgets[l], passes);
+        for (size_t i = 0; i < passes.size(); ++i)
+            passes[i] = std::min(passes[i], limit[i]);
+    }
+}
+
+void HostTier2Encoder::write(const HostCodestreamParams& params, const HostTier1Output& input, size_t numGuardBits, HostOutputArena& output) {
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    const std::vector<J2KPacketLayout::Resolution>& resolutions = packetLayout.getResolutions();
+    const std::vector<J2KPacketLayout::Packet>& packets = packetLayout.getPackets();
+    // tag tree leaves: first layer that includes the block, and number of missing most significant bit planes
+    for (size_t channel = 0; channel < input.numChannels; ++channel) {
+        size_t channelOffset = channel * input.codeBlocks.size();
+        for (size_t i = 0; i < subbands.size(); ++i) {
+            const J2KPacketLayout::Subband& sb = subbands[i];
+            const J2KPacketLayout::Resolution& res = resolutions[sb.resolution];
+            int maxBitPlanes = J2KQuantization::maxBitPlanes(stepSizes[i], numGuardBits);
+            for (size_t p = 0; p < res.numPrecinctsX * res.numPrecinctsY; ++p) {
+                size_t tree = channel * packetLayout.getNumPrecincts() + sb.firstTree + p;
+                inclusion[tree].reset();
+                zeroBitPlanes[tree].reset();
+                size_t x0, y0, x1, y1;
+                packetLayout.precinctBlocks(sb, p, x0, y0, x1, y1);
+                for (size_t y = y0; y < y1; ++y) {
+                    for (size_t x = x0; x < x1; ++x) {
+                        size_t leaf = (x - x0) + (y - y0) * (x1 - x0);
+                        size_t block = channelOffset + sb.firstBlock + x + y * sb.numBlocksX;
+                        size_t layer = 0;
+                        while (layer < layerPasses.size() && !layerPasses[layer][block])
+                            layer++;
+                        inclusion[tree].setValue(leaf, layer < layerPasses.size() ? (int)layer : INT_MAX);
+                        zeroBitPlanes[tree].setValue(leaf, maxBitPlanes - (int)input.blocks[block].numBitPlanes);
+                    }
+                }
+            }
+        }
+    }
+    lblock.assign(input.blocks.size(), INITIAL_LBLOCK);
+
+    output.clear();
+    writeMainHeader(params, input.numChannels, numGuardBits, output);
+
+    size_t tileStart = output.size();
+    output.writeUInt16(J2K_SOT);
+    output.writeUInt16(10);
+    output.writeUInt16(0);
+    size_t psot = output.size();
+    output.writeUInt32(0);
+    output.writeByte(0);
+    output.writeByte(1);
+
+    // single tile part, with every packet in progression order. The packets are written first, as PLT needs
+    // their lengths, and the rest of the tile-part header is then rotated in front of them
+    std::vector<size_t> packetBytes(params.numLayers, 0);
+    size_t packetsStart = output.size();
+    packetLengths.resize(packets.size());
+    for (size_t i = 0; i < packets.size(); ++i) {
+        size_t start = output.size();
+        writePacket(input, packets[i], output);
+        packetLengths[i] = output.size() - start;
+        packetBytes[packets[i].layer] += packetLengths[i];
+    }
+    size_t packetsEnd = output.size();
+    writePacketLengths(output);
+    output.writeUInt16(J2K_SOD);
+    unsigned char* tile = output.data();
+    std::rotate(tile + packetsStart, tile + packetsEnd, tile + output.size());
+    output.patchUInt32(psot, (unsigned int)(output.size() - tileStart));
+    output.writeUInt16(J2K_EOC);
+
+    // headers, and the packets of each layer and those before it
+    layerSize.resize(params.numLayers);
+    size_t size = output.size();
+    for (size_t l = 0; l < params.numLayers; ++l)
+        size -= packetBytes[l];
+    for (size_t l = 0; l < params.numLayers; ++l) {
+        size += packetBytes[l];
+        layerSize[l] = size;
+    }
+}
+
+void HostTier2Encoder::writePacketLengths(HostOutputArena& output) {
+    // Lplt and Zplt, then lengths of 7 bits per byte, most significant first, with the top bit set on all but the last
+    // byte. A length is not split between segments; any that do not fit the last segment are left out
+    size_t i = 0;
+    for (size_t index = 0; index < J2K_MAX_PLT_SEGMENTS && i < packetLengths.size(); ++index) {
+        output.writeUInt16(J2K_PLT);
+        size_t lplt = output.size();
+        output.writeUInt16(0);
+        output.writeByte((unsigned char)index);
+        size_t length = 3;
+        for (; i < packetLengths.size(); ++i) {
+            size_t numBytes = std::max((numBits(packetLengths[i]) + 6) / 7, (size_t)1);
+            if (length + numBytes > 0xFFFF)
+                break;
+            for (size_t b = numBytes; b-- > 0;)
+                output.writeByte((unsigned char)(((packetLengths[i] >> (7 * b)) & 0x7F) | (b ? 0x80 : 0)));
+            length += numBytes;
+        }
+        output.patchUInt16(lplt, (unsigned int)length);
+    }
+}
+
+bool HostTier2Encoder::encode(const HostCodestreamParams& params, const HostTier1Output& input, HostOutputArena& output) {
+    if (!layout(params, input))
+        return false;
+    size_t numGuardBits = 0;
+    if (!guardBits(input, numGuardBits))
+        return false;
+
+    if (params.numLayers > 1 || params.targetBytes || params.targetPSNR > 0) {
+        allocate(params, input, numGuardBits, output);
+        return true;
+    }
+    // every pass in a single layer
+    layerPasses.resize(1);
+    layerPasses[0].resize(input.blocks.size());
+    for (size_t i = 0; i < input.blocks.size(); ++i)
+        layerPasses[0][i] = input.blocks[i].passRates.size();
+    write(params, input, numGuardBits, output);
+    return true;
+}
@@ -0,0 +1,76 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "HostTier1Encoder.h"
+#include "HostOutputArena.h"
+#include "HostBitWriter.h"
+#include "HostTagTree.h"
+#include "HostRateControl.h"
+#include "J2KQuantization.h"
+#include "J2KMarkers.h"
+#include "J2KPacketLayout.h"
+#include <vector>
+
+/*
+Tier-2 encoder: assembles the MQ coded code blocks of a frame into a JPEG 2000 code stream
+(ITU-T Rec. T.800, Annex A and B).
+
+The stream has a single tile, with any number of quality layers, any of the five progression orders,
+and precinct sizes per resolution. Together, the layers hold every coding pass, unless a rate or
+quality target truncates the code blocks. Components are coded as they are: samples are expected to be
+DC level shifted by the caller, and no component transform is signalled. The tile-part header gives the
+length of every packet in PLT marker segments, so that a window decode can skip the packets it does not need.
+
+Tag trees and the subband table are kept between frames, so that a sequence of frames of the same
+geometry is written without allocation once the output arena has grown to fit.
+*/
+class HostTier2Encoder
+{
+public:
+    HostTier2Encoder(void);
+    // Write the code stream of input to output, replacing its contents.
+    // Returns false if input does not match params
+    bool encode(const HostCodestreamParams& params, const HostTier1Output& input, HostOutputArena& output);
+private:
+    // lay out params, and check that input holds its code blocks
+    bool layout(const HostCodestreamParams& params, const HostTier1Output& input);
+    // smallest number of guard bits that holds every code block
+    bool guardBits(const HostTier1Output& input, size_t& numGuardBits);
+    // split the passes of each block into layers, for the layer and target rates of params, and write the stream
+    void allocate(const HostCodestreamParams& params, const HostTier1Output& input, size_t numGuardBits, HostOutputArena& output);
+    // passes of each layer of layerBudgets code word bytes, nested and at most those of quality
+    void truncateLayers(const std::vector<size_t>& layerBudgets, const std::vector<size_t>& quality, size_t qualityBytes);
+    void write(const HostCodestreamParams& params, const HostTier1Output& input, size_t numGuardBits, HostOutputArena& output);
+    void writeMainHeader(const HostCodestreamParams& params, size_t numChannels, size_t numGuardBits, HostOutputArena& output);
+    void writePacket(const HostTier1Output& input, const J2KPacketLayout::Packet& packet, HostOutputArena& output);
+    // PLT marker segments of packetLengths
+    void writePacketLengths(HostOutputArena& output);
+    static void writeNumPasses(HostBitWriter& out, size_t numPasses);
+
+    J2KPacketLayout packetLayout;
+    std::vector<J2KStepSize> stepSizes;     // of each subband
+    std::vector<HostTagTree> inclusion;     // channel * precincts of a channel + subband firstTree + precinct
+    std::vector<HostTagTree> zeroBitPlanes;
+    std::vector<size_t> lblock;             // per code block of the frame, as tier-1 output blocks
+    // passes of each block written up to the end of each layer
+    std::vector< std::vector<size_t> > layerPasses;
+    std::vector<size_t> layerSize;          // code stream bytes up to the end of each layer
+    std::vector<size_t> packetLengths;      // of each packet of the tile, in progression order
+    HostRateControl rateControl;
+    std::vector<double> blockWeights;       // image squared error of a unit error in a coefficient of each block
+};
@@ -0,0 +1,88 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+// code stream markers (ITU-T Rec. T.800, Annex A)
+const unsigned int J2K_SOC = 0xFF4F;     // start of code stream
+const unsigned int J2K_SIZ = 0xFF51;     // image and tile size
+const unsigned int J2K_COD = 0xFF52;     // coding style default
+const unsigned int J2K_QCD = 0xFF5C;     // quantization default
+const unsigned int J2K_SOT = 0xFF90;     // start of tile-part
+const unsigned int J2K_SOD = 0xFF93;     // start of data
+const unsigned int J2K_EOC = 0xFFD9;     // end of code stream
+
+// markers only met when reading code streams of other encoders
+const unsigned int J2K_COC = 0xFF53;     // coding style of a component
+const unsigned int J2K_TLM = 0xFF55;     // tile-part lengths
+const unsigned int J2K_PLM = 0xFF57;     // packet lengths, main header
+const unsigned int J2K_PLT = 0xFF58;     // packet lengths, tile-part header
+const unsigned int J2K_QCC = 0xFF5D;     // quantization of a component
+const unsigned int J2K_RGN = 0xFF5E;     // region of interest
+const unsigned int J2K_POC = 0xFF5F;     // progression order change
+const unsigned int J2K_PPM = 0xFF60;     // packed packet headers, main header
+const unsigned int J2K_PPT = 0xFF61;     // packed packet headers, tile-part header
+const unsigned int J2K_CRG = 0xFF63;     // component registration
+const unsigned int J2K_COM = 0xFF64;     // comment
+const unsigned int J2K_SOP = 0xFF91;     // start of packet
+const unsigned int J2K_EPH = 0xFF92;     // end of packet header
+
+// progression orders, as signalled in COD: the nesting of layer, resolution, component
+// and precinct (position) loops, outermost first
+const unsigned int J2K_PROG_LRCP = 0;
+const unsigned int J2K_PROG_RLCP = 1;
+const unsigned int J2K_PROG_RPCL = 2;
+const unsigned int J2K_PROG_PCRL = 3;
+const unsigned int J2K_PROG_CPRL = 4;
+
+// coding style flag of COD: precinct sizes follow, one byte per resolution
+const unsigned int J2K_COD_PRECINCTS = 1;
+// coding style flags of COD: each packet starts with SOP, each packet header ends with EPH
+const unsigned int J2K_COD_SOP = 2;
+const unsigned int J2K_COD_EPH = 4;
+// largest log2 precinct size, which is also the default
+const unsigned int J2K_MAX_PRECINCT_EXP = 15;
+const unsigned int J2K_MAX_LAYERS = 65535;
+// marker segments of one kind in a tile-part header, by their index Zplt
+const unsigned int J2K_MAX_PLT_SEGMENTS = 256;
+
+// wavelet transform, as signalled in COD
+const unsigned int J2K_TRANSFORM_97 = 0;
+const unsigned int J2K_TRANSFORM_53 = 1;
+
+// quantization styles, as signalled in QCD
+const unsigned int J2K_QUANT_NONE = 0;
+const unsigned int J2K_QUANT_SCALAR_DERIVED = 1;
+const unsigned int J2K_QUANT_SCALAR_EXPOUNDED = 2;
+
+// guard bits signalled unless a frame needs more
+const unsigned int J2K_DEFAULT_GUARD_BITS = 2;
+const unsigned int J2K_MAX_GUARD_BITS = 7;
+
+// JP2 box types (ITU-T Rec. T.800, Annex I)
+const unsigned int JP2_BOX_SIGNATURE = 0x6A502020;     // 'jP  '
+const unsigned int JP2_SIGNATURE = 0x0D0A870A;
+const unsigned int JP2_BOX_FILE_TYPE = 0x66747970;     // 'ftyp'
+const unsigned int JP2_BRAND = 0x6A703220;             // 'jp2 '
+const unsigned int JP2_BOX_HEADER = 0x6A703268;        // 'jp2h', super box of the three below
+const unsigned int JP2_BOX_IMAGE_HEADER = 0x69686472;  // 'ihdr'
+const unsigned int JP2_BOX_COLOUR = 0x636F6C72;        // 'colr'
+const unsigned int JP2_BOX_CHANNELS = 0x63646566;      // 'cdef'
+const unsigned int JP2_BOX_CODESTREAM = 0x6A703263;    // 'jp2c'
+
+// enumerated colour spaces of the colour specification box
+const unsigned int JP2_COLOUR_SRGB = 16;
+const unsigned int JP2_COLOUR_GREY = 17;
@@ -0,0 +1,230 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "J2KPacketLayout.h"
+#include "J2KQuantization.h"
+#include "OCLUtil.h"
+#include <algorithm>
+
+static size_t numBits(size_t val) {
+    size_t n = 0;
+    for (; val; val >>= 1)
+        n++;
+    return n;
+}
+
+// position pos of the reference grid starts a precinct of 2^shift samples; positions fit in 32 bits
+static bool startsPrecinct(size_t pos, size_t shift) {
+    return shift >= 32 ? pos == 0 : (pos & (((size_t)1 << shift) - 1)) == 0;
+}
+
+static size_t precinctIndex(size_t pos, size_t shift) {
+    return shift >= 32 ? 0 : pos >> shift;
+}
+
+J2KPacketLayout::J2KPacketLayout(void) : currentChannels(0),
+    numBlocks(0),
+    numPrecincts(0)
+{
+}
+
+bool J2KPacketLayout::matches(const HostCodestreamParams& params, size_t numChannels) const {
+    return !subbands.empty() && currentChannels == numChannels &&
+           current.width == params.width && current.height == params.height && current.levels == params.levels &&
+           current.codeBlockX == params.codeBlockX && current.codeBlockY == params.codeBlockY &&
+           current.numLayers == params.numLayers && current.progression == params.progression &&
+           current.precinctWidth == params.precinctWidth && current.precinctHeight == params.precinctHeight;
+}
+
+bool J2KPacketLayout::init(const HostCodestreamParams& params, size_t numChannels) {
+    subbands.clear();
+    if (!params.codeBlockX || !params.codeBlockY) {
+        LogError("tier-2: no code block size");
+        return false;
+    }
+    if (params.numLayers < 1 || params.numLayers > J2K_MAX_LAYERS) {
+        LogError("tier-2: %d layers", (int)params.numLayers);
+        return false;
+    }
+    if (params.progression > J2K_PROG_CPRL) {
+        LogError("tier-2: unknown progression order %d", (int)params.progression);
+        return false;
+    }
+
+    // same partition as OCLBPC: level 0 of the low pass dimensions is the full image
+    std::vector<size_t> lowW(1, params.width), lowH(1, params.height);
+    for (size_t level = 1; level <= params.levels; ++level) {
+        lowW.push_back((lowW.back() + 1) >> 1);
+        lowH.push_back((lowH.back() + 1) >> 1);
+    }
+    Subband band;
+    band.orientation = J2K_ORIENT_LL;
+    band.level = params.levels;
+    band.x = band.y = 0;
+    band.width = lowW[params.levels];
+    band.height = lowH[params.levels];
+    subbands.push_back(band);
+    for (size_t level = params.levels; level >= 1; --level) {
+        size_t llW = lowW[level], llH = lowH[level];
+        size_t highW = lowW[level - 1] - llW, highH = lowH[level - 1] - llH;
+        for (size_t orient = J2K_ORIENT_HL; orient <= J2K_ORIENT_HH; ++orient) {
+            band.orientation = orient;
+            band.level = level;
+            band.x = (orient == J2K_ORIENT_LH) ? 0 : llW;
+            band.y = (orient == J2K_ORIENT_HL) ? 0 : llH;
+            band.width = (orient == J2K_ORIENT_LH) ? llW : highW;
+            band.height = (orient == J2K_ORIENT_HL) ? llH : highH;
+            subbands.push_back(band);
+        }
+    }
+    numBlocks = 0;
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        Subband& sb = subbands[i];
+        sb.resolution = (sb.orientation == J2K_ORIENT_LL) ? 0 : params.levels - sb.level + 1;
+        sb.firstBlock = numBlocks;
+        sb.numBlocksX = (sb.width + params.codeBlockX - 1) / params.codeBlockX;
+        sb.numBlocksY = (sb.height + params.codeBlockY - 1) / params.codeBlockY;
+        if (sb.numBlocksX == 0 || sb.numBlocksY == 0)
+            sb.numBlocksX = sb.numBlocksY = 0;
+        numBlocks += sb.numBlocksX * sb.numBlocksY;
+    }
+    if (!precincts(params)) {
+        subbands.clear();
+        return false;
+    }
+    packetOrder(params, numChannels);
+    current = params;
+    currentChannels = numChannels;
+    return true;
+}
+
+bool J2KPacketLayout::precincts(const HostCodestreamParams& params) {
+    if (params.precinctWidth.size() != params.precinctHeight.size()) {
+        LogError("tier-2: %d precinct widths but %d heights", (int)params.precinctWidth.size(), (int)params.precinctHeight.size());
+        return false;
+    }
+    resolutions.resize(params.levels + 1);
+    for (size_t r = 0; r <= params.levels; ++r) {
+        Resolution& res = resolutions[r];
+        res.precinctExpX = res.precinctExpY = J2K_MAX_PRECINCT_EXP;
+        if (!params.precinctWidth.empty()) {
+            size_t i = std::min(params.levels - r, params.precinctWidth.size() - 1);
+            size_t w = params.precinctWidth[i], h = params.precinctHeight[i];
+            res.precinctExpX = numBits(w) - 1;
+            res.precinctExpY = numBits(h) - 1;
+            // above resolution 0, a subband precinct is half the size of the resolution precinct
+            size_t minExpX = numBits(params.codeBlockX) - 1 + (r ? 1 : 0);
+            size_t minExpY = numBits(params.codeBlockY) - 1 + (r ? 1 : 0);
+            if (!w || !h || w != ((size_t)1 << res.precinctExpX) || h != ((size_t)1 << res.precinctExpY) ||
+                    res.precinctExpX > J2K_MAX_PRECINCT_EXP || res.precinctExpY > J2K_MAX_PRECINCT_EXP ||
+                    res.precinctExpX < minExpX || res.precinctExpY < minExpY) {
+                LogError("tier-2: precincts of %dx%d at resolution %d do not hold whole code blocks of %dx%d",
+                         (int)w, (int)h, (int)r, (int)params.codeBlockX, (int)params.codeBlockY);
+                return false;
+            }
+        }
+        size_t shift = params.levels - r;
+        size_t resW = (params.width + ((size_t)1 << shift) - 1) >> shift;
+        size_t resH = (params.height + ((size_t)1 << shift) - 1) >> shift;
+        res.numPrecinctsX = (resW + ((size_t)1 << res.precinctExpX) - 1) >> res.precinctExpX;
+        res.numPrecinctsY = (resH + ((size_t)1 << res.precinctExpY) - 1) >> res.precinctExpY;
+    }
+    numPrecincts = 0;
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        Subband& sb = subbands[i];
+        const Resolution& res = resolutions[sb.resolution];
+        size_t halve = sb.resolution ? 1 : 0;
+        sb.precinctBlocksX = ((size_t)1 << (res.precinctExpX - halve)) / params.codeBlockX;
+        sb.precinctBlocksY = ((size_t)1 << (res.precinctExpY - halve)) / params.codeBlockY;
+        sb.firstTree = numPrecincts;
+        numPrecincts += res.numPrecinctsX * res.numPrecinctsY;
+    }
+    return true;
+}
+
+void J2KPacketLayout::precinctBlocks(const Subband& sb, size_t precinct, size_t& x0, size_t& y0, size_t& x1, size_t& y1) const {
+    const Resolution& res = resolutions[sb.resolution];
+    // precincts past the edge of a narrower subband are empty
+    x0 = std::min((precinct % res.numPrecinctsX) * sb.precinctBlocksX, sb.numBlocksX);
+    y0 = std::min((precinct / res.numPrecinctsX) * sb.precinctBlocksY, sb.numBlocksY);
+    x1 = std::min(x0 + sb.precinctBlocksX, sb.numBlocksX);
+    y1 = std::min(y0 + sb.precinctBlocksY, sb.numBlocksY);
+}
+
+void J2KPacketLayout::packetOrder(const HostCodestreamParams& params, size_t numChannels) {
+    // B.12.1
+    packets.clear();
+    switch (params.progression) {
+    case J2K_PROG_LRCP:
+        for (size_t l = 0; l < params.numLayers; ++l)
+            for (size_t r = 0; r < resolutions.size(); ++r)
+                for (size_t c = 0; c < numChannels; ++c)
+                    for (size_t p = 0; p < resolutions[r].numPrecinctsX * resolutions[r].numPrecinctsY; ++p)
+                        packets.push_back(Packet(l, r, c, p));
+        break;
+    case J2K_PROG_RLCP:
+        for (size_t r = 0; r < resolutions.size(); ++r)
+            for (size_t l = 0; l < params.numLayers; ++l)
+                for (size_t c = 0; c < numChannels; ++c)
+                    for (size_t p = 0; p < resolutions[r].numPrecinctsX * resolutions[r].numPrecinctsY; ++p)
+                        packets.push_back(Packet(l, r, c, p));
+        break;
+    case J2K_PROG_RPCL:
+        // components share the precinct grid, so positions within a resolution are in raster order
+        for (size_t r = 0; r < resolutions.size(); ++r)
+            for (size_t p = 0; p < resolutions[r].numPrecinctsX * resolutions[r].numPrecinctsY; ++p)
+                for (size_t c = 0; c < numChannels; ++c)
+                    addPackets(params, r, c, p);
+        break;
+    case J2K_PROG_PCRL:
+        addPositionPackets(params, 0, numChannels);
+        break;
+    case J2K_PROG_CPRL:
+        for (size_t c = 0; c < numChannels; ++c)
+            addPositionPackets(params, c, c + 1);
+        break;
+    }
+}
+
+void J2KPacketLayout::addPackets(const HostCodestreamParams& params, size_t resolution, size_t channel, size_t precinct) {
+    for (size_t l = 0; l < params.numLayers; ++l)
+        packets.push_back(Packet(l, resolution, channel, precinct));
+}
+
+void J2KPacketLayout::addPositionPackets(const HostCodestreamParams& params, size_t firstChannel, size_t endChannel) {
+    // Step through the reference grid at the smallest precinct size of any resolution; a precinct is
+    // visited at its top left corner. With the tile at the origin, every precinct starts on the grid
+    size_t minShiftX = 31, minShiftY = 31;
+    for (size_t r = 0; r < resolutions.size(); ++r) {
+        minShiftX = std::min(minShiftX, resolutions[r].precinctExpX + params.levels - r);
+        minShiftY = std::min(minShiftY, resolutions[r].precinctExpY + params.levels - r);
+    }
+    for (size_t y = 0; y < params.height; y += (size_t)1 << minShiftY) {
+        for (size_t x = 0; x < params.width; x += (size_t)1 << minShiftX) {
+            for (size_t c = firstChannel; c < endChannel; ++c) {
+                for (size_t r = 0; r < resolutions.size(); ++r) {
+                    const Resolution& res = resolutions[r];
+                    size_t shiftX = res.precinctExpX + params.levels - r;
+                    size_t shiftY = res.precinctExpY + params.levels - r;
+                    if (!startsPrecinct(x, shiftX) || !startsPrecinct(y, shiftY))
+                        continue;
+                    addPackets(params, r, c, precinctIndex(x, shiftX) + precinctIndex(y, shiftY) * res.numPrecinctsX);
+                }
+            }
+        }
+    }
+}
+
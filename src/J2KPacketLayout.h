@@ -0,0 +1,136 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "J2KMarkers.h"
+#include <vector>
+#include <stddef.h>
+
+// coding parameters of a frame, as signalled in the main header
+struct HostCodestreamParams {
+    HostCodestreamParams() : width(0), height(0), levels(0), precision(0), lossy(false), codeBlockX(0), codeBlockY(0),
+        targetBytes(0), targetPSNR(0), numLayers(1), progression(J2K_PROG_LRCP) {}
+    size_t width;
+    size_t height;
+    size_t levels;
+    size_t precision;
+    bool lossy;             // irreversible 9/7, else reversible 5/3
+    size_t codeBlockX;
+    size_t codeBlockY;
+    // rate control: code blocks are truncated to fit the whole code stream into targetBytes,
+    // or to the fewest bytes that reach targetPSNR; zero for no target.
+    // PSNR only counts the distortion of truncated passes, not that of quantization
+    size_t targetBytes;
+    double targetPSNR;
+    // Quality layers: the last layer holds what the targets above keep. layerBytes has a byte target
+    // for each of the others, counting headers and the packets of all layers up to that one;
+    // if empty, each layer gets half the code word bytes of the next
+    size_t numLayers;
+    std::vector<size_t> layerBytes;
+    unsigned int progression;   // J2K_PROG_*
+    // Precinct sizes in samples, powers of two, from the highest resolution down; the last entry
+    // also applies to all lower resolutions. Empty for a single precinct per resolution.
+    // Precincts may not split code blocks: they must be at least twice the code block size,
+    // or the code block size at the lowest resolution
+    std::vector<size_t> precinctWidth;
+    std::vector<size_t> precinctHeight;
+};
+
+/*
+Subbands, precincts and packet order of a single tile code stream (ITU-T Rec. T.800, B.5 to B.12),
+shared by the tier-2 encoder and decoder.
+
+Subbands are in the order of the OCLBPC code block table: LL, then HL, LH and HH of each level
+from the lowest resolution up, each with its code blocks in raster order. Precincts hold whole
+code blocks, as the code block partition is that of the subband.
+*/
+class J2KPacketLayout
+{
+public:
+    struct Subband {
+        size_t orientation;
+        size_t level;           // decomposition level, from 1
+        size_t resolution;
+        size_t x;               // origin and size in the Mallat layout of the DWT output
+        size_t y;
+        size_t width;
+        size_t height;
+        size_t firstBlock;      // into the code block table
+        size_t numBlocksX;
+        size_t numBlocksY;
+        size_t precinctBlocksX; // code blocks across a precinct
+        size_t precinctBlocksY;
+        size_t firstTree;       // precincts of the subband, within those of all subbands of a channel
+    };
+    struct Resolution {
+        size_t precinctExpX;    // log2 precinct size
+        size_t precinctExpY;
+        size_t numPrecinctsX;
+        size_t numPrecinctsY;
+    };
+    struct Packet {
+        Packet(size_t layer, size_t resolution, size_t channel, size_t precinct) : layer(layer),
+            resolution(resolution), channel(channel), precinct(precinct) {}
+        size_t layer;
+        size_t resolution;
+        size_t channel;
+        size_t precinct;
+    };
+
+    J2KPacketLayout(void);
+    // Lay out the geometry and coding options of params.
+    // Returns false, and logs why, if params cannot be laid out
+    bool init(const HostCodestreamParams& params, size_t numChannels);
+    // the current layout is that of params
+    bool matches(const HostCodestreamParams& params, size_t numChannels) const;
+    // code blocks [x0, x1) x [y0, y1) of sb that lie in a precinct of its resolution
+    void precinctBlocks(const Subband& sb, size_t precinct, size_t& x0, size_t& y0, size_t& x1, size_t& y1) const;
+
+    const std::vector<Subband>& getSubbands() const {
+        return subbands;
+    }
+    const std::vector<Resolution>& getResolutions() const {
+        return resolutions;
+    }
+    // every packet of the tile, in progression order
+    const std::vector<Packet>& getPackets() const {
+        return packets;
+    }
+    // code blocks of a channel
+    size_t getNumBlocks() const {
+        return numBlocks;
+    }
+    // precincts of all subbands of a channel
+    size_t getNumPrecincts() const {
+        return numPrecincts;
+    }
+private:
+    bool precincts(const HostCodestreamParams& params);
+    void packetOrder(const HostCodestreamParams& params, size_t numChannels);
+    // packets of every layer of a precinct
+    void addPackets(const HostCodestreamParams& params, size_t resolution, size_t channel, size_t precinct);
+    // packets of the precincts of every resolution of channels [firstChannel, endChannel), in order of position
+    void addPositionPackets(const HostCodestreamParams& params, size_t firstChannel, size_t endChannel);
+
+    HostCodestreamParams current;
+    size_t currentChannels;
+    std::vector<Subband> subbands;
+    std::vector<Resolution> resolutions;
+    std::vector<Packet> packets;
+    size_t numBlocks;
+    size_t numPrecincts;
+};
@@ -0,0 +1,85 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "J2KQuantization.h"
+#include <math.h>
+
+// L2 norms of the 9/7 synthesis basis functions, by orientation and level; the LL row is indexed
+// by number of decompositions, so its first entry is the image itself.
+// Past five levels each norm is close to twice the one before
+static const size_t NUM_NORM_LEVELS = 10;
+static const double norms97[4][NUM_NORM_LEVELS] = {
+    {1.000, 1.965, 4.177, 8.403, 16.90, 33.84, 67.69, 135.3, 270.6, 540.9},
+    {2.022, 3.989, 8.355, 17.04, 34.27, 68.63, 137.3, 274.6, 549.0, 1098.0},
+    {2.022, 3.989, 8.355, 17.04, 34.27, 68.63, 137.3, 274.6, 549.0, 1098.0},
+    {2.080, 3.865, 8.307, 17.18, 34.71, 69.59, 139.3, 278.6, 557.2, 1114.0}
+};
+
+// same for the 5/3 synthesis basis
+static const double norms53[4][NUM_NORM_LEVELS] = {
+    {1.000, 1.500, 2.750, 5.375, 10.68, 21.34, 42.67, 85.33, 170.7, 341.3},
+    {1.038, 1.592, 2.919, 5.703, 11.33, 22.64, 45.25, 90.48, 180.9, 361.8},
+    {1.038, 1.592, 2.919, 5.703, 11.33, 22.64, 45.25, 90.48, 180.9, 361.8},
+    {.7186, .9218, 1.586, 3.043, 6.019, 12.01, 24.00, 47.97, 95.93, 191.9}
+};
+
+int J2KQuantization::floorLog2(int a) {
+    int l;
+    for (l = 0; a > 1; l++) {
+        a >>= 1;
+    }
+    return l;
+}
+
+int J2KQuantization::gain(size_t orient) {
+    return (orient == J2K_ORIENT_LL) ? 0 : ((orient == J2K_ORIENT_HH) ? 2 : 1);
+}
+
+double J2KQuantization::norm(size_t level, size_t orient, bool reversible) {
+    // the LL band has been through one more decomposition than the norm row of its level says
+    size_t index = (orient == J2K_ORIENT_LL) ? level + 1 : level;
+    if (index >= NUM_NORM_LEVELS)
+        index = NUM_NORM_LEVELS - 1;
+    return reversible ? norms53[orient][index] : norms97[orient][index];
+}
+
+J2KStepSize J2KQuantization::irreversibleStep(size_t level, size_t orient, size_t precision) {
+    int g = gain(orient);
+    double norm = J2KQuantization::norm(level, orient, false);
+
+    // Steps are those of 8 bit samples, scaled with the sample range: quantized coefficients then
+    // need the same number of bits whatever the precision, and fit the 16 bit DWT output.
+    // 13 fractional bits, of which the 11 below the leading one become the mantissa
+    double stepSize = ((1 << g) / norm) * pow(2.0, (int)precision - 8);
+    int baseStep = (int)floor(stepSize * 8192);
+    int p = floorLog2(baseStep) - 13;
+    int n = 11 - floorLog2(baseStep);
+    int mantissa = (n < 0 ? baseStep >> -n : baseStep << n) & 0x7ff;
+    return J2KStepSize((int)precision + g - p, mantissa);
+}
+
+J2KStepSize J2KQuantization::reversibleStep(size_t orient, size_t precision) {
+    return J2KStepSize((int)precision + gain(orient), 0);
+}
+
+float J2KQuantization::step(J2KStepSize stepSize, size_t orient, size_t precision) {
+    int rb = (int)precision + gain(orient);
+    return (float)((1.0 + stepSize.mantissa / 2048.0) * pow(2.0, rb - stepSize.exponent));
+}
+
+int J2KQuantization::maxBitPlanes(J2KStepSize stepSize, size_t guardBits) {
+    return (int)guardBits + stepSize.exponent - 1;
+}
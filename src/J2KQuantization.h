@@ -0,0 +1,61 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <stddef.h>
+
+// sub band orientations, as numbered by OCLCodeBlock
+const size_t J2K_ORIENT_LL = 0;
+const size_t J2K_ORIENT_HL = 1;
+const size_t J2K_ORIENT_LH = 2;
+const size_t J2K_ORIENT_HH = 3;
+
+// quantization step of one sub band, as signalled in QCD (ITU-T Rec. T.800, A.6.4 and E.1.1)
+struct J2KStepSize {
+    J2KStepSize() : exponent(0), mantissa(0) {}
+    J2KStepSize(int expn, int mant) : exponent(expn), mantissa(mant) {}
+    int exponent;       // epsilon_b
+    int mantissa;       // mu_b, 11 bits; zero for the reversible transform
+};
+
+/*
+Step sizes shared by the forward DWT, which quantizes with them, and the QCD marker, which signals them,
+so that a decoder dequantizes with exactly the step the encoder used.
+
+level counts decompositions from 0, the finest; the LL band of level is the one produced by its
+decomposition, so it is only coded for the last level.
+*/
+class J2KQuantization
+{
+public:
+    // log2 of the nominal gain of the sub band
+    static int gain(size_t orient);
+    // L2 norm of the synthesis basis function of the sub band: an error e in a coefficient
+    // adds (e * norm)^2 to the squared error of the image
+    static double norm(size_t level, size_t orient, bool reversible);
+    // irreversible 9/7: step in proportion to the inverse of the L2 norm of the synthesis basis of the sub band,
+    // so that all sub bands contribute equally to the mean squared error, and to the sample range
+    static J2KStepSize irreversibleStep(size_t level, size_t orient, size_t precision);
+    // reversible 5/3: no quantization, the exponent only bounds the dynamic range
+    static J2KStepSize reversibleStep(size_t orient, size_t precision);
+    // step of the sub band in sample units: (1 + mu / 2^11) * 2^(R_b - epsilon_b)
+    static float step(J2KStepSize stepSize, size_t orient, size_t precision);
+    // maximum number of bit planes of the sub band, M_b = G + epsilon_b - 1
+    static int maxBitPlanes(J2KStepSize stepSize, size_t guardBits);
+private:
+    static int floorLog2(int a);
+};
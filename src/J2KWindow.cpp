@@ -0,0 +1,148 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "J2KWindow.h"
+#include "J2KQuantization.h"
+#include "OCLUtil.h"
+#include <algorithm>
+
+// Coefficients on each side of the pair interval that the synthesis filters read:
+// one lifting step reaches one coefficient, and 5/3 has two steps, 9/7 four
+static const size_t REVERSIBLE_SUPPORT = 1;
+static const size_t IRREVERSIBLE_SUPPORT = 2;
+
+// needed coefficients [lo0, lo1) of the low pass band and [hi0, hi1) of the high pass band of a
+// dimension of n samples, to reconstruct samples [a, b)
+static void bandIntervals(size_t a, size_t b, size_t n, size_t support, size_t& lo0, size_t& lo1, size_t& hi0, size_t& hi1) {
+    size_t first = a / 2;
+    size_t last = (b - 1) / 2 + 1 + support;
+    lo0 = hi0 = first > support ? first - support : 0;
+    lo1 = std::min(last, (n + 1) / 2);
+    hi1 = std::min(last, n / 2);
+    if (hi0 > hi1)
+        hi0 = hi1;
+}
+
+static size_t evenBelow(size_t val) {
+    return val & ~(size_t)1;
+}
+
+J2KWindow::J2KWindow(void) : discardLevels(0)
+{
+}
+
+void J2KWindow::select(size_t x, size_t y, size_t w, size_t h, size_t discard) {
+    // saturate, so that the whole image can be selected with SIZE_MAX dimensions
+    request = Region(x, y, w > (size_t)-1 - x ? (size_t)-1 : x + w, h > (size_t)-1 - y ? (size_t)-1 : y + h);
+    discardLevels = discard;
+}
+
+bool J2KWindow::layout(const J2KPacketLayout& packetLayout, const HostCodestreamParams& params) {
+    if (discardLevels && discardLevels >= params.levels) {
+        LogError("window: cannot discard %d of %d levels", (int)discardLevels, (int)params.levels);
+        return false;
+    }
+    // dimensions of each level
+    std::vector<size_t> widths(1, params.width);
+    std::vector<size_t> heights(1, params.height);
+    for (size_t level = 1; level <= params.levels; ++level) {
+        widths.push_back(divRndUp(widths.back(), 2));
+        heights.push_back(divRndUp(heights.back(), 2));
+    }
+    window = Region(request.x0, request.y0, std::min(request.x1, widths[discardLevels]), std::min(request.y1, heights[discardLevels]));
+    if (window.empty()) {
+        LogError("window: %dx%d at (%d, %d) misses the %dx%d image", (int)request.width(), (int)request.height(),
+                 (int)request.x0, (int)request.y0, (int)widths[discardLevels], (int)heights[discardLevels]);
+        return false;
+    }
+
+    // walk from the window down to the coarsest level
+    const std::vector<J2KPacketLayout::Subband>& subbands = packetLayout.getSubbands();
+    size_t support = params.lossy ? IRREVERSIBLE_SUPPORT : REVERSIBLE_SUPPORT;
+    regions.assign(params.levels + 1, Region());
+    bandRegions.assign(subbands.size(), Region());
+    regions[discardLevels] = Region(evenBelow(window.x0), evenBelow(window.y0), window.x1, window.y1);
+    for (size_t level = discardLevels; level < params.levels; ++level) {
+        const Region& r = regions[level];
+        Region low, high;
+        bandIntervals(r.x0, r.x1, widths[level], support, low.x0, low.x1, high.x0, high.x1);
+        bandIntervals(r.y0, r.y1, heights[level], support, low.y0, low.y1, high.y0, high.y1);
+        for (size_t i = 0; i < subbands.size(); ++i) {
+            const J2KPacketLayout::Subband& sb = subbands[i];
+            if (sb.level != level + 1 || sb.orientation == J2K_ORIENT_LL)
+                continue;
+            bool highX = sb.orientation != J2K_ORIENT_LH;
+            bool highY = sb.orientation != J2K_ORIENT_HL;
+            bandRegions[i] = Region(highX ? high.x0 : low.x0, highY ? high.y0 : low.y0,
+                                    highX ? high.x1 : low.x1, highY ? high.y1 : low.y1);
+        }
+        regions[level + 1] = low;
+        // the coarsest region is read straight from the LL band, rather than computed
+        if (level + 1 < params.levels) {
+            regions[level + 1].x0 = evenBelow(low.x0);
+            regions[level + 1].y0 = evenBelow(low.y0);
+        }
+    }
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        if (subbands[i].orientation == J2K_ORIENT_LL)
+            bandRegions[i] = regions[params.levels];
+    }
+
+    // code blocks and precincts holding needed coefficients
+    const std::vector<J2KPacketLayout::Resolution>& resolutions = packetLayout.getResolutions();
+    firstPrecinct.clear();
+    size_t numPrecincts = 0;
+    for (size_t r = 0; r < resolutions.size(); ++r) {
+        firstPrecinct.push_back(numPrecincts);
+        numPrecincts += resolutions[r].numPrecinctsX * resolutions[r].numPrecinctsY;
+    }
+    precincts.assign(numPrecincts, false);
+    blocks.clear();
+    // the inner vectors keep their capacity from the last frame
+    bandBlocks.resize(subbands.size());
+    bandBlockBounds.assign(subbands.size(), Region());
+    for (size_t i = 0; i < subbands.size(); ++i) {
+        const J2KPacketLayout::Subband& sb = subbands[i];
+        const Region& band = bandRegions[i];
+        bandBlocks[i].clear();
+        if (band.empty() || !sb.numBlocksX)
+            continue;
+        size_t bx0 = band.x0 / params.codeBlockX, bx1 = divRndUp(band.x1, params.codeBlockX);
+        size_t by0 = band.y0 / params.codeBlockY, by1 = divRndUp(band.y1, params.codeBlockY);
+        for (size_t by = by0; by < by1; ++by) {
+            for (size_t bx = bx0; bx < bx1; ++bx)
+                bandBlocks[i].push_back(sb.firstBlock + bx + by * sb.numBlocksX);
+        }
+        blocks.insert(blocks.end(), bandBlocks[i].begin(), bandBlocks[i].end());
+        bandBlockBounds[i] = Region(sb.x + bx0 * params.codeBlockX, sb.y + by0 * params.codeBlockY,
+                                    sb.x + std::min(bx1 * params.codeBlockX, sb.width),
+                                    sb.y + std::min(by1 * params.codeBlockY, sb.height));
+        const J2KPacketLayout::Resolution& res = resolutions[sb.resolution];
+        for (size_t p = 0; p < res.numPrecinctsX * res.numPrecinctsY; ++p) {
+            size_t x0, y0, x1, y1;
+            packetLayout.precinctBlocks(sb, p, x0, y0, x1, y1);
+            if (x0 < bx1 && bx0 < x1 && y0 < by1 && by0 < y1)
+                precincts[firstPrecinct[sb.resolution] + p] = true;
+        }
+    }
+    return true;
+}
+
+bool J2KWindow::containsPrecinct(size_t resolution, size_t precinct) const {
+    if (resolution >= firstPrecinct.size())
+        return false;
+    size_t i = firstPrecinct[resolution] + precinct;
+    return i < precincts.size() && precincts[i];
+}
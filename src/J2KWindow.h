@@ -0,0 +1,106 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include "J2KPacketLayout.h"
+#include <vector>
+#include <stddef.h>
+
+/*
+Code blocks, precincts and inverse DWT regions needed to reconstruct a window of a frame.
+
+Each level of the inverse DWT only computes the region of its reconstruction that the next finer level,
+or the window, reads: the samples of the region, widened by the support of the synthesis filters, give
+the coefficients of the low and high pass bands it needs, and the low pass ones are the region of the
+coarser level. Regions start on even samples, as the lifting kernels pair samples from the region origin.
+Only code blocks that hold needed coefficients are decoded, and only packets of precincts that hold such
+code blocks are needed.
+
+With discardLevels > 0, the window is one of the image reduced by 2^discardLevels in each dimension,
+and the high pass bands of the finest discardLevels levels are never needed.
+*/
+class J2KWindow
+{
+public:
+    // half open rectangle [x0, x1) x [y0, y1)
+    struct Region {
+        Region() : x0(0), y0(0), x1(0), y1(0) {}
+        Region(size_t x0, size_t y0, size_t x1, size_t y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+        size_t width() const {
+            return x1 - x0;
+        }
+        size_t height() const {
+            return y1 - y0;
+        }
+        bool empty() const {
+            return x0 >= x1 || y0 >= y1;
+        }
+        size_t x0;
+        size_t y0;
+        size_t x1;
+        size_t y1;
+    };
+
+    J2KWindow(void);
+    // Request the window [x, x + w) x [y, y + h) of the image reduced by discardLevels levels;
+    // it is clipped to the image when laid out
+    void select(size_t x, size_t y, size_t w, size_t h, size_t discardLevels);
+    // Lay out the selected window for the frame of layout and params.
+    // Returns false, and logs why, if the window misses the image or too many levels are discarded
+    bool layout(const J2KPacketLayout& layout, const HostCodestreamParams& params);
+
+    size_t getDiscardLevels() const {
+        return discardLevels;
+    }
+    // the selected window, clipped to the reduced image
+    const Region& getWindow() const {
+        return window;
+    }
+    // region of the reconstruction of a level, from getDiscardLevels() up to levels - 1,
+    // that the inverse DWT computes, in the coordinates of that level
+    const Region& getRegion(size_t level) const {
+        return regions[level];
+    }
+    // code blocks of a channel, in code block table order, that hold needed coefficients
+    const std::vector<size_t>& getBlocks() const {
+        return blocks;
+    }
+    // subbands of the frame, in code block table order
+    size_t getNumBands() const {
+        return bandBlocks.size();
+    }
+    // the code blocks of getBlocks() that lie in a subband
+    const std::vector<size_t>& getBandBlocks(size_t subband) const {
+        return bandBlocks[subband];
+    }
+    // bounding box of getBandBlocks(subband) in the Mallat layout of the DWT output; empty if there are none
+    const Region& getBandBlockBounds(size_t subband) const {
+        return bandBlockBounds[subband];
+    }
+    // precinct of a resolution holds code blocks of getBlocks()
+    bool containsPrecinct(size_t resolution, size_t precinct) const;
+private:
+    Region request;
+    size_t discardLevels;
+    Region window;
+    std::vector<Region> regions;            // per level
+    std::vector<Region> bandRegions;        // needed coefficients of each subband, in subband coordinates
+    std::vector<size_t> blocks;
+    std::vector< std::vector<size_t> > bandBlocks;  // per subband
+    std::vector<Region> bandBlockBounds;
+    std::vector<size_t> firstPrecinct;      // per resolution, into precincts
+    std::vector<bool> precincts;
+};
@@ -13,53 +13,903 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+
 #pragma once
 
 #include "OCLBPC.h"
 #include "OCLMemoryManager.h"
+#include "OCLProfiler.h"
 #include <stdint.h>
+#include <algorithm>
+#include "OCLBasic.h"
+#include <queue>
+#include <functional>
 
+// work items per work group of the bucketWorkList kernel
+static const size_t BPC_BUCKET_WORK_GROUP_SIZE = 64;
 
+// initial size of the (CX,D) buffer, in bytes per sample; it grows to fit the largest frame seen
+static const size_t BPC_INITIAL_BYTES_PER_SAMPLE = 2;
 
 template<typename T> OCLBPC<T>::OCLBPC(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr) :
     initInfo(initInfo),
     memoryManager(memMgr),
-    bpc(new OCLKernel( KernelInitInfo(initInfo, "oclbpc.cl", "run") ))
+    bpc(NULL),
+    context(0),
+    deviceLocalMemorySize(0),
+    deviceMaxWorkGroupSize(0),
+    deviceComputeUnits(0),
+    schedule(BPC_SCHEDULE_LIST),
+    width(0),
+    height(0),
+    levels(0),
+    blockX(0),
+    blockY(0),
+    numChannels(0),
+    codeBlocksBuffer(0),
+    bucketedEntries(0),
+    bucketCursorsBuffer(0),
+    currentSet(0),
+    zero(0)
 {
+    cl_device_id device = 0;
+    cl_int error_code = clGetCommandQueueInfo(initInfo.cmd_queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetCommandQueueInfo (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+    error_code = clGetCommandQueueInfo(initInfo.cmd_queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetCommandQueueInfo (CL_QUEUE_DEVICE) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+    error_code = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &deviceLocalMemorySize, 0);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+    error_code = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &deviceComputeUnits, 0);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_MAX_COMPUTE_UNITS) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+    deviceMaxWorkGroupSize = ::deviceMaxWorkGroupSize(device);
 }
 
 
 template<typename T> OCLBPC<T>::~OCLBPC(void)
 {
-    if (bpc)
-        delete bpc;
+    releaseBuffers();
+    for (typename std::map<std::pair<size_t, size_t>, OCLBPCKernel>::iterator it = kernels.begin(); it != kernels.end(); ++it) {
+        if (it->second.kernel)
+            delete it->second.kernel;
+        if (it->second.prepass)
+            delete it->second.prepass;
+        if (it->second.bucket)
+            delete it->second.bucket;
+    }
+}
+
+template<typename T> bool OCLBPC<T>::isLegalCodeBlockSize(size_t codeblockX, size_t codeblockY) {
+    size_t sizes[] = {codeblockX, codeblockY};
+    for (size_t i = 0; i < 2; ++i) {
+        if (sizes[i] < 4 || sizes[i] > 1024 || (sizes[i] & (sizes[i] - 1)))
+            return false;
+    }
+    return codeblockX * codeblockY <= 4096;
+}
+
+template<typename T> size_t OCLBPC<T>::localMemorySize(size_t codeblockX, size_t codeblockY) {
+    size_t stateBufferSize = (codeblockX + 2) * (codeblockY + 2);
+    size_t numStripeColumns = codeblockX * (codeblockY / 4);
+    return (stateBufferSize + numStripeColumns + 2) * sizeof(cl_uint);
+}
+
+template<typename T> OCLBPCKernel* OCLBPC<T>::getKernel(size_t codeblockX, size_t codeblockY) {
+    std::pair<size_t, size_t> key(codeblockX, codeblockY);
+    typename std::map<std::pair<size_t, size_t>, OCLBPCKernel>::iterator it = kernels.find(key);
+    if (it != kernels.end())
+        return it->second.kernel ? &it->second : NULL;
+
+    // failures are remembered too, so that they are only reported once
+    OCLBPCKernel& entry = kernels[key];
+    if (!isLegalCodeBlockSize(codeblockX, codeblockY)) {
+        LogError("OCLBPC: illegal code block size %dx%d.", (int)codeblockX, (int)codeblockY);
+        return NULL;
+    }
+    size_t required = localMemorySize(codeblockX, codeblockY);
+    if (required > deviceLocalMemorySize) {
+        LogError("OCLBPC: %dx%d code blocks need %d bytes of local memory; the device has %d.",
+                 (int)codeblockX, (int)codeblockY, (int)required, (int)deviceLocalMemorySize);
+        return NULL;
+    }
+
+    // one work item per stripe column, or fewer work items with several columns each
+    size_t workGroupSize = codeblockX * (codeblockY / 4);
+    while (workGroupSize > 1 && workGroupSize > deviceMaxWorkGroupSize)
+        workGroupSize >>= 1;
+    std::string options = initInfo.buildOptions + " -D CODEBLOCKX=" + to_str(codeblockX) + " -D CODEBLOCKY=" + to_str(codeblockY) +
+                          " -D LOCAL_MEMORY_SIZE=" + to_str(deviceLocalMemorySize);
+    while (workGroupSize) {
+        KernelInitInfoBase info(initInfo);
+        info.buildOptions = options + " -D WORK_GROUP_SIZE=" + to_str(workGroupSize);
+        OCLKernel* kernel = new OCLKernel( KernelInitInfo(info, "oclbpc.cl", "run") );
+        OCLKernel* prepass = new OCLKernel( KernelInitInfo(info, "oclbpc.cl", "findBitPlanes") );
+        OCLKernel* bucket = new OCLKernel( KernelInitInfo(info, "oclbpc.cl", "bucketWorkList") );
+        if (!kernel->getKernel() || !prepass->getKernel() || !bucket->getKernel()) {
+            delete kernel;
+            delete prepass;
+            delete bucket;
+            return NULL;
+        }
+        // register pressure may limit the work group size below the device maximum
+        if (kernelMaxWorkGroupSize(kernel->getKernel(), kernel->getDevice()) >= workGroupSize &&
+                kernelMaxWorkGroupSize(prepass->getKernel(), prepass->getDevice()) >= workGroupSize) {
+            entry.kernel = kernel;
+            entry.prepass = prepass;
+            entry.bucket = bucket;
+            entry.workGroupSize = workGroupSize;
+            return &entry;
+        }
+        delete kernel;
+        delete prepass;
+        delete bucket;
+        workGroupSize >>= 1;
+    }
+    return NULL;
+}
+
+template<typename T> void OCLBPC<T>::releaseBuffers() {
+    if (codeBlocksBuffer)
+        clReleaseMemObject(codeBlocksBuffer);
+    codeBlocksBuffer = 0;
+    if (bucketedEntries)
+        clReleaseMemObject(bucketedEntries);
+    bucketedEntries = 0;
+    if (bucketCursorsBuffer)
+        clReleaseMemObject(bucketCursorsBuffer);
+    bucketCursorsBuffer = 0;
+    for (size_t i = 0; i < BPC_NUM_OUTPUT_SETS; ++i) {
+        OCLBPCOutputSet& outputSet = outputSets[i];
+        if (outputSet.blockInfo)
+            clReleaseMemObject(outputSet.blockInfo);
+        if (outputSet.cxd)
+            clReleaseMemObject(outputSet.cxd);
+        if (outputSet.cxdHead)
+            clReleaseMemObject(outputSet.cxdHead);
+        if (outputSet.mapEvent)
+            clReleaseEvent(outputSet.mapEvent);
+        OCLBPCWorkList& workList = outputSet.workList;
+        if (workList.entries)
+            clReleaseMemObject(workList.entries);
+        if (workList.counts)
+            clReleaseMemObject(workList.counts);
+        if (workList.bucketCounts)
+            clReleaseMemObject(workList.bucketCounts);
+        if (workList.countsRead)
+            clReleaseEvent(workList.countsRead);
+        outputSet = OCLBPCOutputSet();
+    }
+}
+
+template<typename T> void OCLBPC<T>::addSubband(std::vector<OCLCodeBlock>& blocks, size_t x, size_t y, size_t w, size_t h,
+        int orientation, size_t level, size_t codeblockX, size_t codeblockY) {
+    for (size_t j = 0; j < h; j += codeblockY) {
+        for (size_t i = 0; i < w; i += codeblockX) {
+            OCLCodeBlock block;
+            block.x = (cl_int)(x + i);
+            block.y = (cl_int)(y + j);
+            block.width = (cl_int)std::min(codeblockX, w - i);
+            block.height = (cl_int)std::min(codeblockY, h - j);
+            block.orientation = orientation;
+            block.level = (cl_int)level;
+            blocks.push_back(block);
+        }
+    }
+}
+
+template<typename T> std::vector<OCLCodeBlock> OCLBPC<T>::getCodeBlocks(size_t w, size_t h, size_t levels, size_t codeblockX, size_t codeblockY) {
+    // dimensions of the low pass image of each level: level 0 is the full image
+    std::vector<size_t> lowW(1, w), lowH(1, h);
+    for (size_t level = 1; level <= levels; ++level) {
+        lowW.push_back((lowW.back() + 1) >> 1);
+        lowH.push_back((lowH.back() + 1) >> 1);
+    }
+    std::vector<OCLCodeBlock> blocks;
+    addSubband(blocks, 0, 0, lowW[levels], lowH[levels], 0, levels, codeblockX, codeblockY);
+    for (size_t level = levels; level >= 1; --level) {
+        size_t llW = lowW[level], llH = lowH[level];
+        size_t highW = lowW[level - 1] - llW, highH = lowH[level - 1] - llH;
+        addSubband(blocks, llW, 0, highW, llH, 1, level, codeblockX, codeblockY);
+        addSubband(blocks, 0, llH, llW, highH, 2, level, codeblockX, codeblockY);
+        addSubband(blocks, llW, llH, highW, highH, 3, level, codeblockX, codeblockY);
+    }
+    return blocks;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::createBuffer(cl_mem* buffer, cl_mem_flags flags, size_t size, void* hostPtr) {
+    cl_int error_code = CL_SUCCESS;
+    *buffer = clCreateBuffer(context, flags, size, hostPtr, &error_code);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clCreateBuffer returned %s.", TranslateOpenCLError(error_code));
+        *buffer = 0;
+    }
+    return error_code;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::allocate(size_t codeblockX, size_t codeblockY) {
+    OCLBPCKernel* kernel = getKernel(codeblockX, codeblockY);
+    if (!kernel)
+        return CL_INVALID_KERNEL;
+    bpc = kernel;
+    size_t w = memoryManager->getWidth();
+    size_t h = memoryManager->getHeight();
+    size_t numLevels = memoryManager->getNumLevels();
+    // single component images are not split into planar channels
+    size_t channels = memoryManager->getNumComponents() > 1 ? memoryManager->getNumComponents() : 1;
+    if (codeBlocksBuffer && w == width && h == height && numLevels == levels && codeblockX == blockX &&
+            codeblockY == blockY && channels == numChannels)
+        return DeviceSuccess;
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < BPC_NUM_OUTPUT_SETS; ++i) {
+        if (outputSets[i].mappedInfo) {
+            LogError("OCLBPC: geometry changed while output set %d is mapped.", (int)i);
+            return CL_INVALID_OPERATION;
+        }
+        capacity = std::max(capacity, outputSets[i].cxdCapacity);
+    }
+    releaseBuffers();
+    width = w;
+    height = h;
+    levels = numLevels;
+    blockX = codeblockX;
+    blockY = codeblockY;
+    numChannels = channels;
+    codeBlocks = getCodeBlocks(w, h, numLevels, codeblockX, codeblockY);
+    if (codeBlocks.empty())
+        return CL_INVALID_VALUE;
+
+    tDeviceRC error_code = createBuffer(&codeBlocksBuffer, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        codeBlocks.size() * sizeof(OCLCodeBlock), &codeBlocks[0]);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&bucketedEntries, CL_MEM_READ_WRITE, numChannels * codeBlocks.size() * sizeof(cl_uint2), NULL);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&bucketCursorsBuffer, CL_MEM_READ_WRITE, numChannels * BPC_MAX_BIT_PLANES * sizeof(cl_uint), NULL);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    zeroCounts.assign(numChannels * (1 + BPC_MAX_BIT_PLANES), 0);
+    // until a run of this geometry has been read back, launch a work group for every block
+    expectedCounts.assign(numChannels, (cl_uint)codeBlocks.size());
+    capacity = std::max(capacity, width * height * numChannels * BPC_INITIAL_BYTES_PER_SAMPLE);
+    for (size_t i = 0; i < BPC_NUM_OUTPUT_SETS; ++i) {
+        // output is mapped by the host, so let the runtime place it in host visible memory
+        OCLBPCOutputSet& outputSet = outputSets[i];
+        error_code = createBuffer(&outputSet.blockInfo, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                  numChannels * codeBlocks.size() * BPC_BLOCK_INFO_SIZE * sizeof(cl_uint), NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        error_code = createBuffer(&outputSet.cxdHead, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        outputSet.cxdCapacity = capacity;
+        error_code = createBuffer(&outputSet.cxd, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, capacity, NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+
+        // each set keeps its own work list, which completing the set may still need after the next run
+        OCLBPCWorkList& workList = outputSet.workList;
+        error_code = createBuffer(&workList.entries, CL_MEM_READ_WRITE, numChannels * codeBlocks.size() * sizeof(cl_uint2), NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        error_code = createBuffer(&workList.counts, CL_MEM_READ_WRITE, numChannels * sizeof(cl_uint), NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        error_code = createBuffer(&workList.bucketCounts, CL_MEM_READ_WRITE, numChannels * BPC_MAX_BIT_PLANES * sizeof(cl_uint), NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        workList.blocksPerChannel = codeBlocks.size();
+        workList.numChannels = numChannels;
+        workList.hostCounts.assign(numChannels, 0);
+        workList.hostBucketCounts.assign(numChannels * BPC_MAX_BIT_PLANES, 0);
+    }
+    return DeviceSuccess;
 }
 
 template<typename T>  void OCLBPC<T>::run(size_t codeblockX, size_t codeblockY) {
-    size_t local_work_size[3] = {codeblockX, codeblockY/4};
-    size_t global_work_size[3] = {memoryManager->getWidth(), memoryManager->getHeight()/4,1};
-    for (int i  =0; i < 4; ++i) {
+    if (allocate(codeblockX, codeblockY) != DeviceSuccess)
+        return;
+    currentSet = (currentSet + 1) % BPC_NUM_OUTPUT_SETS;
+    OCLBPCOutputSet& outputSet = outputSets[currentSet];
+    if (outputSet.mappedInfo) {
+        LogError("OCLBPC::run: output set %d is still mapped.", (int)currentSet);
+        return;
+    }
+    if (findBitPlanes(outputSet) != DeviceSuccess)
+        return;
+    if (schedule == BPC_SCHEDULE_BUCKETS && bucketWorkList(outputSet) != DeviceSuccess)
+        return;
+    outputSet.workList.launched = expectedCounts;
+    enqueue(outputSet);
+}
+
+template<typename T> cl_mem* OCLBPC<T>::getChannel(size_t i) {
+    return memoryManager->getNumComponents() > 1 ? memoryManager->getDWTOutByChannel(i) : memoryManager->getDWTOut();
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::findBitPlanes(OCLBPCOutputSet& outputSet) {
+    OCLBPCWorkList& workList = outputSet.workList;
+    cl_int error_code = clEnqueueWriteBuffer(initInfo.cmd_queue, workList.counts, CL_FALSE, 0, numChannels * sizeof(cl_uint),
+                        &zeroCounts[0], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueWriteBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clEnqueueWriteBuffer(initInfo.cmd_queue, workList.bucketCounts, CL_FALSE, 0, numChannels * BPC_MAX_BIT_PLANES * sizeof(cl_uint),
+                                      &zeroCounts[numChannels], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueWriteBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    // one work group per code block
+    size_t local_work_size[3] = {bpc->workGroupSize};
+    size_t global_work_size[3] = {codeBlocks.size() * bpc->workGroupSize};
+    for (size_t i = 0; i < numChannels; ++i) {
+        bpc->prepass->setProfileName("bpc prepass", "channel " + to_str(i));
+        error_code = setPrepassArgs(getChannel(i), (cl_uint)i, outputSet);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+        error_code = bpc->prepass->enqueue(1, global_work_size, local_work_size);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+    }
+    // read back without waiting: complete() sizes the rest of the launch once they have arrived.
+    // The queue is in order, so the second read completes last
+    if (workList.countsRead)
+        clReleaseEvent(workList.countsRead);
+    workList.countsRead = 0;
+    workList.countsKnown = false;
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, workList.bucketCounts, CL_FALSE, 0, numChannels * BPC_MAX_BIT_PLANES * sizeof(cl_uint),
+                                     &workList.hostBucketCounts[0], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, workList.counts, CL_FALSE, 0, numChannels * sizeof(cl_uint),
+                                     &workList.hostCounts[0], 0, NULL, &workList.countsRead);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        workList.countsRead = 0;
+        return error_code;
+    }
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::bucketWorkList(OCLBPCOutputSet& outputSet) {
+    // the kernel finds the start of each bucket from the bucket counts of the prepass
+    cl_int error_code = clEnqueueWriteBuffer(initInfo.cmd_queue, bucketCursorsBuffer, CL_FALSE, 0, numChannels * BPC_MAX_BIT_PLANES * sizeof(cl_uint),
+                        &zeroCounts[numChannels], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueWriteBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    // one work item per block, since the length of the list is not known on the host
+    size_t groupSize = std::min(BPC_BUCKET_WORK_GROUP_SIZE, deviceMaxWorkGroupSize);
+    size_t local_work_size[3] = {groupSize};
+    size_t global_work_size[3] = {((codeBlocks.size() + groupSize - 1) / groupSize) * groupSize};
+    for (size_t i = 0; i < numChannels; ++i) {
+        bpc->bucket->setProfileName("bpc prepass", "bucket channel " + to_str(i));
+        error_code = setBucketArgs((cl_uint)i, outputSet);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+        error_code = bpc->bucket->enqueue(1, global_work_size, local_work_size);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+    }
+    std::swap(outputSet.workList.entries, bucketedEntries);
+    return DeviceSuccess;
+}
+
+template<typename T> double OCLBPC<T>::estimateOccupancy(const std::vector<cl_uint>& costs, size_t numSlots) {
+    if (costs.empty() || !numSlots)
+        return 0;
+    // time at which each slot becomes free
+    std::priority_queue<double, std::vector<double>, std::greater<double> > slots;
+    for (size_t i = 0; i < std::min(numSlots, costs.size()); ++i)
+        slots.push(0);
+    double busy = 0, makespan = 0;
+    for (size_t i = 0; i < costs.size(); ++i) {
+        double end = slots.top() + costs[i];
+        slots.pop();
+        slots.push(end);
+        busy += costs[i];
+        makespan = std::max(makespan, end);
+    }
+    return makespan > 0 ? busy / (makespan * numSlots) : 0;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::recordOccupancy(OCLBPCOutputSet& outputSet) {
+    const OCLBPCWorkList& workList = outputSet.workList;
+    // work groups that are resident at once: local memory is the limiting resource of the BPC
+    size_t groupsPerUnit = (size_t)(deviceLocalMemorySize / localMemorySize(blockX, blockY));
+    size_t numSlots = std::max((size_t)deviceComputeUnits, (size_t)1) * std::max(groupsPerUnit, (size_t)1);
 
-        if (setKernelArgs(memoryManager->getDWTOutByChannel(i)) != DeviceSuccess) {
-            return;
+    // the cost of a block is its number of coding passes
+    std::vector<cl_uint2> entries;
+    if (schedule == BPC_SCHEDULE_LIST) {
+        // blocking, but only when profiling: the order of the list is only known on the device
+        entries.resize(numChannels * codeBlocks.size());
+        cl_int error_code = clEnqueueReadBuffer(initInfo.cmd_queue, workList.entries, CL_TRUE, 0, entries.size() * sizeof(cl_uint2),
+                                                &entries[0], 0, NULL, NULL);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+            return error_code;
         }
-        bpc->enqueue(2,global_work_size, local_work_size);
     }
+    for (size_t i = 0; i < numChannels; ++i) {
+        std::vector<cl_uint> costs;
+        if (schedule == BPC_SCHEDULE_LIST) {
+            for (size_t j = 0; j < workList.hostCounts[i]; ++j)
+                costs.push_back(3 * entries[i * codeBlocks.size() + j].s[1] - 2);
+        } else {
+            for (size_t b = BPC_MAX_BIT_PLANES; b > 0; --b)
+                costs.insert(costs.end(), workList.hostBucketCounts[i * BPC_MAX_BIT_PLANES + b - 1], (cl_uint)(3 * b - 2));
+        }
+        if (!costs.empty())
+            initInfo.profiler->recordMetric("bpc", "occupancy channel " + to_str(i), estimateOccupancy(costs, numSlots));
+    }
+    return DeviceSuccess;
+}
 
+template<typename T> tDeviceRC OCLBPC<T>::enqueue(OCLBPCOutputSet& outputSet) {
+    cl_int error_code = clEnqueueWriteBuffer(initInfo.cmd_queue, outputSet.cxdHead, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueWriteBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    return enqueueEntries(outputSet, std::vector<cl_uint>(numChannels, 0), outputSet.workList.launched);
+}
 
+template<typename T> tDeviceRC OCLBPC<T>::enqueueEntries(OCLBPCOutputSet& outputSet, const std::vector<cl_uint>& first, const std::vector<cl_uint>& count) {
+    // one work group per listed code block; blockInfo of the others was written by the prepass
+    size_t local_work_size[3] = {bpc->workGroupSize};
+    for (size_t i = 0; i < numChannels; ++i) {
+        if (!count[i])
+            continue;
+        size_t global_work_size[3] = {count[i] * bpc->workGroupSize};
+        bpc->kernel->setProfileName("bpc", "channel " + to_str(i));
+        cl_int error_code = setKernelArgs(getChannel(i), (cl_uint)i, first[i], outputSet);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+        error_code = bpc->kernel->enqueue(1,global_work_size, local_work_size);
+        if (error_code != DeviceSuccess) {
+            return error_code;
+        }
+    }
+    return DeviceSuccess;
+}
 
+template<typename T> tDeviceRC OCLBPC<T>::complete(bool& rerun) {
+    cl_uint head = 0;
+    return complete(rerun, head, currentSet);
 }
 
-template<typename T> tDeviceRC OCLBPC<T>::setKernelArgs(cl_mem* channel) {
+template<typename T> tDeviceRC OCLBPC<T>::completeWorkList(OCLBPCOutputSet& outputSet, bool& rerun) {
+    OCLBPCWorkList& workList = outputSet.workList;
+    if (workList.countsKnown)
+        return DeviceSuccess;
+    if (!workList.countsRead)
+        return CL_INVALID_EVENT;
+    cl_int error_code = clWaitForEvents(1, &workList.countsRead);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clWaitForEvents returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    workList.countsKnown = true;
+    if (initInfo.profiler && initInfo.profiler->isEnabled())
+        recordOccupancy(outputSet);
+
+    // a list that outgrew the launch is coded from where the launch ended
+    std::vector<cl_uint> extra(numChannels, 0);
+    bool grew = false;
+    for (size_t i = 0; i < numChannels; ++i) {
+        if (workList.hostCounts[i] > workList.launched[i]) {
+            extra[i] = workList.hostCounts[i] - workList.launched[i];
+            grew = true;
+        }
+    }
+    expectedCounts = workList.hostCounts;
+    if (!grew)
+        return DeviceSuccess;
+    error_code = enqueueEntries(outputSet, workList.launched, extra);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    workList.launched = workList.hostCounts;
+    rerun = true;
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::complete(bool& rerun, cl_uint& head, size_t set) {
+    rerun = false;
+    OCLBPCOutputSet& outputSet = outputSets[set];
+    if (!outputSet.cxd)
+        return CL_INVALID_MEM_OBJECT;
+    cl_int error_code = completeWorkList(outputSet, rerun);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, outputSet.cxdHead, CL_TRUE, 0, sizeof(cl_uint), &head, 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    // some passes did not fit: grow the buffer and code the frame again
+    if (head > outputSet.cxdCapacity) {
+        clReleaseMemObject(outputSet.cxd);
+        outputSet.cxdCapacity = head + (head >> 2);
+        error_code = createBuffer(&outputSet.cxd, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, outputSet.cxdCapacity, NULL);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        error_code = enqueue(outputSet);
+        if (DeviceSuccess != error_code)
+            return error_code;
+        rerun = true;
+    }
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::mapSet(OCLBPCOutputSet& outputSet, size_t cxdSize, cl_bool blocking) {
+    cl_int error_code = CL_SUCCESS;
+    size_t infoSize = numChannels * codeBlocks.size() * BPC_BLOCK_INFO_SIZE * sizeof(cl_uint);
+    outputSet.mappedInfo = clEnqueueMapBuffer(initInfo.cmd_queue, outputSet.blockInfo, blocking, CL_MAP_READ, 0, infoSize,
+                           0, NULL, NULL, &error_code);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueMapBuffer returned %s.", TranslateOpenCLError(error_code));
+        outputSet.mappedInfo = NULL;
+        return error_code;
+    }
+    // an empty region may not be mapped. The queue is in order, so the event of the
+    // second map completes last
+    outputSet.mappedCxd = clEnqueueMapBuffer(initInfo.cmd_queue, outputSet.cxd, blocking, CL_MAP_READ, 0, cxdSize ? cxdSize : 1,
+                          0, NULL, blocking ? NULL : &outputSet.mapEvent, &error_code);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueMapBuffer returned %s.", TranslateOpenCLError(error_code));
+        outputSet.mappedCxd = NULL;
+        outputSet.mapEvent = 0;
+        clEnqueueUnmapMemObject(initInfo.cmd_queue, outputSet.blockInfo, outputSet.mappedInfo, 0, NULL, NULL);
+        outputSet.mappedInfo = NULL;
+        return error_code;
+    }
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::mapOutput(OCLBPCMappedOutput& output) {
+    tDeviceRC error_code = enqueueMapOutput(output);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    return waitForOutput(output);
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::enqueueMapOutput(OCLBPCMappedOutput& output) {
+    OCLBPCOutputSet& outputSet = outputSets[currentSet];
+    if (outputSet.mappedInfo)
+        return CL_INVALID_OPERATION;
+    if (!outputSet.cxd)
+        return CL_INVALID_MEM_OBJECT;
+    // waits for the prepass only
+    bool rerun = false;
+    cl_int error_code = completeWorkList(outputSet, rerun);
+    if (DeviceSuccess != error_code)
+        return error_code;
+
+    // the head is not known until the BPC has finished, so the whole buffer is mapped
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, outputSet.cxdHead, CL_FALSE, 0, sizeof(cl_uint), &outputSet.hostHead, 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = mapSet(outputSet, outputSet.cxdCapacity, CL_FALSE);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    output.codeBlocks = &codeBlocks[0];
+    output.numCodeBlocks = codeBlocks.size();
+    output.numChannels = numChannels;
+    output.blockInfo = (const cl_uint*)outputSet.mappedInfo;
+    output.cxd = (const cl_uchar*)outputSet.mappedCxd;
+    output.set = currentSet;
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::waitForOutput(OCLBPCMappedOutput& output) {
+    if (output.set >= BPC_NUM_OUTPUT_SETS)
+        return CL_INVALID_VALUE;
+    OCLBPCOutputSet& outputSet = outputSets[output.set];
+    if (!outputSet.mappedInfo)
+        return CL_INVALID_OPERATION;
+    if (!outputSet.mapEvent)
+        return DeviceSuccess;
+    cl_int error_code = clWaitForEvents(1, &outputSet.mapEvent);
+    clReleaseEvent(outputSet.mapEvent);
+    outputSet.mapEvent = 0;
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clWaitForEvents returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    if (outputSet.hostHead <= outputSet.cxdCapacity)
+        return DeviceSuccess;
+
+    // some passes did not fit: code the set again with a larger buffer, and map it once that has finished
+    error_code = unmapOutput(output);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    bool rerun = false;
+    cl_uint head = 0;
+    error_code = complete(rerun, head, output.set);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = mapSet(outputSet, head, CL_TRUE);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    output.blockInfo = (const cl_uint*)outputSet.mappedInfo;
+    output.cxd = (const cl_uchar*)outputSet.mappedCxd;
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::unmapOutput(const OCLBPCMappedOutput& output) {
+    if (output.set >= BPC_NUM_OUTPUT_SETS)
+        return CL_INVALID_VALUE;
+    OCLBPCOutputSet& outputSet = outputSets[output.set];
+    if (!outputSet.mappedInfo)
+        return CL_INVALID_OPERATION;
+    // a map that is still in flight must complete before its pointers are handed back
+    if (outputSet.mapEvent) {
+        clWaitForEvents(1, &outputSet.mapEvent);
+        clReleaseEvent(outputSet.mapEvent);
+        outputSet.mapEvent = 0;
+    }
+    cl_int error_code = clEnqueueUnmapMemObject(initInfo.cmd_queue, outputSet.blockInfo, outputSet.mappedInfo, 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueUnmapMemObject returned %s.", TranslateOpenCLError(error_code));
+    }
+    cl_int cxd_error_code = clEnqueueUnmapMemObject(initInfo.cmd_queue, outputSet.cxd, outputSet.mappedCxd, 0, NULL, NULL);
+    if (CL_SUCCESS != cxd_error_code)
+    {
+        LogError("clEnqueueUnmapMemObject returned %s.", TranslateOpenCLError(cxd_error_code));
+        error_code = cxd_error_code;
+    }
+    outputSet.mappedInfo = NULL;
+    outputSet.mappedCxd = NULL;
+    return error_code;
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::readOutput(OCLBPCOutput& output) {
+    OCLBPCMappedOutput mapped;
+    tDeviceRC error_code = mapOutput(mapped);
+    if (DeviceSuccess != error_code)
+        return error_code;
+
+    // gather the passes of each code block, which the device allocates independently
+    output.codeBlocks = codeBlocks;
+    output.numChannels = numChannels;
+    output.info.resize(numChannels * codeBlocks.size());
+    output.cxd.clear();
+    for (size_t i = 0; i < output.info.size(); ++i) {
+        const cl_uint* src = mapped.blockInfo + i * BPC_BLOCK_INFO_SIZE;
+        OCLCodeBlockInfo& info = output.info[i];
+        info.offset = (cl_uint)output.cxd.size();
+        info.numBitPlanes = src[0];
+        info.numPasses = src[1];
+        for (size_t pass = 0; pass < info.numPasses; ++pass) {
+            const cl_uchar* pairs = mapped.cxd + src[2 + 2 * pass];
+            output.cxd.insert(output.cxd.end(), pairs, pairs + src[3 + 2 * pass]);
+            output.cxd.push_back(CXD_PASS_END);
+        }
+        info.count = (cl_uint)output.cxd.size() - info.offset;
+    }
+    return unmapOutput(mapped);
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::setKernelArgs(cl_mem* channel, cl_uint channelIndex, cl_uint firstEntry, OCLBPCOutputSet& outputSet) {
     int numKernelArgs = 0;
-    cl_kernel targetKernel = bpc->getKernel();
+    cl_kernel targetKernel = bpc->kernel->getKernel();
+    cl_uint infoOffset = (cl_uint)(channelIndex * codeBlocks.size());
+    cl_uint capacity = (cl_uint)outputSet.cxdCapacity;
     cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem),channel);
     if (DeviceSuccess != error_code)
     {
         LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
         return error_code;
     }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &codeBlocksBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.entries);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.counts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(channelIndex), &channelIndex);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(firstEntry), &firstEntry);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.blockInfo);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(infoOffset), &infoOffset);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.cxd);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.cxdHead);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(capacity), &capacity);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
 
-    return DeviceSuccess;
+    return memoryManager->setBufferImageArgs(targetKernel, numKernelArgs);
 }
 
+template<typename T> tDeviceRC OCLBPC<T>::setPrepassArgs(cl_mem* channel, cl_uint channelIndex, OCLBPCOutputSet& outputSet) {
+    int numKernelArgs = 0;
+    cl_kernel targetKernel = bpc->prepass->getKernel();
+    cl_uint infoOffset = (cl_uint)(channelIndex * codeBlocks.size());
+    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem),channel);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &codeBlocksBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.blockInfo);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(infoOffset), &infoOffset);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.entries);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.counts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.bucketCounts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(channelIndex), &channelIndex);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    return memoryManager->setBufferImageArgs(targetKernel, numKernelArgs);
+}
+
+template<typename T> tDeviceRC OCLBPC<T>::setBucketArgs(cl_uint channelIndex, OCLBPCOutputSet& outputSet) {
+    int numKernelArgs = 0;
+    cl_kernel targetKernel = bpc->bucket->getKernel();
+    cl_uint infoOffset = (cl_uint)(channelIndex * codeBlocks.size());
+    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.entries);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.counts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &outputSet.workList.bucketCounts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &bucketCursorsBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &bucketedEntries);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(infoOffset), &infoOffset);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(channelIndex), &channelIndex);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    return DeviceSuccess;
+}
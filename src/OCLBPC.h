@@ -13,23 +13,257 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+
 #pragma once
 
 #include "OCLKernel.h"
 #include "OCLMemoryManager.h"
+#include <vector>
+#include <map>
+#include <string.h>
+
+// code block of a subband, in DWT output coordinates; must match code_block_t in oclbpc.cl
+struct OCLCodeBlock {
+    cl_int x;
+    cl_int y;
+    cl_int width;
+    cl_int height;
+    cl_int orientation;     // 0 = LL, 1 = HL, 2 = LH, 3 = HH
+    cl_int level;           // decomposition level of the subband, from 1; number of levels for LL
+};
 
+// BPC output of one code block; must match blockInfo in oclbpc.cl
+struct OCLCodeBlockInfo {
+    cl_uint offset;         // into OCLBPCOutput::cxd
+    cl_uint count;          // number of bytes: (CX,D) pairs and pass terminators
+    cl_uint numBitPlanes;
+    cl_uint numPasses;
+};
 
+// must match oclbpc.cl
+const size_t BPC_MAX_BIT_PLANES = 16;
+const size_t BPC_MAX_PASSES = 3 * BPC_MAX_BIT_PLANES - 2;
+// per code block: number of bit planes, number of passes, (offset, count) of each pass,
+// then the distortion reduction of each pass, as cl_float bits
+const size_t BPC_BLOCK_INFO_SIZE = 2 + 3 * BPC_MAX_PASSES;
+const size_t BPC_BLOCK_INFO_DISTORTION = 2 + 2 * BPC_MAX_PASSES;
+
+// float stored by a kernel in a cl_uint buffer
+inline cl_float asFloat(cl_uint bits) {
+    cl_float val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+// terminates every coding pass in the (CX,D) stream of a code block
+const cl_uchar CXD_PASS_END = 0xFF;
+
+/*
+(CX,D) pairs of all code blocks of a frame.
+Each pair is one byte, (CX << 1) | D; contexts are numbered as in oclbpc.cl
+*/
+struct OCLBPCOutput {
+    OCLBPCOutput() : numChannels(0) {}
+    std::vector<OCLCodeBlock> codeBlocks;   // code blocks of one channel; the same for all channels
+    size_t numChannels;
+    std::vector<OCLCodeBlockInfo> info;     // channel * codeBlocks.size() + code block
+    std::vector<cl_uchar> cxd;
+};
+
+/*
+BPC output of one frame, mapped into host memory.
+Passes are stored where the device allocated them: blockInfo holds BPC_BLOCK_INFO_SIZE
+entries per code block, with offsets into cxd.
+*/
+struct OCLBPCMappedOutput {
+    OCLBPCMappedOutput() : codeBlocks(NULL), numCodeBlocks(0), numChannels(0), blockInfo(NULL), cxd(NULL), set(0) {}
+    const OCLCodeBlock* codeBlocks;         // code blocks of one channel
+    size_t numCodeBlocks;
+    size_t numChannels;
+    const cl_uint* blockInfo;               // channel * numCodeBlocks + code block
+    const cl_uchar* cxd;
+    size_t set;                             // output set that is mapped
+};
+
+/*
+Code blocks with at least one non-zero sample, as found by the prepass of a run.
+Blocks that are not listed have no bit planes and no passes.
+*/
+struct OCLBPCWorkList {
+    OCLBPCWorkList() : entries(0), counts(0), bucketCounts(0), countsRead(0), countsKnown(false), blocksPerChannel(0), numChannels(0) {}
+    // one cl_uint2 per block: (channel * blocksPerChannel + code block, number of bit planes);
+    // the list of channel i starts at entry i * blocksPerChannel
+    cl_mem entries;
+    cl_mem counts;                          // length of the list of each channel
+    cl_mem bucketCounts;                    // per channel, listed blocks with 1 to BPC_MAX_BIT_PLANES bit planes
+    // counts and bucketCounts are read back once per run without blocking; the host
+    // may only look at them once countsRead has completed, which countsKnown records
+    std::vector<cl_uint> hostCounts;
+    std::vector<cl_uint> hostBucketCounts;
+    cl_event countsRead;
+    bool countsKnown;
+    std::vector<cl_uint> launched;          // BPC work groups enqueued for each channel
+    size_t blocksPerChannel;
+    size_t numChannels;
+};
+
+// device buffers that receive the output of one frame, with the work list it was coded from,
+// so that a frame can still be completed after the next one has been enqueued
+struct OCLBPCOutputSet {
+    OCLBPCOutputSet() : blockInfo(0), cxd(0), cxdHead(0), cxdCapacity(0), mappedInfo(NULL), mappedCxd(NULL),
+        hostHead(0), mapEvent(0) {}
+    cl_mem blockInfo;
+    cl_mem cxd;
+    cl_mem cxdHead;
+    size_t cxdCapacity;
+    void* mappedInfo;
+    void* mappedCxd;
+    cl_uint hostHead;       // cxdHead, read back with an enqueued map
+    cl_event mapEvent;      // completes when an enqueued map may be read
+    OCLBPCWorkList workList;
+};
+
+/*
+Order of the work list.
+LIST: blocks in the order the prepass found them.
+BUCKETS: blocks grouped by number of bit planes, most first, so that neighbouring work groups
+do similar work and the most expensive blocks do not start last.
+*/
+enum eBPCSchedule {
+    BPC_SCHEDULE_LIST,
+    BPC_SCHEDULE_BUCKETS
+};
+
+// BPC kernels specialized for one code block size
+struct OCLBPCKernel {
+    OCLBPCKernel() : kernel(NULL), prepass(NULL), bucket(NULL), workGroupSize(0) {}
+    OCLKernel* kernel;
+    OCLKernel* prepass;     // finds the bit planes of each block, and builds the work list
+    OCLKernel* bucket;      // groups the work list by number of bit planes
+    size_t workGroupSize;   // work items per code block
+};
+
+// code block width and height used unless the encoder is configured otherwise
+const size_t DEFAULT_CODEBLOCK_SIZE = 32;
+
+// frames whose output may be alive at once: one being coded on the device, one being read on the host
+const size_t BPC_NUM_OUTPUT_SETS = 2;
 
 template<typename T> class OCLBPC
 {
 public:
     OCLBPC(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr);
     ~OCLBPC(void);
+    // Output sets alternate between runs; the set written by this run must not be mapped.
+    // A prepass lists the non-zero blocks. Enqueueing never waits for the device: the BPC launch
+    // is sized by the list lengths of the last completed run, work groups past the length of
+    // the list exit at once, and complete() enqueues the rest of a longer list.
+    // Kernels are built for each code block size on first use
     void run(size_t codeblockX, size_t codeblockY);
+    // blocking read of the output of the last run
+    tDeviceRC readOutput(OCLBPCOutput& output);
+    // blocking map of the output of the last run, which stays valid until unmapOutput,
+    // while the next run writes to the other output set.
+    // Geometry must not change while an output is mapped
+    tDeviceRC mapOutput(OCLBPCMappedOutput& output);
+    // mapOutput in two halves: enqueue the map of the last run, which only waits for its prepass,
+    // and wait until it may be read. The map completes ahead of work enqueued in between.
+    // waitForOutput codes the set again if its passes did not fit, so it must be called
+    // before the DWT output of the run is overwritten
+    tDeviceRC enqueueMapOutput(OCLBPCMappedOutput& output);
+    tDeviceRC waitForOutput(OCLBPCMappedOutput& output);
+    tDeviceRC unmapOutput(const OCLBPCMappedOutput& output);
+    // Blocking: wait for the last run, code the blocks its launch did not cover, and code it
+    // again with a larger buffer if its passes did not fit. rerun is set if either happened,
+    // so that work enqueued on the output since the run must be enqueued again
+    tDeviceRC complete(bool& rerun);
+
+    // takes effect from the next run
+    void setSchedule(eBPCSchedule mode) {
+        schedule = mode;
+    }
+    eBPCSchedule getSchedule() {
+        return schedule;
+    }
+
+    // output set written by the last run
+    const OCLBPCOutputSet& getOutputSet() {
+        return outputSets[currentSet];
+    }
+    // work list of the last run
+    const OCLBPCWorkList& getWorkList() {
+        return outputSets[currentSet].workList;
+    }
+    const std::vector<OCLCodeBlock>& getCodeBlockTable() {
+        return codeBlocks;
+    }
+    size_t getNumChannels() {
+        return numChannels;
+    }
+
+    // code blocks of all subbands of a w x h image with the given number of decomposition levels,
+    // in resolution order: final LL, then HL, LH and HH of each level from the coarsest;
+    // each subband is partitioned in raster order
+    static std::vector<OCLCodeBlock> getCodeBlocks(size_t w, size_t h, size_t levels, size_t codeblockX, size_t codeblockY);
+    // powers of two from 4 to 1024, with at most 4096 samples (ITU-T Rec. T.800, A.6.1)
+    static bool isLegalCodeBlockSize(size_t codeblockX, size_t codeblockY);
+    // local memory used by the kernel for one code block; must match LOCAL_MEMORY_USED in oclbpc.cl
+    static size_t localMemorySize(size_t codeblockX, size_t codeblockY);
+    // Estimated fraction of work group slots that are busy while a launch runs, if its blocks
+    // are dispatched in order to the first free of numSlots slots, and each costs costs[i]
+    static double estimateOccupancy(const std::vector<cl_uint>& costs, size_t numSlots);
 private:
-    tDeviceRC setKernelArgs(cl_mem* channel);
+    // kernel for the code block size, or NULL if it cannot run on this device
+    OCLBPCKernel* getKernel(size_t codeblockX, size_t codeblockY);
+    static void addSubband(std::vector<OCLCodeBlock>& blocks, size_t x, size_t y, size_t w, size_t h,
+                           int orientation, size_t level, size_t codeblockX, size_t codeblockY);
+    tDeviceRC complete(bool& rerun, cl_uint& head, size_t set);
+    // map blockInfo and the first cxdSize bytes of (CX,D) pairs of outputSet; without blocking,
+    // mapEvent completes when both may be read
+    tDeviceRC mapSet(OCLBPCOutputSet& outputSet, size_t cxdSize, cl_bool blocking);
+    tDeviceRC allocate(size_t codeblockX, size_t codeblockY);
+    tDeviceRC createBuffer(cl_mem* buffer, cl_mem_flags flags, size_t size, void* hostPtr);
+    void releaseBuffers();
+    tDeviceRC findBitPlanes(OCLBPCOutputSet& outputSet);
+    tDeviceRC bucketWorkList(OCLBPCOutputSet& outputSet);
+    // records the estimated occupancy of each BPC launch of the run with the profiler
+    tDeviceRC recordOccupancy(OCLBPCOutputSet& outputSet);
+    tDeviceRC enqueue(OCLBPCOutputSet& outputSet);
+    // enqueue the BPC for entries first[i] to first[i] + count[i] of the work list of each channel i
+    tDeviceRC enqueueEntries(OCLBPCOutputSet& outputSet, const std::vector<cl_uint>& first, const std::vector<cl_uint>& count);
+    // wait for the list lengths of the last run, and code the entries its launch did not cover
+    tDeviceRC completeWorkList(OCLBPCOutputSet& outputSet, bool& rerun);
+    tDeviceRC setPrepassArgs(cl_mem* channel, cl_uint channelIndex, OCLBPCOutputSet& outputSet);
+    tDeviceRC setBucketArgs(cl_uint channelIndex, OCLBPCOutputSet& outputSet);
+    tDeviceRC setKernelArgs(cl_mem* channel, cl_uint channelIndex, cl_uint firstEntry, OCLBPCOutputSet& outputSet);
+    cl_mem* getChannel(size_t i);
     KernelInitInfoBase initInfo;
     OCLMemoryManager<T>* memoryManager;
-    OCLKernel* bpc;
+    std::map<std::pair<size_t, size_t>, OCLBPCKernel> kernels;
+    OCLBPCKernel* bpc;      // kernel of the current code block size
+    cl_context context;
+    cl_ulong deviceLocalMemorySize;
+    size_t deviceMaxWorkGroupSize;
+    cl_uint deviceComputeUnits;
+    eBPCSchedule schedule;
+
+    // geometry of the current code block table
+    size_t width;
+    size_t height;
+    size_t levels;
+    size_t blockX;
+    size_t blockY;
+    size_t numChannels;
+    std::vector<OCLCodeBlock> codeBlocks;
+
+    cl_mem codeBlocksBuffer;
+    OCLBPCOutputSet outputSets[BPC_NUM_OUTPUT_SETS];
+    cl_mem bucketedEntries;     // receives the bucketed work list, then swaps with the entries of the set
+    cl_mem bucketCursorsBuffer;
+    size_t currentSet;      // set written by the last run
+    cl_uint zero;
+    std::vector<cl_uint> zeroCounts;        // numChannels * (1 + BPC_MAX_BIT_PLANES)
+    // list lengths of the last run whose counts were read back, which size the next launch
+    std::vector<cl_uint> expectedCounts;
 };
 
@@ -19,13 +19,17 @@
 #include <exception>
 #include <vector>
 #include <cerrno>
+#include <cstdio>
 
 #ifdef __linux__
 #include <sys/time.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #elif defined(_WIN32) || defined(WIN32)
 #include <windows.h>
+#include <direct.h>
 #else
 #include <ctime>
 #endif
@@ -113,7 +117,9 @@ double  my_clock(void) {
     return ( t.QuadPart /(double) freq.QuadPart ) ;
 #endif
 #ifdef __linux__
-    return (double)(t.tv_sec + t.tv_usec/1e6);
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)(t.tv_sec + t.tv_nsec/1e9);
 #endif
 }
 
@@ -176,6 +182,32 @@ bool is_number (const std::string& x)
 }
 
 
+std::string jsonEscape (const std::string& x)
+{
+    std::string escaped;
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        unsigned char c = (unsigned char)x[i];
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += (char)c;
+        }
+        else if (c < 0x20)
+        {
+            char code[8];
+            sprintf(code, "\\u%04x", (unsigned int)c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += (char)c;
+        }
+    }
+    return escaped;
+}
+
+
 double time_stamp ()
 {
 #ifdef __linux__
@@ -296,6 +328,33 @@ size_t kernelMaxWorkGroupSize (cl_kernel kernel, cl_device_id device)
 }
 
 
+bool devicePrefersBuffers (cl_device_id device)
+{
+    cl_bool imageSupport = CL_FALSE;
+    cl_int err = clGetDeviceInfo(
+                     device,
+                     CL_DEVICE_IMAGE_SUPPORT,
+                     sizeof(imageSupport),
+                     &imageSupport,
+                     0
+                 );
+    SAMPLE_CHECK_ERRORS(err);
+    if (!imageSupport)
+        return true;
+
+    cl_device_type type = 0;
+    err = clGetDeviceInfo(
+              device,
+              CL_DEVICE_TYPE,
+              sizeof(type),
+              &type,
+              0
+          );
+    SAMPLE_CHECK_ERRORS(err);
+    return (type & CL_DEVICE_TYPE_CPU) != 0;
+}
+
+
 double eventExecutionTime (cl_event event)
 {
     cl_ulong end = 0, start = 0;
@@ -336,10 +395,10 @@ std::string exe_dir ()
                 );
             }
 
-            if(len < path.size())
+            if(static_cast<size_t>(len) < path.size())
             {
-                // We got the path.
-                path.resize(len);
+                // We got the path; readlink does not terminate it.
+                path[static_cast<size_t>(len)] = '\0';
                 break;
             }
 
@@ -462,3 +521,35 @@ std::string exe_dir ()
     }
 #endif
 }
+
+
+std::string exe_subdir (const std::string& name)
+{
+    std::string dir;
+    try {
+        dir = exe_dir();
+    } catch (...) {
+        dir = "";
+    }
+    dir += name;
+#if defined(_WIN32) || defined(WIN32)
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0755);
+#endif
+    return dir + "/";
+}
+
+
+std::string deviceInfoString (cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    cl_int error_code = clGetDeviceInfo(device, param, 0, NULL, &size);
+    if (CL_SUCCESS != error_code || size == 0)
+        return "";
+    std::vector<char> value(size);
+    error_code = clGetDeviceInfo(device, param, size, &value[0], NULL);
+    if (CL_SUCCESS != error_code)
+        return "";
+    return std::string(&value[0]);
+}
@@ -123,6 +123,9 @@ std::string to_str (const T x, std::streamsize width = 0, char fill = ' ')
 // Detect if x is std::string representation of int value.
 bool is_number (const std::string& x);
 
+// Escape x for use inside a JSON string literal: quotes, backslashes and control characters
+std::string jsonEscape (const std::string& x);
+
 
 // Return one random number uniformally distributed in
 // range [0,1] by std::rand.
@@ -174,10 +177,22 @@ void deviceMaxWorkItemSizes (cl_device_id device, size_t* sizes);
 // a kernel on a specific device
 size_t kernelMaxWorkGroupSize (cl_kernel kernel, cl_device_id device);
 
+// True if the device has no image support, or is a CPU device,
+// where image sampling is emulated in software and plain buffers are faster
+bool devicePrefersBuffers (cl_device_id device);
+
 
 // Returns directory path of current executable.
 std::string exe_dir ();
 
+// Returns path (with a trailing separator) of directory name next to the executable,
+// creating the directory if it does not exist. Falls back to the working directory.
+std::string exe_subdir (const std::string& name);
+
+// Returns a string valued device parameter (CL_DEVICE_NAME, CL_DRIVER_VERSION, ...),
+// or an empty string on failure
+std::string deviceInfoString (cl_device_id device, cl_device_info param);
+
 
 double eventExecutionTime (cl_event event);
 
@@ -0,0 +1,200 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include "OCLBench.h"
+#include "OCLEncoder.cpp"
+#include "OCLDecoder.cpp"
+#include "OCLBasic.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+template<typename T> OCLBench<T>::OCLBench(ocl_args_d_t* ocl, bool isLossy, eDWTBackend backend, eTier1Backend tier1Backend) :
+    ocl(ocl),
+    encoder(new OCLEncoder<T>(ocl, isLossy, false, backend, DEFAULT_UPLOAD_RING_DEPTH, NULL, tier1Backend)),
+    decoder(ocl ? new OCLDecoder<T>(ocl, isLossy) : NULL),
+    discardLevels(0),
+    windowWidth(0),
+    windowHeight(0),
+    windowX(0),
+    windowY(0),
+    lossy(isLossy)
+{
+}
+
+template<typename T> OCLBench<T>::~OCLBench(void)
+{
+    if (encoder)
+        delete encoder;
+    if (decoder)
+        delete decoder;
+}
+
+// value at the given percentile (nearest rank) of sorted samples
+static double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t)ceil(pct / 100.0 * sorted.size());
+    if (rank < 1)
+        rank = 1;
+    if (rank > sorted.size())
+        rank = sorted.size();
+    return sorted[rank - 1];
+}
+
+template<typename T> bool OCLBench<T>::run(std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+        size_t warmup, size_t iterations, OCLBenchResult& result) {
+    return measure(false, imageName, components, w, h, levels, precision, warmup, iterations, result);
+}
+
+template<typename T> bool OCLBench<T>::runDecode(std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+        size_t warmup, size_t iterations, OCLBenchResult& result) {
+    if (!decoder || components.empty())
+        return false;
+
+    // code stream to decode, encoded once
+    encoder->run(components, w, h, levels, precision);
+    encoder->finish();
+    const HostOutputArena& stream = encoder->getCodestream();
+    if (!stream.size())
+        return false;
+    codestream.assign(stream.data(), stream.data() + stream.size());
+    size_t reducedW = w, reducedH = h;
+    for (size_t i = 0; i < discardLevels; ++i) {
+        reducedW = divRndUp(reducedW, 2);
+        reducedH = divRndUp(reducedH, 2);
+    }
+    windowX = (windowWidth && windowWidth < reducedW) ? (reducedW - windowWidth) / 2 : 0;
+    windowY = (windowHeight && windowHeight < reducedH) ? (reducedH - windowHeight) / 2 : 0;
+    if (!decodeFrame())
+        return false;
+    decoder->finish();
+
+    return measure(true, imageName, components, w, h, levels, precision, warmup, iterations, result);
+}
+
+template<typename T> bool OCLBench<T>::verify(std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+        OCLVerifyResult& result) {
+    if (components.empty() || !w || !h || !levels)
+        return false;
+    // without quantization, so that differences of the 9/7 coefficients are not rounded away
+    std::vector<float> quant;
+    HostDWTForward<T> reference(lossy, true);
+    HostDWTForward<T> host(lossy);
+    reference.run(components, w, h, levels, quant);
+    host.run(components, w, h, levels, quant);
+    size_t refPitch = reference.getRowPitch();
+    result.hostExact = memcmp(reference.getOutput(), host.getOutput(), refPitch * h) == 0;
+    result.deviceChecked = false;
+    result.deviceMaxDiff = 0;
+    result.deviceMismatches = 0;
+    if (!ocl)
+        return true;
+
+    OCLEncoder<T> device(ocl, lossy, true, DEVICE_DWT);
+    device.run(components, w, h, levels, precision);
+    device.finish();
+    void* ptr = NULL;
+    size_t pitch = 0;
+    if (device.mapDWTOut(&ptr, &pitch) != DeviceSuccess)
+        return false;
+    size_t rowSamples = w * components.size();
+    for (size_t y = 0; y < h; ++y) {
+        const unsigned char* refRow = (const unsigned char*)reference.getOutput() + y * refPitch;
+        const unsigned char* deviceRow = (const unsigned char*)ptr + y * pitch;
+        for (size_t i = 0; i < rowSamples; ++i) {
+            double expected = reference.isFloatOutput() ? ((const float*)refRow)[i] : ((const short*)refRow)[i];
+            double actual = reference.isFloatOutput() ? ((const float*)deviceRow)[i] : ((const short*)deviceRow)[i];
+            double diff = fabs(actual - expected);
+            if (diff > 0)
+                result.deviceMismatches++;
+            result.deviceMaxDiff = std::max(result.deviceMaxDiff, diff);
+        }
+    }
+    device.unmapDWTOut(ptr);
+    result.deviceChecked = true;
+    return true;
+}
+
+template<typename T> bool OCLBench<T>::decodeFrame() {
+    return decoder->decodeWindow(&codestream[0], codestream.size(), windowX, windowY,
+                                 windowWidth ? windowWidth : (size_t)-1, windowHeight ? windowHeight : (size_t)-1, discardLevels);
+}
+
+template<typename T> void OCLBench<T>::runOnce(bool decode, std::vector<T*>& components, size_t w, size_t h, size_t levels, size_t precision) {
+    if (decode) {
+        decodeFrame();
+        decoder->finish();
+    } else {
+        encoder->run(components, w, h, levels, precision);
+        encoder->finish();
+    }
+}
+
+template<typename T> bool OCLBench<T>::measure(bool decode, std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+        size_t warmup, size_t iterations, OCLBenchResult& result) {
+    if (components.empty() || iterations == 0)
+        return false;
+    OCLEncodeDecode<T>* coder = decode ? (OCLEncodeDecode<T>*)decoder : (OCLEncodeDecode<T>*)encoder;
+
+    coder->setStageTiming(false);
+    for (size_t i = 0; i < warmup; ++i)
+        runOnce(decode, components, w, h, levels, precision);
+
+    std::vector<double> latencies;
+    for (size_t i = 0; i < iterations; ++i) {
+        double t = my_clock();
+        runOnce(decode, components, w, h, levels, precision);
+        latencies.push_back(my_clock() - t);
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    // per-stage times
+    coder->setStageTiming(true);
+    std::vector< std::vector<double> > stageSamples;
+    std::vector<std::string> stageNames;
+    for (size_t i = 0; i < iterations; ++i) {
+        runOnce(decode, components, w, h, levels, precision);
+        std::vector<OCLStageTime> times = coder->getStageTimes();
+        if (stageNames.empty()) {
+            for (size_t j = 0; j < times.size(); ++j)
+                stageNames.push_back(times[j].name);
+            stageSamples.resize(times.size());
+        }
+        for (size_t j = 0; j < times.size() && j < stageSamples.size(); ++j)
+            stageSamples[j].push_back(times[j].seconds);
+    }
+    coder->setStageTiming(false);
+
+    result.image = imageName;
+    result.width = w;
+    result.height = h;
+    result.lossy = lossy;
+    result.decode = decode;
+    result.levels = levels;
+    result.numComponents = components.size();
+    result.iterations = iterations;
+    result.medianMs = percentile(latencies, 50) * 1000;
+    result.p99Ms = percentile(latencies, 99) * 1000;
+    result.mpixelPerSec = result.medianMs > 0 ? (w * h) / (result.medianMs * 1000) : 0;
+    result.stages.clear();
+    for (size_t j = 0; j < stageSamples.size(); ++j) {
+        std::sort(stageSamples[j].begin(), stageSamples[j].end());
+        result.stages.push_back(OCLStageTime(stageNames[j], percentile(stageSamples[j], 50)));
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "OCLUtil.h"
+#include "OCLEncoder.h"
+#include "OCLDecoder.h"
+
+struct OCLBenchResult {
+    OCLBenchResult() : width(0), height(0), lossy(false), decode(false), levels(0), numComponents(0),
+        iterations(0), medianMs(0), p99Ms(0), mpixelPerSec(0)
+    {}
+    std::string image;
+    size_t width;
+    size_t height;
+    bool lossy;
+    bool decode;        // decode of the encoder's code stream, rather than encode
+    size_t levels;
+    size_t numComponents;
+    size_t iterations;
+    double medianMs;
+    double p99Ms;
+    double mpixelPerSec;
+    std::vector<OCLStageTime> stages;   // median time of each stage
+};
+
+// comparison of the DWT backends with the scalar host reference, on unquantized coefficients
+struct OCLVerifyResult {
+    OCLVerifyResult() : hostExact(false), deviceChecked(false), deviceMaxDiff(0), deviceMismatches(0)
+    {}
+    bool hostExact;             // vectorized host DWT is bit-identical to the reference
+    bool deviceChecked;         // false without a device
+    double deviceMaxDiff;       // largest difference of a device coefficient from the reference
+    size_t deviceMismatches;    // device coefficients that differ from the reference
+};
+
+/*
+Headless encoder and decoder benchmark.
+
+Latency of each frame is measured from run() to finish(); warm-up frames are excluded.
+Per-stage times are measured in separate runs with stage timing enabled,
+since stage timing serializes the pipeline.
+*/
+template< typename T > class OCLBench
+{
+public:
+    OCLBench(ocl_args_d_t* ocl, bool lossy, eDWTBackend backend, eTier1Backend tier1Backend = HOST_TIER1);
+    ~OCLBench(void);
+    bool setCodeBlockSize(size_t codeblockX, size_t codeblockY) {
+        return encoder->setCodeBlockSize(codeblockX, codeblockY);
+    }
+    void setBPCSchedule(eBPCSchedule schedule) {
+        encoder->setBPCSchedule(schedule);
+    }
+    void setRateControl(size_t targetBytes, double targetPSNR) {
+        encoder->setRateControl(targetBytes, targetPSNR);
+    }
+    void setLayers(size_t numLayers, const std::vector<size_t>& layerBytes) {
+        encoder->setLayers(numLayers, layerBytes);
+    }
+    void setProgression(unsigned int progression, const std::vector<size_t>& precinctWidth, const std::vector<size_t>& precinctHeight) {
+        encoder->setProgression(progression, precinctWidth, precinctHeight);
+    }
+    // decode at reduced resolution, discarding the finest levels (see OCLDecoder::decode)
+    void setDiscardLevels(size_t levels) {
+        discardLevels = levels;
+    }
+    // decode only a window of this size at the centre of the image, as a viewer would (see OCLDecoder::decodeWindow);
+    // zero for the whole image
+    void setDecodeWindow(size_t width, size_t height) {
+        windowWidth = width;
+        windowHeight = height;
+    }
+    // code stream of the last encoded frame
+    const HostOutputArena& getCodestream() {
+        return encoder->getCodestream();
+    }
+
+    bool run(std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+             size_t warmup, size_t iterations, OCLBenchResult& result);
+    // decode the encoder's code stream of the components: tier-2, tier-1 and inverse DWT; requires a device
+    bool runDecode(std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+                   size_t warmup, size_t iterations, OCLBenchResult& result);
+    // forward DWT of the components with the vectorized host backend and, given a device, the device kernels,
+    // compared with the scalar host reference
+    bool verify(std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision, OCLVerifyResult& result);
+private:
+    // decode codestream with the window and discarded levels that are set
+    bool decodeFrame();
+    void runOnce(bool decode, std::vector<T*>& components, size_t w, size_t h, size_t levels, size_t precision);
+    bool measure(bool decode, std::string imageName, std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision,
+                 size_t warmup, size_t iterations, OCLBenchResult& result);
+    ocl_args_d_t* ocl;
+    OCLEncoder<T>* encoder;
+    OCLDecoder<T>* decoder;     // NULL when there is no device
+    std::vector<unsigned char> codestream;  // to decode
+    size_t discardLevels;
+    size_t windowWidth;
+    size_t windowHeight;
+    size_t windowX;         // of the centred window, at the reduced resolution
+    size_t windowY;
+    bool lossy;
+};
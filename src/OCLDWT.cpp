@@ -18,11 +18,7 @@
 #include "OCLDWT.h"
 #include "OCLMemoryManager.h"
 #include <stdint.h>
-
-
-inline size_t divRndUp(const size_t n, const size_t d) {
-    return n/d + !!(n % d);
-}
+#include <math.h>
 
 
 template<typename T> OCLDWT<T>::OCLDWT(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr) :
@@ -38,25 +34,34 @@ template<typename T> OCLDWT<T>::~OCLDWT(void)
 }
 
 
+// forward transform: reads level from dwtIn, writes LL to the next level (or dwtOut for the final level)
+// and the high pass bands to dwtOut
 template<typename T> tDeviceRC OCLDWT<T>::setKernelArgs(OCLKernel* myKernel,unsigned int width, unsigned int height,unsigned int steps, unsigned int level, unsigned int levels) {
+    return setKernelArgs(myKernel, memoryManager->getDwtIn(level),
+                         (level < levels-1) ? memoryManager->getDwtIn(level+1) :  memoryManager->getDWTOut(),
+                         memoryManager->getDWTOut(),
+                         width, height, steps, level, levels);
+}
+
+template<typename T> tDeviceRC OCLDWT<T>::setKernelArgs(OCLKernel* myKernel, cl_mem* idata, cl_mem* idata2, cl_mem* odata,
+        unsigned int width, unsigned int height,unsigned int steps, unsigned int level, unsigned int levels) {
     numKernelArgs = 0;
     cl_kernel targetKernel = myKernel->getKernel();
-    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem),  memoryManager->getDwtIn(level));
+    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem),  idata);
     if (DeviceSuccess != error_code)
     {
         LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
         return error_code;
     }
 
-    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), (level < levels-1) ?
-                                memoryManager->getDwtIn(level+1) :  memoryManager->getDWTOut() );
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), idata2);
     if (DeviceSuccess != error_code)
     {
         LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
         return error_code;
     }
 
-    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), memoryManager->getDWTOut());
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), odata);
     if (DeviceSuccess != error_code)
     {
         LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
@@ -126,3 +131,44 @@ template<typename T> tDeviceRC OCLDWT<T>::setKernelArgsQuant(OCLKernel* myKernel
 
     return DeviceSuccess;
 }
+
+
+template<typename T> tDeviceRC OCLDWT<T>::setKernelArgsDequant(OCLKernel* myKernel, float stepLL, float stepHL, float stepLH, float stepHH) {
+
+    cl_kernel targetKernel = myKernel->getKernel();
+    float steps[4] = {stepLL, stepHL, stepLH, stepHH};
+    for (int i = 0; i < 4; ++i) {
+        cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(steps[i]), steps + i);
+        if (DeviceSuccess != error_code)
+        {
+            LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+            return error_code;
+        }
+    }
+
+    return DeviceSuccess;
+}
+
+template<typename T> tDeviceRC OCLDWT<T>::setKernelArgsOrigin(OCLKernel* myKernel, unsigned int originX, unsigned int originY) {
+
+    cl_kernel targetKernel = myKernel->getKernel();
+    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(originX), &originX);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(originY), &originY);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+
+    return DeviceSuccess;
+}
+
+
+template<typename T> float OCLDWT<T>::getStep(size_t level, size_t orient, size_t prec) {
+    return J2KQuantization::step(J2KQuantization::irreversibleStep(level, orient, prec), orient, prec);
+}
@@ -18,6 +18,7 @@
 #include "OCLKernel.h"
 #include <vector>
 #include "OCLMemoryManager.h"
+#include "J2KQuantization.h"
 
 
 
@@ -26,12 +27,20 @@ template<typename T> class OCLDWT
 public:
     OCLDWT(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr);
     ~OCLDWT(void);
+    // quantization step size of a band: orient is 0 for LL, 1 for HL, 2 for LH and 3 for HH;
+    // the step signalled in QCD, from J2KQuantization
+    static float getStep(size_t level, size_t orient, size_t prec);
 protected:
     tDeviceRC setKernelArgs(OCLKernel* myKernel, unsigned int width, unsigned int height, unsigned int steps,unsigned int level, unsigned int levels);
+    tDeviceRC setKernelArgs(OCLKernel* myKernel, cl_mem* idata, cl_mem* idata2, cl_mem* odata,
+                            unsigned int width, unsigned int height, unsigned int steps,unsigned int level, unsigned int levels);
     tDeviceRC setKernelArgsQuant(OCLKernel* myKernel, float quantLL, float quantLH, float quantHH);
+    // dequantization steps of the inverse kernels, which may differ between HL and LH
+    tDeviceRC setKernelArgsDequant(OCLKernel* myKernel, float stepLL, float stepHL, float stepLH, float stepHH);
+    // origin of the region that the inverse kernels reconstruct
+    tDeviceRC setKernelArgsOrigin(OCLKernel* myKernel, unsigned int originX, unsigned int originY);
     KernelInitInfoBase initInfo;
     OCLMemoryManager<T>* memoryManager;
     int numKernelArgs;
-
 };
 
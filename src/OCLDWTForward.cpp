@@ -18,23 +18,21 @@
 #include "OCLDWTForward.h"
 #include "OCLMemoryManager.h"
 #include <stdint.h>
+#include "OCLBasic.h"
 #include "OCLDWT.cpp"
 
 
-//Quantization:
-static float norms[4][6] = {
-    {1.000f, 1.965f, 4.177f, 8.403f, 16.90f, 33.84f},
-    {2.022f, 3.989f, 8.355f, 17.04f, 34.27f, 68.63f},
-    {2.022f, 3.989f, 8.355f, 17.04f, 34.27f, 68.63f},
-    {2.080f, 3.865f, 8.307f, 17.18f, 34.71f, 69.59f}
-};
-
-
 template<typename T> OCLDWTForward<T>::OCLDWTForward(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr) : OCLDWT<T>(initInfo, memMgr),
     forward53(new OCLKernel( KernelInitInfo(initInfo, "ocldwt53.cl", "run") )),
-    forward97(new OCLKernel( KernelInitInfo(initInfo, "ocldwt97.cl", memMgr->isOnlyDwtOut() ? "run" : "runWithQuantization") ))
-
-
+    forward97(new OCLKernel( KernelInitInfo(initInfo, "ocldwt97.cl", memMgr->isOnlyDwtOut() ? "run" : "runWithQuantization") )),
+    tailSize(calcTailSize(initInfo.cmd_queue)),
+    fusedTail(tailSize > 0),
+    tail53(tailSize ? new OCLKernel( KernelInitInfo(tailInitInfo(initInfo, tailSize), "ocldwttail.cl", "run53") ) : NULL),
+    tail97(tailSize ? new OCLKernel( KernelInitInfo(tailInitInfo(initInfo, tailSize), "ocldwttail.cl",
+                                     memMgr->isOnlyDwtOut() ? "run97" : "run97WithQuantization") ) : NULL),
+    tailQuant(0),
+    tailQuantLevels(0),
+    tailQuantPrecision(0)
 {
 }
 
@@ -44,14 +42,59 @@ template<typename T> OCLDWTForward<T>::~OCLDWTForward(void)
         delete forward53;
     if (forward97)
         delete forward97;
+    if (tail53)
+        delete tail53;
+    if (tail97)
+        delete tail97;
+    if (tailQuant)
+        clReleaseMemObject(tailQuant);
+}
+
+// Largest tail tile size (a multiple of 8) such that a square tile of RGBA float pixels
+// fits in local memory, and one work item per row fits in a work group.
+// Returns 0 if the device can't run the tail kernels.
+template<typename T> size_t OCLDWTForward<T>::calcTailSize(cl_command_queue queue) {
+    const size_t maxTailSize = 64;
+    cl_device_id device = 0;
+    cl_int error_code = clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id), &device, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetCommandQueueInfo (CL_QUEUE_DEVICE) returned %s.", TranslateOpenCLError(error_code));
+        return 0;
+    }
+    cl_ulong localMemorySize = 0;
+    error_code = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMemorySize, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE) returned %s.", TranslateOpenCLError(error_code));
+        return 0;
+    }
+    size_t maxWorkGroupSize = 0;
+    error_code = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE) returned %s.", TranslateOpenCLError(error_code));
+        return 0;
+    }
+    size_t size = maxTailSize;
+    while (size >= 8 && (size * size * 4 * sizeof(cl_float) > localMemorySize || size > maxWorkGroupSize))
+        size -= 8;
+    return size >= 8 ? size : 0;
+}
+
+template<typename T> KernelInitInfoBase OCLDWTForward<T>::tailInitInfo(KernelInitInfoBase initInfo, size_t tailSize) {
+    KernelInitInfoBase info(initInfo);
+    info.buildOptions += " -D TAIL_SIZE=" + to_str(tailSize);
+    return info;
 }
 
 template<typename T> void OCLDWTForward<T>::doRun(bool lossy, size_t w, size_t h, size_t windowX, size_t windowY, size_t level, size_t levels) {
 
     OCLKernel* targetKernel = lossy?forward97:forward53;
+    targetKernel->setProfileName("dwt", std::string(lossy ? "dwt97" : "dwt53") + " level " + to_str(level));
     const size_t steps = divRndUp(w, 15 * windowX);
     //set basic dwt kernel arguments
-    if (setKernelArgs(targetKernel,static_cast<unsigned int>(w),
+    if (this->setKernelArgs(targetKernel,static_cast<unsigned int>(w),
                       static_cast<unsigned int>(h),
                       static_cast<unsigned int>(steps),
                       static_cast<unsigned int>(level),
@@ -59,70 +102,102 @@ template<typename T> void OCLDWTForward<T>::doRun(bool lossy, size_t w, size_t h
                      ) != DeviceSuccess)
         return;
     // set dwt + quantization kernel arguments
-    if (lossy && !memoryManager->isOnlyDwtOut() ) {
-        float quantLL =  1.0f/getStep(levels,level, 0, memoryManager->getPrecision());
-        float quantLH =  1.0f/getStep(levels,level, 1, memoryManager->getPrecision());
-        float quantHH =  1.0f/getStep(levels,level, 3, memoryManager->getPrecision());
-        if (setKernelArgsQuant(targetKernel, quantLL, quantLH, quantHH)
+    if (lossy && !this->memoryManager->isOnlyDwtOut() ) {
+        float quantLL =  1.0f/this->getStep(level, 0, this->memoryManager->getPrecision());
+        float quantLH =  1.0f/this->getStep(level, 1, this->memoryManager->getPrecision());
+        float quantHH =  1.0f/this->getStep(level, 3, this->memoryManager->getPrecision());
+        if (this->setKernelArgsQuant(targetKernel, quantLL, quantLH, quantHH)
                 != DeviceSuccess)
             return;
 
     }
+    if (this->memoryManager->setBufferImageArgs(targetKernel->getKernel(), this->numKernelArgs) != DeviceSuccess)
+        return;
+    // first level reads the frame straight from the upload ring:
+    // wait for its upload, and tell the ring when the slot may be overwritten again
+    cl_event uploadEvent = (level == 0) ? this->memoryManager->getUploadEvent() : 0;
+    cl_event releaseEvent = 0;
     size_t local_work_size[3] = {1,windowY,1};
-    if (lossy) {
-        size_t global_offset[3] = {0,-4,0};   //left boundary
-
-        //add one extra windowY to make up for group overlap due to boundary
-        size_t global_work_size[3] = {divRndUp(w, windowX * steps), (divRndUp(h, windowY) + 1)* windowY,1};
-        targetKernel->enqueue(2,global_offset, global_work_size, local_work_size);
-
-    } else {
-        size_t global_offset[3] = {0,-2,0};   //left boundary
-
-        //add one extra windowY to make up for group overlap due to boundary
-        size_t global_work_size[3] = {divRndUp(w, windowX * steps), (divRndUp(h, windowY) + 1)* windowY,1};
-        targetKernel->enqueue(2,global_offset, global_work_size, local_work_size);
+    // work groups overlap by two boundaries (4 rows for 9/7, 2 rows for 5/3 on each side),
+    // so each group only outputs windowY - 2*boundary rows
+    const size_t boundaryY = lossy ? 4 : 2;
+    size_t global_offset[3] = {0,0,0};
+    size_t global_work_size[3] = {divRndUp(w, windowX * steps), divRndUp(h, windowY - 2 * boundaryY)* windowY,1};
+    targetKernel->enqueue(2,global_offset, global_work_size, local_work_size,
+                          uploadEvent ? 1 : 0, uploadEvent ? &uploadEvent : NULL, level == 0 ? &releaseEvent : NULL);
+    if (releaseEvent) {
+        this->memoryManager->setInputReleaseEvent(releaseEvent);
+        clReleaseEvent(releaseEvent);
     }
 
 }
 
 
-//Each resolution has four bands LL LH HL HH
-//Orientation Code for bands     0  1  2  3
-//Gain for the bands:            0  1  1  2
-//Number of bits per sample      precision + gain
-//base_stepsize                  (1 << (gain)) / norm
-
+// compute levels [level, levels) with a single launch of the tail kernel
+template<typename T> void OCLDWTForward<T>::doRunTail(bool lossy, size_t w, size_t h, size_t level, size_t levels) {
 
-//Get logarithm of an integer and round downwards
-//@return Returns log2(a)
-template<typename T> int OCLDWTForward<T>::int_floorlog2(int a) {
-    int l;
-    for (l = 0; a > 1; l) {
-        a >>= 1;
+    OCLKernel* targetKernel = lossy?tail97:tail53;
+    targetKernel->setProfileName("dwt", std::string(lossy ? "dwt97" : "dwt53") + " tail levels " + to_str(level) + "-" + to_str(levels-1));
+    // tail kernels take the same arguments as the per level kernels, and ignore odataLL and steps
+    if (this->setKernelArgs(targetKernel,static_cast<unsigned int>(w),
+                      static_cast<unsigned int>(h),
+                      1,
+                      static_cast<unsigned int>(level),
+                      static_cast<unsigned int>(levels)
+                     ) != DeviceSuccess)
+        return;
+    if (lossy && !this->memoryManager->isOnlyDwtOut() ) {
+        if (setTailQuant(levels) != DeviceSuccess)
+            return;
+        cl_int error_code = clSetKernelArg(targetKernel->getKernel(), this->numKernelArgs++, sizeof(cl_mem), &tailQuant);
+        if (DeviceSuccess != error_code)
+        {
+            LogError("clSetKernelArg returned %s.", TranslateOpenCLError(error_code));
+            return;
+        }
     }
-    return l;
+    if (this->memoryManager->setBufferImageArgs(targetKernel->getKernel(), this->numKernelArgs) != DeviceSuccess)
+        return;
+    // single work group, one work item per tile row
+    size_t local_work_size[3] = {tailSize,1,1};
+    size_t global_work_size[3] = {tailSize,1,1};
+    targetKernel->enqueue(1, global_work_size, local_work_size);
 }
 
-template<typename T> float OCLDWTForward<T>::getStep(size_t numresolutions, size_t level, size_t orient, size_t prec) {
-
-    int gain = (orient == 0) ? 0 : (((orient == 1) || (orient == 2)) ? 1 : 2);
-    int numbps = prec + gain;
-    double norm = norms[orient][level];
-    int base_stepsize = floor( ((1 << (gain)) / norm) * 8192 );
-    int p = int_floorlog2(base_stepsize) - 13;
-    int n = 11 - int_floorlog2(base_stepsize);
-    double mant = (n < 0 ? base_stepsize >> -n : base_stepsize << n) & 0x7ff;
-    double expn = numbps - p;
-
-    expn=8.5f; //?
-    mant=8.0f; //?
-    return (1.0 + mant/2048.0f) * pow(2, numbps - expn);
-
+// (re)build quantization factors for the quantized tail kernel, when the number of levels or precision changes
+template<typename T> tDeviceRC OCLDWTForward<T>::setTailQuant(size_t levels) {
+    size_t precision = this->memoryManager->getPrecision();
+    if (tailQuant && tailQuantLevels == levels && tailQuantPrecision == precision)
+        return DeviceSuccess;
+    std::vector<float> quant;
+    for (size_t level = 0; level < levels; ++level) {
+        quant.push_back(1.0f/this->getStep(level, 0, precision));
+        quant.push_back(1.0f/this->getStep(level, 1, precision));
+        quant.push_back(1.0f/this->getStep(level, 3, precision));
+    }
+    if (tailQuant)
+        clReleaseMemObject(tailQuant);
+    cl_int error_code = DeviceSuccess;
+    tailQuant = clCreateBuffer(tail97->getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               quant.size() * sizeof(float), &quant[0], &error_code);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("clCreateBuffer returned %s.", TranslateOpenCLError(error_code));
+        tailQuant = 0;
+        return error_code;
+    }
+    tailQuantLevels = levels;
+    tailQuantPrecision = precision;
+    return DeviceSuccess;
 }
 
 template<typename T> void OCLDWTForward<T>::run(bool lossy, size_t w,	size_t h, size_t windowX, size_t windowY, size_t level, size_t levels) {
 
+    // level 0 reads straight from the upload ring, so the tail starts at level 1 at the earliest
+    if (level > 0 && fusedTail && w <= tailSize && h <= tailSize) {
+        doRunTail(lossy, w, h, level, levels);
+        return;
+    }
     doRun(lossy, w,h,windowX, windowY,level,levels);
     if(level < levels-1) {
         // copy output's LL band back into input buffer
@@ -29,12 +29,32 @@ public:
     ~OCLDWTForward(void);
 
     void run(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY, size_t level, size_t levels);
+
+    // once a level's LL band fits in a work group's local memory, compute all
+    // remaining levels with a single launch of the tail kernel (enabled by default)
+    void setFusedTail(bool fused) {
+        fusedTail = fused;
+    }
+    size_t getTailSize() {
+        return tailSize;
+    }
 private:
     void doRun(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY, size_t level, size_t levels);
+    void doRunTail(bool lossy, size_t w,	size_t h, size_t level, size_t levels);
+    tDeviceRC setTailQuant(size_t levels);
+    static size_t calcTailSize(cl_command_queue queue);
+    static KernelInitInfoBase tailInitInfo(KernelInitInfoBase initInfo, size_t tailSize);
     OCLKernel* forward53;
     OCLKernel* forward97;
-    int int_floorlog2(int a);
-    float getStep(size_t numresolutions, size_t level, size_t orient, size_t prec);
+    // tail kernels compute levels whose LL band is at most tailSize x tailSize
+    size_t tailSize;
+    bool fusedTail;
+    OCLKernel* tail53;
+    OCLKernel* tail97;
+    // quantization factors (LL, LH/HL, HH per level) for the quantized tail kernel
+    cl_mem tailQuant;
+    size_t tailQuantLevels;
+    size_t tailQuantPrecision;
 
 };
 
@@ -18,11 +18,12 @@
 #include "OCLDWTRev.h"
 #include "OCLMemoryManager.h"
 #include <stdint.h>
+#include "OCLBasic.h"
 #include "OCLDWT.cpp"
 
 template<typename T> OCLDWTRev<T>::OCLDWTRev(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr) : OCLDWT<T>(initInfo, memMgr),
     reverse53(new OCLKernel( KernelInitInfo(initInfo, "ocldwt53rev.cl", "run") )),
-    reverse97(new OCLKernel( KernelInitInfo(initInfo, "ocldwt97rev.cl", "run") ))
+    reverse97(new OCLKernel( KernelInitInfo(initInfo, "ocldwt97rev.cl", memMgr->isOnlyDwtOut() ? "run" : "runWithQuantization") ))
 {
 
 }
@@ -35,27 +36,75 @@ template<typename T> OCLDWTRev<T>::~OCLDWTRev(void)
         delete reverse97;
 }
 
-
-template<typename T> void OCLDWTRev<T>::run(bool lossy, size_t w,	size_t h, size_t windowX, size_t windowY) {
+template<typename T> void OCLDWTRev<T>::doRun(bool lossy, size_t w,	size_t h, size_t windowX, size_t windowY, size_t level, size_t levels,
+        const J2KWindow::Region& region, const std::vector<float>* stepSizes) {
 
     OCLKernel* targetKernel = lossy?reverse97:reverse53;
-    const size_t steps = divRndUp(h, 15 * windowY);
-    setKernelArgs(targetKernel,w,h,steps,level);
+    targetKernel->setProfileName("idwt", std::string(lossy ? "idwt97" : "idwt53") + " level " + to_str(level));
+    const size_t steps = divRndUp(region.height(), 15 * windowY);
+    // coarsest level reads its LL band from the coefficients, all other levels
+    // read it from the reconstruction of the previous (coarser) level
+    cl_mem* idata = this->memoryManager->getDWTOut();
+    cl_mem* idataLL = (level == levels-1) ? idata : this->memoryManager->getDwtIn(level+1);
+    if (this->setKernelArgs(targetKernel, idata, idataLL, this->memoryManager->getDwtIn(level),
+                      static_cast<unsigned int>(w),
+                      static_cast<unsigned int>(h),
+                      static_cast<unsigned int>(steps),
+                      static_cast<unsigned int>(level),
+                      static_cast<unsigned int>(levels)
+                     ) != DeviceSuccess)
+        return;
+    if (this->setKernelArgsOrigin(targetKernel, static_cast<unsigned int>(region.x0), static_cast<unsigned int>(region.y0)) != DeviceSuccess)
+        return;
+    // set dequantization kernel arguments
+    if (lossy && !this->memoryManager->isOnlyDwtOut() ) {
+        float bandSteps[4];
+        for (size_t orient = J2K_ORIENT_LL; orient <= J2K_ORIENT_HH; ++orient) {
+            // LL is only read at the coarsest level, the first entry of the table;
+            // the bands of level follow those of all coarser levels
+            size_t index = (orient == J2K_ORIENT_LL) ? 0 : 1 + (levels - 1 - level) * 3 + orient - 1;
+            bandSteps[orient] = (stepSizes && index < stepSizes->size()) ? (*stepSizes)[index] :
+                                this->getStep(level, orient, this->memoryManager->getPrecision());
+        }
+        if (this->setKernelArgsDequant(targetKernel, bandSteps[J2K_ORIENT_LL], bandSteps[J2K_ORIENT_HL],
+                                       bandSteps[J2K_ORIENT_LH], bandSteps[J2K_ORIENT_HH]) != DeviceSuccess)
+            return;
+    }
+    if (this->memoryManager->setBufferImageArgs(targetKernel->getKernel(), this->numKernelArgs) != DeviceSuccess)
+        return;
     size_t local_work_size[3] = {windowX,1,1};
-    if (lossy) {
-        size_t global_offset[3] = {-4,0,0};   //left boundary
-
-        //add one extra windowX to make up for group overlap due to boundary
-        size_t global_work_size[3] = {(divRndUp(w, windowX) + 1)* windowX, divRndUp(h, windowY * steps),1};
-        targetKernel->enqueue(2,global_offset, global_work_size, local_work_size);
-
-    } else {
-        size_t global_offset[3] = {-2,0,0};   //left boundary
+    // work groups overlap by two boundaries (4 columns for 9/7, 2 columns for 5/3 on each side),
+    // so each group only outputs windowX - 2*boundary columns
+    const size_t boundaryX = lossy ? 4 : 2;
+    size_t global_offset[3] = {0,0,0};
+    size_t global_work_size[3] = {divRndUp(region.width(), windowX - 2 * boundaryX) * windowX, divRndUp(region.height(), windowY * steps),1};
+    targetKernel->enqueue(2,global_offset, global_work_size, local_work_size);
+}
 
-        //add one extra windowX to make up for group overlap due to boundary
-        size_t global_work_size[3] = {(divRndUp(w, windowX) + 1)* windowX, divRndUp(h, windowY * steps),1};
-        targetKernel->enqueue(2,global_offset, global_work_size, local_work_size);
+template<typename T> void OCLDWTRev<T>::run(bool lossy, size_t w,	size_t h, size_t windowX, size_t windowY, size_t levels, size_t discardLevels,
+        const std::vector<float>* stepSizes) {
+    if (levels == 0 || discardLevels >= levels)
+        return;
+    // dimensions of each level, from full resolution down to the coarsest level
+    std::vector<size_t> widths(1, w);
+    std::vector<size_t> heights(1, h);
+    for (size_t level = 1; level < levels; ++level) {
+        widths.push_back(divRndUp(widths.back(), 2));
+        heights.push_back(divRndUp(heights.back(), 2));
     }
+    for (size_t level = levels; level-- > discardLevels; )
+        doRun(lossy, widths[level], heights[level], windowX, windowY, level, levels, J2KWindow::Region(0, 0, widths[level], heights[level]), stepSizes);
 }
 
+template<typename T> void OCLDWTRev<T>::run(bool lossy, size_t w,	size_t h, size_t windowX, size_t windowY, size_t levels, const J2KWindow& window,
+        const std::vector<float>* stepSizes) {
+    std::vector<size_t> widths(1, w);
+    std::vector<size_t> heights(1, h);
+    for (size_t level = 1; level < levels; ++level) {
+        widths.push_back(divRndUp(widths.back(), 2));
+        heights.push_back(divRndUp(heights.back(), 2));
+    }
+    for (size_t level = levels; level-- > window.getDiscardLevels(); )
+        doRun(lossy, widths[level], heights[level], windowX, windowY, level, levels, window.getRegion(level), stepSizes);
+}
 
@@ -19,6 +19,7 @@
 #include "OCLDWT.h"
 #include <vector>
 #include "OCLMemoryManager.h"
+#include "J2KWindow.h"
 
 
 
@@ -28,8 +29,21 @@ public:
     OCLDWTRev(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr);
     ~OCLDWTRev(void);
 
-    void run(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY);
+    // reconstruct the image from levels of coefficients in getDWTOut(), walking from the coarsest
+    // level back to full resolution; the reconstruction of each level is written to getDwtIn(level).
+    // The finest discardLevels levels are skipped: the image, reduced by 2^discardLevels in each
+    // dimension, is then left in getDwtIn(discardLevels), and their high pass bands are never read.
+    // Quantized coefficients are dequantized with stepSizes, in sample units, of each subband in code block
+    // table order, as signalled in the code stream; if stepSizes is NULL, with those of J2KQuantization
+    void run(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY, size_t levels, size_t discardLevels = 0,
+             const std::vector<float>* stepSizes = NULL);
+    // as run, but each level only reconstructs its region of window, which must be laid out for this frame
+    void run(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY, size_t levels, const J2KWindow& window,
+             const std::vector<float>* stepSizes = NULL);
 private:
+    // reconstruct region [x0, x1) x [y0, y1) of the w x h image of level
+    void doRun(bool lossy, size_t w,	size_t h,size_t windowX, size_t windowY, size_t level, size_t levels,
+               const J2KWindow::Region& region, const std::vector<float>* stepSizes);
 
     OCLKernel* reverse53;
     OCLKernel* reverse97;
@@ -14,6 +14,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "OCLDataTransferManager.h"
+#include "OCLProfiler.h"
 
 /*
 
@@ -30,9 +31,25 @@
 */
 
 
-OCLDataTransferManager::OCLDataTransferManager(ocl_args_d_t* ocl) : ocl(ocl)
+OCLDataTransferManager::OCLDataTransferManager(ocl_args_d_t* ocl, size_t ringDepth) : ocl(ocl),
+    profiler(NULL),
+    ringDepth(ringDepth ? ringDepth : 1),
+    transferQueue(0),
+    hostToDevicePendingThread(NULL)
 {
-    HostToDevicePendingFunctor x(ocl, hostToDevicePendingQueue);
+    // uploads get their own in-order queue, so they are not serialized behind
+    // the kernels of the previous frame on the compute queue
+    cl_int error_code = CL_SUCCESS;
+    transferQueue = clCreateCommandQueue(ocl->context, ocl->device, CL_QUEUE_PROFILING_ENABLE, &error_code);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clCreateCommandQueue returned %s.", TranslateOpenCLError(error_code));
+        transferQueue = 0;
+    }
+    for (size_t i = 0; i < this->ringDepth; ++i)
+        availableSlotsQueue.push(i);
+
+    HostToDevicePendingFunctor x(hostToDevicePendingQueue, availableSlotsQueue);
     hostToDevicePendingThread = new boost::thread(x);
 }
 
@@ -40,7 +57,75 @@ OCLDataTransferManager::OCLDataTransferManager(ocl_args_d_t* ocl) : ocl(ocl)
 OCLDataTransferManager::~OCLDataTransferManager(void)
 {
     if (hostToDevicePendingThread) {
+        // empty info tells the pending thread to exit
+        hostToDevicePendingQueue.push(HostToDeviceInfo());
         hostToDevicePendingThread->join();
         delete hostToDevicePendingThread;
     }
+    if (transferQueue)
+        clReleaseCommandQueue(transferQueue);
+}
+
+size_t OCLDataTransferManager::acquireSlot() {
+    size_t slot = 0;
+    availableSlotsQueue.wait_and_pop(slot);
+    return slot;
+}
+
+tDeviceRC OCLDataTransferManager::upload(HostToDeviceInfo& info) {
+    cl_command_queue queue = transferQueue ? transferQueue : ocl->commandQueue;
+    cl_event returned_event = 0;
+    cl_int error_code = CL_SUCCESS;
+    if (info.bufferSize) {
+        error_code = clEnqueueWriteBuffer(queue, info.dst, CL_FALSE, 0, info.bufferSize, info.src,
+                                          info.waitEvent ? 1 : 0,
+                                          info.waitEvent ? &info.waitEvent : NULL,
+                                          &returned_event);
+    } else {
+        size_t origin[] = {info.offsetX,info.offsetY,0}; // Defines the offset in pixels in the image from where to write.
+        size_t region[] = {info.width, info.height, 1}; // Size of object to be transferred
+        error_code = clEnqueueWriteImage(queue, info.dst, CL_FALSE, origin, region,0,0, info.src,
+                                         info.waitEvent ? 1 : 0,
+                                         info.waitEvent ? &info.waitEvent : NULL,
+                                         &returned_event);
+    }
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("upload (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+        // slot is never going to complete, so hand it straight back
+        availableSlotsQueue.push(info.slot);
+        return error_code;
+    }
+    // make sure the transfer is submitted before the compute queue waits on it
+    error_code = clFlush(queue);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clFlush returned %s.", TranslateOpenCLError(error_code));
+    }
+
+    if (profiler)
+        profiler->record("upload", "write image", returned_event);
+
+    // one reference for the caller, one for the pending thread
+    clRetainEvent(returned_event);
+    info.uploadEvent = returned_event;
+    hostToDevicePendingQueue.push(info);
+    return CL_SUCCESS;
+}
+
+void OCLDataTransferManager::setProfiler(OCLProfiler* prof) {
+    profiler = prof;
+    if (profiler && transferQueue)
+        profiler->setQueueName(transferQueue, "transfer queue");
+}
+
+tDeviceRC OCLDataTransferManager::finish() {
+    if (!transferQueue)
+        return CL_SUCCESS;
+    cl_int error_code = clFinish(transferQueue);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clFinish returned %s.", TranslateOpenCLError(error_code));
+    }
+    return error_code;
 }
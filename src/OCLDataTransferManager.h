@@ -22,24 +22,31 @@
 
 
 struct HostToDeviceInfo {
-    HostToDeviceInfo() : src(NULL), width(0), height(0), offsetX(0), offsetY(0), dst(0) { }
+    HostToDeviceInfo() : src(NULL), width(0), height(0), offsetX(0), offsetY(0), dst(0), bufferSize(0),
+        slot(0), waitEvent(0), uploadEvent(0) { }
     void* src;
     size_t width;
     size_t height;
     size_t offsetX;
     size_t offsetY;
     cl_mem dst;
+    size_t bufferSize;      // if non zero, dst is a buffer of this size, rather than an image
+    size_t slot;            // ring slot that owns src and dst
+    cl_event waitEvent;     // upload may not start before this event (last reader of dst) completes
+    cl_event uploadEvent;   // signalled when the upload has completed
 };
 
+// number of frames that may be in flight between host and device
+const size_t DEFAULT_UPLOAD_RING_DEPTH = 3;
 
-const int QUEUE_SIZE = 4;
-
+// Waits for enqueued uploads to complete, and hands their ring slots back to the producer:
+// the queue of available slots is the completion queue of the ring
 struct HostToDevicePendingFunctor
 {
-    HostToDevicePendingFunctor(ocl_args_d_t* ocl, concurrent_queue<HostToDeviceInfo>& pendingQueue) : ocl(ocl), pendingQueue(pendingQueue) {
-        for(int i = 0; i < QUEUE_SIZE; ++i) {
-            // availableEventsQueue.push(returned_event[i]);
-        }
+    HostToDevicePendingFunctor(concurrent_queue<HostToDeviceInfo>& pendingQueue,
+                               concurrent_queue<size_t>& availableSlotsQueue) :
+        pendingQueue(pendingQueue),
+        availableSlotsQueue(availableSlotsQueue) {
     }
     void operator()() {
         HostToDeviceInfo info;
@@ -48,33 +55,58 @@ struct HostToDevicePendingFunctor
 
             if (!info.src)
                 return;
-            size_t origin[] = {info.offsetX,info.offsetY,0}; // Defines the offset in pixels in the image from where to write.
-            size_t region[] = {info.width, info.height, 1}; // Size of object to be transferred
-            cl_event returned_event;
-            cl_int error_code = clEnqueueWriteImage(ocl->commandQueue, info.dst, CL_FALSE, origin, region,0,0, info.src, 0, NULL,&returned_event);
+            cl_int error_code = clWaitForEvents(1, &info.uploadEvent);
             if (CL_SUCCESS != error_code)
             {
-                LogError("clEnqueueWriteImage (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+                LogError("clWaitForEvents returned %s.", TranslateOpenCLError(error_code));
             }
+            clReleaseEvent(info.uploadEvent);
+            info.uploadEvent = 0;
+            availableSlotsQueue.push(info.slot);
         }
     }
     concurrent_queue<HostToDeviceInfo>& pendingQueue;
-    ocl_args_d_t* ocl;
-    cl_event returned_event[QUEUE_SIZE];
-    //concurrent_queue<cl_event> availableEventsQueue;
+    concurrent_queue<size_t>& availableSlotsQueue;
 };
 
 
+/*
+Ring of host to device uploads.
+
+Uploads are issued on a dedicated transfer queue, so that the upload of frame N+1
+overlaps with the kernels of frame N on the compute queue. The compute queue
+chains its first kernel on the event returned by upload().
+*/
 class OCLDataTransferManager
 {
 public:
-    OCLDataTransferManager(ocl_args_d_t* ocl);
+    OCLDataTransferManager(ocl_args_d_t* ocl, size_t ringDepth);
     ~OCLDataTransferManager(void);
+
+    size_t getRingDepth() {
+        return ringDepth;
+    }
+
+    // blocks until a ring slot is free, i.e. its previous upload has completed
+    size_t acquireSlot();
+
+    // enqueue non-blocking upload of info.src to info.dst.
+    // On success, info.uploadEvent is set; caller owns this reference
+    tDeviceRC upload(HostToDeviceInfo& info);
+
+    // block until all enqueued uploads have completed
+    tDeviceRC finish();
+
+    // profiler records every upload; may be NULL
+    void setProfiler(OCLProfiler* prof);
 private:
+    ocl_args_d_t* ocl;
+    OCLProfiler* profiler;
+    size_t ringDepth;
+    cl_command_queue transferQueue;
     boost::thread* hostToDevicePendingThread;
     concurrent_queue<HostToDeviceInfo> hostToDevicePendingQueue;
-    concurrent_queue<HostToDeviceInfo> hostToDeviceCompleteQueue;
-    ocl_args_d_t* ocl;
+    concurrent_queue<size_t> availableSlotsQueue;
 
 };
 
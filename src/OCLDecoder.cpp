@@ -21,19 +21,115 @@
 #include "OCLMemoryManager.cpp"
 #include "OCLEncodeDecode.cpp"
 
-template<typename T> OCLDecoder<T>::OCLDecoder(ocl_args_d_t* ocl, bool isLossy) : OCLEncodeDecode<T>(ocl,lossy,false),
-    dwt(new OCLDWTRev<T>(KernelInitInfoBase(_ocl->commandQueue,  "-I . -D WIN_SIZE_X=128 -D WIN_SIZE_Y=8"), memoryManager))
+template<typename T> OCLDecoder<T>::OCLDecoder(ocl_args_d_t* ocl, bool isLossy, const OCLWindowConfig* windowConfig) :
+    OCLEncodeDecode<T>(ocl,isLossy,false,DEFAULT_UPLOAD_RING_DEPTH,windowConfig),
+    dwt(ocl ? new OCLDWTRev<T>(KernelInitInfoBase(ocl->commandQueue, this->kernelBuildOptions(this->windowOptions(this->windows.reverseX, this->windows.reverseY)), this->profiler), this->memoryManager) : NULL),
+    tier1(ocl ? new HostTier1Decoder() : NULL),
+    outputLevel(0)
 {
 
 }
 
 template<typename T> OCLDecoder<T>::~OCLDecoder() {
+    if (tier1)
+        delete tier1;
     if (dwt)
         delete dwt;
 }
 
-template<typename T> void OCLDecoder<T>::run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision) {
-    OCLEncodeDecode::run(components,w,h,levels);
-    dwt->run(lossy, w,h, 128,8);
+template<typename T> void OCLDecoder<T>::run(void* dwtCoefficients, size_t numComponents, size_t w,size_t h, size_t levels, size_t precision) {
+    if (!this->memoryManager || !dwtCoefficients)
+        return;
+    OCLHostScope scope(this->profiler, "OCLDecoder::run");
+    this->beginStages();
+    // only the geometry of the components is needed, since nothing is uploaded to the input images
+    std::vector<T*> components(numComponents, (T*)NULL);
+    this->memoryManager->init(components, w, h, levels, precision, false);
+    outputLevel = 0;
+    output = J2KWindow::Region(0, 0, w, h);
+    this->memoryManager->hostToDWTOut(dwtCoefficients);
+    this->endStage("upload");
+    dwt->run(this->lossy, w,h, this->windows.reverseX,this->windows.reverseY, levels);
+    this->endStage("idwt");
 }
 
+template<typename T> bool OCLDecoder<T>::checkStream() {
+    const HostCodestreamParams& params = codewords.params;
+    if (codewords.numChannels != 1 && codewords.numChannels != 4) {
+        LogError("OCLDecoder: %d components; the DWT images hold one or four", (int)codewords.numChannels);
+        return false;
+    }
+    if (params.levels == 0) {
+        LogError("OCLDecoder: code stream without DWT levels");
+        return false;
+    }
+    if (params.lossy != this->lossy) {
+        LogError("OCLDecoder: %s code stream, but the decoder is %s", params.lossy ? "lossy" : "lossless",
+                 this->lossy ? "lossy" : "lossless");
+        return false;
+    }
+    // the inverse DWT dequantizes with the steps signalled in QCD, whichever encoder chose them
+    steps.clear();
+    for (size_t i = 0; i < codewords.stepSizes.size() && params.lossy; ++i) {
+        size_t orient = i ? 1 + (i - 1) % 3 : J2K_ORIENT_LL;
+        steps.push_back(J2KQuantization::step(codewords.stepSizes[i], orient, params.precision));
+    }
+    return true;
+}
+
+template<typename T> bool OCLDecoder<T>::decode(const unsigned char* data, size_t size, size_t discardLevels) {
+    return decodeWindow(data, size, 0, 0, (size_t)-1, (size_t)-1, discardLevels);
+}
+
+template<typename T> bool OCLDecoder<T>::decodeWindow(const unsigned char* data, size_t size, size_t x, size_t y, size_t w, size_t h,
+        size_t discardLevels) {
+    if (!this->memoryManager || !tier1)
+        return false;
+    OCLHostScope scope(this->profiler, "OCLDecoder::decodeWindow");
+    this->beginStages();
+    window.select(x, y, w, h, discardLevels);
+    if (!tier2.decode(data, size, codewords, &window) || !checkStream())
+        return false;
+    this->endStage("tier2");
+
+    const HostCodestreamParams& params = codewords.params;
+    std::vector<T*> components(codewords.numChannels, (T*)NULL);
+    this->memoryManager->init(components, params.width, params.height, params.levels, params.precision, false);
+    outputLevel = discardLevels;
+    output = window.getWindow();
+    // Each subband maps only the box of its needed code blocks, so the transfer follows the window size,
+    // where a single box would span the gaps between the subbands of each level. Subbands are mapped one
+    // at a time, as a mapping of a buffer spans whole rows, which the subbands beside it share
+    for (size_t i = 0; i < window.getNumBands(); ++i) {
+        const J2KWindow::Region& bounds = window.getBandBlockBounds(i);
+        if (bounds.empty())
+            continue;
+        void* ptr = NULL;
+        size_t rowPitch = 0;
+        if (this->memoryManager->mapDWTOutForWrite(&ptr, &rowPitch, bounds.x0, bounds.y0, bounds.width(), bounds.height()) != CL_SUCCESS)
+            return false;
+        tier1->decode(&codewords, HostCoefficientImage((short*)ptr, rowPitch / sizeof(short), codewords.numChannels, bounds.x0, bounds.y0),
+                      &window.getBandBlocks(i));
+        tier1->wait();
+        this->memoryManager->unmapMemory(*this->memoryManager->getDWTOut(), ptr);
+    }
+    this->endStage("tier1");
+
+    dwt->run(this->lossy, params.width, params.height, this->windows.reverseX, this->windows.reverseY, params.levels, window, &steps);
+    this->endStage("idwt");
+    return true;
+}
+
+template<typename T>  tDeviceRC OCLDecoder<T>::mapOutput(void** mappedPtr, size_t* rowPitch) {
+    if (!this->memoryManager)
+        return CL_INVALID_MEM_OBJECT;
+    size_t pitch = 0;
+    return this->memoryManager->mapDwtIn(outputLevel, mappedPtr, rowPitch ? rowPitch : &pitch, output.x0, output.y0,
+                                         output.width(), output.height());
+}
+
+template<typename T> tDeviceRC OCLDecoder<T>::unmapOutput(void* mappedPtr) {
+    if (!this->memoryManager)
+        return CL_INVALID_MEM_OBJECT;
+    return this->memoryManager->unmapMemory(*this->memoryManager->getDwtIn(outputLevel), mappedPtr);
+}
@@ -20,15 +20,61 @@ struct ocl_args_d_t;
 #include <vector>
 #include "OCLMemoryManager.h"
 #include "OCLEncodeDecode.h"
+#include "HostTier1Decoder.h"
+#include "HostTier2Decoder.h"
 
 
 template<typename T>  class OCLDecoder : public OCLEncodeDecode<T>
 {
 public:
-    OCLDecoder(ocl_args_d_t* ocl, bool isLossy);
+    OCLDecoder(ocl_args_d_t* ocl, bool isLossy, const OCLWindowConfig* windowConfig = NULL);
     ~OCLDecoder(void);
-    void run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision);
+    // Reconstruct an image from its wavelet coefficients. dwtCoefficients is in the format of
+    // the encoder's DWT output (see mapDWTOut): interleaved components, Mallat layout.
+    void run(void* dwtCoefficients, size_t numComponents, size_t w,size_t h, size_t levels, size_t precision);
+    // Decode a JPEG 2000 code stream, raw or in a JP2 file, of size bytes at data, such as a HostMappedFile.
+    // Tier-2 and tier-1 run on the host, and write straight into the DWT coefficient image; then the
+    // inverse DWT runs on the device. Returns false, and logs why, if the stream cannot be decoded:
+    // besides what HostTier2Decoder rejects, it must have one or four components, at least one level,
+    // the transform of this decoder, and, if irreversible, the step sizes of J2KQuantization.
+    // With discardLevels > 0, the image is reconstructed at 1/2^discardLevels of its size in each
+    // dimension: the high pass bands of the finest discardLevels levels are neither tier-1 decoded nor
+    // inverse transformed. At most levels - 1 levels can be discarded
+    bool decode(const unsigned char* data, size_t size, size_t discardLevels = 0);
+
+    // Decode the window [x, x + w) x [y, y + h) of the image reduced by discardLevels levels, clipped to it,
+    // as decode does the whole image. Only the code blocks that the window needs, given the support of the
+    // synthesis filters, are tier-1 decoded, and each level of the inverse DWT only computes what the next one
+    // reads, so the time taken follows the window size. Where PLT markers give the packet lengths,
+    // tier-2 also skips the packets of precincts that the window does not need
+    bool decodeWindow(const unsigned char* data, size_t size, size_t x, size_t y, size_t w, size_t h, size_t discardLevels = 0);
+
+    // dimensions of the reconstructed image, or window
+    size_t getOutputWidth() {
+        return output.width();
+    }
+    size_t getOutputHeight() {
+        return output.height();
+    }
+    // the reconstructed image, or window, in the coordinates of its level
+    const J2KWindow::Region& getOutputRegion() {
+        return output;
+    }
+    // Reconstructed image, or window, interleaved components. If rowPitch is not NULL, it receives
+    // the bytes per row, which for a window exceed its width
+    tDeviceRC mapOutput(void** mappedPtr, size_t* rowPitch = NULL);
+    tDeviceRC unmapOutput(void* mappedPtr);
 private:
+    // the tier-2 output can be decoded by the device pipeline
+    bool checkStream();
+
     OCLDWTRev<T>* dwt;
+    HostTier2Decoder tier2;
+    HostTier2Output codewords;
+    std::vector<float> steps;   // dequantization step of each subband of codewords
+    HostTier1Decoder* tier1;
+    J2KWindow window;
+    size_t outputLevel;         // reduced resolution of the output
+    J2KWindow::Region output;
 
 };
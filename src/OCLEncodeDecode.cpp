@@ -17,32 +17,98 @@
 
 #include "OCLEncodeDecode.h"
 #include "OCLUtil.h"
+#include "OCLBasic.h"
 #include "OCLMemoryManager.cpp"
 
-template<typename T> OCLEncodeDecode<T>::OCLEncodeDecode(ocl_args_d_t* ocl, bool isLossy, bool outputDwt) :
+template<typename T> OCLEncodeDecode<T>::OCLEncodeDecode(ocl_args_d_t* ocl, bool isLossy, bool outputDwt, size_t uploadRingDepth,
+        const OCLWindowConfig* windowConfig) :
     _ocl(ocl),
     lossy(isLossy),
-    memoryManager(new OCLMemoryManager<T>(ocl, isLossy, outputDwt))
+    windows(windowConfig ? *windowConfig : (ocl ? OCLTuningProfile::load(ocl->device) : OCLWindowConfig())),
+    profiler(new OCLProfiler()),
+    memoryManager(ocl ? new OCLMemoryManager<T>(ocl, isLossy, outputDwt, uploadRingDepth) : NULL),
+    onlyDwtOut(outputDwt),
+    stageTiming(false),
+    stageStart(0)
 {
+    if (memoryManager)
+        memoryManager->setProfiler(profiler);
 
 }
 
 template<typename T> OCLEncodeDecode<T>::~OCLEncodeDecode() {
+    if (!traceFile.empty()) {
+        finish();
+        profiler->writeTrace(traceFile);
+    }
+    if (memoryManager)
+        delete memoryManager;
+    if (profiler)
+        delete profiler;
 }
 
 template<typename T> void OCLEncodeDecode<T>::finish(void) {
 
+    // without a device, all work is done synchronously on the host
+    if (!memoryManager)
+        return;
+    memoryManager->finishUploads();
     clFinish(_ocl->commandQueue);
+    if (profiler->isEnabled()) {
+        profileRecords = profiler->collect();
+        // when tracing, the timeline goes to the trace file instead
+        if (!quiet && !profiler->isTracing())
+            profiler->report(profileRecords);
+    }
+}
+
+template<typename T> void OCLEncodeDecode<T>::setTraceFile(std::string fileName) {
+    traceFile = fileName;
+    profiler->setTracing(!fileName.empty());
+    if (!fileName.empty())
+        profiler->setEnabled(true);
+}
+
+template<typename T> std::string OCLEncodeDecode<T>::kernelBuildOptions(std::string options) {
+    if (memoryManager && memoryManager->isBufferMode())
+        options += " -D USE_BUFFERS";
+    return options;
+}
+
+template<typename T> std::string OCLEncodeDecode<T>::windowOptions(size_t windowX, size_t windowY) {
+    return "-I . -D WIN_SIZE_X=" + to_str(windowX) + " -D WIN_SIZE_Y=" + to_str(windowY);
+}
+
+template<typename T> void OCLEncodeDecode<T>::beginStages() {
+    stageTimes.clear();
+    if (stageTiming)
+        stageStart = time_stamp();
+}
+
+template<typename T> void OCLEncodeDecode<T>::endStage(std::string name) {
+    if (!stageTiming)
+        return;
+    finish();
+    double now = time_stamp();
+    stageTimes.push_back(OCLStageTime(name, now - stageStart));
+    stageStart = now;
 }
 
 template<typename T> void OCLEncodeDecode<T>::run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision) {
-    memoryManager->init(components,w,h,levels,precision);
+    if (memoryManager)
+        memoryManager->init(components,w,h,levels,precision);
 }
 
-template<typename T>  tDeviceRC OCLEncodeDecode<T>::mapDWTOut(void** mappedPtr) {
+template<typename T>  tDeviceRC OCLEncodeDecode<T>::mapDWTOut(void** mappedPtr, size_t* rowPitch) {
+    if (!memoryManager)
+        return CL_INVALID_MEM_OBJECT;
+    if (rowPitch)
+        return memoryManager->mapDWTOutForRead(mappedPtr, rowPitch);
     return memoryManager->mapImage(*memoryManager->getDWTOut(), mappedPtr);
 }
 template<typename T> tDeviceRC OCLEncodeDecode<T>::unmapDWTOut(void* mappedPtr) {
+    if (!memoryManager)
+        return CL_INVALID_MEM_OBJECT;
 
     return memoryManager->unmapMemory(*memoryManager->getDWTOut(), mappedPtr);
 }
@@ -17,22 +17,76 @@
 
 struct ocl_args_d_t;
 #include <vector>
+#include <string>
 #include "OCLMemoryManager.h"
+#include "OCLProfiler.h"
+#include "OCLTuningProfile.h"
+
+// host wall clock time of one pipeline stage
+struct OCLStageTime {
+    OCLStageTime(std::string stageName, double stageSeconds) : name(stageName), seconds(stageSeconds)
+    {}
+    std::string name;
+    double seconds;
+};
 
 
 template<typename T>  class OCLEncodeDecode
 {
 public:
-    OCLEncodeDecode(ocl_args_d_t* ocl, bool isLossy, bool outputDwt);
+    // If windowConfig is NULL, window sizes come from the device's tuning profile
+    OCLEncodeDecode(ocl_args_d_t* ocl, bool isLossy, bool outputDwt, size_t uploadRingDepth = DEFAULT_UPLOAD_RING_DEPTH,
+                    const OCLWindowConfig* windowConfig = NULL);
     ~OCLEncodeDecode(void);
 
-    tDeviceRC mapDWTOut(void** mappedPtr);
+    // if rowPitch is not NULL, it receives the bytes per row of the mapping
+    tDeviceRC mapDWTOut(void** mappedPtr, size_t* rowPitch = NULL);
     tDeviceRC unmapDWTOut(void* mappedPtr);
     void finish(void);
+
+    // When enabled, run() waits for each stage to complete and records its time.
+    // This serializes the pipeline, so it should not be combined with latency measurements.
+    void setStageTiming(bool enable) {
+        stageTiming = enable;
+    }
+    std::vector<OCLStageTime> getStageTimes() {
+        return stageTimes;
+    }
+
+    // When enabled, every enqueued command records a profiling event,
+    // and finish() reports the device timeline of all commands since the previous finish()
+    void setProfiling(bool enable) {
+        profiler->setEnabled(enable);
+    }
+    std::vector<OCLProfileRecord> getProfileRecords() {
+        return profileRecords;
+    }
+
+    OCLWindowConfig getWindowConfig() {
+        return windows;
+    }
+
+    // Write a Chrome trace-event timeline of host spans and device commands to fileName
+    // when this object is destroyed; enables profiling
+    void setTraceFile(std::string fileName);
 protected:
     void run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision);
+    // build options for kernels that access the memory manager's images
+    std::string kernelBuildOptions(std::string options);
+    // build options for kernels with a windowX x windowY work window
+    static std::string windowOptions(size_t windowX, size_t windowY);
+    void beginStages();
+    void endStage(std::string name);
     ocl_args_d_t* _ocl;
     bool lossy;
-    OCLMemoryManager<T>* memoryManager;
+    OCLWindowConfig windows;
+    OCLProfiler* profiler;
+    OCLMemoryManager<T>* memoryManager;     // NULL when there is no device
+    bool onlyDwtOut;
+    bool stageTiming;
+    double stageStart;
+    std::vector<OCLStageTime> stageTimes;
+    std::vector<OCLProfileRecord> profileRecords;
+    std::string traceFile;
 
 };
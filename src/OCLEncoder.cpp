@@ -22,16 +22,36 @@
 #include "OCLEncodeDecode.cpp"
 #include "OCLBPC.cpp"
 #include "OCLRGBtoPlanar.cpp"
+#include "HostDWTForward.cpp"
 
-template<typename T> OCLEncoder<T>::OCLEncoder(ocl_args_d_t* ocl, bool isLossy, bool outputDwt) : OCLEncodeDecode<T>(ocl, isLossy, outputDwt),
-    dwt(new OCLDWTForward<T>(KernelInitInfoBase(_ocl->commandQueue,  "-I . -D WIN_SIZE_X=8 -D WIN_SIZE_Y=128"), memoryManager)),
-    bpc(new OCLBPC<T>(KernelInitInfoBase(_ocl->commandQueue,  "-I . -D CODEBLOCKX=32 -D CODEBLOCKY=32"), memoryManager)),
-    rgbToPlanar(new OCLRGBtoPlanar<T>(KernelInitInfoBase(_ocl->commandQueue,  "-I . -D WIN_SIZE_X=16 -D WIN_SIZE_Y=16"), memoryManager))
+template<typename T> OCLEncoder<T>::OCLEncoder(ocl_args_d_t* ocl, bool isLossy, bool outputDwt, eDWTBackend dwtBackend, size_t uploadRingDepth,
+        const OCLWindowConfig* windowConfig, eTier1Backend tier1Backend) :
+    OCLEncodeDecode<T>(ocl, isLossy, outputDwt, uploadRingDepth, windowConfig),
+    backend(ocl ? dwtBackend : HOST_DWT),
+    hostDwt(backend == HOST_DWT ? new HostDWTForward<T>(isLossy) : NULL),
+    dwt(backend == DEVICE_DWT ? new OCLDWTForward<T>(KernelInitInfoBase(ocl->commandQueue, this->kernelBuildOptions(this->windowOptions(this->windows.forwardX, this->windows.forwardY)), this->profiler), this->memoryManager) : NULL),
+    bpc(ocl ? new OCLBPC<T>(KernelInitInfoBase(ocl->commandQueue, this->kernelBuildOptions("-I ."), this->profiler), this->memoryManager) : NULL),
+    rgbToPlanar(ocl ? new OCLRGBtoPlanar<T>(KernelInitInfoBase(ocl->commandQueue, this->kernelBuildOptions(this->windowOptions(this->windows.planarX, this->windows.planarY)), this->profiler), this->memoryManager) : NULL),
+    codeBlockX(DEFAULT_CODEBLOCK_SIZE),
+    codeBlockY(DEFAULT_CODEBLOCK_SIZE),
+    tier1((ocl && !outputDwt && tier1Backend == HOST_TIER1) ? new HostTier1Encoder() : NULL),
+    mq((ocl && !outputDwt && tier1Backend == DEVICE_TIER1) ? new OCLMQEncoder(KernelInitInfoBase(ocl->commandQueue, "-I .", this->profiler)) : NULL),
+    bpcPending(false),
+    mapPending(false),
+    bpcMapped(false),
+    tier2Pending(false)
 {
 
 }
 
 template<typename T> OCLEncoder<T>::~OCLEncoder() {
+    finishTier1();
+    if (tier1)
+        delete tier1;
+    if (mq)
+        delete mq;
+    if (hostDwt)
+        delete hostDwt;
     if (dwt)
         delete dwt;
     if (bpc)
@@ -41,12 +61,220 @@ template<typename T> OCLEncoder<T>::~OCLEncoder() {
 }
 
 template<typename T> void OCLEncoder<T>::run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision) {
-    OCLEncodeDecode::run(components,w,h,levels,precision);
-    dwt->run(lossy, w,h, precision,128,0,levels);
-    if (!memoryManager->isOnlyDwtOut() ) {
-        if (components.size() > 1)
-            rgbToPlanar->run();
-        bpc->run(32,32);
+    OCLHostScope scope(this->profiler, "OCLEncoder::run");
+    this->beginStages();
+    if (tier1 || mq) {
+        // BPC buffers are reallocated when the geometry changes, so nothing may be mapped
+        // tier-2 of the previous frame is written with the previous geometry
+        size_t frame[] = {w, h, levels, components.size(), codeBlockX, codeBlockY, precision};
+        std::vector<size_t> frameGeometry(frame, frame + 7);
+        if (frameGeometry != geometry) {
+            finishTier1();
+            finishTier2();
+        } else
+            enqueueTier1Input();
+        geometry = frameGeometry;
+    }
+    if (backend == HOST_DWT) {
+        runHostDWT(components, w, h, levels, precision);
+        if (!this->memoryManager)
+            return;
+    } else {
+        OCLEncodeDecode<T>::run(components,w,h,levels,precision);
+        this->endStage("upload");
+        waitForTier1Input();
+        dwt->run(this->lossy, w,h, this->windows.forwardX,this->windows.forwardY,0,levels);
+        this->endStage("dwt");
+    }
+    if (!this->onlyDwtOut ) {
+        if (components.size() > 1) {
+            rgbToPlanar->run(this->windows.planarX, this->windows.planarY);
+            this->endStage("planar");
+        }
+        // the output set of this run is the one that the tier-1 coding of the frame before last used
+        releaseTier1Input();
+        bpc->run(codeBlockX, codeBlockY);
+        if (mq)
+            mq->run(bpc->getOutputSet(), bpc->getWorkList());
+        // the previous frame is coded on the host while the device runs this one
+        startTier1();
+        bpcPending = true;
+        this->endStage("bpc");
+        if (this->stageTiming) {
+            finishTier1();
+            this->endStage("mq");
+            finishTier2();
+            this->endStage("tier2");
+        }
+
+    }
+}
+
+template<typename T> void OCLEncoder<T>::runHostDWT(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision) {
+    // same quantization factors as the device kernel
+    std::vector<float> quant;
+    if (this->lossy && !this->onlyDwtOut) {
+        for (size_t level = 0; level < levels; ++level) {
+            quant.push_back(1.0f/OCLDWT<T>::getStep(level, 0, precision));
+            quant.push_back(1.0f/OCLDWT<T>::getStep(level, 1, precision));
+            quant.push_back(1.0f/OCLDWT<T>::getStep(level, 3, precision));
+        }
+    }
+    hostDwt->run(components, w, h, levels, quant);
+    this->endStage("dwt");
+
+    // remaining stages run on the device
+    if (this->memoryManager) {
+        waitForTier1Input();
+        this->memoryManager->init(components, w, h, levels, precision, false);
+        this->memoryManager->hostToDWTOut(hostDwt->getOutput());
+        this->endStage("upload");
+    }
+}
+
+template<typename T> bool OCLEncoder<T>::setCodeBlockSize(size_t codeblockX, size_t codeblockY) {
+    if (!OCLBPC<T>::isLegalCodeBlockSize(codeblockX, codeblockY))
+        return false;
+    codeBlockX = codeblockX;
+    codeBlockY = codeblockY;
+    return true;
+}
+
+template<typename T> void OCLEncoder<T>::enqueueTier1Input() {
+    if (!tier1 || !bpcPending)
+        return;
+    bpcPending = false;
+    // enqueued ahead of the next frame, so that the in-order queue does not make the map
+    // wait for the next BPC
+    if (bpc->enqueueMapOutput(pendingOutput) == DeviceSuccess)
+        mapPending = true;
+}
+
+template<typename T> void OCLEncoder<T>::waitForTier1Input() {
+    if (mq) {
+        if (!bpcPending)
+            return;
+        bpcPending = false;
+        // the next frame overwrites the tier-1 output
+        finishTier2();
+        readDeviceTier1();
+        tier2Pending = true;
+        return;
+    }
+    if (!mapPending)
+        return;
+    // blocks until the device has finished the previous frame
+    if (bpc->waitForOutput(pendingOutput) != DeviceSuccess) {
+        bpc->unmapOutput(pendingOutput);
+        mapPending = false;
+    }
+}
+
+template<typename T> void OCLEncoder<T>::releaseTier1Input() {
+    if (!tier1)
+        return;
+    tier1->wait();
+    if (bpcMapped) {
+        bpc->unmapOutput(bpcOutput);
+        bpcMapped = false;
+    }
+    // the next frame overwrites the tier-1 output
+    finishTier2();
+}
+
+template<typename T> void OCLEncoder<T>::startTier1() {
+    if (!mapPending)
+        return;
+    mapPending = false;
+    bpcOutput = pendingOutput;
+    bpcMapped = true;
+    tier1->encode(bpcOutput, &tier1Output);
+    tier2Pending = true;
+}
+
+template<typename T> void OCLEncoder<T>::readDeviceTier1() {
+    bool rerun = false;
+    if (bpc->complete(rerun) != DeviceSuccess)
+        return;
+    if (rerun)
+        mq->run(bpc->getOutputSet(), bpc->getWorkList());
+    std::vector<size_t> incomplete;
+    if (mq->readOutput(&tier1Output, incomplete) != DeviceSuccess)
+        return;
+    tier1Output.codeBlocks = bpc->getCodeBlockTable();
+    tier1Output.numChannels = bpc->getNumChannels();
+    if (incomplete.empty())
+        return;
 
+    // blocks whose code word did not fit the device reservation are coded on the host
+    OCLBPCMappedOutput input;
+    if (bpc->mapOutput(input) != DeviceSuccess)
+        return;
+    for (size_t i = 0; i < incomplete.size(); ++i) {
+        size_t block = incomplete[i];
+        HostTier1Encoder::encodeBlock(hostMQ, input.blockInfo + block * BPC_BLOCK_INFO_SIZE, input.cxd, tier1Output.blocks[block]);
     }
+    bpc->unmapOutput(input);
+}
+
+template<typename T> void OCLEncoder<T>::finishTier1() {
+    if (!tier1 && !mq)
+        return;
+    enqueueTier1Input();
+    waitForTier1Input();
+    releaseTier1Input();
+    startTier1();
+    if (tier1)
+        tier1->wait();
+    if (bpcMapped) {
+        bpc->unmapOutput(bpcOutput);
+        bpcMapped = false;
+    }
+}
+
+template<typename T> void OCLEncoder<T>::finishTier2() {
+    if (!tier2Pending)
+        return;
+    tier2Pending = false;
+    if (tier1)
+        tier1->wait();
+    streamParams.width = geometry[0];
+    streamParams.height = geometry[1];
+    streamParams.levels = geometry[2];
+    streamParams.codeBlockX = geometry[4];
+    streamParams.codeBlockY = geometry[5];
+    streamParams.precision = geometry[6];
+    streamParams.lossy = this->lossy;
+    if (!tier2.encode(streamParams, tier1Output, codestream))
+        codestream.clear();
+}
+
+template<typename T> void OCLEncoder<T>::finish(void) {
+    OCLEncodeDecode<T>::finish();
+    finishTier1();
+    finishTier2();
+}
+
+template<typename T>  tDeviceRC OCLEncoder<T>::mapDWTOut(void** mappedPtr, size_t* rowPitch) {
+    if (!this->memoryManager) {
+        if (!mappedPtr)
+            return -1;
+        *mappedPtr = hostDwt->getOutput();
+        if (rowPitch)
+            *rowPitch = hostDwt->getRowPitch();
+        return DeviceSuccess;
+    }
+    return OCLEncodeDecode<T>::mapDWTOut(mappedPtr, rowPitch);
+}
+
+template<typename T> tDeviceRC OCLEncoder<T>::unmapDWTOut(void* mappedPtr) {
+    if (!this->memoryManager)
+        return DeviceSuccess;
+    return OCLEncodeDecode<T>::unmapDWTOut(mappedPtr);
+}
+
+template<typename T> tDeviceRC OCLEncoder<T>::readBPCOutput(OCLBPCOutput& output) {
+    if (!bpc || this->onlyDwtOut)
+        return CL_INVALID_OPERATION;
+    return bpc->readOutput(output);
 }
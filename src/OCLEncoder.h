@@ -22,16 +22,122 @@ struct ocl_args_d_t;
 #include "OCLEncodeDecode.h"
 #include "OCLBPC.h"
 #include "OCLRGBtoPlanar.h"
+#include "HostDWTForward.h"
+#include "HostTier1Encoder.h"
+#include "OCLMQEncoder.h"
+#include "HostTier2Encoder.h"
 
+// where the forward DWT runs
+enum eDWTBackend {
+    DEVICE_DWT,
+    HOST_DWT
+};
+
+// where the MQ coder runs
+enum eTier1Backend {
+    HOST_TIER1,
+    DEVICE_TIER1
+};
+
+/*
+If ocl is NULL, the host DWT backend is used, and the encoder stops after the DWT:
+mapDWTOut then returns the host output.
+
+Tier-1 coding of a frame is pipelined: with the host backend, the host MQ codes the mapped
+BPC output of frame N on a thread pool while the device runs frame N+1. The map of frame N is
+enqueued before frame N+1, waited for before the DWT of N+1 overwrites the input of its BPC,
+and handed to tier-1 once the BPC of N+1 has been enqueued into the other output set;
+tier-1 of N is waited for before the BPC of N+2 reuses that set.
+With the device backend, the MQ coder runs after the BPC, and only code words are read back.
 
+Once tier-1 output of a frame is complete, tier-2 assembles it into a JPEG 2000 code stream.
+Samples are expected to be DC level shifted, as the stream declares unsigned components.
+*/
 template<typename T>  class OCLEncoder :  public OCLEncodeDecode<T>
 {
 public:
-    OCLEncoder(ocl_args_d_t* ocl, bool isLossy, bool outputDwt);
+    OCLEncoder(ocl_args_d_t* ocl, bool isLossy, bool outputDwt, eDWTBackend backend = DEVICE_DWT,
+               size_t uploadRingDepth = DEFAULT_UPLOAD_RING_DEPTH, const OCLWindowConfig* windowConfig = NULL,
+               eTier1Backend tier1Backend = HOST_TIER1);
     ~OCLEncoder(void);
     void run(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision);
+    // wait for the device, and for the tier-1 and tier-2 coding of the last frame
+    void finish(void);
+    // code block size of subsequent frames; returns false, and keeps the current size,
+    // if the size is not a legal JPEG 2000 code block size
+    bool setCodeBlockSize(size_t codeblockX, size_t codeblockY);
+    // order in which the BPC codes the blocks of subsequent frames; the estimated occupancy
+    // of each BPC launch is reported when profiling
+    void setBPCSchedule(eBPCSchedule schedule) {
+        if (bpc)
+            bpc->setSchedule(schedule);
+    }
+    // rate control of subsequent code streams: code block passes are truncated to fit in targetBytes,
+    // including headers, and to the fewest that reach targetPSNR; zero means no target
+    void setRateControl(size_t targetBytes, double targetPSNR) {
+        streamParams.targetBytes = targetBytes;
+        streamParams.targetPSNR = targetPSNR;
+    }
+    // quality layers of subsequent code streams: layerBytes holds a byte target for each layer but the last,
+    // or is empty for layers that each take half the bytes of the next
+    void setLayers(size_t numLayers, const std::vector<size_t>& layerBytes) {
+        streamParams.numLayers = numLayers;
+        streamParams.layerBytes = layerBytes;
+    }
+    // progression order (J2K_PROG_*) and precinct sizes of subsequent code streams, as in HostCodestreamParams
+    void setProgression(unsigned int progression, const std::vector<size_t>& precinctWidth, const std::vector<size_t>& precinctHeight) {
+        streamParams.progression = progression;
+        streamParams.precinctWidth = precinctWidth;
+        streamParams.precinctHeight = precinctHeight;
+    }
+    tDeviceRC mapDWTOut(void** mappedPtr, size_t* rowPitch = NULL);
+    tDeviceRC unmapDWTOut(void* mappedPtr);
+    // blocking read of the (CX,D) pairs of every code block of the last frame
+    tDeviceRC readBPCOutput(OCLBPCOutput& output);
+    // MQ coded code blocks of the last frame; valid after finish()
+    const HostTier1Output& getTier1Output() {
+        return tier1Output;
+    }
+    // code stream of the last frame; valid after finish()
+    const HostOutputArena& getCodestream() {
+        return codestream;
+    }
 private:
+    void runHostDWT(std::vector<T*> components,size_t w,size_t h, size_t levels, size_t precision);
+    // enqueue the map of the BPC output of the last run, ahead of the next frame
+    void enqueueTier1Input();
+    // wait for that map, or read back the output of the device MQ coder. Either may code
+    // the last run again, so this must be called before the next DWT
+    void waitForTier1Input();
+    // wait for tier-1 coding of the mapped BPC output, and release its output set
+    void releaseTier1Input();
+    // hand the waited for BPC output to the tier-1 encoder
+    void startTier1();
+    // complete tier-1 coding, and release the mapped BPC output
+    void finishTier1();
+    // read back the code words of the device MQ coder
+    void readDeviceTier1();
+    // write the code stream of the completed tier-1 output
+    void finishTier2();
+    eDWTBackend backend;
+    HostDWTForward<T>* hostDwt;
     OCLDWTForward<T>* dwt;
     OCLBPC<T>* bpc;
     OCLRGBtoPlanar<T>* rgbToPlanar;
+    size_t codeBlockX;
+    size_t codeBlockY;
+    HostTier1Encoder* tier1;
+    OCLMQEncoder* mq;
+    HostMQEncoder hostMQ;       // codes the blocks that the device MQ coder could not
+    HostTier1Output tier1Output;
+    bool bpcPending;            // BPC output of the last run has not been handed to tier1
+    bool mapPending;            // pendingOutput is mapped, but not yet handed to tier1
+    bool bpcMapped;             // bpcOutput is mapped, and tier1 may be coding it
+    OCLBPCMappedOutput pendingOutput;
+    OCLBPCMappedOutput bpcOutput;
+    HostTier2Encoder tier2;
+    HostOutputArena codestream;
+    bool tier2Pending;          // tier-1 output has not been written to the code stream
+    HostCodestreamParams streamParams;  // coding options; the geometry is that of each frame
+    std::vector<size_t> geometry;   // w, h, levels, components, code block size and precision of the last run
 };
@@ -14,13 +14,19 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "OCLKernel.h"
+#include "OCLProgramCache.h"
+#include "OCLProfiler.h"
 
 
 OCLKernel::OCLKernel(KernelInitInfo initInfo) : myKernel(0),
     queue(initInfo.cmd_queue),
     program(0),
+    localMemorySize(0),
     device(0),
-    context(0)
+    context(0),
+    profiler(initInfo.profiler),
+    profileStage(initInfo.programName.substr(0, initInfo.programName.find('.'))),
+    profileName(initInfo.kernelName)
 {
     CreateAndBuildKernel(initInfo.programName, initInfo.kernelName, initInfo.buildOptions);
     deviceQueue = new OCLQueue(QueueInfo(queue));
@@ -60,7 +66,7 @@ int ReadSourceFromFile(const char* fileName, char** source, size_t* sourceSize)
         *source = new char[*sourceSize];
         if (*source == NULL)
         {
-            LogError("Couldn't allocate %d bytes for program source from file '%s'.", *sourceSize, fileName);
+            LogError("Couldn't allocate %u bytes for program source from file '%s'.", (unsigned int)*sourceSize, fileName);
             errorCode = CL_OUT_OF_HOST_MEMORY;
         }
         else {
@@ -77,6 +83,7 @@ int OCLKernel::CreateAndBuildKernel(std::string openCLFileName, std::string kern
 {
     cl_int error_code;
     size_t src_size = 0;
+    char* source = NULL;
 
     // Obtaining the OpenCL context from the command-queue properties
     error_code = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, NULL);
@@ -104,7 +111,6 @@ int OCLKernel::CreateAndBuildKernel(std::string openCLFileName, std::string kern
 
     // Upload the OpenCL C source code from the input file to source
     // The size of the C program is returned in sourceSize
-    char* source = NULL;
     error_code = ReadSourceFromFile(openCLFileName.c_str(), &source, &src_size);
     if (CL_SUCCESS != error_code)
     {
@@ -112,32 +118,11 @@ int OCLKernel::CreateAndBuildKernel(std::string openCLFileName, std::string kern
         goto Finish;
     }
 
-    // Create program object from the OpenCL C code
-    program = clCreateProgramWithSource(context, 1, (const char**)&source, &src_size, &error_code);
-    if (CL_SUCCESS != error_code)
+    // Load the program from the binary cache, or build it from source
+    program = OCLProgramCache(context, device).getProgram(openCLFileName, source, src_size, buildOptions, &error_code);
+    if (!program)
     {
-        LogError("clCreateProgramWithSource returned %s.", TranslateOpenCLError(error_code));
-        goto Finish;
-    }
-
-    // Build (compile & link) the OpenCL C code
-    error_code = clBuildProgram(program, 1, &device,  buildOptions.c_str(), NULL, NULL);
-    if (error_code != CL_SUCCESS)
-    {
-        LogError("clBuildProgram() for source program returned %s.", TranslateOpenCLError(error_code));
-
-        // In case of error print the build log to the standard output
-        // First check the size of the log
-        // Then allocate the memory and obtain the log from the program
-        size_t log_size = 0;
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-
-        char* build_log = new char[log_size];
-        clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
-
-        printf("Build Fail Log: \t%s", build_log);
-
-        delete[] build_log;
+        LogError("OCLProgramCache::getProgram returned %s.", TranslateOpenCLError(error_code));
         goto Finish;
     }
 
@@ -174,16 +159,28 @@ tDeviceRC OCLKernel::enqueue(int dimension, size_t global_work_size[3], size_t l
 }
 
 tDeviceRC OCLKernel::enqueue(int dimension, size_t global_work_offset[3], size_t global_work_size[3], size_t local_work_size[3]) {
+    return enqueue(dimension, global_work_offset, global_work_size, local_work_size, 0, NULL, NULL);
+}
+
+tDeviceRC OCLKernel::enqueue(int dimension, size_t global_work_offset[3], size_t global_work_size[3], size_t local_work_size[3],
+                             cl_uint numWaitEvents, const cl_event* waitList, cl_event* event) {
 
-    // Enqueue the command to synchronously execute the kernel on the device
-    // The number of dimensions to be used by the global work-items and by work-items in the work-group is 2
-    // The global IDs start at offset (0, 0)
-    // The command should be executed immediately (without conditions)
-    cl_int error_code = clEnqueueNDRangeKernel(queue, myKernel, dimension, global_work_offset, global_work_size, local_work_size, 0, NULL, NULL);
+    // Enqueue the command to asynchronously execute the kernel on the device
+    // The global IDs start at offset global_work_offset
+    // The command is executed once all events in waitList have completed
+    bool profile = profiler && profiler->isEnabled();
+    cl_event profileEvent = 0;
+    cl_int error_code = clEnqueueNDRangeKernel(queue, myKernel, dimension, global_work_offset, global_work_size, local_work_size,
+                        numWaitEvents, numWaitEvents ? waitList : NULL, (event || !profile) ? event : &profileEvent);
     if (CL_SUCCESS != error_code)
     {
         LogError("clEnqueueNDRangeKernel returned %s.", TranslateOpenCLError(error_code));
         return error_code;
     }
+    if (profile) {
+        profiler->record(profileStage, profileName, event ? *event : profileEvent);
+        if (profileEvent)
+            clReleaseEvent(profileEvent);
+    }
     return CL_SUCCESS;
 }
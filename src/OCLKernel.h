@@ -32,13 +32,28 @@ public:
     cl_device_id getDevice() {
         return device;
     }
+    cl_context getContext() {
+        return context;
+    }
+    cl_ulong getLocalMemorySize() {
+        return localMemorySize;
+    }
     tDeviceRC enqueue(int dimension,  size_t global_work_size[3], size_t local_work_size[3]);
     tDeviceRC execute(int dimension, size_t global_work_size[3],  size_t local_work_size[3]);
     tDeviceRC enqueue(int dimension, size_t global_work_offset[3], size_t global_work_size[3], size_t local_work_size[3]);
     tDeviceRC execute(int dimension, size_t global_work_offset[3], size_t global_work_size[3],  size_t local_work_size[3]);
+    // enqueue after the events in waitList have completed; if event is not NULL, it returns
+    // an event that the caller must release
+    tDeviceRC enqueue(int dimension, size_t global_work_offset[3], size_t global_work_size[3], size_t local_work_size[3],
+                      cl_uint numWaitEvents, const cl_event* waitList, cl_event* event);
     tDeviceRC finish() {
         return deviceQueue->finish();
     }
+    // name under which subsequent enqueues are reported by the profiler
+    void setProfileName(std::string stage, std::string name) {
+        profileStage = stage;
+        profileName = name;
+    }
 protected:
     int CreateAndBuildKernel(std::string openCLFileName, std::string kernelName, std::string buildOptions);
     cl_kernel myKernel;
@@ -48,5 +63,8 @@ protected:
     cl_device_id device;
     cl_context context;
     OCLQueue* deviceQueue;
+    OCLProfiler* profiler;
+    std::string profileStage;
+    std::string profileName;
 };
 
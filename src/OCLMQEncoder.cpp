@@ -0,0 +1,289 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "OCLMQEncoder.h"
+#include "OCLBasic.h"
+
+// must match oclmq.cl: virtual byte and flush bytes of each code block reservation
+static const size_t MQ_SCRATCH_OVERHEAD = 1 + 16;
+
+// code blocks per work group
+static const size_t MQ_WORK_GROUP_SIZE = 64;
+
+OCLMQEncoder::OCLMQEncoder(KernelInitInfoBase initInfo) :
+    initInfo(initInfo),
+    mq(new OCLKernel( KernelInitInfo(initInfo, "oclmq.cl", "run") )),
+    workListEntries(0),
+    workListCounts(0),
+    counts(NULL),
+    blocksPerChannel(0),
+    numBlocks(0),
+    blockCapacity(0),
+    scratchCapacity(0),
+    scratchBuffer(0),
+    scratchHeadBuffer(0),
+    mqInfoBuffer(0),
+    codewordBuffer(0),
+    codewordHeadBuffer(0),
+    zero(0)
+{
+}
+
+OCLMQEncoder::~OCLMQEncoder(void)
+{
+    releaseBuffers();
+    if (mq)
+        delete mq;
+}
+
+void OCLMQEncoder::releaseBuffers() {
+    if (scratchBuffer)
+        clReleaseMemObject(scratchBuffer);
+    if (scratchHeadBuffer)
+        clReleaseMemObject(scratchHeadBuffer);
+    if (mqInfoBuffer)
+        clReleaseMemObject(mqInfoBuffer);
+    if (codewordBuffer)
+        clReleaseMemObject(codewordBuffer);
+    if (codewordHeadBuffer)
+        clReleaseMemObject(codewordHeadBuffer);
+    scratchBuffer = 0;
+    scratchHeadBuffer = 0;
+    mqInfoBuffer = 0;
+    codewordBuffer = 0;
+    codewordHeadBuffer = 0;
+    blockCapacity = 0;
+    scratchCapacity = 0;
+}
+
+tDeviceRC OCLMQEncoder::createBuffer(cl_mem* buffer, cl_mem_flags flags, size_t size) {
+    cl_int error_code = CL_SUCCESS;
+    *buffer = clCreateBuffer(mq->getContext(), flags, size, NULL, &error_code);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clCreateBuffer returned %s.", TranslateOpenCLError(error_code));
+        *buffer = 0;
+    }
+    return error_code;
+}
+
+tDeviceRC OCLMQEncoder::allocate(size_t cxdCapacity, size_t blocks) {
+    // every code word fits into its reservation of one byte per pair, plus overhead
+    size_t capacity = cxdCapacity + blocks * MQ_SCRATCH_OVERHEAD;
+    if (scratchBuffer && blocks <= blockCapacity && capacity <= scratchCapacity)
+        return DeviceSuccess;
+    releaseBuffers();
+
+    tDeviceRC error_code = createBuffer(&scratchBuffer, CL_MEM_READ_WRITE, capacity);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&scratchHeadBuffer, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&mqInfoBuffer, CL_MEM_WRITE_ONLY, blocks * MQ_INFO_SIZE * sizeof(cl_uint));
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&codewordBuffer, CL_MEM_WRITE_ONLY, capacity);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    error_code = createBuffer(&codewordHeadBuffer, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    if (DeviceSuccess != error_code)
+        return error_code;
+    blockCapacity = blocks;
+    scratchCapacity = capacity;
+    return DeviceSuccess;
+}
+
+tDeviceRC OCLMQEncoder::run(const OCLBPCOutputSet& input, const OCLBPCWorkList& workList) {
+    workListEntries = workList.entries;
+    workListCounts = workList.counts;
+    // the list lengths are not known on the host yet
+    counts = &workList.hostCounts;
+    blocksPerChannel = workList.blocksPerChannel;
+    numBlocks = workList.numChannels * workList.blocksPerChannel;
+    if (!numBlocks)
+        return DeviceSuccess;
+    tDeviceRC error_code = allocate(input.cxdCapacity, numBlocks);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    cl_mem heads[] = {scratchHeadBuffer, codewordHeadBuffer};
+    for (size_t i = 0; i < 2; ++i) {
+        error_code = clEnqueueWriteBuffer(initInfo.cmd_queue, heads[i], CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clEnqueueWriteBuffer returned %s.", TranslateOpenCLError(error_code));
+            return error_code;
+        }
+    }
+    error_code = setKernelArgs(input);
+    if (DeviceSuccess != error_code)
+        return error_code;
+    // one work item per work list entry; entries past the count of their channel exit at once
+    size_t local_work_size[3] = {MQ_WORK_GROUP_SIZE};
+    size_t global_work_size[3] = {((numBlocks + MQ_WORK_GROUP_SIZE - 1) / MQ_WORK_GROUP_SIZE) * MQ_WORK_GROUP_SIZE};
+    mq->setProfileName("mq", "code blocks");
+    return mq->enqueue(1, global_work_size, local_work_size);
+}
+
+tDeviceRC OCLMQEncoder::readOutput(HostTier1Output* output, std::vector<size_t>& incomplete) {
+    incomplete.clear();
+    output->blocks.assign(numBlocks, HostCodeBlockStream());
+    if (!counts)
+        return CL_INVALID_OPERATION;
+    size_t listed = 0;
+    for (size_t i = 0; i < counts->size(); ++i)
+        listed += (*counts)[i];
+    if (!listed)
+        return DeviceSuccess;
+    if (!mqInfoBuffer)
+        return CL_INVALID_MEM_OBJECT;
+    cl_uint head = 0;
+    cl_int error_code = clEnqueueReadBuffer(initInfo.cmd_queue, codewordHeadBuffer, CL_TRUE, 0, sizeof(cl_uint), &head, 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    std::vector<cl_uint> info(numBlocks * MQ_INFO_SIZE);
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, mqInfoBuffer, CL_TRUE, 0, info.size() * sizeof(cl_uint), &info[0], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    std::vector<cl_uint2> entries(numBlocks);
+    error_code = clEnqueueReadBuffer(initInfo.cmd_queue, workListEntries, CL_TRUE, 0, entries.size() * sizeof(cl_uint2), &entries[0], 0, NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    std::vector<unsigned char> codewords(head);
+    if (head) {
+        error_code = clEnqueueReadBuffer(initInfo.cmd_queue, codewordBuffer, CL_TRUE, 0, head, &codewords[0], 0, NULL, NULL);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clEnqueueReadBuffer returned %s.", TranslateOpenCLError(error_code));
+            return error_code;
+        }
+    }
+
+    for (size_t channel = 0; channel < counts->size(); ++channel) {
+        for (size_t i = channel * blocksPerChannel; i < channel * blocksPerChannel + (*counts)[channel]; ++i) {
+            const cl_uint* src = &info[i * MQ_INFO_SIZE];
+            size_t block = entries[i].s[0];
+            HostCodeBlockStream& stream = output->blocks[block];
+            if (src[1] == MQ_BLOCK_OVERFLOW) {
+                incomplete.push_back(block);
+                continue;
+            }
+            stream.data.assign(codewords.begin() + src[0], codewords.begin() + src[0] + src[1]);
+            stream.numBitPlanes = src[2];
+            stream.passRates.assign(src + 4, src + 4 + src[3]);
+            stream.passDistortions.resize(src[3]);
+            for (size_t pass = 0; pass < src[3]; ++pass)
+                stream.passDistortions[pass] = asFloat(src[MQ_INFO_DISTORTION + pass]);
+        }
+    }
+    return DeviceSuccess;
+}
+
+tDeviceRC OCLMQEncoder::setKernelArgs(const OCLBPCOutputSet& input) {
+    int numKernelArgs = 0;
+    cl_kernel targetKernel = mq->getKernel();
+    cl_uint cxdCapacity = (cl_uint)input.cxdCapacity;
+    cl_uint perChannel = (cl_uint)blocksPerChannel;
+    cl_uint blocks = (cl_uint)numBlocks;
+    cl_uint capacity = (cl_uint)scratchCapacity;
+    cl_int error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &input.blockInfo);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &workListEntries);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &workListCounts);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(perChannel), &perChannel);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(blocks), &blocks);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &input.cxd);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cxdCapacity), &cxdCapacity);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &scratchBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &scratchHeadBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(capacity), &capacity);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &mqInfoBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &codewordBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    error_code = clSetKernelArg(targetKernel, numKernelArgs++, sizeof(cl_mem), &codewordHeadBuffer);
+    if (DeviceSuccess != error_code)
+    {
+        LogError("setKernelArgs returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    return DeviceSuccess;
+}
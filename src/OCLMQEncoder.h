@@ -0,0 +1,68 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include "OCLKernel.h"
+#include "OCLBPC.h"
+#include "HostTier1Encoder.h"
+#include <vector>
+
+// per work list entry: code word offset and length, number of bit planes, number of passes,
+// the truncation length of each pass, then the distortion reduction of each pass; must match oclmq.cl
+const size_t MQ_INFO_SIZE = 4 + 2 * BPC_MAX_PASSES;
+const size_t MQ_INFO_DISTORTION = 4 + BPC_MAX_PASSES;
+// code word length of a block that the device could not code
+const cl_uint MQ_BLOCK_OVERFLOW = 0xFFFFFFFF;
+
+/*
+Device MQ coder: codes the BPC output of a frame with one work item per entry of the BPC work list,
+and packs the code words together, so that only compressed bytes are read back.
+*/
+class OCLMQEncoder
+{
+public:
+    OCLMQEncoder(KernelInitInfoBase initInfo);
+    ~OCLMQEncoder(void);
+    // code the blocks of workList in input
+    tDeviceRC run(const OCLBPCOutputSet& input, const OCLBPCWorkList& workList);
+    // blocking read of the code words of the last run into output->blocks; blocks that are
+    // not in the work list get empty streams. The work list must not have been rewritten since the run,
+    // and its lengths must have been read back: OCLBPC::complete must have returned since the run.
+    // Blocks that the device could not code are listed in incomplete
+    tDeviceRC readOutput(HostTier1Output* output, std::vector<size_t>& incomplete);
+private:
+    tDeviceRC allocate(size_t cxdCapacity, size_t numBlocks);
+    tDeviceRC createBuffer(cl_mem* buffer, cl_mem_flags flags, size_t size);
+    void releaseBuffers();
+    tDeviceRC setKernelArgs(const OCLBPCOutputSet& input);
+    KernelInitInfoBase initInfo;
+    OCLKernel* mq;
+
+    // work list of the last run
+    cl_mem workListEntries;
+    cl_mem workListCounts;
+    const std::vector<cl_uint>* counts;     // read back lengths of the work list
+    size_t blocksPerChannel;
+    size_t numBlocks;
+    size_t blockCapacity;
+    size_t scratchCapacity;
+    cl_mem scratchBuffer;
+    cl_mem scratchHeadBuffer;
+    cl_mem mqInfoBuffer;
+    cl_mem codewordBuffer;
+    cl_mem codewordHeadBuffer;
+    cl_uint zero;
+};
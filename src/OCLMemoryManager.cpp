@@ -18,9 +18,9 @@
 #include "OCLMemoryManager.h"
 #include <math.h>
 #include "OCLBasic.h"
+#include "OCLProfiler.h"
 
-template<typename T> OCLMemoryManager<T>::OCLMemoryManager(ocl_args_d_t* ocl, bool lossy, bool outputDwt) :ocl(ocl),
-    rgbBuffer(NULL),
+template<typename T> OCLMemoryManager<T>::OCLMemoryManager(ocl_args_d_t* ocl, bool lossy, bool outputDwt, size_t uploadRingDepth) :ocl(ocl),
     width(0),
     height(0),
     _levels(0),
@@ -28,46 +28,55 @@ template<typename T> OCLMemoryManager<T>::OCLMemoryManager(ocl_args_d_t* ocl, bo
     numComponents(0),
     lossy(lossy),
     dwtOut(0),
-    onlyDwtOut(outputDwt)
+    onlyDwtOut(outputDwt),
+    bufferMode(devicePrefersBuffers(ocl->device)),
+    transferManager(new OCLDataTransferManager(ocl, uploadRingDepth)),
+    uploadEvent(0),
+    currentSlot(0),
+    profiler(NULL),
+    mapEvent(0)
 {
-
+    if (bufferMode)
+        LogInfo("device has poor image support: using buffers for images");
 }
 
 template<typename T> OCLMemoryManager<T>::~OCLMemoryManager(void)
 {
     freeBuffers();
+    if (transferManager)
+        delete transferManager;
 }
 
-template<typename T> void OCLMemoryManager<T>::fillHostInputBuffer(std::vector<T*> components, size_t w, size_t h) {
+template<typename T> void OCLMemoryManager<T>::fillHostInputBuffer(std::vector<T*> components, T* dest, size_t w, size_t h) {
+    OCLHostScope scope(profiler, "fillHostInputBuffer");
 
     if (components.size() == 4) {
         int rgbIndex = 0;
         for (unsigned int i = 0; i < w*h; i++) {
-            rgbBuffer[rgbIndex++] = components[0][i];
-            rgbBuffer[rgbIndex++] = components[1][i];
-            rgbBuffer[rgbIndex++] = components[2][i];
-            rgbBuffer[rgbIndex++] = components[3][i];
+            dest[rgbIndex++] = components[0][i];
+            dest[rgbIndex++] = components[1][i];
+            dest[rgbIndex++] = components[2][i];
+            dest[rgbIndex++] = components[3][i];
         }
     } else {
-        memcpy(rgbBuffer, components[0], w*h*sizeof(T));
+        memcpy(dest, components[0], w*h*sizeof(T));
     }
 }
 
-template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,	size_t w,	size_t h, size_t levels,size_t precision) {
+template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,	size_t w,	size_t h, size_t levels,size_t precision, bool uploadInput) {
     if (w <=0 || h <= 0 || components.size() == 0 || levels <= 0)
         return;
+    OCLHostScope scope(profiler, "OCLMemoryManager::init");
 
-    if (w != width || h != height || levels != _levels || precision != _precision) {
+    // the upload ring is only allocated once the manager uploads input
+    if (w != width || h != height || levels != _levels || precision != _precision || components.size() != numComponents ||
+            (uploadInput && hostRing.empty())) {
         width = w;
         height = h;
         _levels = levels;
         _precision = precision;
         numComponents = components.size();
         freeBuffers();
-        cl_uint align = requiredOpenCLAlignment(ocl->device);
-        rgbBuffer = (T*)aligned_malloc(w*h*sizeof(T) * numComponents, 4*1024);
-
-        fillHostInputBuffer(components,w,h);
 
         cl_context context  = NULL;
         // Obtain the OpenCL context from the command-queue properties
@@ -98,10 +107,10 @@ template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,
         format.image_channel_data_type = (onlyDwtOut && lossy) ? CL_FLOAT : CL_SIGNED_INT16;
 
         LogInfo("trying to create image");
-        dwtOut = clCreateImage (context, CL_MEM_READ_WRITE, &format, &desc, NULL,&error_code);
+        dwtOut = createImage(context, format, desc, &error_code);
         if (CL_SUCCESS != error_code)
         {
-            LogError("clCreateImage (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+            LogError("createImage returned %s.", TranslateOpenCLError(error_code));
             return;
         }
 
@@ -109,10 +118,10 @@ template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,
             format.image_channel_order = CL_R;
             format.image_channel_data_type = CL_SIGNED_INT16;
             for(int i = 0; i < 4; ++i) {
-                cl_mem temp = clCreateImage (context, CL_MEM_READ_WRITE, &format, &desc, NULL,&error_code);
+                cl_mem temp = createImage(context, format, desc, &error_code);
                 if (CL_SUCCESS != error_code)
                 {
-                    LogError("clCreateImage (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+                    LogError("createImage returned %s.", TranslateOpenCLError(error_code));
                     return;
                 }
                 dwtOutChannels.push_back(temp);
@@ -123,14 +132,25 @@ template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,
         //allocate input images
         format.image_channel_order = numComponents == 4 ? CL_RGBA : CL_R;
         format.image_channel_data_type = lossy ? CL_FLOAT : CL_SIGNED_INT16;
+        // without uploads, as for the decoder and the host DWT, one full resolution image is enough
+        size_t ringDepth = uploadInput ? transferManager->getRingDepth() : 1;
         for (size_t i =0; i < levels; ++i) {
-            cl_mem temp = clCreateImage (context, CL_MEM_READ_WRITE, &format, &desc, NULL,&error_code);
-            if (CL_SUCCESS != error_code)
-            {
-                LogError("clCreateImage (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
-                return;
+            // full resolution input is a ring of images, so that uploads can run ahead of the kernels
+            size_t numImages = (i == 0) ? ringDepth : 1;
+            for (size_t j = 0; j < numImages; ++j) {
+                cl_mem temp = createImage(context, format, desc, &error_code);
+                if (CL_SUCCESS != error_code)
+                {
+                    LogError("createImage returned %s.", TranslateOpenCLError(error_code));
+                    return;
+                }
+                if (i == 0)
+                    uploadRing.push_back(temp);
+                else
+                    dwtIn.push_back(temp);
             }
-            dwtIn.push_back(temp);
+            if (i == 0)
+                dwtIn.push_back(uploadRing[0]);
             desc.image_width = divRndUp(desc.image_width, 2);
             desc.image_height = divRndUp(desc.image_height, 2);
         }
@@ -138,31 +158,163 @@ template<typename T>  void OCLMemoryManager<T>::init(std::vector<T*> components,
     #error "OpenCL versions below 1.2 currently not supported"
 #endif // #if defined(CL_VERSION_1_2)
 
-        hostToDWTIn();
+        // pinned staging buffers, mapped once for the lifetime of the ring
+        size_t hostBufferSize = w*h*sizeof(T) * numComponents;
+        for (size_t i = 0; uploadInput && i < ringDepth; ++i) {
+            cl_mem temp = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, hostBufferSize, NULL, &error_code);
+            if (CL_SUCCESS != error_code)
+            {
+                LogError("clCreateBuffer returned %s.", TranslateOpenCLError(error_code));
+                return;
+            }
+            hostRing.push_back(temp);
+            T* ptr = (T*)clEnqueueMapBuffer(ocl->commandQueue, temp, CL_TRUE, CL_MAP_WRITE, 0, hostBufferSize, 0, NULL, NULL, &error_code);
+            if (CL_SUCCESS != error_code)
+            {
+                LogError("clEnqueueMapBuffer returned %s.", TranslateOpenCLError(error_code));
+                return;
+            }
+            hostRingPtrs.push_back(ptr);
+            inputReleaseEvents.push_back(0);
+        }
+    }
+    if (uploadInput)
+        hostToDWTIn(components);
+
+}
+
+// image object, or, in buffer mode, a buffer holding the image's pixels in row major order
+template<typename T> cl_mem OCLMemoryManager<T>::createImage(cl_context context, cl_image_format format, cl_image_desc desc, cl_int* error_code) {
+    if (!bufferMode)
+        return clCreateImage(context, CL_MEM_READ_WRITE, &format, &desc, NULL, error_code);
+    size_t channels = (format.image_channel_order == CL_RGBA) ? 4 : 1;
+    size_t sampleSize = (format.image_channel_data_type == CL_FLOAT) ? sizeof(cl_float) : sizeof(cl_short);
+    return clCreateBuffer(context, CL_MEM_READ_WRITE, desc.image_width * desc.image_height * channels * sampleSize, NULL, error_code);
+}
 
+template<typename T> tDeviceRC OCLMemoryManager<T>::setBufferImageArgs(cl_kernel kernel, cl_uint firstArg) {
+    if (!bufferMode)
+        return CL_SUCCESS;
+    cl_uint args[3] = {static_cast<cl_uint>(width), static_cast<cl_uint>(height), static_cast<cl_uint>(numComponents)};
+    for (cl_uint i = 0; i < 3; ++i) {
+        cl_int error_code = clSetKernelArg(kernel, firstArg + i, sizeof(cl_uint), args + i);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clSetKernelArg returned %s.", TranslateOpenCLError(error_code));
+            return error_code;
+        }
+    }
+    return CL_SUCCESS;
+}
+
+template<typename T> tDeviceRC OCLMemoryManager<T>::hostToDWTOut(void* src) {
+    if (!dwtOut || !src)
+        return CL_INVALID_MEM_OBJECT;
+    cl_int error_code = CL_SUCCESS;
+    if (bufferMode) {
+        size_t size = 0;
+        error_code = clGetMemObjectInfo(dwtOut, CL_MEM_SIZE, sizeof(size), &size, NULL);
+        if (CL_SUCCESS == error_code)
+            error_code = clEnqueueWriteBuffer(ocl->commandQueue, dwtOut, CL_TRUE, 0, size, src, 0, NULL, profileEvent());
     } else {
-        fillHostInputBuffer(components,width,height);
-        hostToDWTIn();
+        size_t origin[] = {0,0,0};
+        size_t region[] = {width, height, 1};
+        error_code = clEnqueueWriteImage(ocl->commandQueue, dwtOut, CL_TRUE, origin, region, 0, 0, src, 0, NULL, profileEvent());
+    }
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("hostToDWTOut: write returned %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    if (mapEvent) {
+        profiler->record("upload", "write dwt image", mapEvent);
+        clReleaseEvent(mapEvent);
+        mapEvent = 0;
     }
+    return CL_SUCCESS;
+}
+
+template<typename T> tDeviceRC OCLMemoryManager<T>::hostToDWTIn(std::vector<T*> components) {
+    if (hostRingPtrs.empty())
+        return CL_INVALID_MEM_OBJECT;
+
+    // blocks only if all ring slots still have uploads in flight
+    size_t slot = transferManager->acquireSlot();
+
+    fillHostInputBuffer(components, hostRingPtrs[slot], width, height);
+
+    HostToDeviceInfo info;
+    info.src = hostRingPtrs[slot];
+    info.width = width;
+    info.height = height;
+    info.dst = uploadRing[slot];
+    if (bufferMode)
+        info.bufferSize = width*height*sizeof(T) * numComponents;
+    info.slot = slot;
+    info.waitEvent = inputReleaseEvents[slot];
+    cl_int error_code = transferManager->upload(info);
+
+    if (inputReleaseEvents[slot]) {
+        clReleaseEvent(inputReleaseEvents[slot]);
+        inputReleaseEvents[slot] = 0;
+    }
+    if (uploadEvent) {
+        clReleaseEvent(uploadEvent);
+        uploadEvent = 0;
+    }
+    if (CL_SUCCESS != error_code)
+        return error_code;
 
+    uploadEvent = info.uploadEvent;
+    currentSlot = slot;
+    dwtIn[0] = uploadRing[slot];
+    return CL_SUCCESS;
 }
 
-template<typename T> tDeviceRC OCLMemoryManager<T>::hostToDWTIn() {
-    size_t origin[] = {0,0,0}; // Defines the offset in pixels in the image from where to write.
-    size_t region[] = {width, height, 1}; // Size of object to be transferred
-    cl_int error_code = clEnqueueWriteImage(ocl->commandQueue, dwtIn[0], CL_TRUE, origin, region,0,0, rgbBuffer, 0, NULL,NULL);
+template<typename T> void OCLMemoryManager<T>::setInputReleaseEvent(cl_event event) {
+    if (!event || currentSlot >= inputReleaseEvents.size())
+        return;
+    if (inputReleaseEvents[currentSlot])
+        clReleaseEvent(inputReleaseEvents[currentSlot]);
+    clRetainEvent(event);
+    inputReleaseEvents[currentSlot] = event;
+    // the next upload into this slot waits on the event from the transfer queue,
+    // which is only guaranteed to make progress once the compute queue has been flushed
+    cl_int error_code = clFlush(ocl->commandQueue);
     if (CL_SUCCESS != error_code)
     {
-        LogError("clEnqueueWriteImage (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+        LogError("clFlush returned %s.", TranslateOpenCLError(error_code));
     }
-    return error_code;
+}
 
+template<typename T> void OCLMemoryManager<T>::setProfiler(OCLProfiler* prof) {
+    profiler = prof;
+    if (profiler)
+        profiler->setQueueName(ocl->commandQueue, "compute queue");
+    transferManager->setProfiler(prof);
+}
+
+template<typename T> cl_event* OCLMemoryManager<T>::profileEvent() {
+    mapEvent = 0;
+    return (profiler && profiler->isEnabled()) ? &mapEvent : NULL;
+}
+
+template<typename T> void OCLMemoryManager<T>::recordProfileEvent(std::string name) {
+    if (!mapEvent)
+        return;
+    profiler->record("map", name, mapEvent);
+    clReleaseEvent(mapEvent);
+    mapEvent = 0;
 }
 
 template<typename T> tDeviceRC OCLMemoryManager<T>::mapImage(cl_mem img, void** mappedPtr) {
     if (!mappedPtr)
         return -1;
 
+    if (bufferMode)
+        return mapBuffer(img, mappedPtr);
+
+    OCLHostScope scope(profiler, "OCLMemoryManager::mapImage");
     cl_int error_code = CL_SUCCESS;
     size_t image_dimensions[3] = { width, height, 1 };
     size_t image_origin[3] = { 0, 0, 0 };
@@ -178,14 +330,80 @@ template<typename T> tDeviceRC OCLMemoryManager<T>::mapImage(cl_mem img, void**
                                       NULL,
                                       0,
                                       NULL,
-                                      NULL,
+                                      profileEvent(),
                                       &error_code);
     if (CL_SUCCESS != error_code)
     {
         LogError("clEnqueueMapImage return %s.", TranslateOpenCLError(error_code));
 
     }
+    recordProfileEvent("map image");
+
+    return error_code;
+}
+
+template<typename T> tDeviceRC OCLMemoryManager<T>::mapDWTOutForWrite(void** mappedPtr, size_t* rowPitch, size_t x, size_t y, size_t w, size_t h) {
+    if (!dwtOut)
+        return CL_INVALID_MEM_OBJECT;
+    OCLHostScope scope(profiler, "OCLMemoryManager::mapDWTOutForWrite");
+    // the previous contents of the region are not read back, since every sample of it is overwritten
+    tDeviceRC rc = mapRegion(dwtOut, width, height, ((onlyDwtOut && lossy) ? sizeof(cl_float) : sizeof(cl_short)) * numComponents, CL_MAP_WRITE_INVALIDATE_REGION,
+                             x, y, w ? w : width, h ? h : height, mappedPtr, rowPitch);
+    recordProfileEvent("map dwt image");
+    return rc;
+}
+
+template<typename T> tDeviceRC OCLMemoryManager<T>::mapDWTOutForRead(void** mappedPtr, size_t* rowPitch) {
+    if (!dwtOut)
+        return CL_INVALID_MEM_OBJECT;
+    OCLHostScope scope(profiler, "OCLMemoryManager::mapDWTOutForRead");
+    tDeviceRC rc = mapRegion(dwtOut, width, height, ((onlyDwtOut && lossy) ? sizeof(cl_float) : sizeof(cl_short)) * numComponents, CL_MAP_READ,
+                             0, 0, width, height, mappedPtr, rowPitch);
+    recordProfileEvent("map dwt image");
+    return rc;
+}
+
+template<typename T> tDeviceRC OCLMemoryManager<T>::mapDwtIn(size_t level, void** mappedPtr, size_t* rowPitch, size_t x, size_t y, size_t w, size_t h) {
+    cl_mem* img = getDwtIn(level);
+    if (!img)
+        return CL_INVALID_MEM_OBJECT;
+    OCLHostScope scope(profiler, "OCLMemoryManager::mapDwtIn");
+    size_t levelWidth = width, levelHeight = height;
+    for (size_t i = 0; i < level; ++i) {
+        levelWidth = divRndUp(levelWidth, 2);
+        levelHeight = divRndUp(levelHeight, 2);
+    }
+    tDeviceRC rc = mapRegion(*img, levelWidth, levelHeight, (lossy ? sizeof(cl_float) : sizeof(cl_short)) * numComponents, CL_MAP_READ,
+                             x, y, w, h, mappedPtr, rowPitch);
+    recordProfileEvent("map image");
+    return rc;
+}
 
+template<typename T> tDeviceRC OCLMemoryManager<T>::mapRegion(cl_mem mem, size_t memWidth, size_t memHeight, size_t pixelSize, cl_map_flags flags,
+        size_t x, size_t y, size_t w, size_t h, void** mappedPtr, size_t* rowPitch) {
+    if (!mappedPtr || !rowPitch || !w || !h || x + w > memWidth || y + h > memHeight)
+        return CL_INVALID_VALUE;
+
+    cl_int error_code = CL_SUCCESS;
+    if (bufferMode) {
+        // rows are contiguous in a buffer, so the mapping spans from the first sample to the last.
+        // Unless the region is whole rows, that span also covers samples outside of it, which
+        // an invalidating map would leave undefined
+        *rowPitch = memWidth * pixelSize;
+        if ((flags & CL_MAP_WRITE_INVALIDATE_REGION) && w != memWidth && h > 1)
+            flags = (flags & ~(cl_map_flags)CL_MAP_WRITE_INVALIDATE_REGION) | CL_MAP_WRITE;
+        *mappedPtr = clEnqueueMapBuffer(ocl->commandQueue, mem, CL_TRUE, flags, y * *rowPitch + x * pixelSize,
+                                        (h - 1) * *rowPitch + w * pixelSize, 0, NULL, profileEvent(), &error_code);
+    } else {
+        size_t image_dimensions[3] = { w, h, 1 };
+        size_t image_origin[3] = { x, y, 0 };
+        *mappedPtr = clEnqueueMapImage(ocl->commandQueue, mem, CL_TRUE, flags, image_origin, image_dimensions,
+                                       rowPitch, NULL, 0, NULL, profileEvent(), &error_code);
+    }
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("mapRegion returned %s.", TranslateOpenCLError(error_code));
+    }
     return error_code;
 }
 
@@ -193,22 +411,30 @@ template<typename T> tDeviceRC OCLMemoryManager<T>::mapBuffer(cl_mem buffer, voi
     if (!mappedPtr)
         return -1;
 
-    cl_int error_code = CL_SUCCESS;
-    *mappedPtr = clEnqueueMapImage(   ocl->commandQueue,
+    OCLHostScope scope(profiler, "OCLMemoryManager::mapBuffer");
+    size_t size = 0;
+    cl_int error_code = clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size), &size, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetMemObjectInfo return %s.", TranslateOpenCLError(error_code));
+        return error_code;
+    }
+    *mappedPtr = clEnqueueMapBuffer(  ocl->commandQueue,
                                       buffer,
                                       CL_TRUE,
                                       CL_MAP_READ,
                                       0,
-                                      width*height*sizeof(short),
-                                      0
-                                      NULL,
+                                      size,
+                                      0,
                                       NULL,
+                                      profileEvent(),
                                       &error_code);
     if (CL_SUCCESS != error_code)
     {
         LogError("clEnqueueMapBuffer return %s.", TranslateOpenCLError(error_code));
 
     }
+    recordProfileEvent("map buffer");
 
     return error_code;
 }
@@ -217,20 +443,32 @@ template<typename T> tDeviceRC OCLMemoryManager<T>::unmapMemory(cl_mem img, void
     if (!mappedPtr)
         return -1;
 
-    cl_int error_code = clEnqueueUnmapMemObject( ocl->commandQueue, img, mappedPtr, 0,NULL,NULL);
+    OCLHostScope scope(profiler, "OCLMemoryManager::unmapMemory");
+    cl_int error_code = clEnqueueUnmapMemObject( ocl->commandQueue, img, mappedPtr, 0,NULL,profileEvent());
     if (CL_SUCCESS != error_code)
     {
         LogError("clEnqueueUnmapMemObject return %s.", TranslateOpenCLError(error_code));
 
     }
+    recordProfileEvent("unmap");
     return error_code;
 
 }
 
 template<typename T> void OCLMemoryManager<T>::freeBuffers() {
-    if (rgbBuffer) {
-        aligned_free(rgbBuffer);
-        rgbBuffer = NULL;
+    if (!hostRing.empty()) {
+        // nothing may still be reading from or writing to the ring
+        transferManager->finish();
+        clFinish(ocl->commandQueue);
+    }
+    for(std::vector<cl_event>::iterator it = inputReleaseEvents.begin(); it != inputReleaseEvents.end(); ++it) {
+        if (*it)
+            clReleaseEvent(*it);
+    }
+    inputReleaseEvents.clear();
+    if (uploadEvent) {
+        clReleaseEvent(uploadEvent);
+        uploadEvent = 0;
     }
 
     cl_context context  = NULL;
@@ -241,8 +479,32 @@ template<typename T> void OCLMemoryManager<T>::freeBuffers() {
         LogError("clGetCommandQueueInfo (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
         return;
     }
-    // release old buffers
+    for (size_t i = 0; i < hostRing.size(); ++i) {
+        if (i < hostRingPtrs.size())
+            clEnqueueUnmapMemObject(ocl->commandQueue, hostRing[i], hostRingPtrs[i], 0, NULL, NULL);
+        error_code = clReleaseMemObject(hostRing[i]);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clReleaseMemObject (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+            return;
+        }
+    }
+    hostRing.clear();
+    hostRingPtrs.clear();
+
+    // release old buffers (dwtIn[0] is owned by the upload ring)
+    for(std::vector<cl_mem>::iterator it = uploadRing.begin(); it != uploadRing.end(); ++it) {
+        error_code = clReleaseMemObject(*it);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clReleaseMemObject (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
+            return;
+        }
+    }
+    uploadRing.clear();
     for(std::vector<cl_mem>::iterator it = dwtIn.begin(); it != dwtIn.end(); ++it) {
+        if (it == dwtIn.begin())
+            continue;
         error_code = clReleaseMemObject(*it);
         if (CL_SUCCESS != error_code)
         {
@@ -250,6 +512,7 @@ template<typename T> void OCLMemoryManager<T>::freeBuffers() {
             return;
         }
     }
+    dwtIn.clear();
 
     for(std::vector<cl_mem>::iterator it = dwtOutChannels.begin(); it != dwtOutChannels.end(); ++it) {
         error_code = clReleaseMemObject(*it);
@@ -259,6 +522,7 @@ template<typename T> void OCLMemoryManager<T>::freeBuffers() {
             return;
         }
     }
+    dwtOutChannels.clear();
 
     if (dwtOut) {
         error_code = clReleaseMemObject(dwtOut);
@@ -267,6 +531,7 @@ template<typename T> void OCLMemoryManager<T>::freeBuffers() {
             LogError("clReleaseMemObject (CL_QUEUE_CONTEXT) returned %s.", TranslateOpenCLError(error_code));
             return;
         }
+        dwtOut = 0;
     }
 
 }
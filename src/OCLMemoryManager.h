@@ -17,14 +17,16 @@
 
 #include "ocl_platform.h"
 #include "OCLUtil.h"
+#include "OCLDataTransferManager.h"
 
 #include <vector>
+#include <string>
 #include <stdint.h>
 
 template< typename T >  class OCLMemoryManager
 {
 public:
-    OCLMemoryManager(ocl_args_d_t* ocl, bool lossy, bool outputDwt);
+    OCLMemoryManager(ocl_args_d_t* ocl, bool lossy, bool outputDwt, size_t uploadRingDepth = DEFAULT_UPLOAD_RING_DEPTH);
     ~OCLMemoryManager(void);
     size_t getWidth() {
         return width;
@@ -44,6 +46,11 @@ public:
     bool isOnlyDwtOut() {
         return onlyDwtOut;
     }
+    // true if images are stored in plain buffers rather than image objects:
+    // kernels must then be built with -D USE_BUFFERS (see ocl_platform.cl)
+    bool isBufferMode() {
+        return bufferMode;
+    }
     cl_mem* getDWTOut() {
         return &dwtOut;
     }
@@ -57,9 +64,38 @@ public:
             return NULL;
         return &dwtIn[level];
     }
-    void init(std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision);
+    // allocate buffers for the given geometry, and upload the components, unless uploadInput is false;
+    // the upload ring and its staging buffers are only allocated for uploads
+    void init(std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision, bool uploadInput = true);
+    // blocking upload of a host transformed image to getDWTOut(), in the image's own format
+    tDeviceRC hostToDWTOut(void* src);
+
+    // event signalled when the current frame has been uploaded to getDwtIn(0)
+    cl_event getUploadEvent() {
+        return uploadEvent;
+    }
+    // event signalled when the last kernel reading getDwtIn(0) for the current frame has completed;
+    // the ring slot will not be overwritten before this event completes
+    void setInputReleaseEvent(cl_event event);
+    // block until all enqueued uploads have completed
+    tDeviceRC finishUploads() {
+        return transferManager->finish();
+    }
+
+    // profiler records uploads, maps and unmaps; may be NULL
+    void setProfiler(OCLProfiler* prof);
+
+    // in buffer mode, set the trailing BUFFER_IMAGE_ARGS kernel arguments, starting at argument index firstArg
+    tDeviceRC setBufferImageArgs(cl_kernel kernel, cl_uint firstArg);
 
     tDeviceRC mapImage(cl_mem img, void** mappedPtr);
+    // Map the w x h samples at (x, y) of getDWTOut() for the host to overwrite every one of them;
+    // zero dimensions map the full frame. mappedPtr receives sample (x, y), and rowPitch the bytes per row
+    tDeviceRC mapDWTOutForWrite(void** mappedPtr, size_t* rowPitch, size_t x = 0, size_t y = 0, size_t w = 0, size_t h = 0);
+    // map all of getDWTOut() for reading; rowPitch receives the bytes per row
+    tDeviceRC mapDWTOutForRead(void** mappedPtr, size_t* rowPitch);
+    // map the w x h samples at (x, y) of getDwtIn(level) for reading, as mapDWTOutForWrite
+    tDeviceRC mapDwtIn(size_t level, void** mappedPtr, size_t* rowPitch, size_t x, size_t y, size_t w, size_t h);
     tDeviceRC mapBuffer(cl_mem buffer, void** mappedPtr);
     tDeviceRC unmapMemory(cl_mem, void* mappedPtr);
 
@@ -67,10 +103,15 @@ public:
 
 
 private:
-    tDeviceRC hostToDWTIn();
-    void fillHostInputBuffer(std::vector<T*> components, size_t w,	size_t h);
+    tDeviceRC hostToDWTIn(std::vector<T*> components);
+    void fillHostInputBuffer(std::vector<T*> components, T* dest, size_t w,	size_t h);
     void freeBuffers();
-    T* rgbBuffer;
+    cl_mem createImage(cl_context context, cl_image_format format, cl_image_desc desc, cl_int* error_code);
+    // map samples [x, x + w) x [y, y + h) of an image of memWidth x memHeight pixels of pixelSize bytes
+    tDeviceRC mapRegion(cl_mem mem, size_t memWidth, size_t memHeight, size_t pixelSize, cl_map_flags flags,
+                        size_t x, size_t y, size_t w, size_t h, void** mappedPtr, size_t* rowPitch);
+    cl_event* profileEvent();
+    void recordProfileEvent(std::string name);
 
     ocl_args_d_t* ocl;
     size_t width;
@@ -84,6 +125,19 @@ private:
     cl_mem dwtOut;  //could be dwt or dwt + quantization
     std::vector<cl_mem> dwtOutChannels;
     bool onlyDwtOut;
+    bool bufferMode;
+
+    // upload ring: dwtIn[0] points to the ring slot of the current frame
+    OCLDataTransferManager* transferManager;
+    std::vector<cl_mem> uploadRing;
+    std::vector<cl_mem> hostRing;       // pinned staging buffers
+    std::vector<T*> hostRingPtrs;       // persistent host mappings of staging buffers
+    std::vector<cl_event> inputReleaseEvents;
+    cl_event uploadEvent;
+    size_t currentSlot;
+
+    OCLProfiler* profiler;
+    cl_event mapEvent;
 
 };
 
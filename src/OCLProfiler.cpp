@@ -0,0 +1,277 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "OCLProfiler.h"
+#include "OCLUtil.h"
+#include "OCLBasic.h"
+#include <algorithm>
+
+
+OCLProfiler::OCLProfiler(void) : enabled(false),
+    tracing(false)
+{
+}
+
+
+OCLProfiler::~OCLProfiler(void)
+{
+    for (size_t i = 0; i < pending.size(); ++i)
+        clReleaseEvent(pending[i].event);
+}
+
+void OCLProfiler::record(std::string stage, std::string name, cl_event event) {
+    if (!enabled || !event)
+        return;
+    clRetainEvent(event);
+    OCLProfileRecord rec;
+    rec.stage = stage;
+    rec.name = name;
+    rec.event = event;
+    rec.hostTime = time_stamp();
+    clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(cl_command_queue), &rec.queue, NULL);
+    boost::lock_guard<boost::mutex> lock(mutex);
+    pending.push_back(rec);
+}
+
+void OCLProfiler::recordMetric(std::string stage, std::string name, double value) {
+    if (!enabled)
+        return;
+    OCLProfileMetric metric;
+    metric.stage = stage;
+    metric.name = name;
+    metric.value = value;
+    metric.hostTime = time_stamp();
+    boost::lock_guard<boost::mutex> lock(mutex);
+    pendingMetrics.push_back(metric);
+}
+
+std::vector<OCLProfileRecord> OCLProfiler::collect() {
+    std::vector<OCLProfileRecord> records;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        records.swap(pending);
+        metrics.clear();
+        metrics.swap(pendingMetrics);
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        OCLProfileRecord& rec = records[i];
+        cl_int error_code = clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &rec.queued, NULL);
+        if (CL_SUCCESS == error_code)
+            error_code = clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &rec.submit, NULL);
+        if (CL_SUCCESS == error_code)
+            error_code = clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &rec.start, NULL);
+        if (CL_SUCCESS == error_code)
+            error_code = clGetEventProfilingInfo(rec.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &rec.end, NULL);
+        if (CL_SUCCESS != error_code)
+        {
+            LogError("clGetEventProfilingInfo returned %s.", TranslateOpenCLError(error_code));
+        }
+        clReleaseEvent(rec.event);
+        rec.event = 0;
+    }
+    if (tracing) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        traceRecords.insert(traceRecords.end(), records.begin(), records.end());
+        traceMetrics.insert(traceMetrics.end(), metrics.begin(), metrics.end());
+    }
+    return records;
+}
+
+void OCLProfiler::report(const std::vector<OCLProfileRecord>& records, FILE* fp) {
+    if (records.empty())
+        return;
+
+    // all times are relative to the first queued command, in ms
+    cl_ulong origin = records[0].queued;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (records[i].queued && records[i].queued < origin)
+            origin = records[i].queued;
+    }
+
+    fprintf(fp, "%-10s %-28s %10s %10s %10s %10s %10s\n", "stage", "command", "queued", "submit", "start", "end", "duration");
+    for (size_t i = 0; i < records.size(); ++i) {
+        const OCLProfileRecord& rec = records[i];
+        fprintf(fp, "%-10s %-28s %10.3f %10.3f %10.3f %10.3f %10.3f\n", rec.stage.c_str(), rec.name.c_str(),
+                (rec.queued - origin)/1e6, (rec.submit - origin)/1e6, (rec.start - origin)/1e6, (rec.end - origin)/1e6,
+                (rec.end - rec.start)/1e6);
+    }
+
+    // per stage: number of commands, total device time, and span from first start to last end
+    std::vector<std::string> stages;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (std::find(stages.begin(), stages.end(), records[i].stage) == stages.end())
+            stages.push_back(records[i].stage);
+    }
+    fprintf(fp, "\n%-10s %8s %10s %10s %10s %10s\n", "stage", "commands", "busy", "first", "last", "span");
+    for (size_t s = 0; s < stages.size(); ++s) {
+        size_t count = 0;
+        cl_ulong busy = 0, first = 0, last = 0;
+        for (size_t i = 0; i < records.size(); ++i) {
+            const OCLProfileRecord& rec = records[i];
+            if (rec.stage != stages[s])
+                continue;
+            if (count == 0 || rec.start < first)
+                first = rec.start;
+            if (rec.end > last)
+                last = rec.end;
+            busy += rec.end - rec.start;
+            count++;
+        }
+        fprintf(fp, "%-10s %8u %10.3f %10.3f %10.3f %10.3f\n", stages[s].c_str(), (unsigned int)count,
+                busy/1e6, (first - origin)/1e6, (last - origin)/1e6, (last - first)/1e6);
+    }
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (metrics.empty())
+        return;
+    fprintf(fp, "\n%-10s %-28s %10s\n", "stage", "metric", "value");
+    for (size_t i = 0; i < metrics.size(); ++i)
+        fprintf(fp, "%-10s %-28s %10.3f\n", metrics[i].stage.c_str(), metrics[i].name.c_str(), metrics[i].value);
+}
+
+void OCLProfiler::setQueueName(cl_command_queue queue, std::string name) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (size_t i = 0; i < queues.size(); ++i) {
+        if (queues[i] == queue) {
+            queueNames[i] = name;
+            return;
+        }
+    }
+    queues.push_back(queue);
+    queueNames.push_back(name);
+}
+
+// small, stable index of the calling thread; mutex must be held
+size_t OCLProfiler::getThreadIndex() {
+    boost::thread::id id = boost::this_thread::get_id();
+    for (size_t i = 0; i < threads.size(); ++i) {
+        if (threads[i] == id)
+            return i;
+    }
+    threads.push_back(id);
+    return threads.size() - 1;
+}
+
+void OCLProfiler::recordHostSpan(std::string name, double start, double end) {
+    if (!tracing)
+        return;
+    boost::lock_guard<boost::mutex> lock(mutex);
+    OCLHostSpan span;
+    span.name = name;
+    span.start = start;
+    span.end = end;
+    span.thread = getThreadIndex();
+    traceSpans.push_back(span);
+}
+
+bool OCLProfiler::writeTrace(std::string fileName) {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    FILE* fp = fopen(fileName.c_str(), "w");
+    if (!fp) {
+        LogError("Cannot write trace file %s", fileName.c_str());
+        return false;
+    }
+
+    // Device clock has an unknown origin: place it on the host time line, such that no command
+    // is queued before the host recorded it. Commands are recorded right after they are enqueued,
+    // so the smallest difference is the best estimate of the offset.
+    double deviceOffset = 0;
+    for (size_t i = 0; i < traceRecords.size(); ++i) {
+        double offset = traceRecords[i].hostTime - traceRecords[i].queued/1e9;
+        if (i == 0 || offset < deviceOffset)
+            deviceOffset = offset;
+    }
+    double origin = 0;
+    bool haveOrigin = false;
+    for (size_t i = 0; i < traceMetrics.size(); ++i) {
+        if (!haveOrigin || traceMetrics[i].hostTime < origin)
+            origin = traceMetrics[i].hostTime;
+        haveOrigin = true;
+    }
+    for (size_t i = 0; i < traceSpans.size(); ++i) {
+        if (!haveOrigin || traceSpans[i].start < origin)
+            origin = traceSpans[i].start;
+        haveOrigin = true;
+    }
+    for (size_t i = 0; i < traceRecords.size(); ++i) {
+        double queued = deviceOffset + traceRecords[i].queued/1e9;
+        if (!haveOrigin || queued < origin)
+            origin = queued;
+        haveOrigin = true;
+    }
+
+    const int hostPid = 1;
+    const int devicePid = 2;
+    fprintf(fp, "{\"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"host\"}},\n", hostPid);
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"device\"}}", devicePid);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+                hostPid, (unsigned int)i, (unsigned int)i);
+    }
+
+    // device tracks: one per command queue
+    std::vector<cl_command_queue> trackQueues(queues);
+    std::vector<std::string> trackNames(queueNames);
+    for (size_t i = 0; i < traceRecords.size(); ++i) {
+        if (std::find(trackQueues.begin(), trackQueues.end(), traceRecords[i].queue) == trackQueues.end()) {
+            trackQueues.push_back(traceRecords[i].queue);
+            trackNames.push_back("queue " + to_str(trackQueues.size() - 1));
+        }
+    }
+    for (size_t i = 0; i < trackQueues.size(); ++i) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                devicePid, (unsigned int)i, jsonEscape(trackNames[i]).c_str());
+    }
+
+    for (size_t i = 0; i < traceSpans.size(); ++i) {
+        const OCLHostSpan& span = traceSpans[i];
+        fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"host\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                jsonEscape(span.name).c_str(), hostPid, (unsigned int)span.thread, (span.start - origin) * 1e6, (span.end - span.start) * 1e6);
+    }
+    for (size_t i = 0; i < traceRecords.size(); ++i) {
+        const OCLProfileRecord& rec = traceRecords[i];
+        size_t track = std::find(trackQueues.begin(), trackQueues.end(), rec.queue) - trackQueues.begin();
+        double start = deviceOffset + rec.start/1e9;
+        fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {\"queued_us\": %.3f, \"submit_us\": %.3f}}",
+                jsonEscape(rec.name).c_str(), jsonEscape(rec.stage).c_str(), devicePid, (unsigned int)track, (start - origin) * 1e6, (rec.end - rec.start)/1e3,
+                (deviceOffset + rec.queued/1e9 - origin) * 1e6, (deviceOffset + rec.submit/1e9 - origin) * 1e6);
+    }
+    // metrics are counter tracks of the host process
+    for (size_t i = 0; i < traceMetrics.size(); ++i) {
+        const OCLProfileMetric& metric = traceMetrics[i];
+        fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"C\", \"pid\": %d, \"ts\": %.3f, \"args\": {\"value\": %.6f}}",
+                jsonEscape(metric.name).c_str(), jsonEscape(metric.stage).c_str(), hostPid, (metric.hostTime - origin) * 1e6, metric.value);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return true;
+}
+
+
+OCLHostScope::OCLHostScope(OCLProfiler* prof, const char* spanName) : profiler(prof),
+    name(spanName),
+    start(0)
+{
+    if (profiler && profiler->isTracing())
+        start = time_stamp();
+}
+
+OCLHostScope::~OCLHostScope(void)
+{
+    if (profiler && profiler->isTracing() && start != 0)
+        profiler->recordHostSpan(name, start, time_stamp());
+}
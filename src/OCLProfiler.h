@@ -0,0 +1,134 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <boost/thread.hpp>
+#include "ocl_platform.h"
+
+// device timestamps of one profiled command, in nanoseconds
+struct OCLProfileRecord {
+    OCLProfileRecord() : event(0), queue(0), hostTime(0), queued(0), submit(0), start(0), end(0)
+    {}
+    std::string stage;
+    std::string name;
+    cl_event event;
+    cl_command_queue queue;
+    double hostTime;        // host time stamp when the command was recorded, in seconds
+    cl_ulong queued;
+    cl_ulong submit;
+    cl_ulong start;
+    cl_ulong end;
+};
+
+// value computed by the host for a stage, such as an estimated occupancy
+struct OCLProfileMetric {
+    OCLProfileMetric() : value(0), hostTime(0)
+    {}
+    std::string stage;
+    std::string name;
+    double value;
+    double hostTime;        // host time stamp when the metric was recorded, in seconds
+};
+
+// host time span, in seconds
+struct OCLHostSpan {
+    OCLHostSpan() : start(0), end(0), thread(0)
+    {}
+    std::string name;
+    double start;
+    double end;
+    size_t thread;
+};
+
+/*
+Collects profiling events of enqueued commands (kernels, transfers, maps),
+and reports their queued, submit, start and end times once the commands have completed.
+Command queues must be created with CL_QUEUE_PROFILING_ENABLE.
+
+When disabled, nothing is recorded, and callers do not create events.
+
+With tracing enabled, collected commands and host spans are also kept for the
+lifetime of the profiler, and can be written as a Chrome trace-event file
+(viewable in chrome://tracing or Perfetto), with host threads and device queues on separate tracks.
+*/
+class OCLProfiler
+{
+public:
+    OCLProfiler(void);
+    ~OCLProfiler(void);
+
+    void setEnabled(bool enable) {
+        enabled = enable;
+    }
+    bool isEnabled() {
+        return enabled;
+    }
+
+    // store event of an enqueued command; the profiler takes its own reference
+    void record(std::string stage, std::string name, cl_event event);
+
+    // store a metric; reported with the commands of the next collect()
+    void recordMetric(std::string stage, std::string name, double value);
+
+    // read timestamps of all recorded events (commands must have completed),
+    // and release the events
+    std::vector<OCLProfileRecord> collect();
+
+    // print per command and per stage breakdown, followed by the metrics of the last collect()
+    void report(const std::vector<OCLProfileRecord>& records, FILE* fp = stdout);
+
+    void setTracing(bool enable) {
+        tracing = enable;
+    }
+    bool isTracing() {
+        return tracing;
+    }
+    // name of the device track for commands from this queue
+    void setQueueName(cl_command_queue queue, std::string name);
+    void recordHostSpan(std::string name, double start, double end);
+    bool writeTrace(std::string fileName);
+private:
+    size_t getThreadIndex();
+
+    bool enabled;
+    bool tracing;
+    boost::mutex mutex;
+    std::vector<OCLProfileRecord> pending;
+    std::vector<OCLProfileMetric> pendingMetrics;
+    std::vector<OCLProfileMetric> metrics;     // of the last collect()
+
+    std::vector<OCLProfileRecord> traceRecords;
+    std::vector<OCLHostSpan> traceSpans;
+    std::vector<OCLProfileMetric> traceMetrics;
+    std::vector<cl_command_queue> queues;
+    std::vector<std::string> queueNames;
+    std::vector<boost::thread::id> threads;
+};
+
+// Records a host span from construction to destruction, if the profiler is tracing
+class OCLHostScope
+{
+public:
+    OCLHostScope(OCLProfiler* prof, const char* spanName);
+    ~OCLHostScope(void);
+private:
+    OCLProfiler* profiler;
+    const char* name;
+    double start;
+};
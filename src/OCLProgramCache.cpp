@@ -0,0 +1,266 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "OCLProgramCache.h"
+#include "OCLUtil.h"
+#include "OCLBasic.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <sstream>
+
+static const char* PROGRAM_CACHE_DIR = "kernel_cache";
+
+// 64 bit FNV-1a
+static uint64_t fnv1a(const char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a(std::string data, uint64_t hash = 0xcbf29ce484222325ULL) {
+    return fnv1a(data.c_str(), data.size(), hash);
+}
+
+// directory part of path, with a trailing separator, or empty for a bare file name
+static std::string directoryOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+}
+
+// directories of the -I options of the build options, in order, with a trailing separator
+static std::vector<std::string> includeDirectories(const std::string& buildOptions) {
+    std::vector<std::string> dirs;
+    std::istringstream tokens(buildOptions);
+    std::string token;
+    while (tokens >> token) {
+        if (token.compare(0, 2, "-I"))
+            continue;
+        std::string dir = token.substr(2);
+        if (dir.empty() && !(tokens >> dir))
+            break;
+        char last = dir[dir.size() - 1];
+        dirs.push_back((last == '/' || last == '\\') ? dir : dir + "/");
+    }
+    return dirs;
+}
+
+// Hash the #include "..." dependencies of a program source in dir, searched for as the compiler does:
+// next to the including file, then in the -I directories. Returns false if one cannot be found,
+// since a key without it could not tell a changed header from an unchanged one
+static bool hashIncludes(const std::string& source, const std::string& dir, const std::vector<std::string>& searchDirs,
+                         uint64_t& hash, std::set<std::string>& visited) {
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line[pos] != '#')
+            continue;
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos || line.compare(pos, 7, "include"))
+            continue;
+        size_t first = line.find('"', pos);
+        size_t last = (first == std::string::npos) ? std::string::npos : line.find('"', first + 1);
+        if (last == std::string::npos)
+            continue;
+        std::string includeName = line.substr(first + 1, last - first - 1);
+
+        std::vector<std::string> candidates(1, dir + includeName);
+        for (size_t i = 0; i < searchDirs.size(); ++i)
+            candidates.push_back(searchDirs[i] + includeName);
+        std::string path;
+        std::ifstream file;
+        for (size_t i = 0; i < candidates.size() && !file.is_open(); ++i) {
+            path = candidates[i];
+            file.open(path.c_str(), std::ios::binary);
+        }
+        if (!file.is_open()) {
+            LogInfo("program cache: cannot find include file %s", includeName.c_str());
+            return false;
+        }
+        if (visited.count(path))
+            continue;
+        visited.insert(path);
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+        hash = fnv1a(includeName, hash);
+        hash = fnv1a(contents.str(), hash);
+        if (!hashIncludes(contents.str(), directoryOf(path), searchDirs, hash, visited))
+            return false;
+    }
+    return true;
+}
+
+
+OCLProgramCache::OCLProgramCache(cl_context context, cl_device_id device) : context(context),
+    device(device)
+{
+}
+
+
+OCLProgramCache::~OCLProgramCache(void)
+{
+}
+
+std::string OCLProgramCache::getCacheDir() {
+    return exe_subdir(PROGRAM_CACHE_DIR);
+}
+
+std::string OCLProgramCache::getKey(std::string openCLFileName, const char* source, size_t sourceSize, std::string buildOptions) {
+    uint64_t hash = fnv1a(deviceInfoString(device, CL_DEVICE_NAME));
+    hash = fnv1a(deviceInfoString(device, CL_DRIVER_VERSION), hash);
+    hash = fnv1a(buildOptions, hash);
+    hash = fnv1a(source, sourceSize, hash);
+    std::set<std::string> visited;
+    if (!hashIncludes(std::string(source, sourceSize), directoryOf(openCLFileName), includeDirectories(buildOptions), hash, visited))
+        return std::string();
+
+    // keep the program name in the key, so that the cache directory stays readable
+    std::string name = openCLFileName;
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos)
+        name = name.substr(slash + 1);
+    char hex[17];
+    sprintf(hex, "%016llx", (unsigned long long)hash);
+    return name + "." + hex + ".bin";
+}
+
+cl_program OCLProgramCache::loadBinary(std::string path, std::string buildOptions) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        return 0;
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return 0;
+
+    const unsigned char* binaryPtr = &binary[0];
+    size_t binarySize = binary.size();
+    cl_int binaryStatus = CL_SUCCESS;
+    cl_int error_code = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, &binaryPtr, &binaryStatus, &error_code);
+    if (CL_SUCCESS != error_code || CL_SUCCESS != binaryStatus)
+    {
+        LogError("clCreateProgramWithBinary returned %s.", TranslateOpenCLError(CL_SUCCESS != error_code ? error_code : binaryStatus));
+        if (program)
+            clReleaseProgram(program);
+        return 0;
+    }
+    error_code = clBuildProgram(program, 1, &device, buildOptions.c_str(), NULL, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clBuildProgram() for binary program returned %s.", TranslateOpenCLError(error_code));
+        clReleaseProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void OCLProgramCache::storeBinary(std::string path, cl_program program) {
+    // program is built for a single device, so there is exactly one binary
+    size_t binarySize = 0;
+    cl_int error_code = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, NULL);
+    if (CL_SUCCESS != error_code || binarySize == 0)
+    {
+        LogError("clGetProgramInfo (CL_PROGRAM_BINARY_SIZES) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* binaryPtr = &binary[0];
+    error_code = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binaryPtr, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetProgramInfo (CL_PROGRAM_BINARIES) returned %s.", TranslateOpenCLError(error_code));
+        return;
+    }
+
+    // write to a temporary file first, so that concurrent processes never see a partial binary
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file)
+            return;
+        file.write((const char*)binaryPtr, binarySize);
+        if (!file)
+            return;
+    }
+    remove(path.c_str());
+    if (rename(tempPath.c_str(), path.c_str()) != 0)
+        remove(tempPath.c_str());
+}
+
+cl_program OCLProgramCache::buildFromSource(const char* source, size_t sourceSize, std::string buildOptions, cl_int* error_code) {
+    // Create program object from the OpenCL C code
+    cl_program program = clCreateProgramWithSource(context, 1, (const char**)&source, &sourceSize, error_code);
+    if (CL_SUCCESS != *error_code)
+    {
+        LogError("clCreateProgramWithSource returned %s.", TranslateOpenCLError(*error_code));
+        return 0;
+    }
+
+    // Build (compile & link) the OpenCL C code
+    *error_code = clBuildProgram(program, 1, &device,  buildOptions.c_str(), NULL, NULL);
+    if (*error_code != CL_SUCCESS)
+    {
+        LogError("clBuildProgram() for source program returned %s.", TranslateOpenCLError(*error_code));
+
+        // In case of error print the build log to the standard output
+        // First check the size of the log
+        // Then allocate the memory and obtain the log from the program
+        size_t log_size = 0;
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+
+        char* build_log = new char[log_size];
+        clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG, log_size, build_log, NULL);
+
+        printf("Build Fail Log: \t%s", build_log);
+
+        delete[] build_log;
+        clReleaseProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+cl_program OCLProgramCache::getProgram(std::string openCLFileName, const char* source, size_t sourceSize,
+                                       std::string buildOptions, cl_int* error_code) {
+    double t = time_stamp();
+    std::string key = getKey(openCLFileName, source, sourceSize, buildOptions);
+    if (key.empty()) {
+        // the dependencies are unknown, so no binary can be trusted, nor stored for later
+        LogInfo("program cache miss for %s: includes not found", openCLFileName.c_str());
+        return buildFromSource(source, sourceSize, buildOptions, error_code);
+    }
+    std::string path = getCacheDir() + key;
+
+    cl_program program = loadBinary(path, buildOptions);
+    if (program) {
+        *error_code = CL_SUCCESS;
+        LogInfo("program cache hit for %s: loaded in %.2f ms", openCLFileName.c_str(), (time_stamp() - t) * 1000);
+        return program;
+    }
+
+    program = buildFromSource(source, sourceSize, buildOptions, error_code);
+    if (!program)
+        return 0;
+    storeBinary(path, program);
+    LogInfo("program cache miss for %s: built in %.2f ms", openCLFileName.c_str(), (time_stamp() - t) * 1000);
+    return program;
+}
@@ -0,0 +1,52 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <string>
+#include "ocl_platform.h"
+
+/*
+On-disk cache of OpenCL program binaries.
+
+Programs are keyed by device name, driver version, build options and a hash
+of the program source (including the sources it #includes), so that
+a change to any of these silently invalidates the cached binary.
+Includes are found next to the including file, then in the -I directories of the
+build options; if one cannot be found, the program is built without the cache.
+Binaries are stored in kernel_cache/ next to the executable.
+*/
+class OCLProgramCache
+{
+public:
+    OCLProgramCache(cl_context context, cl_device_id device);
+    ~OCLProgramCache(void);
+
+    // Returns a built program for the given source and build options, either loaded
+    // from the cache or built from source (and then added to the cache).
+    // Returns 0 on failure, with error_code set.
+    cl_program getProgram(std::string openCLFileName, const char* source, size_t sourceSize,
+                          std::string buildOptions, cl_int* error_code);
+private:
+    // file name of the cached binary, or empty if an include cannot be found
+    std::string getKey(std::string openCLFileName, const char* source, size_t sourceSize, std::string buildOptions);
+    cl_program loadBinary(std::string path, std::string buildOptions);
+    void storeBinary(std::string path, cl_program program);
+    cl_program buildFromSource(const char* source, size_t sourceSize, std::string buildOptions, cl_int* error_code);
+    std::string getCacheDir();
+
+    cl_context context;
+    cl_device_id device;
+};
@@ -24,6 +24,7 @@ template<typename T> OCLRGBtoPlanar<T>::OCLRGBtoPlanar(KernelInitInfoBase initIn
     memoryManager(memMgr),
     planar(new OCLKernel( KernelInitInfo(initInfo, "oclplanar.cl", "run") ))
 {
+    planar->setProfileName("planar", "rgb to planar");
 
 }
 
@@ -33,13 +34,14 @@ template<typename T> OCLRGBtoPlanar<T>::~OCLRGBtoPlanar(void)
         delete planar;
 }
 
-template<typename T>  void OCLRGBtoPlanar<T>::run() {
+template<typename T>  void OCLRGBtoPlanar<T>::run(size_t windowX, size_t windowY) {
 
     if (setKernelArgs() != DeviceSuccess) {
         return;
     }
-    size_t local_work_size[3] = {16,16};
-    size_t global_work_size[3] = {memoryManager->getWidth(), memoryManager->getHeight(),1};
+    size_t local_work_size[3] = {windowX,windowY};
+    size_t global_work_size[3] = {divRndUp(memoryManager->getWidth(), local_work_size[0]) * local_work_size[0],
+                                  divRndUp(memoryManager->getHeight(), local_work_size[1]) * local_work_size[1],1};
     planar->enqueue(2,global_work_size, local_work_size);
 }
 
@@ -76,6 +78,6 @@ template<typename T> tDeviceRC OCLRGBtoPlanar<T>::setKernelArgs() {
         }
     }
 
-    return DeviceSuccess;
+    return memoryManager->setBufferImageArgs(targetKernel, numKernelArgs);
 }
 
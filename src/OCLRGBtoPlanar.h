@@ -25,7 +25,7 @@ template<typename T> class OCLRGBtoPlanar
 public:
     OCLRGBtoPlanar(KernelInitInfoBase initInfo, OCLMemoryManager<T>* memMgr);
     ~OCLRGBtoPlanar(void);
-    void run();
+    void run(size_t windowX, size_t windowY);
 private:
     tDeviceRC setKernelArgs();
     KernelInitInfoBase initInfo;
@@ -49,22 +49,9 @@ template<typename T, typename U> void OCLTest<T,U>::test()
 {
     testInit();
 
-    // Read the input image
-    cv::Size dsize;
+    // Read the input image (any size)
     cv::Mat img_src = cv::imread(OCL_SAMPLE_IMAGE_NAME, 1);
-
-    int alignCols=8, alignRows=64;
-
-    if (!img_src.empty())
-    {
-        // Make sure that the input image size is fit:
-        // number of rows is multiple of 8
-        // number of columns is multiple of 64
-        dsize.height = ((img_src.rows % alignRows) == 0) ? img_src.rows : (((img_src.rows + alignRows - 1) / alignRows) * alignRows);
-        dsize.width = ((img_src.cols % alignCols) == 0) ? img_src.cols : (((img_src.cols + alignCols - 1) / alignCols) * alignCols);
-        resize(img_src, img_src, dsize);
-    }
-    else
+    if (img_src.empty())
     {
         LogError("Cannot read image file: %s", OCL_SAMPLE_IMAGE_NAME);
         return;
@@ -98,10 +85,11 @@ template<typename T, typename U> void OCLTest<T,U>::test()
 
     double t = my_clock();
     int numIterations = 40;
+    // frames are pipelined through the upload ring, so only wait for the last one
     for (int j =0; j < numIterations; ++j) {
         testRun(components, img_src.cols, img_src.rows,levels,precision);
-        testFinish();
     }
+    testFinish();
     t = my_clock() - t;
     fprintf(stdout, "encode time: %d micro seconds ", (int)((t * 1000000)/numIterations));
 
@@ -0,0 +1,227 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include "OCLTuner.h"
+#include "OCLEncoder.cpp"
+#include "OCLDecoder.cpp"
+#include <algorithm>
+#include <math.h>
+
+template<typename T> OCLTuner<T>::OCLTuner(ocl_args_d_t* ocl, bool isLossy) :
+    ocl(ocl),
+    lossy(isLossy),
+    width(0),
+    height(0),
+    levels(0),
+    precision(0),
+    iterations(0)
+{
+}
+
+template<typename T> OCLWindowConfig OCLTuner<T>::tune(std::vector<T*> comps, size_t w, size_t h, size_t numLevels,
+        size_t prec, size_t numIterations) {
+    OCLWindowConfig best = ocl ? OCLTuningProfile::load(ocl->device) : OCLWindowConfig();
+    if (!ocl || comps.empty() || numIterations == 0)
+        return best;
+    components = comps;
+    width = w;
+    height = h;
+    levels = numLevels;
+    precision = prec;
+    iterations = numIterations;
+
+    // reference outputs of the starting configuration
+    double seconds = 0;
+    if (!runEncoder(best, coefficients, seconds) || !runDecoder(best, reconstruction, seconds)) {
+        LogError("OCLTuner: starting configuration failed; keeping it");
+        return best;
+    }
+
+    std::vector<size_t> small, large;
+    for (size_t i = 2; i <= 32; i <<= 1)
+        small.push_back(i);
+    for (size_t i = 16; i <= 512; i <<= 1)
+        large.push_back(i);
+
+    double bestSeconds = measure(FORWARD_WINDOW, best);
+    tuneWindow(FORWARD_WINDOW, small, large, best, bestSeconds);
+
+    bestSeconds = measure(REVERSE_WINDOW, best);
+    tuneWindow(REVERSE_WINDOW, large, small, best, bestSeconds);
+
+    if (components.size() > 1) {
+        std::vector<size_t> planarX, planarY;
+        for (size_t i = 4; i <= 64; i <<= 1)
+            planarX.push_back(i);
+        for (size_t i = 4; i <= 32; i <<= 1)
+            planarY.push_back(i);
+        bestSeconds = measure(PLANAR_WINDOW, best);
+        tuneWindow(PLANAR_WINDOW, planarX, planarY, best, bestSeconds);
+    }
+    return best;
+}
+
+template<typename T> void OCLTuner<T>::tuneWindow(eWindow window, const std::vector<size_t>& candidatesX,
+        const std::vector<size_t>& candidatesY, OCLWindowConfig& best, double& bestSeconds) {
+    // coordinate descent: x with y fixed, then y with the best x
+    for (size_t pass = 0; pass < 2; ++pass) {
+        const std::vector<size_t>& candidates = pass ? candidatesY : candidatesX;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            OCLWindowConfig config = best;
+            size_t windowX = 0, windowY = 0;
+            getWindow(window, config, windowX, windowY);
+            if (pass)
+                windowY = candidates[i];
+            else
+                windowX = candidates[i];
+            if (!isLegal(window, windowX, windowY))
+                continue;
+            setWindow(window, config, windowX, windowY);
+            double seconds = measure(window, config);
+            if (seconds >= 0 && (bestSeconds < 0 || seconds < bestSeconds)) {
+                best = config;
+                bestSeconds = seconds;
+            }
+        }
+    }
+}
+
+template<typename T> bool OCLTuner<T>::isLegal(eWindow window, size_t windowX, size_t windowY) {
+    switch (window) {
+    case FORWARD_WINDOW:
+        return OCLTuningProfile::isLegalForward(ocl->device, windowX, windowY);
+    case REVERSE_WINDOW:
+        return OCLTuningProfile::isLegalReverse(ocl->device, windowX, windowY);
+    default:
+        return OCLTuningProfile::isLegalPlanar(ocl->device, windowX, windowY);
+    }
+}
+
+template<typename T> void OCLTuner<T>::getWindow(eWindow window, const OCLWindowConfig& config, size_t& windowX, size_t& windowY) {
+    switch (window) {
+    case FORWARD_WINDOW:
+        windowX = config.forwardX;
+        windowY = config.forwardY;
+        break;
+    case REVERSE_WINDOW:
+        windowX = config.reverseX;
+        windowY = config.reverseY;
+        break;
+    default:
+        windowX = config.planarX;
+        windowY = config.planarY;
+        break;
+    }
+}
+
+template<typename T> void OCLTuner<T>::setWindow(eWindow window, OCLWindowConfig& config, size_t windowX, size_t windowY) {
+    switch (window) {
+    case FORWARD_WINDOW:
+        config.forwardX = windowX;
+        config.forwardY = windowY;
+        break;
+    case REVERSE_WINDOW:
+        config.reverseX = windowX;
+        config.reverseY = windowY;
+        break;
+    default:
+        config.planarX = windowX;
+        config.planarY = windowY;
+        break;
+    }
+}
+
+template<typename T> double OCLTuner<T>::measure(eWindow window, const OCLWindowConfig& config) {
+    double seconds = -1;
+    if (window == REVERSE_WINDOW) {
+        std::vector<T> output;
+        if (!runDecoder(config, output, seconds) || output.size() != reconstruction.size())
+            return -1;
+        // lossy reconstruction is float; allow for a different order of operations
+        double tolerance = lossy ? 1e-2 : 0;
+        for (size_t i = 0; i < output.size(); ++i) {
+            if (fabs((double)output[i] - (double)reconstruction[i]) > tolerance)
+                return -1;
+        }
+    } else {
+        std::vector<short> output;
+        if (!runEncoder(config, output, seconds) || output.size() != coefficients.size())
+            return -1;
+        // lossy coefficients are quantized floats, which may round either way
+        int tolerance = lossy ? 1 : 0;
+        for (size_t i = 0; i < output.size(); ++i) {
+            if (abs(output[i] - coefficients[i]) > tolerance)
+                return -1;
+        }
+    }
+    return seconds;
+}
+
+template<typename T> double OCLTuner<T>::stageSeconds(const std::vector<OCLStageTime>& times, std::string name) {
+    for (size_t i = 0; i < times.size(); ++i) {
+        if (times[i].name == name)
+            return times[i].seconds;
+    }
+    return 0;
+}
+
+template<typename T> bool OCLTuner<T>::runEncoder(const OCLWindowConfig& config, std::vector<short>& output, double& seconds) {
+    OCLEncoder<T> encoder(ocl, lossy, false, DEVICE_DWT, DEFAULT_UPLOAD_RING_DEPTH, &config);
+    encoder.setStageTiming(true);
+    std::vector<double> samples;
+    // first frame is warm-up
+    for (size_t i = 0; i <= iterations; ++i) {
+        encoder.run(components, width, height, levels, precision);
+        encoder.finish();
+        std::vector<OCLStageTime> times = encoder.getStageTimes();
+        if (i > 0)
+            samples.push_back(stageSeconds(times, "dwt") + stageSeconds(times, "planar"));
+    }
+    std::sort(samples.begin(), samples.end());
+    seconds = samples[samples.size() / 2];
+
+    void* ptr = NULL;
+    if (encoder.mapDWTOut(&ptr) != DeviceSuccess)
+        return false;
+    short* dwtOut = (short*)ptr;
+    output.assign(dwtOut, dwtOut + width * height * components.size());
+    encoder.unmapDWTOut(ptr);
+    return true;
+}
+
+template<typename T> bool OCLTuner<T>::runDecoder(const OCLWindowConfig& config, std::vector<T>& output, double& seconds) {
+    OCLDecoder<T> decoder(ocl, lossy, &config);
+    decoder.setStageTiming(true);
+    std::vector<double> samples;
+    for (size_t i = 0; i <= iterations; ++i) {
+        decoder.run(&coefficients[0], components.size(), width, height, levels, precision);
+        decoder.finish();
+        if (i > 0)
+            samples.push_back(stageSeconds(decoder.getStageTimes(), "idwt"));
+    }
+    std::sort(samples.begin(), samples.end());
+    seconds = samples[samples.size() / 2];
+
+    void* ptr = NULL;
+    if (decoder.mapOutput(&ptr) != DeviceSuccess)
+        return false;
+    T* out = (T*)ptr;
+    output.assign(out, out + width * height * components.size());
+    decoder.unmapOutput(ptr);
+    return true;
+}
@@ -0,0 +1,67 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <vector>
+#include "OCLUtil.h"
+#include "OCLTuningProfile.h"
+#include "OCLEncoder.h"
+#include "OCLDecoder.h"
+
+/*
+Searches the window sizes of the forward DWT, inverse DWT and rgb to planar kernels for a device.
+
+Each window is tuned in turn, one coordinate at a time, starting from the current profile:
+a candidate is kept when its median stage time beats the best so far, and its output
+matches the output of the starting configuration. Candidates the device cannot launch
+are skipped.
+*/
+template< typename T > class OCLTuner
+{
+public:
+    OCLTuner(ocl_args_d_t* ocl, bool lossy);
+
+    // tune on one frame; the frame should have 4 components to tune the planar window
+    OCLWindowConfig tune(std::vector<T*> components, size_t w, size_t h, size_t levels, size_t precision, size_t iterations);
+private:
+    enum eWindow {
+        FORWARD_WINDOW,
+        REVERSE_WINDOW,
+        PLANAR_WINDOW
+    };
+    void tuneWindow(eWindow window, const std::vector<size_t>& candidatesX, const std::vector<size_t>& candidatesY,
+                    OCLWindowConfig& best, double& bestSeconds);
+    bool isLegal(eWindow window, size_t windowX, size_t windowY);
+    static void getWindow(eWindow window, const OCLWindowConfig& config, size_t& windowX, size_t& windowY);
+    static void setWindow(eWindow window, OCLWindowConfig& config, size_t windowX, size_t windowY);
+    // median time of the window's stage, or a negative value if the output does not match the reference
+    double measure(eWindow window, const OCLWindowConfig& config);
+    bool runEncoder(const OCLWindowConfig& config, std::vector<short>& output, double& seconds);
+    bool runDecoder(const OCLWindowConfig& config, std::vector<T>& output, double& seconds);
+    static double stageSeconds(const std::vector<OCLStageTime>& times, std::string name);
+
+    ocl_args_d_t* ocl;
+    bool lossy;
+    std::vector<T*> components;
+    size_t width;
+    size_t height;
+    size_t levels;
+    size_t precision;
+    size_t iterations;
+    std::vector<short> coefficients;    // reference forward DWT output; input to the decoder
+    std::vector<T> reconstruction;      // reference inverse DWT output
+};
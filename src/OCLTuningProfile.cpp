@@ -0,0 +1,149 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include "OCLTuningProfile.h"
+#include "OCLUtil.h"
+#include "OCLBasic.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char* TUNING_PROFILE_DIR = "tuning";
+
+// scratch of the DWT kernels: four channels of windowX * windowY floats
+static const size_t DWT_SCRATCH_BYTES_PER_SAMPLE = 4 * sizeof(cl_float);
+
+// widest boundary of the DWT kernels (9/7): each work group overlaps its neighbours by this many rows or columns on each side
+static const size_t DWT_MAX_BOUNDARY = 4;
+
+// the 5/3 kernels keep this many extra columns (forward) or rows (reverse) of short samples
+// next to their window, so a window at least this wide still fits the float scratch above
+static const size_t DWT_MIN_LIFTING_WINDOW = 4;
+
+std::string OCLTuningProfile::getPath(cl_device_id device) {
+    std::string name = deviceInfoString(device, CL_DEVICE_NAME) + "_" + deviceInfoString(device, CL_DRIVER_VERSION);
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-'))
+            name[i] = '_';
+    }
+    return exe_subdir(TUNING_PROFILE_DIR) + name + ".txt";
+}
+
+OCLWindowConfig OCLTuningProfile::load(cl_device_id device) {
+    OCLWindowConfig defaults;
+    if (!device)
+        return defaults;
+    std::string path = getPath(device);
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp)
+        return defaults;
+    OCLWindowConfig config;
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+        char key[64];
+        unsigned int x = 0, y = 0;
+        if (line[0] == '#' || sscanf(line, "%63s %u %u", key, &x, &y) != 3)
+            continue;
+        if (strcmp(key, "forward") == 0) {
+            config.forwardX = x;
+            config.forwardY = y;
+        } else if (strcmp(key, "reverse") == 0) {
+            config.reverseX = x;
+            config.reverseY = y;
+        } else if (strcmp(key, "planar") == 0) {
+            config.planarX = x;
+            config.planarY = y;
+        }
+    }
+    fclose(fp);
+    if (!isLegal(device, config)) {
+        LogError("Ignoring tuning profile %s: window sizes are not legal for this device", path.c_str());
+        return defaults;
+    }
+    LogInfo("Loaded tuning profile %s", path.c_str());
+    return config;
+}
+
+bool OCLTuningProfile::store(cl_device_id device, const OCLWindowConfig& config) {
+    std::string path = getPath(device);
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        LogError("Cannot write tuning profile %s", path.c_str());
+        return false;
+    }
+    fprintf(fp, "# window sizes for %s, driver %s\n", deviceInfoString(device, CL_DEVICE_NAME).c_str(),
+            deviceInfoString(device, CL_DRIVER_VERSION).c_str());
+    fprintf(fp, "forward %u %u\n", (unsigned int)config.forwardX, (unsigned int)config.forwardY);
+    fprintf(fp, "reverse %u %u\n", (unsigned int)config.reverseX, (unsigned int)config.reverseY);
+    fprintf(fp, "planar %u %u\n", (unsigned int)config.planarX, (unsigned int)config.planarY);
+    fclose(fp);
+    return true;
+}
+
+bool OCLTuningProfile::fitsWorkGroup(cl_device_id device, size_t sizeX, size_t sizeY) {
+    size_t itemSizes[3] = {0, 0, 0};
+    cl_int error_code = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(itemSizes), itemSizes, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_MAX_WORK_ITEM_SIZES) returned %s.", TranslateOpenCLError(error_code));
+        return false;
+    }
+    size_t maxWorkGroupSize = 0;
+    error_code = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE) returned %s.", TranslateOpenCLError(error_code));
+        return false;
+    }
+    return sizeX <= itemSizes[0] && sizeY <= itemSizes[1] && sizeX * sizeY <= maxWorkGroupSize;
+}
+
+bool OCLTuningProfile::fitsLocalMemory(cl_device_id device, size_t windowX, size_t windowY) {
+    cl_ulong localMemorySize = 0;
+    cl_int error_code = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMemorySize, NULL);
+    if (CL_SUCCESS != error_code)
+    {
+        LogError("clGetDeviceInfo (CL_DEVICE_LOCAL_MEM_SIZE) returned %s.", TranslateOpenCLError(error_code));
+        return false;
+    }
+    return windowX * windowY * DWT_SCRATCH_BYTES_PER_SAMPLE <= localMemorySize;
+}
+
+bool OCLTuningProfile::isLegalForward(cl_device_id device, size_t windowX, size_t windowY) {
+    // lifting works on pairs of samples
+    if (windowX < DWT_MIN_LIFTING_WINDOW || (windowX & 1) || (windowY & 1) || windowY <= 2 * DWT_MAX_BOUNDARY)
+        return false;
+    return fitsWorkGroup(device, 1, windowY) && fitsLocalMemory(device, windowX, windowY);
+}
+
+bool OCLTuningProfile::isLegalReverse(cl_device_id device, size_t windowX, size_t windowY) {
+    if (windowY < DWT_MIN_LIFTING_WINDOW || (windowX & 1) || (windowY & 1) || windowX <= 2 * DWT_MAX_BOUNDARY)
+        return false;
+    return fitsWorkGroup(device, windowX, 1) && fitsLocalMemory(device, windowX, windowY);
+}
+
+bool OCLTuningProfile::isLegalPlanar(cl_device_id device, size_t windowX, size_t windowY) {
+    if (windowX == 0 || windowY == 0)
+        return false;
+    return fitsWorkGroup(device, windowX, windowY);
+}
+
+bool OCLTuningProfile::isLegal(cl_device_id device, const OCLWindowConfig& config) {
+    return isLegalForward(device, config.forwardX, config.forwardY) &&
+           isLegalReverse(device, config.reverseX, config.reverseY) &&
+           isLegalPlanar(device, config.planarX, config.planarY);
+}
@@ -0,0 +1,57 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#pragma once
+
+#include <string>
+#include "ocl_platform.h"
+
+// work group window sizes of the DWT and planar kernels
+struct OCLWindowConfig {
+    OCLWindowConfig() : forwardX(8), forwardY(128), reverseX(128), reverseY(8), planarX(16), planarY(16)
+    {}
+    size_t forwardX;    // forward DWT: columns per window; work group is 1 x forwardY
+    size_t forwardY;
+    size_t reverseX;    // inverse DWT: work group is reverseX x 1
+    size_t reverseY;    // rows per window
+    size_t planarX;     // rgb to planar work group
+    size_t planarY;
+};
+
+/*
+Window sizes of each device, as measured by OCLTuner.
+
+Profiles are plain text files in tuning/ next to the executable, one per device name
+and driver version. A missing profile, or one with sizes that are not legal
+for the device, gives the default sizes.
+*/
+class OCLTuningProfile
+{
+public:
+    static OCLWindowConfig load(cl_device_id device);
+    static bool store(cl_device_id device, const OCLWindowConfig& config);
+
+    // legal sizes fit the device's work group and local memory limits,
+    // and give each work group at least one output row (forward) or column (reverse)
+    static bool isLegalForward(cl_device_id device, size_t windowX, size_t windowY);
+    static bool isLegalReverse(cl_device_id device, size_t windowX, size_t windowY);
+    static bool isLegalPlanar(cl_device_id device, size_t windowX, size_t windowY);
+    static bool isLegal(cl_device_id device, const OCLWindowConfig& config);
+private:
+    static std::string getPath(cl_device_id device);
+    static bool fitsWorkGroup(cl_device_id device, size_t sizeX, size_t sizeY);
+    static bool fitsLocalMemory(cl_device_id device, size_t windowX, size_t windowY);
+};
@@ -19,8 +19,8 @@
 #include <windows.h>
 #else
 #include "time.h"
-#include "stdarg.h"
 #endif
+#include <stdarg.h>
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
@@ -61,7 +61,12 @@ void LogInfo(const char* str, ...)
 {
     if (str && (quiet == false))
     {
-        std::cout << "INFO: " << str << std::endl;
+        va_list args;
+        va_start(args, str);
+        printf("INFO: ");
+        vprintf(str, args);
+        printf("\n");
+        va_end(args);
     }
 }
 
@@ -69,7 +74,12 @@ void LogError(const char* str, ...)
 {
     if (str)
     {
-        std::cerr << "ERROR: " << str << std::endl;
+        va_list args;
+        va_start(args, str);
+        fprintf(stderr, "ERROR: ");
+        vfprintf(stderr, str, args);
+        fprintf(stderr, "\n");
+        va_end(args);
     }
 }
 
@@ -67,4 +67,8 @@ const char* TranslateOpenCLError(cl_int errorCode);
 int InitOpenCL(ocl_args_d_t* ocl, data_args_d_t* data);
 
 // Returns host time in (ms)
-unsigned long long HostTime();
\ No newline at end of file
+unsigned long long HostTime();
+// Integer division, rounded up
+inline size_t divRndUp(const size_t n, const size_t d) {
+    return n/d + !!(n % d);
+}
@@ -0,0 +1,565 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "OCLBench.cpp"
+#include "OCLTuner.cpp"
+#include "OCLUtil.h"
+#include "OCLBasic.h"
+#include "OCLDeviceManager.h"
+#include "HostJP2Writer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+extern bool quiet;
+
+struct BenchConfig {
+    BenchConfig() :
+        resourceDir("resources"),
+        warmup(3),
+        iterations(20),
+        precision(8),
+        backend(DEVICE_DWT),
+        tier1Backend(HOST_TIER1),
+        codeBlockX(DEFAULT_CODEBLOCK_SIZE),
+        codeBlockY(DEFAULT_CODEBLOCK_SIZE),
+        bpcSchedule(BPC_SCHEDULE_LIST),
+        targetBytes(0),
+        targetPSNR(0),
+        numLayers(1),
+        progression(J2K_PROG_LRCP),
+        jp2(false),
+        decode(false),
+        discardLevels(0),
+        windowWidth(0),
+        windowHeight(0),
+        tune(false),
+        verify(false)
+    {
+        levels.push_back(1);
+        levels.push_back(3);
+        levels.push_back(5);
+        components.push_back(1);
+        components.push_back(4);
+        lossy.push_back(true);
+        lossy.push_back(false);
+    }
+    std::string resourceDir;
+    std::vector<size_t> levels;
+    std::vector<size_t> components;
+    std::vector<bool> lossy;
+    size_t warmup;
+    size_t iterations;
+    size_t precision;
+    eDWTBackend backend;
+    eTier1Backend tier1Backend;
+    size_t codeBlockX;
+    size_t codeBlockY;
+    eBPCSchedule bpcSchedule;
+    size_t targetBytes;
+    double targetPSNR;
+    size_t numLayers;
+    std::vector<size_t> layerBytes;
+    unsigned int progression;
+    std::vector<size_t> precinctWidth;
+    std::vector<size_t> precinctHeight;
+    bool jp2;
+    bool decode;
+    size_t discardLevels;
+    size_t windowWidth;
+    size_t windowHeight;
+    bool tune;
+    bool verify;
+    std::string csvFile;
+    std::string jsonFile;
+    std::string j2kDir;
+};
+
+static void usage() {
+    printf("usage: roger_bench [options]\n"
+           "  --resources <dir>      directory of input images (default: resources)\n"
+           "  --levels <list>        comma separated DWT level counts (default: 1,3,5)\n"
+           "  --components <list>    comma separated component counts, 1 or 4 (default: 1,4)\n"
+           "  --mode <lossy|lossless|both>   (default: both)\n"
+           "  --dwt <device|host>    DWT backend (default: device)\n"
+           "  --mq <host|device>     MQ coder backend (default: host)\n"
+           "  --codeblock <WxH>      code block size, powers of two from 4 to 1024 with at most 4096 samples (default: 32x32)\n"
+           "  --bpc-schedule <list|buckets>  order of BPC work groups: as found, or grouped by bit plane count (default: list)\n"
+           "  --bytes <n>            rate control: largest code stream, in bytes (default: no limit)\n"
+           "  --psnr <dB>            rate control: lowest PSNR, ignoring quantization error (default: no limit)\n"
+           "  --layers <n>           quality layers (default: 1)\n"
+           "  --layer-bytes <list>   comma separated byte targets of each layer but the last (default: halving)\n"
+           "  --progression <lrcp|rlcp|rpcl|pcrl|cprl>  (default: lrcp)\n"
+           "  --precincts <list>     comma separated precinct sizes WxH, from the highest resolution down (default: one per resolution)\n"
+           "  --j2k <dir>            write the code stream of each image and configuration to dir\n"
+           "  --jp2 <yes|no>         wrap the code streams written by --j2k in JP2 files (default: no)\n"
+           "  --decode <yes|no>      also benchmark decoding the code stream of each encoded frame (default: no)\n"
+           "  --discard <n>          decode at reduced resolution, skipping the n finest DWT levels; configurations\n"
+           "                         with n or fewer levels are not decoded (default: 0)\n"
+           "  --window <WxH>         decode only a window of this size at the centre of each image (default: whole image)\n"
+           "  --tune <yes|no>        tune kernel window sizes on the first image and store them in the device's profile\n"
+           "                         before benchmarking (default: no)\n"
+           "  --verify <yes|no>      instead of benchmarking, compare the forward DWT of the host and device backends\n"
+           "                         with the scalar host reference (default: no)\n"
+           "  --warmup <n>           untimed frames per configuration (default: 3)\n"
+           "  --iterations <n>       timed frames per configuration (default: 20)\n"
+           "  --csv <file>           write results as CSV (default: stdout)\n"
+           "  --json <file>          write results as JSON\n");
+}
+
+static std::vector<size_t> parseList(const char* str) {
+    std::vector<size_t> rc;
+    std::string s(str);
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos)
+            end = s.size();
+        int val = atoi(s.substr(start, end - start).c_str());
+        if (val > 0)
+            rc.push_back((size_t)val);
+        start = end + 1;
+    }
+    return rc;
+}
+
+static bool parseArgs(int argc, char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--help" || arg == "-h")
+            return false;
+        if (i + 1 >= argc) {
+            LogError("missing value for %s", argv[i]);
+            return false;
+        }
+        const char* val = argv[++i];
+        if (arg == "--resources") {
+            config.resourceDir = val;
+        } else if (arg == "--levels") {
+            config.levels = parseList(val);
+        } else if (arg == "--components") {
+            config.components = parseList(val);
+        } else if (arg == "--mode") {
+            config.lossy.clear();
+            if (strcmp(val, "lossless") != 0)
+                config.lossy.push_back(true);
+            if (strcmp(val, "lossy") != 0)
+                config.lossy.push_back(false);
+        } else if (arg == "--dwt") {
+            config.backend = (strcmp(val, "host") == 0) ? HOST_DWT : DEVICE_DWT;
+        } else if (arg == "--mq") {
+            config.tier1Backend = (strcmp(val, "device") == 0) ? DEVICE_TIER1 : HOST_TIER1;
+        } else if (arg == "--codeblock") {
+            int x = 0, y = 0;
+            if (sscanf(val, "%dx%d", &x, &y) != 2 || !OCLBPC<short>::isLegalCodeBlockSize((size_t)x, (size_t)y)) {
+                LogError("illegal code block size %s", val);
+                return false;
+            }
+            config.codeBlockX = (size_t)x;
+            config.codeBlockY = (size_t)y;
+        } else if (arg == "--bpc-schedule") {
+            config.bpcSchedule = (strcmp(val, "buckets") == 0) ? BPC_SCHEDULE_BUCKETS : BPC_SCHEDULE_LIST;
+        } else if (arg == "--bytes") {
+            config.targetBytes = (size_t)atol(val);
+        } else if (arg == "--psnr") {
+            config.targetPSNR = atof(val);
+        } else if (arg == "--layers") {
+            config.numLayers = (size_t)atoi(val);
+        } else if (arg == "--layer-bytes") {
+            config.layerBytes = parseList(val);
+        } else if (arg == "--progression") {
+            const char* orders[] = { "lrcp", "rlcp", "rpcl", "pcrl", "cprl" };
+            unsigned int order = 0;
+            while (order <= J2K_PROG_CPRL && strcmp(val, orders[order]) != 0)
+                order++;
+            if (order > J2K_PROG_CPRL) {
+                LogError("unknown progression order %s", val);
+                return false;
+            }
+            config.progression = order;
+        } else if (arg == "--precincts") {
+            config.precinctWidth.clear();
+            config.precinctHeight.clear();
+            std::string s(val);
+            for (size_t start = 0; start < s.size();) {
+                size_t end = s.find(',', start);
+                if (end == std::string::npos)
+                    end = s.size();
+                int x = 0, y = 0;
+                if (sscanf(s.substr(start, end - start).c_str(), "%dx%d", &x, &y) != 2 || x <= 0 || y <= 0) {
+                    LogError("illegal precinct size %s", val);
+                    return false;
+                }
+                config.precinctWidth.push_back((size_t)x);
+                config.precinctHeight.push_back((size_t)y);
+                start = end + 1;
+            }
+        } else if (arg == "--j2k") {
+            config.j2kDir = val;
+        } else if (arg == "--jp2") {
+            config.jp2 = (strcmp(val, "yes") == 0);
+        } else if (arg == "--decode") {
+            config.decode = (strcmp(val, "yes") == 0);
+        } else if (arg == "--discard") {
+            config.discardLevels = (size_t)atoi(val);
+        } else if (arg == "--window") {
+            int x = 0, y = 0;
+            if (sscanf(val, "%dx%d", &x, &y) != 2 || x <= 0 || y <= 0) {
+                LogError("illegal window size %s", val);
+                return false;
+            }
+            config.windowWidth = (size_t)x;
+            config.windowHeight = (size_t)y;
+        } else if (arg == "--tune") {
+            config.tune = (strcmp(val, "yes") == 0);
+        } else if (arg == "--verify") {
+            config.verify = (strcmp(val, "yes") == 0);
+        } else if (arg == "--warmup") {
+            config.warmup = (size_t)atoi(val);
+        } else if (arg == "--iterations") {
+            config.iterations = (size_t)atoi(val);
+        } else if (arg == "--csv") {
+            config.csvFile = val;
+        } else if (arg == "--json") {
+            config.jsonFile = val;
+        } else {
+            LogError("unknown option %s", argv[i-1]);
+            return false;
+        }
+    }
+    return !config.levels.empty() && !config.components.empty() && !config.lossy.empty() && config.iterations > 0;
+}
+
+static bool isImageFile(std::string name) {
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp" || ext == "tif" || ext == "tiff";
+}
+
+static std::vector<std::string> listImages(std::string dir) {
+    std::vector<std::string> rc;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &findData);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (isImageFile(findData.cFileName))
+                rc.push_back(findData.cFileName);
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+    }
+#else
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (isImageFile(entry->d_name))
+                rc.push_back(entry->d_name);
+        }
+        closedir(d);
+    }
+#endif
+    std::sort(rc.begin(), rc.end());
+    return rc;
+}
+
+// Convert an 8 bit image into level shifted components.
+// Four components are stored as B,G,R plus a copy of R, matching the RGBA input layout
+template<typename T> std::vector<T*> makeComponents(cv::Mat img, size_t numComponents) {
+    std::vector<T*> components;
+    size_t imageSize = img.cols * img.rows;
+    cv::Mat channel[3];
+    if (numComponents == 1) {
+        cv::cvtColor(img, channel[0], CV_BGR2GRAY);
+    } else {
+        cv::split(img, channel);
+    }
+    for (size_t chan = 0; chan < numComponents; ++chan) {
+        size_t comp = std::min(chan, (size_t)2);
+        T* data = new T[imageSize];
+        for (size_t i = 0; i < imageSize; ++i) {
+            data[i] = (T)( (channel[comp].data[i]) - 128);
+        }
+        components.push_back(data);
+    }
+    return components;
+}
+
+template<typename T> void freeComponents(std::vector<T*> components) {
+    for (size_t i = 0; i < components.size(); ++i)
+        delete[] components[i];
+}
+
+template<typename T> void benchImage(OCLBench<T>* bench, std::string name, cv::Mat img, BenchConfig& config,
+                                     std::vector<OCLBenchResult>& results) {
+    for (size_t c = 0; c < config.components.size(); ++c) {
+        size_t numComponents = config.components[c];
+        if (numComponents != 1 && numComponents != 4) {
+            LogError("unsupported component count %u", (unsigned int)numComponents);
+            continue;
+        }
+        std::vector<T*> components = makeComponents<T>(img, numComponents);
+        for (size_t l = 0; l < config.levels.size(); ++l) {
+            OCLBenchResult result;
+            if (bench->run(name, components, img.cols, img.rows, config.levels[l], config.precision,
+                           config.warmup, config.iterations, result)) {
+                results.push_back(result);
+                if (!config.j2kDir.empty() && bench->getCodestream().size()) {
+                    std::string fileName = config.j2kDir + "/" + name + "_" + (result.lossy ? "lossy" : "lossless") +
+                                           "_l" + to_str(config.levels[l]) + "_c" + to_str(numComponents) + (config.jp2 ? ".jp2" : ".j2k");
+                    if (config.jp2) {
+                        HostJP2Writer jp2;
+                        if (jp2.open(fileName, img.cols, img.rows, numComponents, config.precision))
+                            jp2.write(bench->getCodestream());
+                        jp2.close();
+                    } else {
+                        bench->getCodestream().writeFile(fileName);
+                    }
+                }
+            }
+            OCLBenchResult decodeResult;
+            if (config.decode && config.discardLevels < config.levels[l] && bench->runDecode(name, components, img.cols, img.rows, config.levels[l], config.precision,
+                                                  config.warmup, config.iterations, decodeResult))
+                results.push_back(decodeResult);
+        }
+        freeComponents(components);
+    }
+}
+
+// largest difference of a 9/7 device coefficient from the host reference that float rounding explains
+const double VERIFY_LOSSY_TOLERANCE = 0.01;
+
+// Compare the DWT backends with the host reference for every configuration; returns the number that fail.
+// The 5/3 transform must be bit-exact everywhere, the 9/7 transform on the host only
+template<typename T> size_t verifyImage(OCLBench<T>* bench, std::string name, cv::Mat img, BenchConfig& config, bool lossy) {
+    size_t failures = 0;
+    for (size_t c = 0; c < config.components.size(); ++c) {
+        size_t numComponents = config.components[c];
+        if (numComponents != 1 && numComponents != 4)
+            continue;
+        std::vector<T*> components = makeComponents<T>(img, numComponents);
+        for (size_t l = 0; l < config.levels.size(); ++l) {
+            OCLVerifyResult result;
+            if (!bench->verify(components, img.cols, img.rows, config.levels[l], config.precision, result)) {
+                failures++;
+                continue;
+            }
+            bool deviceOk = !result.deviceChecked ||
+                            (lossy ? result.deviceMaxDiff <= VERIFY_LOSSY_TOLERANCE : result.deviceMismatches == 0);
+            if (!result.hostExact || !deviceOk)
+                failures++;
+            printf("%s %s l%u c%u: host %s", name.c_str(), lossy ? "lossy" : "lossless", (unsigned int)config.levels[l],
+                   (unsigned int)numComponents, result.hostExact ? "exact" : "MISMATCH");
+            if (result.deviceChecked)
+                printf(", device %s (%u coefficients differ, max difference %g)", deviceOk ? "ok" : "MISMATCH",
+                       (unsigned int)result.deviceMismatches, result.deviceMaxDiff);
+            printf("\n");
+        }
+        freeComponents(components);
+    }
+    return failures;
+}
+
+// stage names in order of first appearance
+static std::vector<std::string> stageNames(const std::vector<OCLBenchResult>& results) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < results.size(); ++i) {
+        for (size_t j = 0; j < results[i].stages.size(); ++j) {
+            if (std::find(names.begin(), names.end(), results[i].stages[j].name) == names.end())
+                names.push_back(results[i].stages[j].name);
+        }
+    }
+    return names;
+}
+
+static void writeCSV(FILE* fp, const std::vector<OCLBenchResult>& results) {
+    std::vector<std::string> names = stageNames(results);
+    fprintf(fp, "image,width,height,mode,operation,levels,components,iterations,median_ms,p99_ms,mpixel_per_s");
+    for (size_t j = 0; j < names.size(); ++j)
+        fprintf(fp, ",%s_ms", names[j].c_str());
+    fprintf(fp, "\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const OCLBenchResult& r = results[i];
+        fprintf(fp, "%s,%u,%u,%s,%s,%u,%u,%u,%.3f,%.3f,%.2f", r.image.c_str(), (unsigned int)r.width, (unsigned int)r.height,
+                r.lossy ? "lossy" : "lossless", r.decode ? "decode" : "encode", (unsigned int)r.levels, (unsigned int)r.numComponents,
+                (unsigned int)r.iterations, r.medianMs, r.p99Ms, r.mpixelPerSec);
+        for (size_t j = 0; j < names.size(); ++j) {
+            fprintf(fp, ",");
+            for (size_t k = 0; k < r.stages.size(); ++k) {
+                if (r.stages[k].name == names[j])
+                    fprintf(fp, "%.3f", r.stages[k].seconds * 1000);
+            }
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+static void writeJSON(FILE* fp, const std::vector<OCLBenchResult>& results) {
+    fprintf(fp, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const OCLBenchResult& r = results[i];
+        fprintf(fp, "  {\"image\": \"%s\", \"width\": %u, \"height\": %u, \"mode\": \"%s\", \"operation\": \"%s\", \"levels\": %u, \"components\": %u, "
+                "\"iterations\": %u, \"median_ms\": %.3f, \"p99_ms\": %.3f, \"mpixel_per_s\": %.2f, \"stages_ms\": {",
+                jsonEscape(r.image).c_str(), (unsigned int)r.width, (unsigned int)r.height, r.lossy ? "lossy" : "lossless",
+                r.decode ? "decode" : "encode", (unsigned int)r.levels, (unsigned int)r.numComponents, (unsigned int)r.iterations,
+                r.medianMs, r.p99Ms, r.mpixelPerSec);
+        for (size_t k = 0; k < r.stages.size(); ++k)
+            fprintf(fp, "%s\"%s\": %.3f", k ? ", " : "", jsonEscape(r.stages[k].name).c_str(), r.stages[k].seconds * 1000);
+        fprintf(fp, "}}%s\n", (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+// Tune window sizes on the lossy pipeline, which has the most expensive DWT, with the largest level count
+static void tuneDevice(ocl_args_d_t* ocl, std::string name, cv::Mat img, BenchConfig& config) {
+    std::vector<float*> components = makeComponents<float>(img, 4);
+    size_t levels = *std::max_element(config.levels.begin(), config.levels.end());
+    OCLTuner<float> tuner(ocl, true);
+    OCLWindowConfig windows = tuner.tune(components, img.cols, img.rows, levels, config.precision, config.iterations);
+    freeComponents(components);
+    if (!OCLTuningProfile::store(ocl->device, windows))
+        return;
+    fprintf(stderr, "tuned on %s: forward %ux%u, reverse %ux%u, planar %ux%u\n", name.c_str(),
+            (unsigned int)windows.forwardX, (unsigned int)windows.forwardY,
+            (unsigned int)windows.reverseX, (unsigned int)windows.reverseY,
+            (unsigned int)windows.planarX, (unsigned int)windows.planarY);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        usage();
+        return 1;
+    }
+    std::vector<std::string> images = listImages(config.resourceDir);
+    if (images.empty()) {
+        LogError("no images found in %s", config.resourceDir.c_str());
+        return 1;
+    }
+
+    OCLDeviceManager* deviceManager = new OCLDeviceManager();
+    deviceManager->init();
+    ocl_args_d_t* ocl = deviceManager->getInfo();
+    // keep stdout clean for the CSV output
+    quiet = true;
+    if (!ocl) {
+        if (config.backend != HOST_DWT && !config.verify) {
+            LogError("no OpenCL device available");
+            delete deviceManager;
+            return 1;
+        }
+        fprintf(stderr, "no OpenCL device available: benchmarking host DWT only\n");
+    }
+    if (config.tune) {
+        cv::Mat img;
+        for (size_t i = 0; i < images.size() && img.empty(); ++i) {
+            img = cv::imread(config.resourceDir + "/" + images[i], 1);
+            if (!img.empty() && ocl)
+                tuneDevice(ocl, images[i], img, config);
+        }
+    }
+    std::vector<OCLBenchResult> results;
+    size_t verifyFailures = 0;
+    for (size_t m = 0; m < config.lossy.size(); ++m) {
+        bool lossy = config.lossy[m];
+        // lossy pipeline works on float samples, lossless on 16 bit integers
+        OCLBench<float>* lossyBench = lossy ? new OCLBench<float>(ocl, true, config.backend, config.tier1Backend) : NULL;
+        OCLBench<short>* losslessBench = lossy ? NULL : new OCLBench<short>(ocl, false, config.backend, config.tier1Backend);
+        if (lossyBench) {
+            lossyBench->setCodeBlockSize(config.codeBlockX, config.codeBlockY);
+            lossyBench->setBPCSchedule(config.bpcSchedule);
+            lossyBench->setRateControl(config.targetBytes, config.targetPSNR);
+            lossyBench->setLayers(config.numLayers, config.layerBytes);
+            lossyBench->setProgression(config.progression, config.precinctWidth, config.precinctHeight);
+            lossyBench->setDiscardLevels(config.discardLevels);
+            lossyBench->setDecodeWindow(config.windowWidth, config.windowHeight);
+        } else {
+            losslessBench->setCodeBlockSize(config.codeBlockX, config.codeBlockY);
+            losslessBench->setBPCSchedule(config.bpcSchedule);
+            losslessBench->setRateControl(config.targetBytes, config.targetPSNR);
+            losslessBench->setLayers(config.numLayers, config.layerBytes);
+            losslessBench->setProgression(config.progression, config.precinctWidth, config.precinctHeight);
+            losslessBench->setDiscardLevels(config.discardLevels);
+            losslessBench->setDecodeWindow(config.windowWidth, config.windowHeight);
+        }
+        for (size_t i = 0; i < images.size(); ++i) {
+            cv::Mat img = cv::imread(config.resourceDir + "/" + images[i], 1);
+            if (img.empty()) {
+                LogError("Cannot read image file: %s", images[i].c_str());
+                continue;
+            }
+
+            if (config.verify) {
+                if (lossyBench)
+                    verifyFailures += verifyImage(lossyBench, images[i], img, config, true);
+                else
+                    verifyFailures += verifyImage(losslessBench, images[i], img, config, false);
+            } else if (lossyBench) {
+                benchImage(lossyBench, images[i], img, config, results);
+            } else {
+                benchImage(losslessBench, images[i], img, config, results);
+            }
+        }
+        if (lossyBench)
+            delete lossyBench;
+        if (losslessBench)
+            delete losslessBench;
+    }
+    if (config.verify) {
+        delete deviceManager;
+        return verifyFailures ? 1 : 0;
+    }
+
+    if (config.csvFile.empty()) {
+        writeCSV(stdout, results);
+    } else {
+        FILE* fp = fopen(config.csvFile.c_str(), "w");
+        if (fp) {
+            writeCSV(fp, results);
+            fclose(fp);
+        } else {
+            LogError("Cannot write %s", config.csvFile.c_str());
+        }
+    }
+    if (!config.jsonFile.empty()) {
+        FILE* fp = fopen(config.jsonFile.c_str(), "w");
+        if (fp) {
+            writeJSON(fp, results);
+            fclose(fp);
+        } else {
+            LogError("Cannot write %s", config.jsonFile.c_str());
+        }
+    }
+
+    delete deviceManager;
+    return 0;
+}
@@ -0,0 +1,25 @@
+/*  Copyright 2014 Aaron Boxer (boxerab@gmail.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "HostTest.h"
+
+#include <stdlib.h>
+
+// host round trip checks; an optional argument seeds the random streams
+int main(int argc, char* argv[])
+{
+    HostTest hostTester(argc > 1 ? (unsigned int)atoi(argv[1]) : 1);
+    return hostTester.test() ? 0 : 1;
+}
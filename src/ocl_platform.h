@@ -31,19 +31,24 @@ struct QueueInfo {
 
 };
 
+class OCLProfiler;
+
 struct KernelInitInfoBase : QueueInfo {
 
-    KernelInitInfoBase(cl_command_queue queue, std::string bldOptions) :
+    KernelInitInfoBase(cl_command_queue queue, std::string bldOptions, OCLProfiler* prof = NULL) :
         QueueInfo(queue),
-        buildOptions(bldOptions)
+        buildOptions(bldOptions),
+        profiler(prof)
     {}
     KernelInitInfoBase(const KernelInitInfoBase& other) :
         QueueInfo(other.cmd_queue),
-        buildOptions(other.buildOptions)
+        buildOptions(other.buildOptions),
+        profiler(other.profiler)
     {
     }
 
     std::string buildOptions;
+    OCLProfiler* profiler;  // optional: records an event for every enqueue
 };
 
 struct KernelInitInfo : KernelInitInfoBase {